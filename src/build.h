@@ -42,6 +42,9 @@
 
 #define MORPHO_PACKAGELIST ".morphopackages"  // File in $HOME that contains package locations
 
+#define MORPHO_MODULECACHEDIR ".morphocache"  // Folder in $HOME where compiled modules are cached
+#define MORPHO_MODULECACHEEXTENSION "mbc"     // File extension for cached modules
+
 /* **********************************************************************
  * Numeric tolerances
  * ********************************************************************** */
@@ -94,6 +97,22 @@
 #ifndef _NO_NAN_BOXING
 #define MORPHO_NAN_BOXING
 #endif
+/** @brief Optimize bytecode after compilation [disable with morpho_setoptimizer(NULL)] */
+#ifndef _NO_OPTIMIZER
+#define MORPHO_OPTIMIZER
+#endif
+/** @brief Cache compiled modules so that subsequent imports skip the compiler */
+#ifndef _NO_MODULECACHE
+#define MORPHO_MODULECACHE
+#endif
+/** @brief Defer compiling the bodies of functions declared in modules until they are referenced [enable with morpho_setlazycompilation(true)];
+ *         compile errors other than syntax errors aren't reported for bodies that are never referenced */
+//#define MORPHO_LAZYCOMPILATION
+/** @brief Environment variable that overrides the default above: set to 1 to enable lazy compilation or 0 to disable it */
+#define MORPHO_LAZYCOMPILATIONENV "MORPHO_LAZYCOMPILATION"
+/** @brief Provide the NativeExample function, which creates example native objects used by the test suite [enable with cmake -DMORPHO_BUILD_NATIVEEXAMPLES=ON] */
+//#define MORPHO_NATIVEEXAMPLES
+
 /** @brief Number of bytes to bind before GC first runs */
 #define MORPHO_GCINITIAL 1024
 /** It seems that DeltaBlue benefits strongly from garbage collecting while the heap is still fairly small */
@@ -113,6 +132,18 @@
 /** @brief Default number of threads */
 #define MORPHO_DEFAULTTHREADNUMBER 0
 
+/** @brief Number of elements a thread claims at once when mapping over a mesh; 0 chooses automatically [set with System.setgrainsize or functional_setgrainsize] */
+#define MORPHO_FUNCTIONALGRAINSIZE 0
+
+/** @brief Size in bytes above which functional gradients are assembled into a single matrix by colouring elements, rather than one per thread [set with System.setreplicationlimit or functional_setreplicationlimit] */
+#define MORPHO_FUNCTIONALREPLICATIONLIMIT (64*1024*1024)
+
+/** @brief Number of chunks ParallelMap divides a collection into; results within a chunk are combined first */
+#define MORPHO_PARALLELMAPCHUNKS 64
+
+/** @brief Minimum number of elements before List.sort and List.order use the threadpool */
+#define MORPHO_PARALLELSORTTHRESHOLD 65536
+
 /** @brief Size of L1 cache line */
 #define _MORPHO_L1CACHELINESIZE 128 // M1/M2 is 128; most intel are 64
 
@@ -172,6 +203,12 @@
 /** @brief Log garbage collector */
 //#define MORPHO_DEBUG_LOGGARBAGECOLLECTOR
 
+/** @brief Report instruction counts before and after optimization */
+//#define MORPHO_DEBUG_LOGOPTIMIZER
+
+/** @brief Report the work done by each thread in multithreaded functional maps */
+//#define MORPHO_DEBUG_LOGFUNCTIONALMAP
+
 /** @brief Check GC size tracking */
 //#define MORPHO_DEBUG_GCSIZETRACKING
 
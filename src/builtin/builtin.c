@@ -10,6 +10,7 @@
 #include "functiondefs.h"
 #include "file.h"
 #include "system.h"
+#include "task.h"
 #include "classes.h"
 
 #include "sparse.h"
@@ -421,6 +422,7 @@ void builtin_initialize(void) {
     
     file_initialize();
     system_initialize();
+    task_initialize();
     json_initialize();
     
     // Initialize function definitions
@@ -7,12 +7,14 @@
 #include <time.h>
 #include <stdlib.h>
 #include <complex.h>
+#include <stdatomic.h>
 
 #include "functiondefs.h"
 #include "random.h"
 #include "builtin.h"
 #include "common.h"
 #include "cmplx.h"
+#include "threadpool.h"
 
 #include "matrix.h"
 #include "sparse.h"
@@ -570,6 +572,203 @@ value builtin_apply(vm *v, int nargs, value *args) {
     return ret;
 }
 
+/* ************************************
+ * ParallelMap
+ * *************************************/
+
+threadpool parallelmap_pool;
+bool parallelmap_poolinitialized;
+
+/** State shared by the tasks of a parallel map */
+typedef struct {
+    value fn; /* Function to map */
+    value reducefn; /* Function to combine results, or nil */
+    value collection; /* Collection to map over */
+    unsigned int n; /* Number of items */
+    unsigned int grain; /* Number of items in each chunk */
+    unsigned int nchunks;
+    atomic_uint next; /* Next chunk to claim */
+    atomic_bool failed; /* Set when a call raises an error */
+    value *results; /* Result for each item if there is no reduction, otherwise for each chunk */
+} parallelmapschedule;
+
+/** A task that maps over chunks claimed from the schedule using its own subkernel */
+typedef struct {
+    parallelmapschedule *schedule;
+    vm *subkernel;
+    _MORPHO_PADDING;
+} parallelmaptask;
+
+/** Counts the items in a collection, returning false if it can't be mapped over */
+static bool parallelmap_count(value collection, unsigned int *n) {
+    if (MORPHO_ISLIST(collection)) *n=MORPHO_GETLIST(collection)->val.count;
+    else if (MORPHO_ISTUPLE(collection)) *n=MORPHO_GETTUPLE(collection)->length;
+    else if (MORPHO_ISRANGE(collection)) *n=range_count(MORPHO_GETRANGE(collection));
+    else if (MORPHO_ISARRAY(collection)) *n=MORPHO_GETARRAY(collection)->nelements;
+#ifdef MORPHO_INCLUDE_LINALG
+    else if (MORPHO_ISMATRIX(collection)) *n=MORPHO_GETMATRIX(collection)->ncols;
+#endif
+    else return false;
+    return true;
+}
+
+/** Gets item i of a collection; columns of a matrix are copied into new matrices bound to the subkernel */
+static bool parallelmap_item(vm *v, value collection, unsigned int i, value *out) {
+    if (MORPHO_ISLIST(collection)) *out=MORPHO_GETLIST(collection)->val.data[i];
+    else if (MORPHO_ISTUPLE(collection)) *out=MORPHO_GETTUPLE(collection)->tuple[i];
+    else if (MORPHO_ISRANGE(collection)) *out=range_iterate(MORPHO_GETRANGE(collection), i);
+    else if (MORPHO_ISARRAY(collection)) *out=MORPHO_GETARRAY(collection)->values[i];
+#ifdef MORPHO_INCLUDE_LINALG
+    else if (MORPHO_ISMATRIX(collection)) {
+        objectmatrix *m = MORPHO_GETMATRIX(collection);
+        objectmatrix *col = object_newmatrix(m->nrows, 1, false);
+        if (!col) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); return false; }
+        double *src;
+        matrix_getcolumn(m, i, &src);
+        memcpy(col->elements, src, sizeof(double)*m->nrows);
+        *out=MORPHO_OBJECT(col);
+        morpho_bindobjects(v, 1, out);
+    }
+#endif
+    else return false;
+    return true;
+}
+
+/** Maps over a single chunk, reducing the results within the chunk if required */
+static bool parallelmap_chunk(vm *v, parallelmapschedule *s, unsigned int chunk) {
+    unsigned int start=chunk*s->grain, end=start+s->grain;
+    if (end>s->n) end=s->n;
+    
+    value acc=MORPHO_NIL;
+    for (unsigned int i=start; i<end; i++) {
+        value item, ret=MORPHO_NIL;
+        if (!parallelmap_item(v, s->collection, i, &item) ||
+            !morpho_call(v, s->fn, 1, &item, &ret)) return false;
+        
+        if (MORPHO_ISNIL(s->reducefn)) s->results[i]=ret;
+        else if (i==start) acc=ret;
+        else {
+            value args[2] = { acc, ret };
+            if (!morpho_call(v, s->reducefn, 2, args, &acc)) return false;
+        }
+    }
+    if (!MORPHO_ISNIL(s->reducefn)) s->results[chunk]=acc;
+    
+    return true;
+}
+
+/** Worker function that claims and processes chunks until none remain */
+static bool parallelmap_worker(void *arg) {
+    parallelmaptask *task = (parallelmaptask *) arg;
+    parallelmapschedule *s = task->schedule;
+    
+    while (!atomic_load_explicit(&s->failed, memory_order_relaxed)) {
+        unsigned int chunk=atomic_fetch_add_explicit(&s->next, 1, memory_order_relaxed);
+        if (chunk>=s->nchunks) break;
+        if (!parallelmap_chunk(task->subkernel, s, chunk)) {
+            atomic_store(&s->failed, true);
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Maps a function over a collection in parallel, optionally reducing the results with a second function */
+value builtin_parallelmap(vm *v, int nargs, value *args) {
+    value out=MORPHO_NIL;
+    
+    if (nargs<2 || nargs>3) {
+        morpho_runtimeerror(v, PARALLELMAP_ARGS);
+        return MORPHO_NIL;
+    }
+    
+    parallelmapschedule s;
+    s.fn=MORPHO_GETARG(args, 0);
+    s.collection=MORPHO_GETARG(args, 1);
+    s.reducefn=(nargs==3 ? MORPHO_GETARG(args, 2) : MORPHO_NIL);
+    
+    if (!morpho_iscallable(s.fn) ||
+        !(MORPHO_ISNIL(s.reducefn) || morpho_iscallable(s.reducefn))) {
+        morpho_runtimeerror(v, PARALLELMAP_NOTCALLABLE);
+        return MORPHO_NIL;
+    }
+    
+    if (!parallelmap_count(s.collection, &s.n)) {
+        morpho_runtimeerror(v, PARALLELMAP_COLLECTION);
+        return MORPHO_NIL;
+    }
+    
+    /* Chunks depend only on the number of items so that reductions don't depend on the number of threads */
+    s.grain=(s.n+MORPHO_PARALLELMAPCHUNKS-1)/MORPHO_PARALLELMAPCHUNKS;
+    if (s.grain<1) s.grain=1;
+    s.nchunks=(s.n+s.grain-1)/s.grain;
+    atomic_init(&s.next, 0);
+    atomic_init(&s.failed, false);
+    
+    /* Run serially if called from a worker or if there's only one thread */
+    int ntask=morpho_threadnumber();
+    if (ntask<1 || vm_issubkernel(v)) ntask=1;
+    if (ntask>s.nchunks) ntask=(s.nchunks ? s.nchunks : 1);
+    
+    if (ntask>1 && !threadpool_prepare(&parallelmap_pool, &parallelmap_poolinitialized, morpho_threadnumber())) ntask=1;
+    
+    vm *subkernels[ntask];
+    parallelmaptask task[ntask];
+    
+    /* Results are written directly into a list; it's bound before any calls are made, and subkernels never collect garbage */
+    objectlist *results=NULL;
+    if (MORPHO_ISNIL(s.reducefn)) {
+        results=object_newlist(0, NULL);
+        if (!results || (s.n && !varray_valueresize(&results->val, s.n))) goto parallelmap_allocationfailed;
+        for (unsigned int i=0; i<s.n; i++) results->val.data[i]=MORPHO_NIL;
+        results->val.count=s.n;
+        out=MORPHO_OBJECT(results);
+        morpho_bindobjects(v, 1, &out);
+        s.results=results->val.data;
+    } else {
+        if (!s.n) return MORPHO_NIL;
+        s.results=MORPHO_MALLOC(sizeof(value)*s.nchunks);
+        if (!s.results) goto parallelmap_allocationfailed;
+    }
+    
+    if (!vm_subkernels(v, ntask, subkernels)) goto parallelmap_allocationfailed;
+    
+    for (int i=0; i<ntask; i++) task[i] = (parallelmaptask) { .schedule=&s, .subkernel=subkernels[i] };
+    
+    if (ntask>1) {
+        for (int i=0; i<ntask; i++) threadpool_add_task(&parallelmap_pool, parallelmap_worker, (void *) &task[i]);
+        threadpool_fence(&parallelmap_pool);
+        threadpool_release(&parallelmap_pool);
+    } else parallelmap_worker((void *) &task[0]);
+    
+    /* Combine the results of each chunk in order using the first subkernel */
+    if (!MORPHO_ISNIL(s.reducefn) && !atomic_load(&s.failed)) {
+        value acc=s.results[0];
+        for (unsigned int i=1; i<s.nchunks; i++) {
+            value args[2] = { acc, s.results[i] };
+            if (!morpho_call(subkernels[0], s.reducefn, 2, args, &acc)) break;
+        }
+        out=acc;
+    }
+    
+    /* Transfer objects created by the subkernels, and any error, back to this vm */
+    for (int i=0; i<ntask; i++) vm_releasesubkernel(subkernels[i]);
+    
+    if (!MORPHO_ISNIL(s.reducefn)) MORPHO_FREE(s.results);
+    
+    return out;
+    
+parallelmap_allocationfailed:
+    if (ntask>1) threadpool_release(&parallelmap_pool);
+    if (!MORPHO_ISNIL(s.reducefn) && s.results) MORPHO_FREE(s.results);
+    morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+    return MORPHO_NIL;
+}
+
+void functiondefs_finalize(void) {
+    if (parallelmap_poolinitialized) threadpool_clear(&parallelmap_pool);
+}
+
 /* ************************************
  * System
  * *************************************/
@@ -682,6 +881,7 @@ void functiondefs_initialize(void) {
     builtin_addfunction(FUNCTION_SIGN, builtin_sign, BUILTIN_FLAGSEMPTY);
 
     builtin_addfunction(FUNCTION_APPLY, builtin_apply, BUILTIN_FLAGSEMPTY);
+    builtin_addfunction(FUNCTION_PARALLELMAP, builtin_parallelmap, BUILTIN_FLAGSEMPTY);
     
     morpho_defineerror(MATH_ARGS, ERROR_HALT, MATH_ARGS_MSG);
     morpho_defineerror(MATH_NUMARGS, ERROR_HALT, MATH_NUMARGS_MSG);
@@ -690,6 +890,12 @@ void functiondefs_initialize(void) {
     morpho_defineerror(MAX_ARGS, ERROR_HALT, MAX_ARGS_MSG);
     morpho_defineerror(APPLY_ARGS, ERROR_HALT, APPLY_ARGS_MSG);
     morpho_defineerror(APPLY_NOTCALLABLE, ERROR_HALT, APPLY_NOTCALLABLE_MSG);
+    morpho_defineerror(PARALLELMAP_ARGS, ERROR_HALT, PARALLELMAP_ARGS_MSG);
+    morpho_defineerror(PARALLELMAP_NOTCALLABLE, ERROR_HALT, PARALLELMAP_NOTCALLABLE_MSG);
+    morpho_defineerror(PARALLELMAP_COLLECTION, ERROR_HALT, PARALLELMAP_COLLECTION_MSG);
+    
+    parallelmap_poolinitialized=false;
+    morpho_addfinalizefn(functiondefs_finalize);
 }
 
 #undef BUILTIN_MATH
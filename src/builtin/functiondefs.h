@@ -37,6 +37,7 @@
 #define FUNCTION_SIGN           "sign"
 
 #define FUNCTION_APPLY         "apply"
+#define FUNCTION_PARALLELMAP   "ParallelMap"
 
 #define FUNCTION_ARCTAN        "arctan"
 
@@ -65,10 +66,20 @@
 #define APPLY_NOTCALLABLE            "ApplyNtCllble"
 #define APPLY_NOTCALLABLE_MSG        "Function 'apply' requires a callable object as its first argument."
 
+#define PARALLELMAP_ARGS             "PrllMpArgs"
+#define PARALLELMAP_ARGS_MSG         "Function 'ParallelMap' expects a function, a collection and optionally a function to combine results."
+
+#define PARALLELMAP_NOTCALLABLE      "PrllMpNtCllble"
+#define PARALLELMAP_NOTCALLABLE_MSG  "Function 'ParallelMap' requires callable objects as the function to map and to combine results."
+
+#define PARALLELMAP_COLLECTION       "PrllMpCllctn"
+#define PARALLELMAP_COLLECTION_MSG   "Function 'ParallelMap' can map over a List, Tuple, Range, Array or the columns of a Matrix."
+
 /* -------------------------------------------------------
  * Interface to define builtin functions
  * ------------------------------------------------------- */
 
 void functiondefs_initialize(void);
+void functiondefs_finalize(void);
 
 #endif /* functions_h */
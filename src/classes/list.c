@@ -7,6 +7,7 @@
 #include "morpho.h"
 #include "classes.h"
 #include "common.h"
+#include "threadpool.h"
 
 /* **********************************************************************
  * objectlist definitions
@@ -123,15 +124,269 @@ bool list_getelement(objectlist *list, int i, value *out) {
     return true;
 }
 
-/** Sort function for list_sort */
-int list_sortfunction(const void *a, const void *b) {
-    value l=*(value *) a, r=*(value *) b;
-    return -morpho_extendedcomparevalue(l, r);
+/* -------------------------------------------------------
+ * Sorting
+ * ------------------------------------------------------- */
+
+/** Lists are sorted by building an array of entries, sorting this array and then
+    writing the result back. Lists that consist solely of numbers are sorted with a
+    radix sort on a 64 bit key; other lists are sorted with a stable merge sort.
+    Large lists are sorted in chunks on the threadpool and the chunks merged in parallel. */
+
+typedef struct {
+    uint64_t key; /* Radix key for numerical sorts */
+    value val; /* Value to compare for generic sorts */
+    value el; /* List element */
+    unsigned int indx; /* Original index of the element */
+} listsortentry;
+
+/** Converts a number to a key whose unsigned ordering matches the numerical ordering */
+static bool list_sortkey(value val, uint64_t *key) {
+    double x;
+    if (MORPHO_ISFLOAT(val)) x=MORPHO_GETFLOATVALUE(val);
+    else if (MORPHO_ISINTEGER(val)) x=(double) MORPHO_GETINTEGERVALUE(val);
+    else return false;
+    
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    *key = (bits & ((uint64_t) 1 << 63) ? ~bits : bits | ((uint64_t) 1 << 63));
+    return true;
+}
+
+/** Ranks values of different types so that lists of mixed type sort with numbers first, then objects, bools and nil */
+static inline int list_sortrank(value val) {
+    if (MORPHO_ISNUMBER(val)) return 0;
+    if (MORPHO_ISOBJECT(val)) return 1;
+    if (MORPHO_ISBOOL(val)) return 2;
+    return 3;
+}
+
+/** Compares two entries; returns true if b should be placed strictly before a */
+static inline bool list_sortbefore(listsortentry *a, listsortentry *b, bool numeric) {
+    if (numeric) return b->key < a->key;
+    
+    int ra=list_sortrank(a->val), rb=list_sortrank(b->val);
+    if (ra!=rb) return rb<ra;
+    if (ra==1 && MORPHO_GETOBJECTTYPE(a->val)!=MORPHO_GETOBJECTTYPE(b->val)) {
+        return MORPHO_GETOBJECTTYPE(b->val)<MORPHO_GETOBJECTTYPE(a->val);
+    }
+    return morpho_extendedcomparevalue(a->val, b->val)<0;
+}
+
+/** LSD radix sort of n entries on their key. The result is left in a; tmp is used as scratch space */
+static void list_radixsort(listsortentry *a, listsortentry *tmp, size_t n) {
+    size_t count[8][256];
+    memset(count, 0, sizeof(count));
+    
+    for (size_t i=0; i<n; i++) {
+        for (int b=0; b<8; b++) count[b][(a[i].key >> (8*b)) & 0xff]++;
+    }
+    
+    listsortentry *src=a, *dest=tmp;
+    for (int b=0; b<8; b++) {
+        size_t *c=count[b];
+        if (c[(src[0].key >> (8*b)) & 0xff]==n) continue; /* Skip passes where every key has the same digit */
+        
+        size_t offset=0;
+        for (int k=0; k<256; k++) { size_t m=c[k]; c[k]=offset; offset+=m; }
+        
+        for (size_t i=0; i<n; i++) dest[c[(src[i].key >> (8*b)) & 0xff]++]=src[i];
+        
+        listsortentry *swp=src; src=dest; dest=swp;
+    }
+    
+    if (src!=a) memcpy(a, src, sizeof(listsortentry)*n);
+}
+
+/** Merges two sorted runs a[0...na) and b[0...nb) into out */
+static void list_merge(listsortentry *a, size_t na, listsortentry *b, size_t nb, listsortentry *out, bool numeric) {
+    size_t i=0, j=0, k=0;
+    while (i<na && j<nb) {
+        if (list_sortbefore(a+i, b+j, numeric)) out[k++]=b[j++];
+        else out[k++]=a[i++];
+    }
+    if (i<na) memcpy(out+k, a+i, sizeof(listsortentry)*(na-i));
+    if (j<nb) memcpy(out+k+na-i, b+j, sizeof(listsortentry)*(nb-j));
+}
+
+#define LIST_INSERTIONSORTRUN 16
+
+/** Stable bottom-up merge sort of n entries. The result is left in a; tmp is used as scratch space */
+static void list_mergesort(listsortentry *a, listsortentry *tmp, size_t n, bool numeric) {
+    /* Insertion sort short runs */
+    for (size_t start=0; start<n; start+=LIST_INSERTIONSORTRUN) {
+        size_t end = (start+LIST_INSERTIONSORTRUN<n ? start+LIST_INSERTIONSORTRUN : n);
+        for (size_t i=start+1; i<end; i++) {
+            listsortentry e=a[i];
+            size_t j=i;
+            while (j>start && list_sortbefore(a+j-1, &e, numeric)) { a[j]=a[j-1]; j--; }
+            a[j]=e;
+        }
+    }
+    
+    /* Then merge runs of increasing width */
+    listsortentry *src=a, *dest=tmp;
+    for (size_t width=LIST_INSERTIONSORTRUN; width<n; width*=2) {
+        for (size_t start=0; start<n; start+=2*width) {
+            size_t mid = (start+width<n ? start+width : n);
+            size_t end = (start+2*width<n ? start+2*width : n);
+            list_merge(src+start, mid-start, src+mid, end-mid, dest+start, numeric);
+        }
+        listsortentry *swp=src; src=dest; dest=swp;
+    }
+    
+    if (src!=a) memcpy(a, src, sizeof(listsortentry)*n);
+}
+
+/** Sorts n entries, choosing the algorithm by whether the keys are numerical */
+static void list_sortentries(listsortentry *a, listsortentry *tmp, size_t n, bool numeric) {
+    if (n<2) return;
+    if (numeric && n>LIST_INSERTIONSORTRUN) list_radixsort(a, tmp, n);
+    else list_mergesort(a, tmp, n, numeric);
+}
+
+/* Parallel sort */
+
+threadpool list_pool;
+bool list_poolinitialized;
+
+/** A task either sorts src[start...end) or merges src[start...mid) and src[mid...end) into dest */
+typedef struct {
+    listsortentry *src, *dest;
+    size_t start, mid, end;
+    bool numeric;
+    _MORPHO_PADDING;
+} listsorttask;
+
+/** Worker function to sort a chunk */
+static bool list_sortchunkfn(void *arg) {
+    listsorttask *task = (listsorttask *) arg;
+    list_sortentries(task->src+task->start, task->dest+task->start, task->end-task->start, task->numeric);
+    return true;
+}
+
+/** Worker function to merge two adjacent chunks */
+static bool list_mergechunkfn(void *arg) {
+    listsorttask *task = (listsorttask *) arg;
+    list_merge(task->src+task->start, task->mid-task->start, task->src+task->mid, task->end-task->mid, task->dest+task->start, task->numeric);
+    return true;
+}
+
+/** Sorts entries in parallel: each worker sorts a chunk and the chunks are then merged pairwise */
+static bool list_parallelsort(listsortentry *a, listsortentry *tmp, size_t n, bool numeric, int nthreads) {
+    if (!threadpool_prepare(&list_pool, &list_poolinitialized, nthreads)) return false;
+    
+    int nchunks = nthreads;
+    size_t bounds[nchunks+1];
+    for (int i=0; i<=nchunks; i++) bounds[i] = (n*i)/nchunks;
+    
+    listsorttask task[nchunks];
+    for (int i=0; i<nchunks; i++) {
+        task[i] = (listsorttask) { .src=a, .dest=tmp, .start=bounds[i], .mid=bounds[i+1], .end=bounds[i+1], .numeric=numeric };
+        threadpool_add_task(&list_pool, list_sortchunkfn, task+i);
+    }
+    threadpool_fence(&list_pool);
+    
+    listsortentry *src=a, *dest=tmp;
+    for (int width=1; width<nchunks; width*=2) {
+        int ntask=0;
+        for (int i=0; i<nchunks; i+=2*width) {
+            int mid = (i+width<nchunks ? i+width : nchunks);
+            int end = (i+2*width<nchunks ? i+2*width : nchunks);
+            task[ntask] = (listsorttask) { .src=src, .dest=dest, .start=bounds[i], .mid=bounds[mid], .end=bounds[end], .numeric=numeric };
+            threadpool_add_task(&list_pool, list_mergechunkfn, task+ntask);
+            ntask++;
+        }
+        threadpool_fence(&list_pool);
+        listsortentry *swp=src; src=dest; dest=swp;
+    }
+    threadpool_release(&list_pool);
+    
+    if (src!=a) memcpy(a, src, sizeof(listsortentry)*n);
+    return true;
+}
+
+/** Sorts an array of entries, using the threadpool for large arrays */
+static bool list_sortarray(listsortentry *a, size_t n, bool numeric) {
+    listsortentry *tmp = MORPHO_MALLOC(sizeof(listsortentry)*n);
+    if (!tmp) return false;
+    
+    int nthreads = morpho_threadnumber();
+    if (nthreads>1 && n>=MORPHO_PARALLELSORTTHRESHOLD) {
+        if (!list_parallelsort(a, tmp, n, numeric, nthreads)) list_sortentries(a, tmp, n, numeric);
+    } else list_sortentries(a, tmp, n, numeric);
+    
+    MORPHO_FREE(tmp);
+    return true;
+}
+
+/** Fills out an array of sort entries from a list
+ * @param[in] v - virtual machine to use for key functions
+ * @param[in] list - list to sort
+ * @param[in] keyfn - optional function to extract sort keys; set to MORPHO_NIL if not needed
+ * @param[out] entries - entries to fill out
+ * @param[out] numeric - whether the keys are all numerical
+ * @param[out] handle - handle for keys retained by the vm
+ * @returns true on success */
+static bool list_sortprepare(vm *v, objectlist *list, value keyfn, listsortentry *entries, bool *numeric, int *handle) {
+    bool num=true;
+    
+    for (unsigned int i=0; i<list->val.count; i++) {
+        entries[i].el=list->val.data[i];
+        entries[i].indx=i;
+        entries[i].val=list->val.data[i];
+    }
+    
+    /* Call the key function once per element */
+    if (!MORPHO_ISNIL(keyfn)) {
+        for (unsigned int i=0; i<list->val.count; i++) {
+            if (!morpho_call(v, keyfn, 1, &entries[i].el, &entries[i].val)) return false;
+            int h=morpho_retainobjects(v, 1, &entries[i].val);
+            if (*handle<0) *handle=h;
+        }
+    }
+    
+    for (unsigned int i=0; i<list->val.count && num; i++) {
+        num=list_sortkey(entries[i].val, &entries[i].key);
+    }
+    
+    *numeric=num;
+    return true;
+}
+
+/** Sort the contents of a list, optionally using a key function
+ * @param[in] v - virtual machine to use; may be NULL if no key function is provided
+ * @param[in] list - list to sort
+ * @param[in] keyfn - optional function that extracts a sort key from each element, or MORPHO_NIL
+ * @param[in] order - if true, the list is replaced by the indices that would sort it
+ * @returns true on success */
+bool list_sortwithkey(vm *v, objectlist *list, value keyfn, bool order) {
+    unsigned int n=list->val.count;
+    if (n==0) return true;
+    
+    listsortentry *entries = MORPHO_MALLOC(sizeof(listsortentry)*n);
+    if (!entries) return false;
+    
+    int handle=-1;
+    bool numeric, success=false;
+    
+    if (list_sortprepare(v, list, keyfn, entries, &numeric, &handle) &&
+        list_sortarray(entries, n, numeric)) {
+        n = (list->val.count<n ? list->val.count : n); // Guard against the key function modifying the list
+        for (unsigned int i=0; i<n; i++) {
+            list->val.data[i] = (order ? MORPHO_INTEGER(entries[i].indx) : entries[i].el);
+        }
+        success=true;
+    }
+    
+    if (handle>=0) morpho_releaseobjects(v, handle);
+    MORPHO_FREE(entries);
+    return success;
 }
 
 /** Sort the contents of a list */
 void list_sort(objectlist *list) {
-    qsort(list->val.data, list->val.count, sizeof(value), list_sortfunction);
+    list_sortwithkey(NULL, list, MORPHO_NIL, false);
 }
 
 static vm *list_sortwithfn_vm;
@@ -161,42 +416,6 @@ bool list_sortwithfn(vm *v, value fn, objectlist *list) {
     return !list_sortwithfn_err;
 }
 
-/** Sort function for list_order */
-typedef struct {
-    unsigned int indx;
-    value val;
-} listorderstruct;
-
-/** Sort function for list_order */
-int list_orderfunction(const void *a, const void *b) {
-    return -morpho_comparevalue(((listorderstruct *) a)->val, ((listorderstruct *) b)->val);
-}
-
-/* Returns a list of indices giving the ordering of a list */
-objectlist *list_order(objectlist *list) {
-    listorderstruct *order = MORPHO_MALLOC(list->val.count*sizeof(listorderstruct));
-    objectlist *new = NULL;
-
-    if (order) {
-        for (unsigned int i=0; i<list->val.count; i++) {
-            order[i].indx=i;
-            order[i].val=list->val.data[i];
-        }
-        qsort(order, list->val.count, sizeof(listorderstruct), list_orderfunction);
-
-        new=object_newlist(list->val.count, NULL);
-        if (new) {
-            for (unsigned int i=0; i<list->val.count; i++) {
-                new->val.data[i]=MORPHO_INTEGER(order[i].indx);
-            }
-            new->val.count=list->val.count;
-        }
-
-        MORPHO_FREE(order);
-    }
-    return new;
-}
-
 /** Reverses a list in place */
 void list_reverse(objectlist *list) {
     unsigned int hlen = list->val.count / 2;
@@ -627,9 +846,27 @@ value XList_sort(vm *v, int nargs, value *args) {
     return MORPHO_NIL;
 }
 
+static value list_keyoption;
+
+/** Processes the key option for sort and order, returning false if an error was raised */
+static bool list_getkeyoption(vm *v, int nargs, value *args, value *keyfn) {
+    builtin_options(v, nargs, args, NULL, 1, list_keyoption, keyfn);
+    if (!MORPHO_ISNIL(*keyfn) && !MORPHO_ISCALLABLE(*keyfn)) {
+        morpho_runtimeerror(v, LIST_SRTKEY);
+        return false;
+    }
+    return true;
+}
+
 /** Sorts a list */
 value List_sort(vm *v, int nargs, value *args) {
-    list_sort(MORPHO_GETLIST(MORPHO_SELF(args)));
+    objectlist *slf = MORPHO_GETLIST(MORPHO_SELF(args));
+    value keyfn=MORPHO_NIL;
+    
+    if (list_getkeyoption(v, nargs, args, &keyfn) &&
+        !list_sortwithkey(v, slf, keyfn, false) &&
+        MORPHO_ISNIL(keyfn)) morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); // Errors in the key function are reported by the vm
+    
     return MORPHO_NIL;
 }
 
@@ -644,13 +881,19 @@ value List_sort_fn(vm *v, int nargs, value *args) {
 /** Returns a list of indices that would sort the list self */
 value List_order(vm *v, int nargs, value *args) {
     objectlist *slf = MORPHO_GETLIST(MORPHO_SELF(args));
+    value keyfn=MORPHO_NIL;
     value out=MORPHO_NIL;
-
-    objectlist *new=list_order(slf);
-    if (new) {
+    
+    if (!list_getkeyoption(v, nargs, args, &keyfn)) return MORPHO_NIL;
+    
+    objectlist *new=list_clone(slf);
+    if (new && list_sortwithkey(v, new, keyfn, true)) {
         out=MORPHO_OBJECT(new);
         morpho_bindobjects(v, 1, &out);
-    } else morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+    } else {
+        if (new) object_free((object *) new);
+        if (MORPHO_ISNIL(keyfn)) morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+    }
 
     return out;
 }
@@ -721,10 +964,20 @@ void list_initialize(void) {
     // List constructor function
     morpho_addfunction(LIST_CLASSNAME, LIST_CLASSNAME " (...)", list_constructor, MORPHO_FN_CONSTRUCTOR, NULL);
     
+    // Options for sort and order
+    list_keyoption=builtin_internsymbolascstring(LIST_KEYOPTION);
+    
     // List error messages
     morpho_defineerror(LIST_ENTRYNTFND, ERROR_HALT, LIST_ENTRYNTFND_MSG);
     morpho_defineerror(LIST_ADDARGS, ERROR_HALT, LIST_ADDARGS_MSG);
     morpho_defineerror(LIST_SRTFN, ERROR_HALT, LIST_SRTFN_MSG);
+    morpho_defineerror(LIST_SRTKEY, ERROR_HALT, LIST_SRTKEY_MSG);
     morpho_defineerror(LIST_ARGS, ERROR_HALT, LIST_ARGS_MSG);
     morpho_defineerror(LIST_NUMARGS, ERROR_HALT, LIST_NUMARGS_MSG);
+    
+    morpho_addfinalizefn(list_finalize);
+}
+
+void list_finalize(void) {
+    if (list_poolinitialized) threadpool_clear(&list_pool);
 }
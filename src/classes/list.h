@@ -48,6 +48,8 @@ objectlist *object_newlist(unsigned int nval, value *val);
 #define LIST_SETS_METHOD                  "sets"
 #define LIST_REVERSE_METHOD               "reverse"
 
+#define LIST_KEYOPTION                    "key"
+
 /* -------------------------------------------------------
  * List error messages
  * ------------------------------------------------------- */
@@ -61,6 +63,9 @@ objectlist *object_newlist(unsigned int nval, value *val);
 #define LIST_SRTFN                        "LstSrtFn"
 #define LIST_SRTFN_MSG                    "List sort function must return an integer."
 
+#define LIST_SRTKEY                       "LstSrtKey"
+#define LIST_SRTKEY_MSG                   "List sort key must be a function."
+
 #define LIST_ARGS                         "LstArgs"
 #define LIST_ARGS_MSG                     "Lists must be called with integer dimensions as arguments."
 
@@ -78,8 +83,10 @@ void list_append(objectlist *list, value v);
 unsigned int list_length(objectlist *list);
 bool list_getelement(objectlist *list, int i, value *out);
 void list_sort(objectlist *list);
+bool list_sortwithkey(vm *v, objectlist *list, value keyfn, bool order);
 objectlist *list_clone(objectlist *list);
 
 void list_initialize(void);
+void list_finalize(void);
 
 #endif
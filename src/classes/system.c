@@ -10,6 +10,7 @@
 #include "classes.h"
 #include "system.h"
 #include "platform.h"
+#include "functional.h"
 
 /* **********************************************************************
  * System utility functions
@@ -162,6 +163,115 @@ value System_homefolder(vm *v, int nargs, value *args) {
     return out;
 }
 
+/** Number of worker threads */
+value System_threads(vm *v, int nargs, value *args) {
+    return MORPHO_INTEGER(morpho_threadnumber());
+}
+
+/** Set the number of worker threads; threadpools are resized when next used while no other thread is using them */
+value System_setthreads(vm *v, int nargs, value *args) {
+    if (nargs==1 &&
+        MORPHO_ISINTEGER(MORPHO_GETARG(args, 0)) &&
+        MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0))>=0) {
+        morpho_setthreadnumber(MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0)));
+    } else morpho_runtimeerror(v, STTHRDS_ARGS);
+    
+    return MORPHO_NIL;
+}
+
+/** Pin worker threads to consecutive cpus starting from a given cpu, or unpin them */
+value System_pinthreads(vm *v, int nargs, value *args) {
+    if (nargs==1 &&
+        MORPHO_ISINTEGER(MORPHO_GETARG(args, 0)) &&
+        MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0))>=0) {
+        morpho_setthreadaffinity(MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0)));
+    } else if (nargs==1 && MORPHO_ISFALSE(MORPHO_GETARG(args, 0))) {
+        morpho_setthreadaffinity(-1);
+    } else morpho_runtimeerror(v, PNTHRDS_ARGS);
+    
+    return MORPHO_NIL;
+}
+
+/** Number of elements a thread claims at once when mapping a functional over a mesh, or zero if chosen automatically */
+value System_grainsize(vm *v, int nargs, value *args) {
+    return MORPHO_INTEGER(functional_getgrainsize());
+}
+
+/** Set the number of elements a thread claims at once when mapping a functional over a mesh; zero chooses automatically */
+value System_setgrainsize(vm *v, int nargs, value *args) {
+    if (nargs==1 &&
+        MORPHO_ISINTEGER(MORPHO_GETARG(args, 0)) &&
+        MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0))>=0) {
+        functional_setgrainsize(MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0)));
+    } else morpho_runtimeerror(v, STGRN_ARGS);
+    
+    return MORPHO_NIL;
+}
+
+/** Size in bytes above which functional gradients are assembled by colouring elements rather than in one matrix per thread */
+value System_replicationlimit(vm *v, int nargs, value *args) {
+    return MORPHO_INTEGER((int) functional_getreplicationlimit());
+}
+
+/** Set the size in bytes above which functional gradients are assembled by colouring elements; zero always colours them */
+value System_setreplicationlimit(vm *v, int nargs, value *args) {
+    if (nargs==1 &&
+        MORPHO_ISINTEGER(MORPHO_GETARG(args, 0)) &&
+        MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0))>=0) {
+        functional_setreplicationlimit((size_t) MORPHO_GETINTEGERVALUE(MORPHO_GETARG(args, 0)));
+    } else morpho_runtimeerror(v, STRPLCTN_ARGS);
+    
+    return MORPHO_NIL;
+}
+
+/** Work done by each thread in the most recent multithreaded map of a functional over a mesh, as a list of dictionaries */
+value System_mapstatistics(vm *v, int nargs, value *args) {
+    value out = MORPHO_NIL;
+    
+    int n = functional_getmapstatistics(0, NULL);
+    functional_taskstatistics stats[n+1];
+    int nstats = functional_getmapstatistics(n, stats);
+    if (nstats>n) nstats=n; // Another map may have finished in the meantime
+    
+    char *labels[] = { SYSTEM_MAPSTATISTICS_ELEMENTS, SYSTEM_MAPSTATISTICS_CHUNKS, SYSTEM_MAPSTATISTICS_TIME };
+    int nlabels = sizeof(labels)/sizeof(char *);
+    value new[nstats+nlabels+1]; // Objects created, which are bound to the vm once complete
+    int nnew = 0;
+    bool success = true;
+    
+    value keys[nlabels];
+    for (int i=0; i<nlabels && success; i++) {
+        keys[i] = object_stringfromcstring(labels[i], strlen(labels[i]));
+        if (MORPHO_ISOBJECT(keys[i])) new[nnew++]=keys[i];
+        else success=false;
+    }
+    
+    objectlist *list = (success ? object_newlist(0, NULL) : NULL);
+    if (list) new[nnew++]=MORPHO_OBJECT(list);
+    else success=false;
+    
+    for (int i=0; i<nstats && success; i++) {
+        objectdictionary *dict = object_newdictionary();
+        if (!dict) { success=false; break; }
+        new[nnew++]=MORPHO_OBJECT(dict);
+        
+        success=(dictionary_insert(&dict->dict, keys[0], MORPHO_INTEGER(stats[i].nelements)) &&
+                 dictionary_insert(&dict->dict, keys[1], MORPHO_INTEGER(stats[i].nchunks)) &&
+                 dictionary_insert(&dict->dict, keys[2], MORPHO_FLOAT(stats[i].time)) &&
+                 varray_valueadd(&list->val, &new[nnew-1], 1));
+    }
+    
+    if (success) {
+        morpho_bindobjects(v, nnew, new);
+        out = MORPHO_OBJECT(list);
+    } else {
+        for (int i=0; i<nnew; i++) morpho_freeobject(new[i]);
+        morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+    }
+    
+    return out;
+}
+
 MORPHO_BEGINCLASS(System)
 MORPHO_METHOD(SYSTEM_PLATFORM_METHOD, System_platform, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(SYSTEM_VERSION_METHOD, System_version, BUILTIN_FLAGSEMPTY),
@@ -173,7 +283,15 @@ MORPHO_METHOD(SYSTEM_ARGUMENTS_METHOD, System_arguments, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(SYSTEM_EXIT_METHOD, System_exit, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(SYSTEM_SETWORKINGFOLDER_METHOD, System_setworkingfolder, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(SYSTEM_WORKINGFOLDER_METHOD, System_workingfolder, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(SYSTEM_HOMEFOLDER_METHOD, System_homefolder, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(SYSTEM_HOMEFOLDER_METHOD, System_homefolder, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_THREADS_METHOD, System_threads, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_SETTHREADS_METHOD, System_setthreads, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_PINTHREADS_METHOD, System_pinthreads, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_GRAINSIZE_METHOD, System_grainsize, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_SETGRAINSIZE_METHOD, System_setgrainsize, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_MAPSTATISTICS_METHOD, System_mapstatistics, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_REPLICATIONLIMIT_METHOD, System_replicationlimit, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(SYSTEM_SETREPLICATIONLIMIT_METHOD, System_setreplicationlimit, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* **********************************************************************
@@ -190,6 +308,10 @@ void system_initialize(void) {
     morpho_defineerror(VM_EXIT, ERROR_EXIT, VM_EXIT_MSG);
     morpho_defineerror(SYS_STWRKDR, ERROR_EXIT, SYS_STWRKDR_MSG);
     morpho_defineerror(STWRKDR_ARGS, ERROR_EXIT, STWRKDR_ARGS_MSG);
+    morpho_defineerror(STTHRDS_ARGS, ERROR_HALT, STTHRDS_ARGS_MSG);
+    morpho_defineerror(PNTHRDS_ARGS, ERROR_HALT, PNTHRDS_ARGS_MSG);
+    morpho_defineerror(STGRN_ARGS, ERROR_HALT, STGRN_ARGS_MSG);
+    morpho_defineerror(STRPLCTN_ARGS, ERROR_HALT, STRPLCTN_ARGS_MSG);
     
     objectlist *alist = object_newlist(0, NULL);
     if (alist) arglist = MORPHO_OBJECT(alist);
@@ -28,6 +28,21 @@
 #define SYSTEM_WORKINGFOLDER_METHOD   "workingfolder"
 #define SYSTEM_SETWORKINGFOLDER_METHOD "setworkingfolder"
 
+#define SYSTEM_THREADS_METHOD         "threads"
+#define SYSTEM_SETTHREADS_METHOD      "setthreads"
+#define SYSTEM_PINTHREADS_METHOD      "pinthreads"
+
+#define SYSTEM_GRAINSIZE_METHOD       "grainsize"
+#define SYSTEM_SETGRAINSIZE_METHOD    "setgrainsize"
+#define SYSTEM_MAPSTATISTICS_METHOD   "mapstatistics"
+#define SYSTEM_REPLICATIONLIMIT_METHOD "replicationlimit"
+#define SYSTEM_SETREPLICATIONLIMIT_METHOD "setreplicationlimit"
+
+/* Keys of the dictionaries returned by mapstatistics */
+#define SYSTEM_MAPSTATISTICS_ELEMENTS "elements"
+#define SYSTEM_MAPSTATISTICS_CHUNKS   "chunks"
+#define SYSTEM_MAPSTATISTICS_TIME     "time"
+
 /* -------------------------------------------------------
  * System error messages
  * ------------------------------------------------------- */
@@ -41,6 +56,18 @@
 #define SYS_STWRKDR                   "SystmStWrkDr"
 #define SYS_STWRKDR_MSG               "Couldn't set working directory."
 
+#define STTHRDS_ARGS                  "SystmStThrdsArgs"
+#define STTHRDS_ARGS_MSG              "Setthreads method expects a non-negative integer number of threads."
+
+#define PNTHRDS_ARGS                  "SystmPnThrdsArgs"
+#define PNTHRDS_ARGS_MSG              "Pinthreads method expects a non-negative integer cpu number, or false to unpin threads."
+
+#define STGRN_ARGS                    "SystmStGrnArgs"
+#define STGRN_ARGS_MSG                "Setgrainsize method expects a non-negative integer number of elements."
+
+#define STRPLCTN_ARGS                 "SystmStRplctnArgs"
+#define STRPLCTN_ARGS_MSG             "Setreplicationlimit method expects a non-negative integer number of bytes."
+
 void system_initialize(void);
 void system_finalize(void);
 
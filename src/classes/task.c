@@ -0,0 +1,344 @@
+/** @file task.c
+ *  @author T J Atherton
+ *
+ *  @brief Defines task object type and Task class, which run functions in the background
+ */
+
+#include "morpho.h"
+#include "classes.h"
+#include "common.h"
+#include "task.h"
+#include "threadpool.h"
+
+/** Threadpool that runs tasks */
+static threadpool task_pool;
+static bool task_poolinitialized;
+
+/** Handle for a thread local variable that holds a list of each vm's unreleased tasks */
+static int task_outstandinghandle;
+
+/* **********************************************************************
+ * Task objects
+ * ********************************************************************** */
+
+objecttype objecttasktype;
+
+static void task_waitforpool(objecttask *task);
+static void task_releasesubkernel(objecttask *task);
+
+/** Task object definitions */
+size_t objecttask_sizefn(object *obj) {
+    return sizeof(objecttask)+sizeof(value)*((objecttask *) obj)->nargs;
+}
+
+void objecttask_markfn(object *obj, void *v) {
+    objecttask *task = (objecttask *) obj;
+    morpho_markvalue(v, task->fn);
+    for (int i=0; i<task->nargs; i++) morpho_markvalue(v, task->args[i]);
+    if (atomic_load(&task->state)!=TASK_DONE) return; // The result is written by the thread running the task
+
+    /* Until it's released, the result belongs to the subkernel, whose objects aren't swept by the parent;
+       clear any marks left by an earlier collection so that the result is traced again */
+    if (task->subkernel) vm_unmarksubkernel(task->subkernel);
+    morpho_markvalue(v, task->result);
+}
+
+void objecttask_freefn(object *obj) {
+    objecttask *task = (objecttask *) obj;
+
+    /* The task must no longer be in use by the threadpool before it can be freed */
+    task_waitforpool(task);
+
+    /* Discard anything left on the subkernel; its objects aren't referenced by the parent */
+    if (task->subkernel) {
+        vm_cleansubkernel(task->subkernel);
+        error_clear(morpho_geterror(task->subkernel));
+        vm_releasesubkernel(task->subkernel);
+        task->subkernel=NULL;
+    }
+
+    if (task->args) MORPHO_FREE(task->args);
+    MorphoMutex_clear(&task->lock);
+    MorphoCond_clear(&task->changed);
+}
+
+void objecttask_printfn(object *obj, void *v) {
+    morpho_printf(v, "<Task>");
+}
+
+objecttypedefn objecttaskdefn = {
+    .printfn=objecttask_printfn,
+    .markfn=objecttask_markfn,
+    .freefn=objecttask_freefn,
+    .sizefn=objecttask_sizefn,
+    .hashfn=NULL,
+    .cmpfn=NULL
+};
+
+/** Creates a task object that will call fn with the given arguments */
+objecttask *object_newtask(vm *v, value fn, int nargs, value *args) {
+    objecttask *new = (objecttask *) object_new(sizeof(objecttask), OBJECT_TASK);
+
+    if (new) {
+        new->fn=fn;
+        new->nargs=nargs;
+        new->args=NULL;
+        new->result=MORPHO_NIL;
+        error_init(&new->err);
+        new->parent=v;
+        new->subkernel=NULL;
+        atomic_init(&new->state, TASK_PENDING);
+        atomic_init(&new->queued, false);
+        MorphoMutex_init(&new->lock);
+        MorphoCond_init(&new->changed);
+
+        if (nargs) {
+            new->args=MORPHO_MALLOC(sizeof(value)*nargs);
+            if (!new->args) {
+                object_free((object *) new);
+                return NULL;
+            }
+            for (int i=0; i<nargs; i++) new->args[i]=args[i];
+        }
+    }
+
+    return new;
+}
+
+/* **********************************************************************
+ * Running tasks
+ * ********************************************************************** */
+
+/** Calls the task's function on a given vm, recording the result or any error */
+static void task_call(objecttask *task, vm *v) {
+    value ret=MORPHO_NIL;
+
+    if (morpho_call(v, task->fn, task->nargs, task->args, &ret)) {
+        task->result=ret;
+    } else {
+        error *err=morpho_geterror(v);
+        task->err=*err;
+        error_clear(err);
+    }
+}
+
+/** Runs a task on its subkernel and signals that it's done */
+static void task_run(objecttask *task) {
+    task_call(task, task->subkernel);
+
+    MorphoMutex_lock(&task->lock);
+    atomic_store(&task->state, TASK_DONE);
+    MorphoCond_broadcast(&task->changed);
+    MorphoMutex_unlock(&task->lock);
+}
+
+/** Claims a pending task so that it can be run, returning false if another thread has already claimed it */
+static bool task_claim(objecttask *task) {
+    int expected=TASK_PENDING;
+    return atomic_compare_exchange_strong(&task->state, &expected, TASK_RUNNING);
+}
+
+/** Worker function called by the threadpool */
+static bool task_workerfn(void *arg) {
+    objecttask *task = (objecttask *) arg;
+
+    if (task_claim(task)) task_run(task);
+
+    MorphoMutex_lock(&task->lock);
+    atomic_store(&task->queued, false);
+    MorphoCond_broadcast(&task->changed);
+    MorphoMutex_unlock(&task->lock);
+    return true;
+}
+
+/** Waits for a task to finish; a task that hasn't started yet is run on the calling thread */
+static void task_waitfordone(objecttask *task) {
+    if (task_claim(task)) {
+        task_run(task);
+        return;
+    }
+
+    MorphoMutex_lock(&task->lock);
+    while (atomic_load(&task->state)!=TASK_DONE) MorphoCond_wait(&task->changed, &task->lock);
+    MorphoMutex_unlock(&task->lock);
+}
+
+/** Waits until the threadpool no longer refers to a task, cancelling it if it hasn't started */
+static void task_waitforpool(objecttask *task) {
+    int expected=TASK_PENDING;
+    atomic_compare_exchange_strong(&task->state, &expected, TASK_DONE);
+
+    MorphoMutex_lock(&task->lock);
+    while (atomic_load(&task->queued) ||
+           atomic_load(&task->state)==TASK_RUNNING) MorphoCond_wait(&task->changed, &task->lock);
+    MorphoMutex_unlock(&task->lock);
+}
+
+/* **********************************************************************
+ * Outstanding tasks
+ * ********************************************************************** */
+
+/** Tasks are held in a list by the vm that created them until they're released, so they can't be collected while running */
+static objectlist *task_outstanding(vm *v) {
+    value list=MORPHO_NIL;
+    if (!vm_gettlvar(v, task_outstandinghandle, &list)) return NULL;
+
+    if (!MORPHO_ISLIST(list)) {
+        objectlist *new=object_newlist(0, NULL);
+        if (!new) return NULL;
+        list=MORPHO_OBJECT(new);
+        vm_settlvar(v, task_outstandinghandle, list);
+        morpho_bindobjects(v, 1, &list);
+    }
+
+    return MORPHO_GETLIST(list);
+}
+
+/** Transfers objects created by a finished task to its parent vm */
+static void task_releasesubkernel(objecttask *task) {
+    if (!task->subkernel) return;
+    vm_releasesubkernel(task->subkernel);
+    task->subkernel=NULL;
+}
+
+/** Releases a finished task created by v and removes it from the outstanding list */
+static void task_release(vm *v, objecttask *task) {
+    if (task->parent!=v || !task->subkernel) return;
+    task_releasesubkernel(task);
+
+    objectlist *list=task_outstanding(v);
+    if (!list) return;
+
+    for (unsigned int i=0; i<list->val.count; i++) {
+        if (MORPHO_GETOBJECT(list->val.data[i])==(object *) task) {
+            memmove(list->val.data+i, list->val.data+i+1, sizeof(value)*(list->val.count-i-1));
+            list->val.count--;
+            break;
+        }
+    }
+}
+
+/** Releases any finished tasks created by v */
+static void task_releasefinished(vm *v, objectlist *list) {
+    unsigned int k=0;
+    for (unsigned int i=0; i<list->val.count; i++) {
+        objecttask *task=MORPHO_GETTASK(list->val.data[i]);
+        if (atomic_load(&task->state)==TASK_DONE) task_releasesubkernel(task);
+        else list->val.data[k++]=list->val.data[i];
+    }
+    list->val.count=k;
+}
+
+/** Waits for a task and raises any error it encountered */
+static bool task_wait(vm *v, objecttask *task) {
+    task_waitfordone(task);
+    task_release(v, task);
+
+    if (!ERROR_SUCCEEDED(task->err)) {
+        morpho_error(v, &task->err);
+        return false;
+    }
+    return true;
+}
+
+/* **********************************************************************
+ * Task class
+ * ********************************************************************** */
+
+/** Creates a task and starts it running */
+value task_constructor(vm *v, int nargs, value *args) {
+    value out=MORPHO_NIL;
+
+    if (nargs<1 || !morpho_iscallable(MORPHO_GETARG(args, 0))) MORPHO_RAISE(v, TASK_ARGS);
+
+    /* Tasks created by a subkernel, or if no threads are available, run immediately */
+    bool background = !vm_issubkernel(v);
+    if (background) background=threadpool_prepare(&task_pool, &task_poolinitialized, morpho_threadnumber());
+
+    objectlist *list=NULL;
+    if (background) {
+        list=task_outstanding(v);
+        if (!list) {
+            threadpool_release(&task_pool);
+            MORPHO_RAISE(v, ERROR_ALLOCATIONFAILED);
+        }
+        task_releasefinished(v, list);
+    }
+
+    objecttask *new=object_newtask(v, MORPHO_GETARG(args, 0), nargs-1, &MORPHO_GETARG(args, 1));
+    if (!new) {
+        if (background) threadpool_release(&task_pool);
+        MORPHO_RAISE(v, ERROR_ALLOCATIONFAILED);
+    }
+    out=MORPHO_OBJECT(new);
+    morpho_bindobjects(v, 1, &out);
+
+    if (background && vm_subkernels(v, 1, &new->subkernel) &&
+        varray_valueadd(&list->val, &out, 1)) {
+        atomic_store(&new->queued, true);
+        threadpool_add_task(&task_pool, task_workerfn, (void *) new);
+    } else {
+        if (background) threadpool_release(&task_pool);
+
+        task_releasesubkernel(new);
+
+        int handle=morpho_retainobjects(v, 1, &out);
+        atomic_store(&new->state, TASK_RUNNING);
+        task_call(new, v);
+        atomic_store(&new->state, TASK_DONE);
+        morpho_releaseobjects(v, handle);
+    }
+
+    return out;
+}
+
+/** Waits for the task to finish */
+value Task_wait(vm *v, int nargs, value *args) {
+    task_wait(v, MORPHO_GETTASK(MORPHO_SELF(args)));
+    return MORPHO_NIL;
+}
+
+/** Waits for the task to finish and returns the result */
+value Task_result(vm *v, int nargs, value *args) {
+    objecttask *task=MORPHO_GETTASK(MORPHO_SELF(args));
+    if (!task_wait(v, task)) return MORPHO_NIL;
+    return task->result;
+}
+
+/** Tests whether the task has finished without waiting */
+value Task_isdone(vm *v, int nargs, value *args) {
+    objecttask *task=MORPHO_GETTASK(MORPHO_SELF(args));
+    return MORPHO_BOOL(atomic_load(&task->state)==TASK_DONE);
+}
+
+MORPHO_BEGINCLASS(Task)
+MORPHO_METHOD(TASK_WAIT, Task_wait, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(TASK_RESULT, Task_result, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(TASK_ISDONE, Task_isdone, BUILTIN_FLAGSEMPTY)
+MORPHO_ENDCLASS
+
+/* **********************************************************************
+ * Initialization
+ * ********************************************************************** */
+
+void task_initialize(void) {
+    objecttasktype=object_addtype(&objecttaskdefn);
+    task_outstandinghandle=vm_addtlvar();
+    task_poolinitialized=false;
+
+    objectstring objname = MORPHO_STATICSTRING(OBJECT_CLASSNAME);
+    value objclass = builtin_findclass(MORPHO_OBJECT(&objname));
+
+    morpho_addfunction(TASK_CLASSNAME, TASK_CLASSNAME " (...)", task_constructor, MORPHO_FN_CONSTRUCTOR, NULL);
+
+    value taskclass=builtin_addclass(TASK_CLASSNAME, MORPHO_GETCLASSDEFINITION(Task), objclass);
+    object_setveneerclass(OBJECT_TASK, taskclass);
+
+    morpho_defineerror(TASK_ARGS, ERROR_HALT, TASK_ARGS_MSG);
+
+    morpho_addfinalizefn(task_finalize);
+}
+
+void task_finalize(void) {
+    if (task_poolinitialized) threadpool_clear(&task_pool);
+}
@@ -0,0 +1,77 @@
+/** @file task.h
+ *  @author T J Atherton
+ *
+ *  @brief Defines task object type and Task class, which run functions in the background
+ */
+
+#ifndef task_h
+#define task_h
+
+#include <stdatomic.h>
+#include "object.h"
+#include "morpho.h"
+#include "platform.h"
+
+/* -------------------------------------------------------
+ * Task objects
+ * ------------------------------------------------------- */
+
+extern objecttype objecttasktype;
+#define OBJECT_TASK objecttasktype
+
+/** States a task passes through */
+typedef enum {
+    TASK_PENDING, /* Waiting to run */
+    TASK_RUNNING, /* Running on a thread */
+    TASK_DONE     /* Finished; the result is available */
+} taskstate;
+
+/** A task runs a function with a fixed set of arguments on a subkernel, usually on another thread */
+typedef struct {
+    object obj;
+    value fn; /* Function to call */
+    int nargs; /* Arguments to pass */
+    value *args;
+    value result; /* Value returned by the function */
+    error err; /* Any error raised by the function */
+
+    vm *parent; /* Vm that created the task */
+    vm *subkernel; /* Subkernel the task runs on; NULL once released back to the parent */
+
+    atomic_int state; /* A taskstate */
+    atomic_bool queued; /* Set while the threadpool holds a reference to the task */
+    MorphoMutex lock; /* Protects the state while waiting */
+    MorphoCond changed; /* Signals that the state or queued flag changed */
+} objecttask;
+
+/** Tests whether an object is a task */
+#define MORPHO_ISTASK(val) object_istype(val, OBJECT_TASK)
+
+/** Gets the object as a task */
+#define MORPHO_GETTASK(val)   ((objecttask *) MORPHO_GETOBJECT(val))
+
+/* -------------------------------------------------------
+ * Task class
+ * ------------------------------------------------------- */
+
+#define TASK_CLASSNAME    "Task"
+
+#define TASK_WAIT         "wait"
+#define TASK_RESULT       "result"
+#define TASK_ISDONE       "isdone"
+
+/* -------------------------------------------------------
+ * Task error messages
+ * ------------------------------------------------------- */
+
+#define TASK_ARGS                         "TskArgs"
+#define TASK_ARGS_MSG                     "Task expects a callable object and the arguments to call it with."
+
+/* -------------------------------------------------------
+ * Task interface
+ * ------------------------------------------------------- */
+
+void task_initialize(void);
+void task_finalize(void);
+
+#endif /* task_h */
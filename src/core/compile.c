@@ -5,8 +5,11 @@
  */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include "compile.h"
+#include "optimize.h"
+#include "modulecache.h"
 #include "error.h"
 #include "vm.h"
 #include "morpho.h"
@@ -20,6 +23,9 @@ static objectclass *baseclass;
 
 static optimizerfn *optimizer;
 
+/** Whether modules are compiled lazily */
+static bool lazycompilation;
+
 /* **********************************************************************
 * Bytecode compiler
 * ********************************************************************** */
@@ -285,12 +291,16 @@ void compiler_addclass(compiler *c, objectclass *klass) {
 
 /** Finds a class in the compiler's dictionary of classes */
 objectclass *compiler_findclass(compiler *c, value name) {
-    value val;
-    if (dictionary_get(&c->classes, name, &val) &&
-        MORPHO_ISCLASS(val)) return MORPHO_GETCLASS(val);
-    
-    if (c->parent) return compiler_findclass(c->parent, name);
+    for (compiler *cc=c; cc!=NULL; cc=cc->parent) {
+        value val;
+        if (dictionary_get(&cc->classes, name, &val) &&
+            MORPHO_ISCLASS(val)) {
+            modulecache_lookup(c, cc, MODULECACHE_LOOKUPCLASS, name);
+            return MORPHO_GETCLASS(val);
+        }
+    }
     
+    modulecache_lookup(c, NULL, MODULECACHE_LOOKUPCLASS, name);
     return NULL;
 }
 
@@ -800,6 +810,57 @@ unsigned int compiler_currentscope(compiler *c) {
     return f->scopedepth;
 }
 
+/* ------------------------------------------
+ * Deferred functions
+ * ------------------------------------------- */
+
+DEFINE_VARRAY(deferredfunction, deferredfunction)
+
+/** Finds the root compiler, which holds the deferred functions */
+static compiler *compiler_root(compiler *c) {
+    compiler *root=c;
+    while (root->parent!=NULL) root=root->parent;
+    return root;
+}
+
+/** Marks a deferred function as referenced, given the function itself or the global that holds it */
+static void compiler_requiredeferred(compiler *c, value key) {
+    compiler *root=compiler_root(c);
+    value indx;
+    
+    if (root->deferred.count>0 &&
+        dictionary_get(&root->deferredrefs, key, &indx)) {
+        root->deferred.data[MORPHO_GETINTEGERVALUE(indx)].wanted=true;
+    }
+}
+
+/** Marks any deferred functions referred to by a function or metafunction constant as referenced */
+static void compiler_requiredeferredconstant(compiler *c, value constant) {
+    if (MORPHO_ISFUNCTION(constant)) {
+        compiler_requiredeferred(c, constant);
+    } else if (MORPHO_ISMETAFUNCTION(constant)) {
+        objectmetafunction *mf = MORPHO_GETMETAFUNCTION(constant);
+        for (int i=0; i<mf->fns.count; i++) compiler_requiredeferred(c, mf->fns.data[i]);
+    }
+}
+
+/** Frees the deferred functions and retained module compilers held by a root compiler */
+static void compiler_cleardeferred(compiler *c) {
+    for (unsigned int i=0; i<c->deferred.count; i++) {
+        if (!c->deferred.data[i].compiled) compiler_functionstateclear(&c->deferred.data[i].state);
+    }
+    varray_deferredfunctionclear(&c->deferred);
+    dictionary_clear(&c->deferredrefs);
+    
+    compiler *next=NULL;
+    for (compiler *cc=c->retained; cc!=NULL; cc=next) {
+        next=cc->next;
+        compiler_clear(cc);
+        MORPHO_FREE(cc);
+    }
+    c->retained=NULL;
+}
+
 /* ------------------------------------------
  * Constants
  * ------------------------------------------- */
@@ -818,6 +879,8 @@ static registerindx compiler_addconstant(compiler *c, syntaxtreenode *node, valu
     registerindx out=REGISTER_UNALLOCATED;
     unsigned int prev=0;
 
+    compiler_requiredeferredconstant(c, constant);
+    
     if (konst) {
         /* Was a similar previous constant already added? */
         if (usestrict) {
@@ -1082,12 +1145,17 @@ globalindx compiler_findglobal(compiler *c, value symbol, bool recurse) {
     for (compiler *cc=c; cc!=NULL; cc=cc->parent) {
         value indx;
         if (dictionary_get(&cc->globals, symbol, &indx)) {
+            if (recurse) {
+                modulecache_lookup(c, cc, MODULECACHE_LOOKUPGLOBAL, symbol);
+                compiler_requiredeferred(c, indx);
+            }
             if (MORPHO_ISINTEGER(indx)) return (globalindx) MORPHO_GETINTEGERVALUE(indx);
             else UNREACHABLE("Unknown type in global table.");
         }
         if (!recurse) break;
     }
 
+    if (recurse) modulecache_lookup(c, NULL, MODULECACHE_LOOKUPGLOBAL, symbol);
     return GLOBAL_UNALLOCATED;
 }
 
@@ -1792,15 +1860,180 @@ static codeinfo compiler_constant(compiler *c, syntaxtreenode *node, registerind
     return CODEINFO(CONSTANT, indx, 0);
 }
 
+/** Evaluates a literal at compile time if it consists only of constants
+ * @param[in] c - the compiler
+ * @param[in] node - the literal
+ * @param[out] made - objects created, which the caller must bind or free
+ * @param[out] out - value of the literal
+ * @returns true if the literal could be evaluated */
+static bool compiler_literalvalue(compiler *c, syntaxtreenode *node, varray_value *made, value *out) {
+    object *new=NULL;
+
+    switch (node->type) {
+        case NODE_NIL: case NODE_BOOL: case NODE_INTEGER: case NODE_FLOAT:
+            *out=node->content;
+            return true;
+        case NODE_STRING:
+            *out=object_clonestring(node->content);
+            break;
+        case NODE_IMAG:
+            *out=object_clonecomplexvalue(node->content);
+            break;
+        case NODE_NEGATE: {
+            syntaxtreenode *operand = compiler_getnode(c, node->left);
+            if (!operand) return false;
+            if (operand->type==NODE_INTEGER) *out=MORPHO_INTEGER(-MORPHO_GETINTEGERVALUE(operand->content));
+            else if (operand->type==NODE_FLOAT) *out=MORPHO_FLOAT(-MORPHO_GETFLOATVALUE(operand->content));
+            else return false;
+            return true;
+        }
+        case NODE_LIST: case NODE_TUPLE: case NODE_DICTIONARY: {
+            bool isdict=(node->type==NODE_DICTIONARY);
+            varray_syntaxtreeindx entries;
+            varray_syntaxtreeindxinit(&entries);
+            if (isdict) {
+                syntaxtreenodetype dictentrytype[] = { NODE_DICTIONARY, NODE_DICTENTRY };
+                if (node->left!=SYNTAXTREE_UNCONNECTED) syntaxtree_flatten(compiler_getsyntaxtree(c), node->left, 2, dictentrytype, &entries);
+                if (node->right!=SYNTAXTREE_UNCONNECTED) syntaxtree_flatten(compiler_getsyntaxtree(c), node->right, 2, dictentrytype, &entries);
+            } else {
+                syntaxtreenodetype listentrytype[] = { NODE_ARGLIST };
+                if (node->right!=SYNTAXTREE_UNCONNECTED) syntaxtree_flatten(compiler_getsyntaxtree(c), node->right, 1, listentrytype, &entries);
+            }
+
+            varray_value val;
+            varray_valueinit(&val);
+            bool success=true;
+            for (int i=0; i<entries.count && success; i++) {
+                value v=MORPHO_NIL;
+                success=compiler_literalvalue(c, compiler_getnode(c, entries.data[i]), made, &v);
+                /* Dictionary keys are hashed, so they must not be mutable */
+                if (success && isdict && !(i%2)) success=!(MORPHO_ISLIST(v) || MORPHO_ISDICTIONARY(v));
+                if (success) success=varray_valueadd(&val, &v, 1);
+            }
+
+            if (success) {
+                if (node->type==NODE_LIST && val.count==1 && MORPHO_ISTUPLE(val.data[0])) {
+                    /* As for List(), a list made from a single tuple holds the tuple's elements */
+                    objecttuple *tuple = MORPHO_GETTUPLE(val.data[0]);
+                    new=(object *) object_newlist(tuple->length, tuple->tuple);
+                } else if (node->type==NODE_LIST) {
+                    new=(object *) object_newlist(val.count, val.data);
+                } else if (node->type==NODE_TUPLE) {
+                    new=(object *) object_newtuple(val.count, val.data);
+                } else {
+                    objectdictionary *dict = object_newdictionary();
+                    for (int i=0; dict && i<val.count; i+=2) {
+                        if (!dictionary_insert(&dict->dict, val.data[i], val.data[i+1])) {
+                            object_free((object *) dict);
+                            dict=NULL;
+                        }
+                    }
+                    new=(object *) dict;
+                }
+                if (!new) compiler_error(c, node, ERROR_ALLOCATIONFAILED);
+            }
+
+            varray_valueclear(&val);
+            varray_syntaxtreeindxclear(&entries);
+            if (!new) return false;
+            *out=MORPHO_OBJECT(new);
+        }
+            break;
+        default:
+            return false;
+    }
+
+    if (!MORPHO_ISOBJECT(*out) || !varray_valueadd(made, out, 1)) {
+        morpho_freeobject(*out);
+        compiler_error(c, node, ERROR_ALLOCATIONFAILED);
+        return false;
+    }
+    return true;
+}
+
+/** Tests whether a constant value is immutable; tuples are immutable only if their elements are */
+static bool compiler_isimmutablevalue(value val) {
+    if (MORPHO_ISLIST(val) || MORPHO_ISDICTIONARY(val)) return false;
+    if (!MORPHO_ISTUPLE(val)) return true;
+
+    objecttuple *tuple = MORPHO_GETTUPLE(val);
+    for (unsigned int i=0; i<tuple->length; i++) {
+        if (!compiler_isimmutablevalue(tuple->tuple[i])) return false;
+    }
+    return true;
+}
+
+/** Tests whether a constant list or tuple can be shared because none of its elements are mutable */
+static bool compiler_isimmutableliteral(value lit) {
+    if (MORPHO_ISTUPLE(lit)) return compiler_isimmutablevalue(lit);
+    if (!MORPHO_ISLIST(lit)) return false;
+
+    objectlist *list = MORPHO_GETLIST(lit);
+    for (unsigned int i=0; i<list->val.count; i++) {
+        if (!compiler_isimmutablevalue(list->val.data[i])) return false;
+    }
+    return true;
+}
+
+/** Compiles a literal that was evaluated at compile time.
+ *  Lists, dictionaries and matrices, and tuples that contain them, are mutable, so a fresh copy of the constant is made with
+ *  OP_CLONE each time the literal is evaluated; the constant itself is loaded directly if it is immutable or if share is set */
+static codeinfo compiler_loadliteral(compiler *c, syntaxtreenode *node, value lit, bool share, registerindx reqout) {
+    registerindx k=compiler_addconstant(c, node, lit, true, false);
+    if (k==REGISTER_UNALLOCATED) return CODEINFO_EMPTY;
+    if (share || (MORPHO_ISTUPLE(lit) && compiler_isimmutablevalue(lit))) return CODEINFO(CONSTANT, k, 0);
+
+    registerindx out=compiler_regtemp(c, reqout);
+    compiler_addinstruction(c, ENCODE_LONG(OP_CLONE, out, k), node);
+
+    char *classname = (MORPHO_ISLIST(lit) ? LIST_CLASSNAME : DICTIONARY_CLASSNAME);
+    if (MORPHO_ISTUPLE(lit)) classname = TUPLE_CLASSNAME;
+#ifdef MORPHO_INCLUDE_LINALG
+    if (MORPHO_ISMATRIX(lit)) classname = MATRIX_CLASSNAME;
+#endif
+    value type=MORPHO_NIL;
+    if (compiler_findtypefromcstring(c, classname, &type)) {
+        if (!compiler_regsetcurrenttype(c, node, out, type)) return CODEINFO_EMPTY;
+    }
+
+    return CODEINFO(REGISTER, out, 1);
+}
+
+/** Attempts to compile a list, tuple or dictionary literal whose elements are all constants as a single constant
+ * @param[in] c - the compiler
+ * @param[in] node - the literal
+ * @param[in] share - whether the literal may be shared if none of its elements are mutable
+ * @param[in] reqout - requested register
+ * @param[out] out - the compiled literal
+ * @returns true if the literal was compiled */
+static bool compiler_constantliteral(compiler *c, syntaxtreenode *node, bool share, registerindx reqout, codeinfo *out) {
+    varray_value made;
+    varray_valueinit(&made);
+
+    value lit=MORPHO_NIL;
+    bool success=compiler_literalvalue(c, node, &made, &lit);
+    for (int i=0; i<made.count; i++) {
+        if (success) program_bindobject(c->out, MORPHO_GETOBJECT(made.data[i]));
+        else morpho_freeobject(made.data[i]);
+    }
+    varray_valueclear(&made);
+
+    if (success) *out=compiler_loadliteral(c, node, lit, share && compiler_isimmutableliteral(lit), reqout);
+    return success;
+}
+
 /** Compiles a list or tuple */
 static codeinfo compiler_list(compiler *c, syntaxtreenode *node, registerindx reqout) {
     syntaxtreenodetype dictentrytype[] = { NODE_ARGLIST };
     varray_syntaxtreeindx entries;
+    codeinfo out;
+
+    if (compiler_constantliteral(c, node, false, reqout, &out)) return out;
 
     /* Set up a call to the List() function */
     char *classname = LIST_CLASSNAME;
     if (node->type==NODE_TUPLE) classname = TUPLE_CLASSNAME;
-    codeinfo out = compiler_findbuiltin(c, node, classname, reqout);
+    out = compiler_findbuiltin(c, node, classname, reqout);
     
     value listtype=MORPHO_NIL; /* Set the type associated with the register */
     if (compiler_findtypefromcstring(c, classname, &listtype)) {
@@ -1841,9 +2074,12 @@ static codeinfo compiler_list(compiler *c, syntaxtreenode *node, registerindx re
 static codeinfo compiler_dictionary(compiler *c, syntaxtreenode *node, registerindx reqout) {
     syntaxtreenodetype dictentrytype[] = { NODE_DICTIONARY, NODE_DICTENTRY };
     varray_syntaxtreeindx entries;
+    codeinfo out;
+
+    if (compiler_constantliteral(c, node, false, reqout, &out)) return out;
 
     /* Set up a call to the Dictionary() function */
-    codeinfo out = compiler_findbuiltin(c, node, DICTIONARY_CLASSNAME, reqout);
+    out = compiler_findbuiltin(c, node, DICTIONARY_CLASSNAME, reqout);
 
     value dicttype=MORPHO_NIL; /* Set the type associated with the register */
     if (compiler_findtypefromcstring(c, DICTIONARY_CLASSNAME, &dicttype)) {
@@ -2052,6 +2288,82 @@ static codeinfo compiler_not(compiler *c, syntaxtreenode *node, registerindx req
     return CODEINFO(REGISTER, out, ninstructions);
 }
 
+/** Tests whether a type is the class of a given value */
+static bool compiler_istypeof(compiler *c, value type, value example) {
+    value match;
+    return (compiler_typefromvalue(c, example, &match) && MORPHO_ISSAME(type, match));
+}
+
+/** @brief Determines the type an expression is expected to have
+ *  @details Uses constants and the current or declared types of the variables involved. Typed variables
+ *           can nonetheless be assigned values of other types, so the result may only be used as a hint. */
+static bool compiler_expressiontype(compiler *c, syntaxtreenode *node, value *out) {
+    if (!node) return false;
+    value left, right;
+
+    switch (node->type) {
+        case NODE_INTEGER: case NODE_FLOAT:
+            return compiler_typefromvalue(c, node->content, out);
+        case NODE_SYMBOL:
+        {
+            registerindx reg=compiler_getlocal(c, node->content);
+            if (reg!=REGISTER_UNALLOCATED) {
+                if (compiler_regcurrenttype(c, reg, out) && !MORPHO_ISNIL(*out)) return true;
+                return (compiler_regtype(c, reg, out) && !MORPHO_ISNIL(*out));
+            }
+            globalindx g=compiler_findglobal(c, node->content, false);
+            return (g!=GLOBAL_UNALLOCATED && program_globaltype(c->out, g, out) && !MORPHO_ISNIL(*out));
+        }
+        case NODE_GROUPING: case NODE_NEGATE:
+            return compiler_expressiontype(c, compiler_getnode(c, node->left), out);
+        case NODE_ADD: case NODE_SUBTRACT: case NODE_MULTIPLY: case NODE_DIVIDE: case NODE_POW:
+        {
+            if (!compiler_expressiontype(c, compiler_getnode(c, node->left), &left) ||
+                !compiler_expressiontype(c, compiler_getnode(c, node->right), &right)) return false;
+            
+            bool lint=compiler_istypeof(c, left, MORPHO_INTEGER(0)), rint=compiler_istypeof(c, right, MORPHO_INTEGER(0));
+            if (!(lint || compiler_istypeof(c, left, MORPHO_FLOAT(0))) ||
+                !(rint || compiler_istypeof(c, right, MORPHO_FLOAT(0)))) return false;
+            
+            /* Integers are closed under addition, subtraction and multiplication; everything else gives a float */
+            bool isint=(lint && rint && node->type!=NODE_DIVIDE && node->type!=NODE_POW);
+            return compiler_typefromvalue(c, (isint ? MORPHO_INTEGER(0) : MORPHO_FLOAT(0)), out);
+        }
+        default:
+            return false;
+    }
+}
+
+/** Selects a version of an arithmetic or comparison instruction specialised to its operands if they're expected to be both Float or both Int */
+static opcode compiler_specializeop(compiler *c, opcode op, syntaxtreenode *left, syntaxtreenode *right) {
+    value ltype, rtype;
+    if (!compiler_expressiontype(c, left, &ltype) ||
+        !compiler_expressiontype(c, right, &rtype) ||
+        !MORPHO_ISSAME(ltype, rtype)) return op;
+
+    if (compiler_istypeof(c, ltype, MORPHO_FLOAT(0))) {
+        switch (op) {
+            case OP_ADD: return OP_ADDF;
+            case OP_SUB: return OP_SUBF;
+            case OP_MUL: return OP_MULF;
+            case OP_DIV: return OP_DIVF;
+            case OP_LT: return OP_LTF;
+            case OP_LE: return OP_LEF;
+            default: break;
+        }
+    } else if (compiler_istypeof(c, ltype, MORPHO_INTEGER(0))) {
+        switch (op) {
+            case OP_ADD: return OP_ADDI;
+            case OP_SUB: return OP_SUBI;
+            case OP_MUL: return OP_MULI;
+            case OP_LT: return OP_LTI;
+            case OP_LE: return OP_LEI;
+            default: break;
+        }
+    }
+    return op;
+}
+
 /** Compile arithmetic operators */
 static codeinfo compiler_binary(compiler *c, syntaxtreenode *node, registerindx reqout) {
     codeinfo left = compiler_nodetobytecode(c, node->left, REGISTER_UNALLOCATED);
@@ -2073,6 +2385,7 @@ static codeinfo compiler_binary(compiler *c, syntaxtreenode *node, registerindx
     registerindx out = compiler_regtemp(c, reqout);
 
     opcode op=OP_NOP;
+    syntaxtreenode *lnode=compiler_getnode(c, node->left), *rnode=compiler_getnode(c, node->right);
 
     switch (node->type) {
         case NODE_ADD: op=OP_ADD; break;
@@ -2087,18 +2400,22 @@ static codeinfo compiler_binary(compiler *c, syntaxtreenode *node, registerindx
         case NODE_GT:
             {   /* a>b is equivalent to b<a */
                 codeinfo swap = right; right=left; left = swap;
+                syntaxtreenode *nswap = rnode; rnode=lnode; lnode=nswap;
                 op=OP_LT;
             }
             break;
         case NODE_GTEQ:
             {   /* a>=b is equivalent to b<=a */
                 codeinfo swap = right; right=left; left = swap;
+                syntaxtreenode *nswap = rnode; rnode=lnode; lnode=nswap;
                 op=OP_LE;
             }
             break;
         default:
             UNREACHABLE("in compiling binary instruction [check bytecode compiler table]");
     }
+    
+    op=compiler_specializeop(c, op, lnode, rnode);
 
     if (compiler_haserror(c)) return CODEINFO_EMPTY;
     
@@ -2564,8 +2881,11 @@ static codeinfo compiler_for(compiler *c, syntaxtreenode *node, registerindx req
     // Register allocation for the loop
     // |  rObj  | rIndx  || rMax  | rEnum |  rVal   | rTmp   |  ...
 
-    // Fetch the collection object
-    codeinfo coll=compiler_nodetobytecode(c, innode->right, REGISTER_UNALLOCATED);
+    // Fetch the collection object; a constant list may be shared as the loop never exposes it
+    codeinfo coll;
+    if (!(collnode->type==NODE_LIST && compiler_constantliteral(c, collnode, true, REGISTER_UNALLOCATED, &coll))) {
+        coll=compiler_nodetobytecode(c, innode->right, REGISTER_UNALLOCATED);
+    }
     ninstructions+=coll.ninstructions;
     if (!CODEINFO_ISREGISTER(coll)) {
         coll=compiler_movetoregister(c, collnode, coll, REGISTER_UNALLOCATED);
@@ -2610,8 +2930,8 @@ static codeinfo compiler_for(compiler *c, syntaxtreenode *node, registerindx req
     compiler_addinstruction(c, ENCODE_DOUBLE(OP_MOV, rMax, rVal), collnode);
     ninstructions++;
     
-    /* Test index against the maximum value */
-    instructionindx tst=compiler_addinstruction(c, ENCODE(OP_LT, rTmp, rIndx, rMax), node);
+    /* Test index against the maximum value; the index is an integer, as the maximum normally is */
+    instructionindx tst=compiler_addinstruction(c, ENCODE(OP_LTI, rTmp, rIndx, rMax), node);
     condindx=compiler_addinstruction(c, ENCODE_BYTE(OP_NOP), node); // Placeholder for branch
     ninstructions+=2;
     
@@ -2639,7 +2959,7 @@ static codeinfo compiler_for(compiler *c, syntaxtreenode *node, registerindx req
 
     int cOne = compiler_addconstant(c, node, MORPHO_INTEGER(1), false, false);
     compiler_addinstruction(c, ENCODE_LONG(OP_LCT, rTmp, cOne), node);
-    instructionindx add=compiler_addinstruction(c, ENCODE(OP_ADD, rIndx, rIndx, rTmp), node);
+    instructionindx add=compiler_addinstruction(c, ENCODE(OP_ADDI, rIndx, rIndx, rTmp), node);
     ninstructions+=2;
     
     /* Compile the unconditional branch back to the test instruction */
@@ -3072,6 +3392,49 @@ static registerindx compiler_functionparameters(compiler *c, syntaxtreeindx indx
 
 value _selfsymbol;
 
+/** Determines whether compiling the body of a function declaration can be deferred until the function is referenced */
+static bool compiler_candefer(compiler *c, syntaxtreenode *node, bool ismethod, bool isanonymous) {
+    if (!c->lazy || ismethod || isanonymous || !compiler_checkglobal(c)) return false;
+    
+    /* Functions that have already been referenced are compiled immediately */
+    functionstate *f=compiler_currentfunctionstate(c);
+    for (unsigned int i=0; i<f->forwardref.count; i++) {
+        if (MORPHO_ISEQUAL(f->forwardref.data[i].symbol, node->content)) return false;
+    }
+    
+    return true;
+}
+
+/** Defers the body of the function currently being compiled, retaining its functionstate in the root compiler */
+static void compiler_deferfunction(compiler *c, syntaxtreenode *node) {
+    compiler *root=compiler_root(c);
+    deferredfunction d = { .func=compiler_getcurrentfunction(c), .owner=c, .node=node, .wanted=false, .compiled=false };
+    
+    d.state=*compiler_currentfunctionstate(c);
+    compiler_functionstateinit(compiler_currentfunctionstate(c));
+    c->fstackp--;
+    debugannotation_setfunction(&c->out->annotations, compiler_getcurrentfunction(c));
+    c->prevfunction=d.func;
+    
+    if (!varray_deferredfunctionadd(&root->deferred, &d, 1) ||
+        !dictionary_insert(&root->deferredrefs, MORPHO_OBJECT(d.func), MORPHO_INTEGER(root->deferred.count-1))) {
+        compiler_error(c, node, ERROR_ALLOCATIONFAILED);
+    }
+}
+
+/** Records the global that holds a deferred function; globals shared by several implementations are compiled immediately */
+static void compiler_deferglobal(compiler *c, objectfunction *func, globalindx global) {
+    compiler *root=compiler_root(c);
+    value indx, prev;
+    
+    if (!dictionary_get(&root->deferredrefs, MORPHO_OBJECT(func), &indx)) return;
+    
+    if (dictionary_get(&root->deferredrefs, MORPHO_INTEGER(global), &prev)) {
+        root->deferred.data[MORPHO_GETINTEGERVALUE(prev)].wanted=true;
+        root->deferred.data[MORPHO_GETINTEGERVALUE(indx)].wanted=true;
+    } else dictionary_insert(&root->deferredrefs, MORPHO_INTEGER(global), indx);
+}
+
 /** Compiles a function declaration */
 static codeinfo compiler_function(compiler *c, syntaxtreenode *node, registerindx reqout) {
     syntaxtreeindx body=node->right; /* Function body */
@@ -3079,11 +3442,12 @@ static codeinfo compiler_function(compiler *c, syntaxtreenode *node, registerind
     indx closure = REGISTER_UNALLOCATED;
     registerindx kindx=REGISTER_UNALLOCATED;
     registerindx reg=REGISTER_UNALLOCATED; /* Register where the function is stored */
-    instructionindx bindx;
+    instructionindx bindx=0;
     unsigned int ninstructions=0;
     bool ismethod = (c->currentmethod==node);
     bool isanonymous = MORPHO_ISNIL(node->content);
     bool isinitializer = false;
+    bool defer = compiler_candefer(c, node, ismethod, isanonymous);
 
     objectstring initlabel = MORPHO_STATICSTRING(MORPHO_INITIALIZER_METHOD);
 
@@ -3091,7 +3455,7 @@ static codeinfo compiler_function(compiler *c, syntaxtreenode *node, registerind
 
     /* We preface the function code with a branch;
        for now simply create a blank instruction and store the indx */
-    bindx=compiler_addinstruction(c, ENCODE_BYTE(OP_NOP), node);
+    if (!defer) bindx=compiler_addinstruction(c, ENCODE_BYTE(OP_NOP), node);
 
     objectfunction *func = object_newfunction(bindx+1, node->content, compiler_getcurrentfunction(c), 0);
     if (!func) { compiler_error(c, node, ERROR_ALLOCATIONFAILED); return CODEINFO_EMPTY; }
@@ -3134,6 +3498,12 @@ static codeinfo compiler_function(compiler *c, syntaxtreenode *node, registerind
         return CODEINFO_EMPTY;
     }
 
+    /* The body may be compiled later, once the function is referenced */
+    if (defer) {
+        compiler_deferfunction(c, node);
+        goto compiler_function_store;
+    }
+
     /* -- Compile the body -- */
     if (body!=REGISTER_UNALLOCATED) bodyinfo=compiler_nodetobytecode(c, body, REGISTER_UNALLOCATED);
     ninstructions+=bodyinfo.ninstructions;
@@ -3156,6 +3526,8 @@ static codeinfo compiler_function(compiler *c, syntaxtreenode *node, registerind
     /* Restore the old function */
     compiler_endfunction(c);
 
+compiler_function_store:
+
     if (!ismethod) {
         /* Generate a closure prototype if necessary */
         closure=compiler_closure(c, node, REGISTER_UNALLOCATED);
@@ -3172,6 +3544,7 @@ static codeinfo compiler_function(compiler *c, syntaxtreenode *node, registerind
                 compiler_checkglobal(c)) {
                 compiler_regfreetemp(c, fvar.dest);
                 fvar=compiler_addvariable(c, node, node->content);
+                if (defer && CODEINFO_ISGLOBAL(fvar)) compiler_deferglobal(c, func, fvar.dest);
             }
         }
         reg=fvar.dest;
@@ -3309,6 +3682,88 @@ static bool compiler_isinvocation(compiler *c, syntaxtreenode *call) {
     return isinvocation;
 }
 
+/** Finds a representative value for a literal argument; returns false if the argument isn't a literal */
+static bool compiler_literalargument(compiler *c, syntaxtreenode *node, value *out) {
+    switch (node->type) {
+        case NODE_INTEGER: case NODE_FLOAT: case NODE_STRING: case NODE_BOOL: case NODE_NIL:
+            *out = node->content;
+            return true;
+        case NODE_NEGATE:
+        {
+            syntaxtreenode *operand = compiler_getnode(c, node->left);
+            if (!operand || !(operand->type==NODE_INTEGER || operand->type==NODE_FLOAT)) return false;
+            *out = operand->content;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/** Attempts to resolve a call to a metafunction at compile time; this is possible if every argument is a literal */
+static void compiler_resolvemetafunctioncall(compiler *c, syntaxtreenode *node, codeinfo *func) {
+    if (func->returntype!=CONSTANT) return;
+    value mf = compiler_getconstant(c, func->dest);
+    if (!MORPHO_ISMETAFUNCTION(mf)) return;
+    
+    varray_syntaxtreeindx argnodes;
+    varray_syntaxtreeindxinit(&argnodes);
+    if (node->right!=SYNTAXTREE_UNCONNECTED) syntaxtree_flatten(compiler_getsyntaxtree(c), node->right, 1, (syntaxtreenodetype []) { NODE_ARGLIST }, &argnodes);
+    
+    value args[MORPHO_MAXARGS];
+    bool literal=(argnodes.count<=MORPHO_MAXARGS);
+    for (int i=0; literal && i<argnodes.count; i++) {
+        literal=compiler_literalargument(c, compiler_getnode(c, argnodes.data[i]), &args[i]);
+    }
+    
+    value fn=MORPHO_NIL;
+    error err;
+    error_init(&err);
+    if (literal &&
+        metafunction_resolve(MORPHO_GETMETAFUNCTION(mf), argnodes.count, args, &err, &fn) &&
+        (MORPHO_ISBUILTINFUNCTION(fn) ||
+         (MORPHO_ISFUNCTION(fn) && !function_isclosure(MORPHO_GETFUNCTION(fn))))) {
+        func->dest=compiler_addconstant(c, node, fn, true, false);
+    }
+    error_clear(&err);
+    
+    varray_syntaxtreeindxclear(&argnodes);
+}
+
+/** Attempts to create the matrix built by a call to Matrix() with a constant list at compile time */
+static bool compiler_matrixliteral(compiler *c, syntaxtreenode *node, codeinfo func, registerindx reqout, codeinfo *out) {
+#ifdef MORPHO_INCLUDE_LINALG
+    if (func.returntype!=CONSTANT || func.ninstructions || node->right==SYNTAXTREE_UNCONNECTED) return false;
+
+    objectstring name = MORPHO_STATICSTRING(MATRIX_CLASSNAME);
+    if (!MORPHO_ISSAME(compiler_getconstant(c, func.dest), builtin_findfunction(MORPHO_OBJECT(&name)))) return false;
+
+    varray_syntaxtreeindx argnodes;
+    varray_syntaxtreeindxinit(&argnodes);
+    syntaxtree_flatten(compiler_getsyntaxtree(c), node->right, 1, (syntaxtreenodetype []) { NODE_ARGLIST }, &argnodes);
+    syntaxtreenode *arg = (argnodes.count==1 ? compiler_getnode(c, argnodes.data[0]) : NULL);
+    varray_syntaxtreeindxclear(&argnodes);
+    if (!arg || arg->type!=NODE_LIST) return false;
+
+    varray_value made;
+    varray_valueinit(&made);
+
+    value lit=MORPHO_NIL;
+    objectmatrix *new=NULL;
+    if (compiler_literalvalue(c, arg, &made, &lit)) new=object_matrixfromlist(MORPHO_GETLIST(lit));
+
+    for (int i=0; i<made.count; i++) morpho_freeobject(made.data[i]);
+    varray_valueclear(&made);
+    if (!new) return false;
+
+    program_bindobject(c->out, (object *) new);
+    *out=compiler_loadliteral(c, node, MORPHO_OBJECT(new), false, reqout);
+    return true;
+#else
+    return false;
+#endif
+}
+
 /** Compiles a function call */
 static codeinfo compiler_call(compiler *c, syntaxtreenode *node, registerindx reqout) {
     unsigned int ninstructions=0;
@@ -3346,6 +3801,16 @@ static codeinfo compiler_call(compiler *c, syntaxtreenode *node, registerindx re
         func=compiler_addforwardreference(c, symbol, symbol->content);
     }
     ninstructions+=func.ninstructions;
+    
+    compiler_resolvemetafunctioncall(c, node, &func);
+
+    /* A matrix constructed from a constant list can be created in advance */
+    codeinfo matrix;
+    if (compiler_matrixliteral(c, node, func, reqout, &matrix)) {
+        compiler_endargs(c);
+        compiler_regsetcurrenttype(c, selnode, matrix.dest, rtype);
+        return matrix;
+    }
 
     /* Move selector into a temporary register unless we already have one
        that's at the top of the stack */
@@ -4036,6 +4501,7 @@ static codeinfo compiler_dot(compiler *c, syntaxtreenode *node, registerindx req
         compiler_findsymbolwithnamespace(c, node, left->content, right->content, &out)) {
         
         if (MORPHO_ISINTEGER(out)) {
+            compiler_requiredeferred(c, out);
             return CODEINFO(GLOBAL, MORPHO_GETINTEGERVALUE(out), 0);
         } else if (MORPHO_ISFUNCTION(out) ||
                    MORPHO_ISMETAFUNCTION(out) ||
@@ -4122,6 +4588,52 @@ static codeinfo compiler_nodetobytecode(compiler *c, syntaxtreeindx indx, regist
     return ret;
 }
 
+/** Compiles the body of a deferred function */
+static void compiler_compiledeferredfunction(compiler *c, deferredfunction *d) {
+    compiler *owner=d->owner;
+    syntaxtreenode *node=d->node;
+    codeinfo bodyinfo=CODEINFO_EMPTY;
+    
+    debugannotation_setmodule(&c->out->annotations, compiler_getmodule(owner));
+    
+    instructionindx bindx=compiler_addinstruction(owner, ENCODE_BYTE(OP_NOP), node);
+    d->func->entry=bindx+1;
+    
+    /* Restore the function's state */
+    owner->fstackp++;
+    owner->fstack[owner->fstackp]=d->state;
+    debugannotation_setfunction(&c->out->annotations, d->func);
+    
+    if (node->right!=REGISTER_UNALLOCATED) bodyinfo=compiler_nodetobytecode(owner, node->right, REGISTER_UNALLOCATED);
+    compiler_addinstruction(owner, ENCODE_BYTE(OP_RETURN), node);
+    compiler_checkoutstandingforwardreference(owner);
+    
+    compiler_setinstruction(owner, bindx, ENCODE_LONG(OP_B, REGISTER_UNALLOCATED, bodyinfo.ninstructions+1));
+    compiler_endfunction(owner);
+    compiler_checkoutstandingforwardreference(owner);
+    
+    debugannotation_setmodule(&c->out->annotations, compiler_getmodule(c));
+    
+    if (!ERROR_SUCCEEDED(owner->err)) c->err=owner->err;
+}
+
+/** Compiles deferred functions that have been referenced; compiling one may require others */
+static void compiler_compiledeferred(compiler *c) {
+    bool found=true;
+    
+    while (found && ERROR_SUCCEEDED(c->err)) {
+        found=false;
+        for (unsigned int i=0; i<c->deferred.count && ERROR_SUCCEEDED(c->err); i++) {
+            if (!c->deferred.data[i].wanted || c->deferred.data[i].compiled) continue;
+            
+            deferredfunction d=c->deferred.data[i];
+            c->deferred.data[i].compiled=true;
+            compiler_compiledeferredfunction(c, &d);
+            found=true;
+        }
+    }
+}
+
 /** Compiles the current syntax tree to bytecode */
 static bool compiler_tobytecode(compiler *c, program *out) {
     if (c->tree.tree.count>0 && c->tree.entry!=SYNTAXTREE_UNCONNECTED) {
@@ -4129,6 +4641,7 @@ static bool compiler_tobytecode(compiler *c, program *out) {
         compiler_releaseoperand(c, info);
     }
     compiler_checkoutstandingforwardreference(c);
+    if (ERROR_SUCCEEDED(c->err)) compiler_compiledeferred(c);
     if (c->tree.tree.count==0) {
         compiler_addinstruction(c, ENCODE_BYTE(OP_END), NULL);
     } else if (c->tree.entry>=0) {
@@ -4227,140 +4740,187 @@ bool compiler_findmodule(char *name, varray_char *fname) {
     return success;
 }
 
-/** Import a module */
-static codeinfo compiler_import(compiler *c, syntaxtreenode *node, registerindx reqout) {
+/** Imports a module given its name or file name
+ * @param[in] c         the compiler
+ * @param[in] node      syntax tree node used to report errors
+ * @param[in] module    module name or file name
+ * @param[in] issymbol  whether module is a module name
+ * @param[in] label     namespace label, or nil
+ * @param[in] fordict   symbols to import, or an empty dictionary to import all symbols
+ * @returns the number of instructions generated */
+instructionindx compiler_importmodule(compiler *c, syntaxtreenode *node, value module, bool issymbol, value label, dictionary *fordict) {
     varray_char filename;
-    syntaxtreenode *module = compiler_getnode(c, node->left);
-    syntaxtreenode *qual = compiler_getnode(c, node->right);
-    dictionary fordict;
     namespc *nmspace=NULL;
     char *fname=NULL;
+    value key=MORPHO_NIL;
     unsigned int start=0, end=0;
     FILE *f = NULL;
+    dictionary *selected = (fordict && fordict->count>0 ? fordict : NULL);
 
-    dictionary_init(&fordict);
     varray_charinit(&filename);
 
-    if (compiler_checkerror(c)) return CODEINFO_EMPTY;
-
-    while (qual) {
-        if (qual->type==NODE_FOR) {
-            syntaxtreenode *l = compiler_getnode(c, qual->left);
-            if (l && l->type==NODE_SYMBOL) {
-                dictionary_insert(&fordict, l->content, MORPHO_NIL);
-            } else UNREACHABLE("Incorrect syntax tree structure in FOR node.");
-        } else if (qual->type==NODE_AS) {
-            syntaxtreenode *l = compiler_getnode(c, qual->left);
-            if (l && l->type==NODE_SYMBOL) {
-                nmspace=compiler_addnamespace(c, l->content);
-                
-                if (!nmspace) { compiler_error(c, node, ERROR_ALLOCATIONFAILED); return CODEINFO_EMPTY; }
-            } else UNREACHABLE("Incorrect syntax tree structure in AS node.");
-        } else UNREACHABLE("Unexpected node type.");
-        qual=compiler_getnode(c, qual->right);
+    if (MORPHO_ISSTRING(label)) {
+        nmspace=compiler_addnamespace(c, label);
+        
+        if (!nmspace) { compiler_error(c, node, ERROR_ALLOCATIONFAILED); return 0; }
     }
 
-    if (module) {
-        if (module->type==NODE_SYMBOL) {
-            dictionary *fndict, *clssdict;
+    modulecache_begindirective(c, module, issymbol, label, fordict);
+
+    if (issymbol) {
+        dictionary *fndict, *clssdict;
+        
+        if (extension_load(MORPHO_GETCSTRING(module), &fndict, &clssdict)) {
+            compiler_copysymbols(clssdict, (nmspace ? &nmspace->symbols: builtin_getclasstable()), selected);
+            compiler_copysymbols(fndict, (nmspace ? &nmspace->symbols: builtin_getfunctiontable()), selected);
             
-            if (extension_load(MORPHO_GETCSTRING(module->content), &fndict, &clssdict)) {
-                compiler_copysymbols(clssdict, (nmspace ? &nmspace->symbols: builtin_getclasstable()), (fordict.count>0 ? &fordict : NULL));
-                compiler_copysymbols(fndict, (nmspace ? &nmspace->symbols: builtin_getfunctiontable()), (fordict.count>0 ? &fordict : NULL));
-                
-                if (nmspace) { // Copy classes into the namespace's class table
-                    compiler_copysymbols(clssdict, &nmspace->classes, (fordict.count>0 ? &fordict : NULL));
-                }
-            } else if (compiler_findmodule(MORPHO_GETCSTRING(module->content), &filename)) {
-                fname=filename.data;
-            } else {
-                compiler_error(c, module, COMPILE_MODULENOTFOUND, MORPHO_GETCSTRING(module->content));
+            if (nmspace) { // Copy classes into the namespace's class table
+                compiler_copysymbols(clssdict, &nmspace->classes, selected);
             }
-        } else if (module->type==NODE_STRING) {
-            fname=MORPHO_GETCSTRING(module->content);
+        } else if (compiler_findmodule(MORPHO_GETCSTRING(module), &filename)) {
+            fname=filename.data;
+        } else {
+            compiler_error(c, node, COMPILE_MODULENOTFOUND, MORPHO_GETCSTRING(module));
         }
+    } else {
+        fname=MORPHO_GETCSTRING(module);
+    }
 
-        compiler *root = c;
-        while (root->parent!=NULL) root=root->parent;
+    compiler *root = c;
+    while (root->parent!=NULL) root=root->parent;
 
-        // Check if the module was previously imported
-        if (fname) {
-            objectstring chkmodname = MORPHO_STATICSTRING(fname);
-            value symboldict=MORPHO_NIL;
+    // Check if the module was previously imported
+    objectstring chkmodname = MORPHO_STATICSTRING((fname ? fname : ""));
+    if (fname) {
+        value symboldict=MORPHO_NIL;
+        
+        if (dictionary_get(&root->modules, MORPHO_OBJECT(&chkmodname), &symboldict)) {
+            // If so, copy its symbols into the compiler
+            compiler_copysymbols(MORPHO_GETDICTIONARYSTRUCT(symboldict), (nmspace ? &nmspace->symbols: &c->globals), selected);
+            key=MORPHO_OBJECT(&chkmodname);
             
-            if (dictionary_get(&root->modules, MORPHO_OBJECT(&chkmodname), &symboldict)) {
-                // If so, copy its symbols into the compiler
-                compiler_copysymbols(MORPHO_GETDICTIONARYSTRUCT(symboldict), (nmspace ? &nmspace->symbols: &c->globals), (fordict.count>0 ? &fordict : NULL));
-                
-                goto compiler_import_cleanup;
-            }
+            goto compiler_import_cleanup;
         }
+    }
 
-        if (fname) f=file_openrelative(fname, "r");
-        else goto compiler_import_cleanup;
+    if (fname) f=file_openrelative(fname, "r");
+    else goto compiler_import_cleanup;
 
-        if (f) {
-            value modname=object_stringfromcstring(fname, strlen(fname));
-            value symboldict=MORPHO_NIL;
-
-            /* Read in source */
-            varray_char src;
-            varray_charinit(&src);
-            if (!file_readintovarray(f, &src)) {
-                compiler_error(c, module, COMPILE_IMPORTFLD, fname);
-                goto compiler_import_cleanup;
-            }
+    if (f) {
+        value modname=object_stringfromcstring(fname, strlen(fname));
+        value symboldict=MORPHO_NIL;
+
+        /* Read in source */
+        varray_char src;
+        varray_charinit(&src);
+        if (!file_readintovarray(f, &src)) {
+            compiler_error(c, node, COMPILE_IMPORTFLD, fname);
+            goto compiler_import_cleanup;
+        }
 
-            /* Remember the initial position of the code */
-            start=c->out->code.count;
-
-            /* Set up the compiler */
-            compiler cc;
-            compiler_init(src.data, c->out, &cc);
-            compiler_setmodule(&cc, modname);
-            debugannotation_setmodule(&c->out->annotations, modname);
-            cc.parent=c; /* Ensures global variables can be found */
-
-            morpho_compile(src.data, &cc, false, &c->err);
-
-            if (ERROR_SUCCEEDED(c->err)) {
-                compiler_stripend(c);
-                compiler_copysymbols(&cc.globals, (nmspace ? &nmspace->symbols: &c->globals), (fordict.count>0 ? &fordict : NULL));
-                if (nmspace) { // If we're in a namespace, copy the class table into that
-                    compiler_copysymbols(&cc.classes, &nmspace->classes, (fordict.count>0 ? &fordict : NULL));
-                    compiler_copyfunctionreftonamespace(&cc, nmspace, (fordict.count>0 ? &fordict : NULL));
-                } else { // Otherwise just put it into the parent compiler's class table
-                    compiler_copysymbols(&cc.classes, &c->classes, (fordict.count>0 ? &fordict : NULL));
-                    compiler_copyfunctionref(&cc, c, (fordict.count>0 ? &fordict : NULL));
-                }
-                
-                objectdictionary *dict = object_newdictionary(); // Preserve all symbols for further imports
-                if (dict) {
-                    compiler_copysymbols(&cc.globals, &dict->dict, NULL);
-                    symboldict = MORPHO_OBJECT(dict);
-                }
-                
-            } else {
-                c->err.file = (cc.err.file ? cc.err.file : MORPHO_GETCSTRING(modname));
-            }
-            
-            debugannotation_setmodule(&c->out->annotations, compiler_getmodule(c));
-            
-            end=c->out->code.count;
-            
-            compiler_clear(&cc);
+        /* Remember the initial position of the code */
+        start=c->out->code.count;
+
+        /* Set up the compiler; if compiling lazily, the root compiler retains it until deferred functions are compiled */
+        compiler modcompiler, *cc=&modcompiler;
+        if (lazycompilation) cc=MORPHO_MALLOC(sizeof(compiler));
+        if (!cc) {
+            compiler_error(c, node, ERROR_ALLOCATIONFAILED);
             varray_charclear(&src);
+            goto compiler_import_cleanup;
+        }
+        
+        compiler_init(src.data, c->out, cc);
+        compiler_setmodule(cc, modname);
+        debugannotation_setmodule(&c->out->annotations, modname);
+        cc->parent=c; /* Ensures global variables can be found */
+        if (lazycompilation) {
+            cc->lazy=true;
+            cc->next=root->retained;
+            root->retained=cc;
+        }
+
+        /* Use the cached module if possible; otherwise compile it, recording what's needed to cache it.
+           Lazily compiled modules are incomplete and so aren't cached. */
+        if (!modulecache_load(cc, node, src.data, (issymbol ? module : MORPHO_NIL), &c->err)) {
+            if (!cc->lazy) modulecache_record(cc, src.data, (issymbol ? module : MORPHO_NIL));
+            bool success=morpho_compile(src.data, cc, false, &c->err);
+            if (!cc->lazy) modulecache_save(cc, success);
+        }
+
+        if (ERROR_SUCCEEDED(c->err)) {
+            compiler_stripend(c);
+            compiler_copysymbols(&cc->globals, (nmspace ? &nmspace->symbols: &c->globals), selected);
+            if (nmspace) { // If we're in a namespace, copy the class table into that
+                compiler_copysymbols(&cc->classes, &nmspace->classes, selected);
+                compiler_copyfunctionreftonamespace(cc, nmspace, selected);
+            } else { // Otherwise just put it into the parent compiler's class table
+                compiler_copysymbols(&cc->classes, &c->classes, selected);
+                compiler_copyfunctionref(cc, c, selected);
+            }
             
-            dictionary_insert(&root->modules, modname, symboldict);
-        } else compiler_error(c, module, COMPILE_FILENOTFOUND, fname);
-    }
+            objectdictionary *dict = object_newdictionary(); // Preserve all symbols for further imports
+            if (dict) {
+                compiler_copysymbols(&cc->globals, &dict->dict, NULL);
+                symboldict = MORPHO_OBJECT(dict);
+            }
+            key=modname;
+        } else {
+            c->err.file = (cc->err.file ? cc->err.file : MORPHO_GETCSTRING(modname));
+        }
+        
+        debugannotation_setmodule(&c->out->annotations, compiler_getmodule(c));
+        
+        end=c->out->code.count;
+        
+        if (!cc->lazy) compiler_clear(cc);
+        varray_charclear(&src);
+        
+        dictionary_insert(&root->modules, modname, symboldict);
+    } else compiler_error(c, node, COMPILE_FILENOTFOUND, fname);
 
 compiler_import_cleanup:
+    modulecache_enddirective(c, key);
     if (f) fclose(f);
     varray_charclear(&filename);
+
+    return end-start;
+}
+
+/** Import a module */
+static codeinfo compiler_import(compiler *c, syntaxtreenode *node, registerindx reqout) {
+    syntaxtreenode *module = compiler_getnode(c, node->left);
+    syntaxtreenode *qual = compiler_getnode(c, node->right);
+    dictionary fordict;
+    value label=MORPHO_NIL;
+    instructionindx ninstructions=0;
+
+    if (compiler_checkerror(c)) return CODEINFO_EMPTY;
+
+    dictionary_init(&fordict);
+
+    while (qual) {
+        if (qual->type==NODE_FOR) {
+            syntaxtreenode *l = compiler_getnode(c, qual->left);
+            if (l && l->type==NODE_SYMBOL) {
+                dictionary_insert(&fordict, l->content, MORPHO_NIL);
+            } else UNREACHABLE("Incorrect syntax tree structure in FOR node.");
+        } else if (qual->type==NODE_AS) {
+            syntaxtreenode *l = compiler_getnode(c, qual->left);
+            if (l && l->type==NODE_SYMBOL) {
+                label=l->content;
+            } else UNREACHABLE("Incorrect syntax tree structure in AS node.");
+        } else UNREACHABLE("Unexpected node type.");
+        qual=compiler_getnode(c, qual->right);
+    }
+
+    if (module && (module->type==NODE_SYMBOL || module->type==NODE_STRING)) {
+        ninstructions=compiler_importmodule(c, module, module->content, (module->type==NODE_SYMBOL), label, &fordict);
+    }
+
     dictionary_clear(&fordict);
 
-    return CODEINFO(REGISTER, REGISTER_UNALLOCATED, end-start);
+    return CODEINFO(REGISTER, REGISTER_UNALLOCATED, ninstructions);
 }
 
 /** Compile a breakpoint */
@@ -4395,6 +4955,8 @@ void compiler_init(const char *source, program *out, compiler *c) {
     dictionary_init(&c->globals);
     dictionary_init(&c->classes);
     dictionary_init(&c->modules);
+    dictionary_init(&c->moduledeps);
+    c->record = NULL;
     if (out) c->fstack[0].func=out->global; /* The global pseudofunction */
     c->out = out;
     c->prevfunction = NULL;
@@ -4403,6 +4965,11 @@ void compiler_init(const char *source, program *out, compiler *c) {
     c->namespaces = NULL; 
     c->currentmodule = MORPHO_NIL;
     c->parent = NULL;
+    c->lazy = false;
+    varray_deferredfunctioninit(&c->deferred);
+    dictionary_init(&c->deferredrefs);
+    c->retained = NULL;
+    c->next = NULL;
     c->line = 1; // Count from 1
 }
 
@@ -4417,7 +4984,11 @@ void compiler_clear(compiler *c) {
     dictionary_clear(&c->globals); // Keys are bound to the program
     dictionary_freecontents(&c->modules, true, true);
     dictionary_clear(&c->modules);
+    dictionary_freecontents(&c->moduledeps, true, true);
+    dictionary_clear(&c->moduledeps);
+    modulecache_clearrecord(c);
     dictionary_clear(&c->classes);
+    compiler_cleardeferred(c);
 }
 
 /* **********************************************************************
@@ -4507,6 +5078,13 @@ void morpho_setoptimizer(optimizerfn *opt) {
     optimizer = opt;
 }
 
+/** Sets whether the bodies of functions declared in modules are compiled only once they are referenced.
+ *  Modules are still parsed in full, so syntax errors are reported, but other compile errors
+ *  in the body of a function that is never referenced are not. */
+void morpho_setlazycompilation(bool lazy) {
+    lazycompilation = lazy;
+}
+
 /** Initializes the compiler */
 void compile_initialize(void) {
     _selfsymbol=builtin_internsymbolascstring("self");
@@ -4514,7 +5092,20 @@ void compile_initialize(void) {
     /** Types we need to refer to */
     _closuretype = MORPHO_OBJECT(object_getveneerclass(OBJECT_CLOSURE));
     
+#ifdef MORPHO_OPTIMIZER
+    optimizer = optimize_program;
+#else
     optimizer = NULL;
+#endif
+
+#ifdef MORPHO_LAZYCOMPILATION
+    lazycompilation = true;
+#else
+    lazycompilation = false;
+#endif
+    
+    const char *lazy = getenv(MORPHO_LAZYCOMPILATIONENV);
+    if (lazy) lazycompilation = (strcmp(lazy, "0")!=0);
 
     /* Compile errors */
     morpho_defineerror(COMPILE_SYMBOLNOTDEFINED, ERROR_COMPILE, COMPILE_SYMBOLNOTDEFINED_MSG);
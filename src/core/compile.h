@@ -247,6 +247,22 @@ typedef struct {
     //unsigned int nopt; /* Number of optional args recorded in latest call */
 } functionstate;
 
+/* -------------------------------------------------------
+ * Deferred functions
+ * ------------------------------------------------------- */
+
+/** A function declared in a module whose body is only compiled once the function is referenced */
+typedef struct {
+    objectfunction *func; /** The function */
+    struct scompiler *owner; /** Compiler for the module that declared the function */
+    syntaxtreenode *node; /** Syntax tree node of the declaration */
+    functionstate state; /** State of the function once its parameters have been compiled */
+    bool wanted; /** Whether the function has been referenced */
+    bool compiled; /** Whether the body has been compiled */
+} deferredfunction;
+
+DECLARE_VARRAY(deferredfunction, deferredfunction)
+
 /* -------------------------------------------------------
  * Lists
  * ------------------------------------------------------- */
@@ -316,8 +332,23 @@ typedef struct scompiler {
     /* Modules included */
     dictionary modules;
     
+    /* Dependencies of modules included, used by the module cache */
+    dictionary moduledeps;
+    
+    /* Information recorded while compiling a module, used by the module cache */
+    struct smodulerecord *record;
+    
     /* The parent compiler */
     struct scompiler *parent;
+    
+    /* Whether function bodies in this module may be deferred */
+    bool lazy;
+    
+    /* Deferred functions and the module compilers that declared them; held by the root compiler */
+    varray_deferredfunction deferred;
+    dictionary deferredrefs; /** Maps deferred functions, and the globals that hold them, to entries in deferred */
+    struct scompiler *retained; /** Linked list of retained module compilers */
+    struct scompiler *next;
 } compiler;
 
 /* -------------------------------------------------------
@@ -336,4 +367,10 @@ typedef struct {
 void compiler_init(const char *source, program *out, compiler *c);
 void compiler_clear(compiler *c);
 
+globalindx compiler_findglobal(compiler *c, value symbol, bool recurse);
+objectclass *compiler_findclass(compiler *c, value name);
+namespc *compiler_isnamespace(compiler *c, value label);
+bool compiler_findmodule(char *name, varray_char *fname);
+instructionindx compiler_importmodule(compiler *c, syntaxtreenode *node, value module, bool issymbol, value label, dictionary *fordict);
+
 #endif /* compile_h */
@@ -0,0 +1,2413 @@
+/** @file modulecache.c
+ *  @author T J Atherton
+ *
+ *  @brief Caches compiled modules so that later imports can skip the compiler
+ *
+ *  @details While a module is compiled, the compiler records where its code,
+ *  debug annotations, globals and objects were placed in the program, together
+ *  with the import statements it contains, the modules it depends on and any
+ *  symbols it looked for but couldn't find. The compiled module is then written
+ *  to a file in the user's cache folder, named by a hash of the source and the
+ *  morpho version.
+ *
+ *  When identical source is imported later, the cache file is used instead of
+ *  the compiler: import statements are replayed, the module's own objects are
+ *  recreated and the code is relocated against the program's globals, constant
+ *  table and upvalue prototypes. A cache file is only used if every dependency
+ *  still has the same source and was imported in the same order as before.
+ *  Modules that depend on definitions made by the compiler that imports them
+ *  are never cached.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "modulecache.h"
+#include "morpho.h"
+#include "classes.h"
+#include "file.h"
+#include "platform.h"
+#include "debug.h"
+
+#ifdef MORPHO_MODULECACHE
+
+/* **********************************************************************
+ * Writing and reading binary data
+ * ********************************************************************** */
+
+/** Writes raw bytes */
+static void modulecache_writebytes(varray_char *out, const void *data, size_t n) {
+    varray_charadd(out, (char *) data, (int) n);
+}
+
+/** Writes a single byte */
+static void modulecache_writebyte(varray_char *out, unsigned int x) {
+    varray_charwrite(out, (char) (x & 0xff));
+}
+
+/** Writes an unsigned 32 bit integer in little endian order */
+static void modulecache_writeu32(varray_char *out, uint32_t x) {
+    char b[4];
+    for (int i=0; i<4; i++) b[i]=(char) ((x >> (8*i)) & 0xff);
+    modulecache_writebytes(out, b, 4);
+}
+
+/** Writes a signed integer */
+static void modulecache_writeint(varray_char *out, int x) {
+    modulecache_writeu32(out, (uint32_t) x);
+}
+
+/** Writes an unsigned 64 bit integer in little endian order */
+static void modulecache_writeu64(varray_char *out, uint64_t x) {
+    modulecache_writeu32(out, (uint32_t) (x & 0xffffffff));
+    modulecache_writeu32(out, (uint32_t) (x >> 32));
+}
+
+/** Writes a double */
+static void modulecache_writedouble(varray_char *out, double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(double));
+    modulecache_writeu64(out, u);
+}
+
+/** Writes a string of given length, followed by a zero terminator */
+static void modulecache_writecstring(varray_char *out, const char *str, size_t length) {
+    modulecache_writeu32(out, (uint32_t) length);
+    modulecache_writebytes(out, str, length);
+    modulecache_writebyte(out, 0);
+}
+
+/** Writes a string object */
+static void modulecache_writestring(varray_char *out, value str) {
+    modulecache_writecstring(out, MORPHO_GETCSTRING(str), MORPHO_GETSTRINGLENGTH(str));
+}
+
+/** Reads data written by the above */
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t posn;
+    bool ok; /** Set to false if an attempt is made to read beyond the data */
+} mcreader;
+
+/** Reads raw bytes */
+static bool modulecache_readbytes(mcreader *in, void *out, size_t n) {
+    if (!in->ok || in->length-in->posn<n) { in->ok=false; return false; }
+    memcpy(out, in->data+in->posn, n);
+    in->posn+=n;
+    return true;
+}
+
+/** Reads a single byte */
+static unsigned int modulecache_readbyte(mcreader *in) {
+    unsigned char b=0;
+    modulecache_readbytes(in, &b, 1);
+    return b;
+}
+
+/** Reads an unsigned 32 bit integer */
+static uint32_t modulecache_readu32(mcreader *in) {
+    unsigned char b[4] = { 0, 0, 0, 0 };
+    modulecache_readbytes(in, b, 4);
+    return ((uint32_t) b[0]) | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+/** Reads a signed integer */
+static int modulecache_readint(mcreader *in) {
+    return (int) modulecache_readu32(in);
+}
+
+/** Reads a count, checking that it's plausible given the remaining data */
+static unsigned int modulecache_readcount(mcreader *in) {
+    uint32_t n = modulecache_readu32(in);
+    if (n>in->length-in->posn) { in->ok=false; return 0; }
+    return n;
+}
+
+/** Reads an unsigned 64 bit integer */
+static uint64_t modulecache_readu64(mcreader *in) {
+    uint64_t lo = modulecache_readu32(in);
+    uint64_t hi = modulecache_readu32(in);
+    return lo | (hi << 32);
+}
+
+/** Reads a double */
+static double modulecache_readdouble(mcreader *in) {
+    uint64_t u = modulecache_readu64(in);
+    double x;
+    memcpy(&x, &u, sizeof(double));
+    return x;
+}
+
+/** Reads a string, returning a pointer into the data and its length */
+static char *modulecache_readcstring(mcreader *in, size_t *length) {
+    size_t n = modulecache_readcount(in);
+    if (!in->ok || in->length-in->posn<n+1 || in->data[in->posn+n]!='\0') { in->ok=false; return NULL; }
+    char *out = (char *) in->data+in->posn;
+    in->posn+=n+1;
+    if (length) *length=n;
+    return out;
+}
+
+/* **********************************************************************
+ * Hashing
+ * ********************************************************************** */
+
+#define MODULECACHE_FNVOFFSET 14695981039346656037ULL
+#define MODULECACHE_FNVPRIME 1099511628211ULL
+
+/** Continues a 64 bit FNV-1a hash over some data */
+static uint64_t modulecache_hash(uint64_t hash, const void *data, size_t n) {
+    const unsigned char *c = data;
+    for (size_t i=0; i<n; i++) {
+        hash ^= c[i];
+        hash *= MODULECACHE_FNVPRIME;
+    }
+    return hash;
+}
+
+/** Hashes source code */
+static uint64_t modulecache_sourcehash(const char *src, size_t length) {
+    return modulecache_hash(MODULECACHE_FNVOFFSET, src, length);
+}
+
+/** Key used to name the cache file for a given source, incorporating the morpho version */
+static uint64_t modulecache_key(uint64_t srchash) {
+    uint32_t format = MODULECACHE_FORMATVERSION;
+    uint64_t key = modulecache_hash(srchash, MORPHO_VERSIONSTRING, strlen(MORPHO_VERSIONSTRING));
+    return modulecache_hash(key, &format, sizeof(uint32_t));
+}
+
+/** Constructs the path of the cache file for a given key, optionally creating the cache folder */
+static bool modulecache_path(uint64_t key, bool create, varray_char *path) {
+    size_t len = platform_maxpathsize();
+    char home[len];
+    if (!platform_gethomedirectory(home, len)) return false;
+
+    path->count=0;
+    varray_charadd(path, home, (int) strlen(home));
+    varray_charwrite(path, MORPHO_DIRSEPARATOR);
+    varray_charadd(path, MORPHO_MODULECACHEDIR, (int) strlen(MORPHO_MODULECACHEDIR));
+
+    if (create) {
+        varray_charwrite(path, '\0');
+        bool success=platform_makedirectory(path->data);
+        path->count--;
+        if (!success) return false;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%c%016llx.%s", MORPHO_DIRSEPARATOR, (unsigned long long) key, MORPHO_MODULECACHEEXTENSION);
+    varray_charadd(path, name, (int) strlen(name));
+    varray_charwrite(path, '\0');
+
+    return true;
+}
+
+/* **********************************************************************
+ * Dependencies
+ * ********************************************************************** */
+
+/** A module that another module depends on */
+typedef struct {
+    value name; /** Name the module was imported by, or nil if it was imported by file name */
+    value fname; /** File name of the module, as used by the import */
+    uint64_t hash; /** Hash of the module's source */
+    bool preexisting; /** Whether the module had already been imported when recording began */
+} mcdependency;
+
+DECLARE_VARRAY(mcdependency, mcdependency)
+DEFINE_VARRAY(mcdependency, mcdependency)
+
+/** Frees the contents of a list of dependencies */
+static void modulecache_cleardependencies(varray_mcdependency *deps) {
+    for (int i=0; i<deps->count; i++) {
+        morpho_freeobject(deps->data[i].name);
+        morpho_freeobject(deps->data[i].fname);
+    }
+    varray_mcdependencyclear(deps);
+}
+
+/** Finds the compiler at the root of a chain of imports */
+static compiler *modulecache_root(compiler *c) {
+    compiler *root = c;
+    while (root->parent!=NULL) root=root->parent;
+    return root;
+}
+
+/** Creates a string object whose contents may include zeros */
+static value modulecache_blob(varray_char *data) {
+    value out = object_stringfromcstring(NULL, data->count);
+    if (MORPHO_ISSTRING(out)) {
+        objectstring *str = MORPHO_GETSTRING(out);
+        memcpy(str->string, data->data, data->count);
+        str->length=data->count;
+    }
+    return out;
+}
+
+/** The root compiler keeps a registry of every module imported, mapping file names to a
+ *  blob containing a flag indicating whether all dependencies are known, the order in which
+ *  the module was registered, and the module's dependencies (including itself). */
+static void modulecache_register(compiler *c, value fname, bool complete, varray_mcdependency *closure) {
+    compiler *root = modulecache_root(c);
+    if (dictionary_get(&root->moduledeps, fname, NULL)) return;
+
+    varray_char data;
+    varray_charinit(&data);
+    modulecache_writebyte(&data, complete);
+    modulecache_writeu32(&data, root->moduledeps.count);
+    modulecache_writeu32(&data, closure->count);
+    for (int i=0; i<closure->count; i++) {
+        mcdependency *dep = &closure->data[i];
+        if (MORPHO_ISSTRING(dep->name)) modulecache_writestring(&data, dep->name);
+        else modulecache_writecstring(&data, "", 0);
+        modulecache_writestring(&data, dep->fname);
+        modulecache_writeu64(&data, dep->hash);
+    }
+
+    value key = object_clonestring(fname);
+    value blob = modulecache_blob(&data);
+    if (MORPHO_ISSTRING(key) && MORPHO_ISSTRING(blob)) {
+        dictionary_insert(&root->moduledeps, key, blob);
+    } else {
+        morpho_freeobject(key);
+        morpho_freeobject(blob);
+    }
+    varray_charclear(&data);
+}
+
+/** Looks up a module in the registry, returning a reader positioned at its list of dependencies */
+static bool modulecache_registry(compiler *c, value fname, bool *complete, int *seq, mcreader *in) {
+    compiler *root = modulecache_root(c);
+    value blob = MORPHO_NIL;
+    if (!dictionary_get(&root->moduledeps, fname, &blob) || !MORPHO_ISSTRING(blob)) return false;
+
+    objectstring *str = MORPHO_GETSTRING(blob);
+    *in = (mcreader) { .data=(unsigned char *) str->string, .length=str->length, .posn=0, .ok=true };
+    bool cmplt = modulecache_readbyte(in);
+    int sq = modulecache_readint(in);
+    if (complete) *complete=cmplt;
+    if (seq) *seq=sq;
+
+    return in->ok;
+}
+
+/** Retrieves the hash of a registered module's source */
+static bool modulecache_registeredhash(compiler *c, value fname, uint64_t *hash) {
+    mcreader in;
+    if (!modulecache_registry(c, fname, NULL, NULL, &in) ||
+        modulecache_readcount(&in)<1) return false;
+
+    modulecache_readcstring(&in, NULL);
+    modulecache_readcstring(&in, NULL);
+    *hash = modulecache_readu64(&in);
+
+    return in.ok;
+}
+
+/* **********************************************************************
+ * Recording
+ * ********************************************************************** */
+
+/** An import statement made by a module being recorded */
+typedef struct {
+    instructionindx codestart, codeend; /** Code generated by the import */
+    int annstart, annend; /** Annotations generated by the import */
+    int globalstart, globalend; /** Globals created by the import */
+    object *boundstart, *boundend; /** Objects bound to the program by the import */
+    bool closed; /** Set once the import is complete */
+    bool issymbol; /** Whether the module was imported by name */
+    value module; /** The module name or file name */
+    value label; /** Namespace label, or nil */
+    varray_value fornames; /** Symbols selected with 'for' */
+} mcdirective;
+
+DECLARE_VARRAY(mcdirective, mcdirective)
+DEFINE_VARRAY(mcdirective, mcdirective)
+
+/** Kinds of lookup are stored as a bitmask */
+#define MODULECACHE_LOOKUPMASK(type) (1 << (type))
+
+/** Records information about a module while it is compiled */
+typedef struct smodulerecord {
+    bool valid; /** Whether the module can be cached */
+    bool complete; /** Whether all dependencies of the module are known */
+    value name; /** Module name if imported by name, or nil */
+    uint64_t hash; /** Hash of the source */
+    size_t length; /** Length of the source */
+    int seq; /** Number of modules registered when recording began */
+
+    instructionindx codestart; /** Start of the module's code */
+    int annstart; /** Start of the module's annotations */
+    int globalstart; /** Number of globals when recording began */
+    object *boundstart; /** Head of the program's bound list when recording began */
+
+    varray_mcdirective directives; /** Import statements */
+    varray_mcdependency deps; /** Modules imported, directly or indirectly */
+    dictionary lookups; /** Symbols looked for but not found, mapped to a mask of lookup types */
+    dictionary ancestors; /** Classes found in a compiler that imports the module */
+} modulerecord;
+
+/** Records a symbol in one of a recording's dictionaries */
+static void modulecache_recordsymbol(modulerecord *r, dictionary *dict, value symbol, int mask) {
+    value prev=MORPHO_INTEGER(0);
+    if (dictionary_get(dict, symbol, &prev)) {
+        dictionary_insert(dict, symbol, MORPHO_INTEGER(MORPHO_GETINTEGERVALUE(prev) | mask));
+    } else {
+        value key = object_clonestring(symbol);
+        if (MORPHO_ISSTRING(key)) dictionary_insert(dict, key, MORPHO_INTEGER(mask));
+        else r->valid=false;
+    }
+}
+
+/** Records a symbol lookup that escaped from a module.
+ * @param[in] c       the compiler that performed the lookup
+ * @param[in] found   the compiler in which the symbol was found, or NULL if it wasn't found
+ * @param[in] type    kind of lookup
+ * @param[in] symbol  the symbol */
+void modulecache_lookup(compiler *c, compiler *found, modulecachelookup type, value symbol) {
+    if (found==c) return;
+
+    if (found) {
+        for (compiler *cc=c; cc!=found; cc=cc->parent) {
+            modulerecord *r = cc->record;
+            if (!r || !r->valid) continue;
+            // Classes defined by other modules can be found again when the module is loaded, but the module can't depend on globals defined by the compiler that imports it
+            if (type==MODULECACHE_LOOKUPCLASS && MORPHO_ISSTRING(symbol)) modulecache_recordsymbol(r, &r->ancestors, symbol, 0);
+            else r->valid=false;
+        }
+        return;
+    }
+
+    modulerecord *r = c->record;
+    if (!r || !r->valid) return;
+    if (MORPHO_ISSTRING(symbol)) modulecache_recordsymbol(r, &r->lookups, symbol, MODULECACHE_LOOKUPMASK(type));
+    else r->valid=false;
+}
+
+/** Called as the compiler begins to process an import statement */
+void modulecache_begindirective(compiler *c, value module, bool issymbol, value label, dictionary *fordict) {
+    modulerecord *r = c->record;
+    if (!r) return;
+
+    program *p = c->out;
+
+    // Imports within functions, blocks or classes aren't replayed
+    if (c->fstackp!=0 || c->fstack[0].scopedepth>0 || c->currentclass) r->valid=false;
+
+    mcdirective d = { .codestart=p->code.count, .annstart=p->annotations.count, .globalstart=p->globals.count, .boundstart=p->boundlist, .closed=false, .issymbol=issymbol };
+    d.module=object_clonestring(module);
+    d.label=object_clonestring(label);
+    varray_valueinit(&d.fornames);
+    if (fordict) for (unsigned int i=0; i<fordict->capacity; i++) {
+        value key = fordict->contents[i].key;
+        if (MORPHO_ISSTRING(key)) varray_valuewrite(&d.fornames, object_clonestring(key));
+    }
+
+    varray_mcdirectivewrite(&r->directives, d);
+}
+
+/** Adds the dependencies of a module to a recording */
+static void modulecache_adddependencies(compiler *c, value fname) {
+    modulerecord *r = c->record;
+    bool complete;
+    mcreader in;
+
+    if (!modulecache_registry(c, fname, &complete, NULL, &in) || !complete) {
+        r->valid=false; r->complete=false;
+        return;
+    }
+
+    unsigned int n = modulecache_readcount(&in);
+    for (unsigned int i=0; i<n && in.ok; i++) {
+        size_t nlen, flen;
+        char *name = modulecache_readcstring(&in, &nlen);
+        char *file = modulecache_readcstring(&in, &flen);
+        uint64_t hash = modulecache_readu64(&in);
+        if (!in.ok) break;
+
+        objectstring fstr = MORPHO_STATICSTRINGWITHLENGTH(file, flen);
+        bool found=false;
+        for (int j=0; j<r->deps.count && !found; j++) found=MORPHO_ISEQUAL(r->deps.data[j].fname, MORPHO_OBJECT(&fstr));
+        if (found) continue;
+
+        int seq;
+        mcreader dep;
+        if (!modulecache_registry(c, MORPHO_OBJECT(&fstr), NULL, &seq, &dep)) { in.ok=false; break; }
+
+        mcdependency d = { .name = (nlen>0 ? object_stringfromcstring(name, nlen) : MORPHO_NIL),
+                           .fname = object_stringfromcstring(file, flen),
+                           .hash = hash,
+                           .preexisting = (seq < r->seq) };
+        varray_mcdependencywrite(&r->deps, d);
+    }
+
+    if (!in.ok) { r->valid=false; r->complete=false; }
+}
+
+/** Called once the compiler has processed an import statement.
+ * @param[in] c       the compiler
+ * @param[in] fname   file name of the module imported, or nil if an extension was imported or the import failed */
+void modulecache_enddirective(compiler *c, value fname) {
+    modulerecord *r = c->record;
+    if (!r || !r->directives.count) return;
+
+    program *p = c->out;
+    mcdirective *d = &r->directives.data[r->directives.count-1];
+    d->codeend=p->code.count;
+    d->annend=p->annotations.count;
+    d->globalend=p->globals.count;
+    d->boundend=p->boundlist;
+    d->closed=true;
+
+    if (MORPHO_ISSTRING(fname)) modulecache_adddependencies(c, fname);
+    else { r->valid=false; r->complete=false; }
+}
+
+/** Begins recording a module as it is compiled
+ * @param[in] c       the compiler that will compile the module
+ * @param[in] src     source of the module
+ * @param[in] name    module name, if imported by name, or nil */
+void modulecache_record(compiler *c, char *src, value name) {
+    modulerecord *r = MORPHO_MALLOC(sizeof(modulerecord));
+    if (!r) return;
+
+    program *p = c->out;
+    r->valid=true;
+    r->complete=true;
+    r->name=object_clonestring(name);
+    r->length=strlen(src);
+    r->hash=modulecache_sourcehash(src, r->length);
+    r->seq=modulecache_root(c)->moduledeps.count;
+    r->codestart=p->code.count;
+    r->annstart=p->annotations.count;
+    r->globalstart=p->globals.count;
+    r->boundstart=p->boundlist;
+    varray_mcdirectiveinit(&r->directives);
+    varray_mcdependencyinit(&r->deps);
+    dictionary_init(&r->lookups);
+    dictionary_init(&r->ancestors);
+
+    c->record=r;
+}
+
+/** Frees a recording attached to a compiler */
+void modulecache_clearrecord(compiler *c) {
+    modulerecord *r = c->record;
+    if (!r) return;
+
+    morpho_freeobject(r->name);
+    for (int i=0; i<r->directives.count; i++) {
+        mcdirective *d = &r->directives.data[i];
+        morpho_freeobject(d->module);
+        morpho_freeobject(d->label);
+        for (int j=0; j<d->fornames.count; j++) morpho_freeobject(d->fornames.data[j]);
+        varray_valueclear(&d->fornames);
+    }
+    varray_mcdirectiveclear(&r->directives);
+    modulecache_cleardependencies(&r->deps);
+    dictionary_freecontents(&r->lookups, true, false);
+    dictionary_clear(&r->lookups);
+    dictionary_freecontents(&r->ancestors, true, false);
+    dictionary_clear(&r->ancestors);
+
+    MORPHO_FREE(r);
+    c->record=NULL;
+}
+
+/** Finds a class defined by a compiler that imports the module, without recording the lookup */
+static objectclass *modulecache_findancestorclass(compiler *c, value name) {
+    for (compiler *cc=c->parent; cc!=NULL; cc=cc->parent) {
+        value val;
+        if (dictionary_get(&cc->classes, name, &val) && MORPHO_ISCLASS(val)) return MORPHO_GETCLASS(val);
+    }
+    return NULL;
+}
+
+/** Identifies the module that defined a class from the location of one of its methods */
+static value modulecache_classmodule(program *p, objectclass *klass) {
+    objectfunction *method=NULL;
+    for (unsigned int i=0; i<klass->methods.capacity && !method; i++) {
+        value val = klass->methods.contents[i].val;
+        if (MORPHO_ISFUNCTION(val) && MORPHO_GETFUNCTION(val)->klass==klass) method=MORPHO_GETFUNCTION(val);
+        else if (MORPHO_ISMETAFUNCTION(val)) {
+            objectmetafunction *mf = MORPHO_GETMETAFUNCTION(val);
+            for (int j=0; j<mf->fns.count && !method; j++) {
+                if (MORPHO_ISFUNCTION(mf->fns.data[j]) && MORPHO_GETFUNCTION(mf->fns.data[j])->klass==klass) method=MORPHO_GETFUNCTION(mf->fns.data[j]);
+            }
+        }
+    }
+
+    value module=MORPHO_NIL;
+    if (method) debug_infofromindx(p, method->entry, &module, NULL, NULL, NULL, NULL);
+    return module;
+}
+
+/* **********************************************************************
+ * Cache file format
+ * ********************************************************************** */
+
+/** Tags for serialized values */
+enum {
+    MODULECACHE_NIL,
+    MODULECACHE_TRUE,
+    MODULECACHE_FALSE,
+    MODULECACHE_INTEGER,
+    MODULECACHE_FLOAT,
+    MODULECACHE_STRING,
+    MODULECACHE_SYMBOL, // An interned string
+    MODULECACHE_COMPLEX,
+    MODULECACHE_OWN, // An object created by the module
+    MODULECACHE_EXTERNAL, // An object defined elsewhere
+    MODULECACHE_GLOBALFN, // The program's global pseudofunction
+    MODULECACHE_LIST, // A constant list, tuple, dictionary or matrix created from a literal
+    MODULECACHE_TUPLE,
+    MODULECACHE_DICTIONARY,
+    MODULECACHE_MATRIX
+};
+
+/** Tags for references to objects defined elsewhere */
+enum {
+    MODULECACHE_BUILTINFN, // A builtin function, by name
+    MODULECACHE_BUILTINCLASS, // A builtin class, by name
+    MODULECACHE_CLASS, // An entry in the compiler's class table
+    MODULECACHE_ANCESTORCLASS, // A class found in a compiler that imports the module
+    MODULECACHE_NSCLASS, // An entry in a namespace's class table
+    MODULECACHE_NSSYMBOL, // An entry in a namespace's symbol table
+    MODULECACHE_FUNCREF, // A function visible at global scope, by name and ordinal
+    MODULECACHE_METHOD, // A method of a class
+    MODULECACHE_LINEARIZATION, // An entry in the linearization of a class
+    MODULECACHE_ELEMENT // An implementation within a metafunction
+};
+
+/** Tags for references to globals */
+enum {
+    MODULECACHE_GLOBALOWN, // A global created by the module
+    MODULECACHE_GLOBALNAME, // An entry in the compiler's global table
+    MODULECACHE_GLOBALNS // An entry in a namespace's symbol table
+};
+
+/** Kinds of instruction operand that must be relocated */
+enum {
+    MODULECACHE_RELOCKONST, // Index into the global constant table
+    MODULECACHE_RELOCPROTO, // Index into the global function's upvalue prototypes
+    MODULECACHE_RELOCGLOBAL // Index of a global
+};
+
+/** Kinds of object created by a module */
+enum {
+    MODULECACHE_OBJFUNCTION,
+    MODULECACHE_OBJCLASS,
+    MODULECACHE_OBJMETAFUNCTION,
+    MODULECACHE_OBJDICTIONARY
+};
+
+/* **********************************************************************
+ * Serializing a module
+ * ********************************************************************** */
+
+/** State used while serializing a module */
+typedef struct {
+    compiler *c;
+    program *p;
+    modulerecord *r;
+    bool ok; /** Set to false if the module can't be serialized */
+
+    varray_value own; /** Objects created by the module in order of creation */
+    varray_value ext; /** Objects defined elsewhere that are referred to */
+    varray_char extout; /** References to these objects */
+
+    varray_int globals; /** Globals created by the module */
+    dictionary globalmap; /** Maps global indices to references */
+    int ngrefs;
+    varray_char grefout;
+
+    dictionary konstmap; /** Maps global constant indices to entries in the list of constants */
+    varray_int konst;
+    dictionary protomap; /** Maps global prototype indices to entries in the list of prototypes */
+    varray_int protos;
+
+    varray_char relocout;
+    int nrelocs;
+
+    varray_int segcode; /** Start and end of each segment of code */
+    varray_int segann; /** Start and end of each segment's annotations */
+} mcsave;
+
+/** Finds an object in the module's own list */
+static int modulecache_ownindex(mcsave *s, value v) {
+    if (!MORPHO_ISOBJECT(v)) return -1;
+    for (int i=0; i<s->own.count; i++) if (MORPHO_GETOBJECT(s->own.data[i])==MORPHO_GETOBJECT(v)) return i;
+    return -1;
+}
+
+/** Checks whether a string is an interned symbol */
+static bool modulecache_issymbol(program *p, value str) {
+    if (builtin_checksymbol(str)) {
+        return MORPHO_GETOBJECT(builtin_internsymbol(str))==MORPHO_GETOBJECT(str);
+    }
+    if (dictionary_get(&p->symboltable, str, NULL)) {
+        return MORPHO_GETOBJECT(dictionary_intern(&p->symboltable, str))==MORPHO_GETOBJECT(str);
+    }
+    return false;
+}
+
+static int modulecache_external(mcsave *s, value v);
+static void modulecache_writevalue(mcsave *s, varray_char *out, value v);
+
+/** Serializes a constant list, tuple or dictionary created from a literal */
+static void modulecache_writeliteral(mcsave *s, varray_char *out, value v) {
+    if (MORPHO_ISDICTIONARY(v)) {
+        dictionary *dict = &MORPHO_GETDICTIONARY(v)->dict;
+        modulecache_writebyte(out, MODULECACHE_DICTIONARY);
+        modulecache_writeu32(out, dict->count);
+        for (unsigned int i=0; i<dict->capacity; i++) {
+            if (MORPHO_ISNIL(dict->contents[i].key)) continue;
+            modulecache_writevalue(s, out, dict->contents[i].key);
+            modulecache_writevalue(s, out, dict->contents[i].val);
+        }
+    } else if (MORPHO_ISLIST(v)) {
+        objectlist *list = MORPHO_GETLIST(v);
+        modulecache_writebyte(out, MODULECACHE_LIST);
+        modulecache_writeu32(out, list->val.count);
+        for (unsigned int i=0; i<list->val.count; i++) modulecache_writevalue(s, out, list->val.data[i]);
+    } else {
+        objecttuple *tuple = MORPHO_GETTUPLE(v);
+        modulecache_writebyte(out, MODULECACHE_TUPLE);
+        modulecache_writeu32(out, tuple->length);
+        for (unsigned int i=0; i<tuple->length; i++) modulecache_writevalue(s, out, tuple->tuple[i]);
+    }
+}
+
+/** Serializes a value */
+static void modulecache_writevalue(mcsave *s, varray_char *out, value v) {
+    if (MORPHO_ISNIL(v)) {
+        modulecache_writebyte(out, MODULECACHE_NIL);
+    } else if (MORPHO_ISBOOL(v)) {
+        modulecache_writebyte(out, (MORPHO_GETBOOLVALUE(v) ? MODULECACHE_TRUE : MODULECACHE_FALSE));
+    } else if (MORPHO_ISINTEGER(v)) {
+        modulecache_writebyte(out, MODULECACHE_INTEGER);
+        modulecache_writeint(out, MORPHO_GETINTEGERVALUE(v));
+    } else if (MORPHO_ISFLOAT(v)) {
+        modulecache_writebyte(out, MODULECACHE_FLOAT);
+        modulecache_writedouble(out, MORPHO_GETFLOATVALUE(v));
+    } else if (MORPHO_ISOBJECT(v)) {
+        int k = modulecache_ownindex(s, v);
+        if (k>=0) {
+            modulecache_writebyte(out, MODULECACHE_OWN);
+            modulecache_writeint(out, k);
+        } else if (MORPHO_GETOBJECT(v)==(object *) s->p->global) {
+            modulecache_writebyte(out, MODULECACHE_GLOBALFN);
+        } else if (MORPHO_ISSTRING(v)) {
+            modulecache_writebyte(out, (modulecache_issymbol(s->p, v) ? MODULECACHE_SYMBOL : MODULECACHE_STRING));
+            modulecache_writestring(out, v);
+        } else if (MORPHO_ISCOMPLEX(v)) {
+            MorphoComplex z = MORPHO_GETDOUBLECOMPLEX(v);
+            modulecache_writebyte(out, MODULECACHE_COMPLEX);
+            modulecache_writedouble(out, creal(z));
+            modulecache_writedouble(out, cimag(z));
+        } else if (MORPHO_ISLIST(v) || MORPHO_ISTUPLE(v) || MORPHO_ISDICTIONARY(v)) {
+            modulecache_writeliteral(s, out, v);
+#ifdef MORPHO_INCLUDE_LINALG
+        } else if (MORPHO_ISMATRIX(v)) {
+            objectmatrix *m = MORPHO_GETMATRIX(v);
+            modulecache_writebyte(out, MODULECACHE_MATRIX);
+            modulecache_writeu32(out, m->nrows);
+            modulecache_writeu32(out, m->ncols);
+            for (unsigned int i=0; i<m->nrows*m->ncols; i++) modulecache_writedouble(out, m->elements[i]);
+#endif
+        } else {
+            k = modulecache_external(s, v);
+            if (k>=0) {
+                modulecache_writebyte(out, MODULECACHE_EXTERNAL);
+                modulecache_writeint(out, k);
+            } else s->ok=false;
+        }
+    } else s->ok=false;
+}
+
+/** Serializes a list of values */
+static void modulecache_writevaluelist(mcsave *s, varray_char *out, int n, value *list) {
+    modulecache_writeu32(out, n);
+    for (int i=0; i<n; i++) modulecache_writevalue(s, out, list[i]);
+}
+
+/** Searches a dictionary for a given object, returning the key */
+static bool modulecache_findindictionary(dictionary *dict, value v, value *key) {
+    for (unsigned int i=0; i<dict->capacity; i++) {
+        if (MORPHO_ISSTRING(dict->contents[i].key) &&
+            MORPHO_ISSAME(dict->contents[i].val, v)) {
+            *key = dict->contents[i].key;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Adds an entry to the table of external references */
+static int modulecache_addexternal(mcsave *s, value v, varray_char *entry) {
+    modulecache_writebytes(&s->extout, entry->data, entry->count);
+    return varray_valuewrite(&s->ext, v);
+}
+
+/** Identifies a method of a class that isn't defined by the module */
+static int modulecache_externalmethod(mcsave *s, value v) {
+    for (int i=0; i<s->own.count; i++) {
+        if (!MORPHO_ISCLASS(s->own.data[i])) continue;
+        objectclass *klass = MORPHO_GETCLASS(s->own.data[i]);
+
+        // Methods may be inherited from any class in the linearization, or from the base class
+        for (int j=0; j<=klass->linearization.count; j++) {
+            value parent = (j<klass->linearization.count ? klass->linearization.data[j] : (klass->superclass ? MORPHO_OBJECT(klass->superclass) : MORPHO_NIL));
+            if (!MORPHO_ISCLASS(parent) || modulecache_ownindex(s, parent)>=0) continue;
+            dictionary *methods = &MORPHO_GETCLASS(parent)->methods;
+
+            for (unsigned int k=0; k<methods->capacity; k++) {
+                value key = methods->contents[k].key, method = methods->contents[k].val;
+                if (!MORPHO_ISSTRING(key)) continue;
+
+                int elindx=-1;
+                if (MORPHO_ISMETAFUNCTION(method)) {
+                    objectmetafunction *mf = MORPHO_GETMETAFUNCTION(method);
+                    for (int l=0; l<mf->fns.count; l++) if (MORPHO_ISSAME(mf->fns.data[l], v)) elindx=l;
+                }
+                if (!MORPHO_ISSAME(method, v) && elindx<0) continue;
+
+                int pindx = modulecache_external(s, parent);
+                if (pindx<0) return -1;
+
+                varray_char entry;
+                varray_charinit(&entry);
+                modulecache_writebyte(&entry, MODULECACHE_METHOD);
+                modulecache_writeint(&entry, pindx);
+                modulecache_writestring(&entry, key);
+                int out = modulecache_addexternal(s, method, &entry);
+
+                if (elindx>=0) {
+                    entry.count=0;
+                    modulecache_writebyte(&entry, MODULECACHE_ELEMENT);
+                    modulecache_writeint(&entry, out);
+                    modulecache_writeint(&entry, elindx);
+                    out = modulecache_addexternal(s, v, &entry);
+                }
+                varray_charclear(&entry);
+                return out;
+            }
+        }
+    }
+    return -1;
+}
+
+/** Identifies a class that isn't defined by the module through the linearization of a class that inherits from it */
+static int modulecache_externalancestor(mcsave *s, value v) {
+    for (int i=0; i<s->own.count; i++) {
+        if (!MORPHO_ISCLASS(s->own.data[i])) continue;
+        objectclass *klass = MORPHO_GETCLASS(s->own.data[i]);
+
+        for (int j=0; j<klass->linearization.count; j++) {
+            value child = klass->linearization.data[j];
+            if (!MORPHO_ISCLASS(child) || MORPHO_ISSAME(child, v) || modulecache_ownindex(s, child)>=0) continue;
+            varray_value *lin = &MORPHO_GETCLASS(child)->linearization;
+
+            for (int k=0; k<lin->count; k++) {
+                if (!MORPHO_ISSAME(lin->data[k], v)) continue;
+
+                int cindx = modulecache_external(s, child);
+                if (cindx<0) break;
+
+                varray_char entry;
+                varray_charinit(&entry);
+                modulecache_writebyte(&entry, MODULECACHE_LINEARIZATION);
+                modulecache_writeint(&entry, cindx);
+                modulecache_writeint(&entry, k);
+                int out = modulecache_addexternal(s, v, &entry);
+                varray_charclear(&entry);
+                return out;
+            }
+        }
+    }
+    return -1;
+}
+
+/** Identifies an object defined elsewhere, adding it to the table of external references */
+static int modulecache_external(mcsave *s, value v) {
+    for (int i=0; i<s->ext.count; i++) if (MORPHO_ISSAME(s->ext.data[i], v)) return i;
+
+    compiler *c = s->c;
+    value key=MORPHO_NIL;
+    int out=-1;
+    varray_char entry;
+    varray_charinit(&entry);
+
+    value fnname = (MORPHO_ISBUILTINFUNCTION(v) ? MORPHO_GETBUILTINFUNCTION(v)->name :
+                    (MORPHO_ISMETAFUNCTION(v) ? MORPHO_GETMETAFUNCTION(v)->name : MORPHO_NIL));
+
+    if (MORPHO_ISSTRING(fnname) &&
+        MORPHO_ISSAME(builtin_findfunction(fnname), v)) { // Builtin functions may be implemented by metafunctions
+        modulecache_writebyte(&entry, MODULECACHE_BUILTINFN);
+        modulecache_writestring(&entry, fnname);
+    } else if (MORPHO_ISCLASS(v) &&
+               MORPHO_ISSAME(builtin_findclass(MORPHO_GETCLASS(v)->name), v)) {
+        modulecache_writebyte(&entry, MODULECACHE_BUILTINCLASS);
+        modulecache_writestring(&entry, MORPHO_GETCLASS(v)->name);
+    } else if (modulecache_findindictionary(&c->classes, v, &key)) {
+        modulecache_writebyte(&entry, MODULECACHE_CLASS);
+        modulecache_writestring(&entry, key);
+    } else if (MORPHO_ISCLASS(v) && dictionary_get(&s->r->ancestors, MORPHO_GETCLASS(v)->name, NULL) &&
+               modulecache_findancestorclass(c, MORPHO_GETCLASS(v)->name)==MORPHO_GETCLASS(v)) {
+        modulecache_writebyte(&entry, MODULECACHE_ANCESTORCLASS);
+        modulecache_writestring(&entry, MORPHO_GETCLASS(v)->name);
+    } else {
+        for (namespc *spc=c->namespaces; spc!=NULL && !entry.count; spc=spc->next) {
+            if (!MORPHO_ISSTRING(spc->label)) continue;
+            if (modulecache_findindictionary(&spc->classes, v, &key)) {
+                modulecache_writebyte(&entry, MODULECACHE_NSCLASS);
+            } else if (modulecache_findindictionary(&spc->symbols, v, &key)) {
+                modulecache_writebyte(&entry, MODULECACHE_NSSYMBOL);
+            } else continue;
+            modulecache_writestring(&entry, spc->label);
+            modulecache_writestring(&entry, key);
+        }
+    }
+
+    if (!entry.count && MORPHO_ISFUNCTION(v)) {
+        varray_functionref *refs = &c->fstack[0].functionref;
+        value symbol = MORPHO_GETFUNCTION(v)->name;
+        int ordinal=0;
+        for (int i=0; i<refs->count; i++) {
+            functionref *ref = &refs->data[i];
+            if (!MORPHO_ISEQUAL(ref->symbol, symbol) ||
+                modulecache_ownindex(s, MORPHO_OBJECT(ref->function))>=0) continue;
+            if (ref->function==MORPHO_GETFUNCTION(v) && MORPHO_ISSTRING(symbol)) {
+                modulecache_writebyte(&entry, MODULECACHE_FUNCREF);
+                modulecache_writestring(&entry, symbol);
+                modulecache_writeint(&entry, ordinal);
+                break;
+            }
+            ordinal++;
+        }
+    }
+
+    if (entry.count) out=modulecache_addexternal(s, v, &entry);
+    else if (MORPHO_ISCLASS(v)) out=modulecache_externalancestor(s, v);
+    else out=modulecache_externalmethod(s, v);
+
+    varray_charclear(&entry);
+    return out;
+}
+
+/** Identifies a global referred to by the module, returning an index into the table of global references */
+static int modulecache_globalref(mcsave *s, int gindx) {
+    value out;
+    if (dictionary_get(&s->globalmap, MORPHO_INTEGER(gindx), &out)) return MORPHO_GETINTEGERVALUE(out);
+
+    value key=MORPHO_NIL, val=MORPHO_INTEGER(gindx);
+    int own=-1;
+    for (int i=0; i<s->globals.count; i++) if (s->globals.data[i]==gindx) own=i;
+
+    if (own>=0) {
+        modulecache_writebyte(&s->grefout, MODULECACHE_GLOBALOWN);
+        modulecache_writeint(&s->grefout, own);
+    } else if (modulecache_findindictionary(&s->c->globals, val, &key)) {
+        modulecache_writebyte(&s->grefout, MODULECACHE_GLOBALNAME);
+        modulecache_writestring(&s->grefout, key);
+    } else {
+        namespc *spc;
+        for (spc=s->c->namespaces; spc!=NULL; spc=spc->next) {
+            if (MORPHO_ISSTRING(spc->label) &&
+                modulecache_findindictionary(&spc->symbols, val, &key)) break;
+        }
+        if (!spc) { s->ok=false; return 0; }
+        modulecache_writebyte(&s->grefout, MODULECACHE_GLOBALNS);
+        modulecache_writestring(&s->grefout, spc->label);
+        modulecache_writestring(&s->grefout, key);
+    }
+
+    int indx = s->ngrefs++;
+    dictionary_insert(&s->globalmap, MORPHO_INTEGER(gindx), MORPHO_INTEGER(indx));
+    return indx;
+}
+
+/** Maps an index into a global table onto a list of entries used by the module */
+static int modulecache_mapindex(dictionary *map, varray_int *list, int indx) {
+    value out;
+    if (dictionary_get(map, MORPHO_INTEGER(indx), &out)) return MORPHO_GETINTEGERVALUE(out);
+    int k = varray_intwrite(list, indx);
+    dictionary_insert(map, MORPHO_INTEGER(indx), MORPHO_INTEGER(k));
+    return k;
+}
+
+/** Records an instruction operand that must be relocated */
+static void modulecache_addreloc(mcsave *s, int seg, int off, int type, int indx) {
+    modulecache_writeint(&s->relocout, seg);
+    modulecache_writeint(&s->relocout, off);
+    modulecache_writebyte(&s->relocout, type);
+    modulecache_writeint(&s->relocout, indx);
+    s->nrelocs++;
+}
+
+/** Converts an instruction index into a segment and offset */
+static void modulecache_writeposition(mcsave *s, varray_char *out, instructionindx i) {
+    int nseg = s->segcode.count/2;
+    for (int k=0; k<nseg; k++) {
+        int start=s->segcode.data[2*k], end=s->segcode.data[2*k+1];
+        if (i>=start && (i<end || (i==end && k==nseg-1) || (i==end && s->segcode.data[2*k+2]!=end))) {
+            modulecache_writeint(out, k);
+            modulecache_writeint(out, (int) (i-start));
+            return;
+        }
+    }
+    s->ok=false;
+}
+
+/** Tests whether a dictionary is an error handler rather than a constant created from a literal */
+static bool modulecache_ishandler(mcsave *s, value v) {
+    if (!MORPHO_ISDICTIONARY(v)) return false;
+    for (unsigned int i=0; i<s->p->annotations.count; i++) {
+        debugannotation *ann = &s->p->annotations.data[i];
+        if (ann->type==DEBUG_PUSHERR && (object *) ann->content.errorhandler.handler==MORPHO_GETOBJECT(v)) return true;
+    }
+    return false;
+}
+
+/** Collects the objects created by the module, excluding those created by imports */
+static void modulecache_collectobjects(mcsave *s) {
+    varray_mcdirective *dirs = &s->r->directives;
+    int di = dirs->count-1;
+    object *obj = s->p->boundlist;
+
+    varray_value bound;
+    varray_valueinit(&bound);
+
+    for (;;) {
+        while (di>=0 && obj==dirs->data[di].boundend) { obj=dirs->data[di].boundstart; di--; }
+        if (obj==s->r->boundstart) break;
+        if (!obj) { s->ok=false; break; }
+
+        value v = MORPHO_OBJECT(obj);
+        if (MORPHO_ISFUNCTION(v) || MORPHO_ISCLASS(v) ||
+            MORPHO_ISMETAFUNCTION(v) || modulecache_ishandler(s, v)) varray_valuewrite(&bound, v);
+        obj=obj->next;
+    }
+    if (di>=0) s->ok=false;
+
+    // The bound list is in reverse order of creation
+    for (int i=bound.count-1; i>=0; i--) varray_valuewrite(&s->own, bound.data[i]);
+    varray_valueclear(&bound);
+}
+
+/** Collects the globals created by the module, excluding those created by imports */
+static void modulecache_collectglobals(mcsave *s) {
+    varray_mcdirective *dirs = &s->r->directives;
+    int di=0;
+    for (int i=s->r->globalstart; i<s->p->globals.count; i++) {
+        while (di<dirs->count && i>=dirs->data[di].globalend) di++;
+        if (di<dirs->count && i>=dirs->data[di].globalstart) continue;
+        varray_intwrite(&s->globals, i);
+    }
+}
+
+/** Serializes the objects created by the module as shells; their contents are written separately */
+static void modulecache_writeshells(mcsave *s, varray_char *out) {
+    modulecache_writeu32(out, s->own.count);
+    for (int i=0; i<s->own.count; i++) {
+        value v = s->own.data[i], name=MORPHO_NIL;
+        if (MORPHO_ISFUNCTION(v)) {
+            modulecache_writebyte(out, MODULECACHE_OBJFUNCTION);
+            name = MORPHO_GETFUNCTION(v)->name;
+        } else if (MORPHO_ISCLASS(v)) {
+            modulecache_writebyte(out, MODULECACHE_OBJCLASS);
+            name = MORPHO_GETCLASS(v)->name;
+        } else if (MORPHO_ISMETAFUNCTION(v)) {
+            modulecache_writebyte(out, MODULECACHE_OBJMETAFUNCTION);
+            name = MORPHO_GETMETAFUNCTION(v)->name;
+        } else {
+            modulecache_writebyte(out, MODULECACHE_OBJDICTIONARY);
+        }
+        modulecache_writebyte(out, MORPHO_ISSTRING(name));
+        if (MORPHO_ISSTRING(name)) modulecache_writestring(out, name);
+    }
+}
+
+/** Serializes the annotations and code of a segment of the module */
+static void modulecache_writesegment(mcsave *s, varray_char *out, int seg) {
+    program *p = s->p;
+    int cstart=s->segcode.data[2*seg], cend=s->segcode.data[2*seg+1];
+    int astart=s->segann.data[2*seg], aend=s->segann.data[2*seg+1];
+
+    modulecache_writeu32(out, cend-cstart);
+    for (int i=cstart; i<cend; i++) modulecache_writeu32(out, p->code.data[i]);
+
+    modulecache_writeu32(out, aend-astart);
+    bool global=true; // Code at the start of a segment always belongs to the global function
+    int i=cstart;
+    for (int j=astart; j<aend; j++) {
+        debugannotation *ann = &p->annotations.data[j];
+        modulecache_writebyte(out, ann->type);
+        switch (ann->type) {
+            case DEBUG_FUNCTION: {
+                value fn = (ann->content.function.function ? MORPHO_OBJECT(ann->content.function.function) : MORPHO_NIL);
+                if (!MORPHO_ISNIL(fn) && modulecache_ownindex(s, fn)<0 && ann->content.function.function!=p->global) s->ok=false;
+                global = (MORPHO_ISNIL(fn) || ann->content.function.function==p->global);
+                modulecache_writevalue(s, out, fn);
+            }
+                break;
+            case DEBUG_CLASS: {
+                value klass = (ann->content.klass.klass ? MORPHO_OBJECT(ann->content.klass.klass) : MORPHO_NIL);
+                if (!MORPHO_ISNIL(klass) && modulecache_ownindex(s, klass)<0) s->ok=false;
+                modulecache_writevalue(s, out, klass);
+            }
+                break;
+            case DEBUG_PUSHERR: {
+                value dict = (ann->content.errorhandler.handler ? MORPHO_OBJECT(ann->content.errorhandler.handler) : MORPHO_NIL);
+                if (modulecache_ownindex(s, dict)<0) s->ok=false;
+                modulecache_writevalue(s, out, dict);
+            }
+                break;
+            case DEBUG_POPERR:
+                break;
+            case DEBUG_PUSHINLINE: {
+                value fn = MORPHO_OBJECT(ann->content.inlined.function);
+                if (modulecache_ownindex(s, fn)<0) s->ok=false;
+                modulecache_writevalue(s, out, fn);
+                modulecache_writeint(out, ann->content.inlined.line);
+                modulecache_writeint(out, ann->content.inlined.posn);
+            }
+                break;
+            case DEBUG_POPINLINE:
+                break;
+            case DEBUG_REGISTER:
+                if (!MORPHO_ISSTRING(ann->content.reg.symbol)) { s->ok=false; break; }
+                modulecache_writeint(out, (int) ann->content.reg.reg);
+                modulecache_writestring(out, ann->content.reg.symbol);
+                break;
+            case DEBUG_GLOBAL:
+                if (!MORPHO_ISSTRING(ann->content.global.symbol)) { s->ok=false; break; }
+                modulecache_writeint(out, modulecache_globalref(s, (int) ann->content.global.gindx));
+                modulecache_writestring(out, ann->content.global.symbol);
+                break;
+            case DEBUG_ELEMENT: {
+                int n = ann->content.element.ninstr;
+                modulecache_writeint(out, n);
+                modulecache_writeint(out, ann->content.element.line);
+                modulecache_writeint(out, ann->content.element.posn);
+
+                if (n<0 || i+n>cend) { s->ok=false; break; }
+                for (int k=i; k<i+n; k++) {
+                    instruction instr = p->code.data[k];
+                    int op = DECODE_OP(instr);
+                    switch (op) {
+                        case OP_B: case OP_BIF: case OP_BIFF: case OP_POPERR: {
+                            int target = k+1+DECODE_sBx(instr);
+                            if (target<cstart || target>cend) s->ok=false;
+                        }
+                            break;
+                        case OP_LGL: case OP_SGL:
+                            modulecache_addreloc(s, seg, k-cstart, MODULECACHE_RELOCGLOBAL, modulecache_globalref(s, DECODE_Bx(instr)));
+                            break;
+                        case OP_LCT: case OP_CLONE: case OP_PUSHERR:
+                            if (global) modulecache_addreloc(s, seg, k-cstart, MODULECACHE_RELOCKONST, modulecache_mapindex(&s->konstmap, &s->konst, DECODE_Bx(instr)));
+                            break;
+                        case OP_CLOSURE:
+                            if (global) modulecache_addreloc(s, seg, k-cstart, MODULECACHE_RELOCPROTO, modulecache_mapindex(&s->protomap, &s->protos, DECODE_B(instr)));
+                            break;
+                        default: break;
+                    }
+                }
+                i+=n;
+            }
+                break;
+            default: // Includes DEBUG_MODULE, which is only generated by imports
+                s->ok=false;
+        }
+        if (!s->ok) return;
+    }
+
+    if (i!=cend) s->ok=false; // Every instruction must be annotated
+}
+
+/** Serializes the contents of a function */
+static void modulecache_writefunction(mcsave *s, varray_char *out, objectfunction *func) {
+    modulecache_writeint(out, func->nargs);
+    modulecache_writeint(out, func->nopt);
+    modulecache_writeint(out, func->varg);
+    modulecache_writeposition(s, out, func->entry);
+    modulecache_writeint(out, func->creg);
+    modulecache_writevalue(s, out, (func->parent ? MORPHO_OBJECT(func->parent) : MORPHO_NIL));
+    modulecache_writeint(out, func->nregs);
+    modulecache_writevalue(s, out, (func->klass ? MORPHO_OBJECT(func->klass) : MORPHO_NIL));
+    modulecache_writevaluelist(s, out, func->konst.count, func->konst.data);
+
+    modulecache_writeu32(out, func->prototype.count);
+    for (int i=0; i<func->prototype.count; i++) {
+        varray_upvalue *proto = &func->prototype.data[i];
+        modulecache_writeu32(out, proto->count);
+        for (int j=0; j<proto->count; j++) {
+            modulecache_writebyte(out, proto->data[j].islocal);
+            modulecache_writeint(out, (int) proto->data[j].reg);
+        }
+    }
+
+    modulecache_writeu32(out, func->opt.count);
+    for (int i=0; i<func->opt.count; i++) {
+        modulecache_writevalue(s, out, func->opt.data[i].symbol);
+        modulecache_writeint(out, (int) func->opt.data[i].def);
+        modulecache_writeint(out, (int) func->opt.data[i].reg);
+    }
+
+    modulecache_writevaluelist(s, out, func->sig.types.count, func->sig.types.data);
+    modulecache_writevalue(s, out, func->sig.ret);
+    modulecache_writebyte(out, func->sig.varg);
+}
+
+/** Serializes the contents of a class */
+static void modulecache_writeclass(mcsave *s, varray_char *out, objectclass *klass) {
+    modulecache_writevalue(s, out, (klass->superclass ? MORPHO_OBJECT(klass->superclass) : MORPHO_NIL));
+    modulecache_writevaluelist(s, out, klass->parents.count, klass->parents.data);
+    modulecache_writevaluelist(s, out, klass->linearization.count, klass->linearization.data);
+
+    modulecache_writeu32(out, klass->methods.count);
+    for (unsigned int i=0; i<klass->methods.capacity; i++) {
+        value key = klass->methods.contents[i].key;
+        if (MORPHO_ISNIL(key)) continue;
+        modulecache_writevalue(s, out, key);
+        modulecache_writevalue(s, out, klass->methods.contents[i].val);
+    }
+}
+
+/** Serializes the contents of a metafunction */
+static void modulecache_writemetafunction(mcsave *s, varray_char *out, objectmetafunction *mf) {
+    modulecache_writevalue(s, out, (mf->klass ? MORPHO_OBJECT(mf->klass) : MORPHO_NIL));
+    modulecache_writevaluelist(s, out, mf->fns.count, mf->fns.data);
+    modulecache_writebyte(out, mf->resolver.count>0);
+}
+
+/** Serializes the contents of an error handler dictionary */
+static void modulecache_writehandler(mcsave *s, varray_char *out, objectdictionary *dict) {
+    modulecache_writeu32(out, dict->dict.count);
+    for (unsigned int i=0; i<dict->dict.capacity; i++) {
+        value key = dict->dict.contents[i].key, val = dict->dict.contents[i].val;
+        if (MORPHO_ISNIL(key)) continue;
+        if (!MORPHO_ISINTEGER(val)) { s->ok=false; return; }
+        modulecache_writevalue(s, out, key);
+        modulecache_writeposition(s, out, MORPHO_GETINTEGERVALUE(val));
+    }
+}
+
+/** Serializes the symbols the module makes available to the compiler that imports it */
+static void modulecache_writeexports(mcsave *s, varray_char *out) {
+    compiler *c = s->c;
+
+    modulecache_writeu32(out, c->globals.count);
+    for (unsigned int i=0; i<c->globals.capacity; i++) {
+        value key = c->globals.contents[i].key, val = c->globals.contents[i].val;
+        if (MORPHO_ISNIL(key)) continue;
+        if (!MORPHO_ISSTRING(key) || !MORPHO_ISINTEGER(val)) { s->ok=false; return; }
+        modulecache_writestring(out, key);
+        modulecache_writeint(out, modulecache_globalref(s, MORPHO_GETINTEGERVALUE(val)));
+    }
+
+    modulecache_writeu32(out, c->classes.count);
+    for (unsigned int i=0; i<c->classes.capacity; i++) {
+        value key = c->classes.contents[i].key;
+        if (MORPHO_ISNIL(key)) continue;
+        if (!MORPHO_ISSTRING(key)) { s->ok=false; return; }
+        modulecache_writestring(out, key);
+        modulecache_writevalue(s, out, c->classes.contents[i].val);
+    }
+
+    varray_functionref *refs = &c->fstack[0].functionref;
+    modulecache_writeu32(out, refs->count);
+    for (int i=0; i<refs->count; i++) {
+        modulecache_writevalue(s, out, MORPHO_OBJECT(refs->data[i].function));
+        modulecache_writeint(out, refs->data[i].scopedepth);
+    }
+}
+
+/** Serializes a recorded module */
+static bool modulecache_serialize(compiler *c, varray_char *out) {
+    program *p = c->out;
+    modulerecord *r = c->record;
+    mcsave s = { .c=c, .p=p, .r=r, .ok=true, .ngrefs=0, .nrelocs=0 };
+
+    varray_valueinit(&s.own);
+    varray_valueinit(&s.ext);
+    varray_charinit(&s.extout);
+    varray_intinit(&s.globals);
+    dictionary_init(&s.globalmap);
+    varray_charinit(&s.grefout);
+    dictionary_init(&s.konstmap);
+    varray_intinit(&s.konst);
+    dictionary_init(&s.protomap);
+    varray_intinit(&s.protos);
+    varray_charinit(&s.relocout);
+    varray_intinit(&s.segcode);
+    varray_intinit(&s.segann);
+
+    varray_char ancestors, shells, prog, globals, konst, protos, bodies, exports;
+    varray_char *sections[] = { &ancestors, &shells, &prog, &globals, &konst, &protos, &bodies, &exports };
+    int nsections = sizeof(sections)/sizeof(varray_char *);
+    for (int i=0; i<nsections; i++) varray_charinit(sections[i]);
+
+    // Divide the code into segments separated by imports
+    varray_mcdirective *dirs = &r->directives;
+    int cstart=r->codestart, astart=r->annstart;
+    for (int i=0; i<dirs->count; i++) {
+        mcdirective *d = &dirs->data[i];
+        if (!d->closed || d->codestart<cstart || d->annstart<astart) s.ok=false;
+        varray_intwrite(&s.segcode, cstart); varray_intwrite(&s.segcode, (int) d->codestart);
+        varray_intwrite(&s.segann, astart); varray_intwrite(&s.segann, d->annstart);
+        cstart=(int) d->codeend; astart=d->annend;
+    }
+    if (p->code.count<cstart || p->annotations.count<astart) s.ok=false;
+    varray_intwrite(&s.segcode, cstart); varray_intwrite(&s.segcode, p->code.count);
+    varray_intwrite(&s.segann, astart); varray_intwrite(&s.segann, p->annotations.count);
+
+    if (s.ok) modulecache_collectobjects(&s);
+    modulecache_collectglobals(&s);
+    if (s.ok) modulecache_writeshells(&s, &shells);
+
+    // Program: segments of code interleaved with imports
+    modulecache_writeu32(&prog, dirs->count);
+    for (int i=0; i<=dirs->count && s.ok; i++) {
+        if (i>0) {
+            mcdirective *d = &dirs->data[i-1];
+            modulecache_writebyte(&prog, d->issymbol);
+            if (!MORPHO_ISSTRING(d->module)) { s.ok=false; break; }
+            modulecache_writestring(&prog, d->module);
+            modulecache_writebyte(&prog, MORPHO_ISSTRING(d->label));
+            if (MORPHO_ISSTRING(d->label)) modulecache_writestring(&prog, d->label);
+            modulecache_writeu32(&prog, d->fornames.count);
+            for (int j=0; j<d->fornames.count; j++) modulecache_writestring(&prog, d->fornames.data[j]);
+        }
+        modulecache_writesegment(&s, &prog, i);
+    }
+
+    // Contents of objects
+    for (int i=0; i<s.own.count && s.ok; i++) {
+        value v = s.own.data[i];
+        if (MORPHO_ISFUNCTION(v)) modulecache_writefunction(&s, &bodies, MORPHO_GETFUNCTION(v));
+        else if (MORPHO_ISCLASS(v)) modulecache_writeclass(&s, &bodies, MORPHO_GETCLASS(v));
+        else if (MORPHO_ISMETAFUNCTION(v)) modulecache_writemetafunction(&s, &bodies, MORPHO_GETMETAFUNCTION(v));
+        else modulecache_writehandler(&s, &bodies, MORPHO_GETDICTIONARY(v));
+    }
+
+    if (s.ok) modulecache_writeexports(&s, &exports);
+
+    // Classes found in compilers that import the module must have been defined by one of its dependencies
+    modulecache_writeu32(&ancestors, r->ancestors.count);
+    for (unsigned int i=0; i<r->ancestors.capacity && s.ok; i++) {
+        value key = r->ancestors.contents[i].key;
+        if (!MORPHO_ISSTRING(key)) continue;
+        objectclass *klass = modulecache_findancestorclass(c, key);
+        value module = (klass ? modulecache_classmodule(p, klass) : MORPHO_NIL);
+
+        bool found=false;
+        for (int j=0; j<r->deps.count && !found; j++) found=MORPHO_ISEQUAL(r->deps.data[j].fname, module);
+        if (!found) { s.ok=false; break; }
+
+        modulecache_writestring(&ancestors, key);
+        modulecache_writestring(&ancestors, module);
+    }
+
+    // Globals created by the module
+    modulecache_writeu32(&globals, s.globals.count);
+    for (int i=0; i<s.globals.count && s.ok; i++) {
+        globalinfo *info = &p->globals.data[s.globals.data[i]];
+        if (!MORPHO_ISSTRING(info->symbol)) { s.ok=false; break; }
+        modulecache_writestring(&globals, info->symbol);
+        modulecache_writevalue(&s, &globals, info->type);
+    }
+
+    // Entries in the global constant table; these may add further external references
+    modulecache_writeu32(&konst, s.konst.count);
+    for (int i=0; i<s.konst.count && s.ok; i++) {
+        int k = s.konst.data[i];
+        if (k<0 || k>=p->global->konst.count) { s.ok=false; break; }
+        modulecache_writevalue(&s, &konst, p->global->konst.data[k]);
+    }
+
+    modulecache_writeu32(&protos, s.protos.count);
+    for (int i=0; i<s.protos.count && s.ok; i++) {
+        int k = s.protos.data[i];
+        if (k<0 || k>=p->global->prototype.count) { s.ok=false; break; }
+        varray_upvalue *proto = &p->global->prototype.data[k];
+        modulecache_writeu32(&protos, proto->count);
+        for (int j=0; j<proto->count; j++) {
+            modulecache_writebyte(&protos, proto->data[j].islocal);
+            modulecache_writeint(&protos, (int) proto->data[j].reg);
+        }
+    }
+
+    if (s.ok) {
+        // Header
+        modulecache_writebytes(out, MODULECACHE_MAGIC, strlen(MODULECACHE_MAGIC));
+        modulecache_writeu32(out, MODULECACHE_FORMATVERSION);
+        modulecache_writecstring(out, MORPHO_VERSIONSTRING, strlen(MORPHO_VERSIONSTRING));
+        modulecache_writeu64(out, r->hash);
+        modulecache_writeu64(out, r->length);
+
+        // Dependencies
+        modulecache_writeu32(out, r->deps.count);
+        for (int i=0; i<r->deps.count; i++) {
+            mcdependency *dep = &r->deps.data[i];
+            if (MORPHO_ISSTRING(dep->name)) modulecache_writestring(out, dep->name);
+            else modulecache_writecstring(out, "", 0);
+            modulecache_writestring(out, dep->fname);
+            modulecache_writeu64(out, dep->hash);
+            modulecache_writebyte(out, dep->preexisting);
+        }
+
+        // Symbols that weren't found
+        modulecache_writeu32(out, r->lookups.count);
+        for (unsigned int i=0; i<r->lookups.capacity; i++) {
+            value key = r->lookups.contents[i].key;
+            if (!MORPHO_ISSTRING(key)) continue;
+            modulecache_writeint(out, MORPHO_GETINTEGERVALUE(r->lookups.contents[i].val));
+            modulecache_writestring(out, key);
+        }
+        modulecache_writebytes(out, ancestors.data, ancestors.count);
+
+        modulecache_writeu32(out, s.ext.count);
+        modulecache_writebytes(out, s.extout.data, s.extout.count);
+        modulecache_writebytes(out, shells.data, shells.count);
+        modulecache_writebytes(out, prog.data, prog.count);
+        modulecache_writebytes(out, globals.data, globals.count);
+        modulecache_writeu32(out, s.ngrefs);
+        modulecache_writebytes(out, s.grefout.data, s.grefout.count);
+        modulecache_writebytes(out, konst.data, konst.count);
+        modulecache_writebytes(out, protos.data, protos.count);
+        modulecache_writeu32(out, s.nrelocs);
+        modulecache_writebytes(out, s.relocout.data, s.relocout.count);
+        modulecache_writebytes(out, bodies.data, bodies.count);
+        modulecache_writebytes(out, exports.data, exports.count);
+        modulecache_writeint(out, p->global->nregs);
+
+        // Trailer
+        modulecache_writeu64(out, modulecache_hash(MODULECACHE_FNVOFFSET, out->data, out->count));
+    }
+
+    for (int i=0; i<nsections; i++) varray_charclear(sections[i]);
+    varray_valueclear(&s.own);
+    varray_valueclear(&s.ext);
+    varray_charclear(&s.extout);
+    varray_intclear(&s.globals);
+    dictionary_clear(&s.globalmap);
+    varray_charclear(&s.grefout);
+    dictionary_clear(&s.konstmap);
+    varray_intclear(&s.konst);
+    dictionary_clear(&s.protomap);
+    varray_intclear(&s.protos);
+    varray_charclear(&s.relocout);
+    varray_intclear(&s.segcode);
+    varray_intclear(&s.segann);
+
+    return s.ok;
+}
+
+/** Writes data to a cache file, using a temporary file so that the cache file appears atomically */
+static void modulecache_write(uint64_t key, varray_char *data) {
+    varray_char path, tmp;
+    varray_charinit(&path);
+    varray_charinit(&tmp);
+
+    if (modulecache_path(key, true, &path)) {
+        unsigned char rnd[8];
+        uint64_t suffix=0;
+        if (platform_randombytes((char *) rnd, sizeof(rnd))) memcpy(&suffix, rnd, sizeof(rnd));
+
+        char ext[32];
+        snprintf(ext, sizeof(ext), ".%016llx", (unsigned long long) suffix);
+        varray_charadd(&tmp, path.data, path.count-1);
+        varray_charadd(&tmp, ext, (int) strlen(ext)+1);
+
+        FILE *f = fopen(tmp.data, "wb");
+        if (f) {
+            bool success = (fwrite(data->data, sizeof(char), data->count, f)==(size_t) data->count);
+            success &= (fclose(f)==0);
+            if (!success || rename(tmp.data, path.data)!=0) remove(tmp.data);
+        }
+    }
+
+    varray_charclear(&path);
+    varray_charclear(&tmp);
+}
+
+/** Called once a module has been compiled; registers its dependencies and, if possible, writes it to the cache
+ * @param[in] c        the compiler that compiled the module
+ * @param[in] success  whether compilation succeeded */
+void modulecache_save(compiler *c, bool success) {
+    modulerecord *r = c->record;
+    if (!r) return;
+
+    varray_mcdependency closure;
+    varray_mcdependencyinit(&closure);
+    mcdependency self = { .name=r->name, .fname=c->currentmodule, .hash=r->hash };
+    varray_mcdependencywrite(&closure, self);
+    varray_mcdependencyadd(&closure, r->deps.data, r->deps.count);
+    if (MORPHO_ISSTRING(c->currentmodule)) modulecache_register(c, c->currentmodule, r->complete, &closure);
+    varray_mcdependencyclear(&closure);
+
+    if (success && r->valid && ERROR_SUCCEEDED(c->err)) {
+        varray_char data;
+        varray_charinit(&data);
+        if (modulecache_serialize(c, &data)) modulecache_write(modulecache_key(r->hash), &data);
+        varray_charclear(&data);
+    }
+}
+
+/* **********************************************************************
+ * Loading a module
+ * ********************************************************************** */
+
+/** State used while loading a module */
+typedef struct {
+    compiler *c;
+    program *p;
+    mcreader in;
+    size_t externals; /** Position of the references to objects defined elsewhere */
+
+    varray_value own; /** Objects created by the module */
+    varray_value ext; /** Objects defined elsewhere */
+    varray_int globals; /** Globals created by the module */
+    varray_int grefs; /** Globals referred to by the module */
+    varray_int konst; /** Entries in the global constant table */
+    varray_int protos; /** Upvalue prototypes of the global function */
+    varray_int segcode; /** Start and length of each segment of code */
+    varray_int segann; /** Start and length of each segment's annotations */
+} mcload;
+
+/** Reads a string and creates a static string object that refers to it */
+#define MODULECACHE_READSTATICSTRING(in, name) \
+    size_t name##len=0; \
+    char *name##str = modulecache_readcstring(in, &name##len); \
+    objectstring name = MORPHO_STATICSTRINGWITHLENGTH((name##str ? name##str : ""), name##len);
+
+static value modulecache_readliteral(mcload *l, int tag);
+
+/** Reads a value */
+static value modulecache_readvalue(mcload *l) {
+    mcreader *in = &l->in;
+    value out=MORPHO_NIL;
+    int tag = modulecache_readbyte(in);
+
+    switch (tag) {
+        case MODULECACHE_NIL: break;
+        case MODULECACHE_TRUE: out=MORPHO_TRUE; break;
+        case MODULECACHE_FALSE: out=MORPHO_FALSE; break;
+        case MODULECACHE_INTEGER: out=MORPHO_INTEGER(modulecache_readint(in)); break;
+        case MODULECACHE_FLOAT: out=MORPHO_FLOAT(modulecache_readdouble(in)); break;
+        case MODULECACHE_STRING: {
+            size_t len;
+            char *str = modulecache_readcstring(in, &len);
+            if (!str) break;
+            out=object_stringfromcstring(str, len);
+            if (MORPHO_ISOBJECT(out)) program_bindobject(l->p, MORPHO_GETOBJECT(out));
+            else in->ok=false;
+        }
+            break;
+        case MODULECACHE_SYMBOL: {
+            MODULECACHE_READSTATICSTRING(in, symbol);
+            if (in->ok) out=program_internsymbol(l->p, MORPHO_OBJECT(&symbol));
+        }
+            break;
+        case MODULECACHE_COMPLEX: {
+            double re = modulecache_readdouble(in);
+            double im = modulecache_readdouble(in);
+            objectcomplex *z = object_newcomplex(re, im);
+            if (z) {
+                program_bindobject(l->p, (object *) z);
+                out=MORPHO_OBJECT(z);
+            } else in->ok=false;
+        }
+            break;
+        case MODULECACHE_OWN: {
+            int k = modulecache_readint(in);
+            if (k>=0 && k<l->own.count) out=l->own.data[k];
+            else in->ok=false;
+        }
+            break;
+        case MODULECACHE_EXTERNAL: {
+            int k = modulecache_readint(in);
+            if (k>=0 && k<l->ext.count) out=l->ext.data[k];
+            else in->ok=false;
+        }
+            break;
+        case MODULECACHE_GLOBALFN:
+            out=MORPHO_OBJECT(l->p->global);
+            break;
+        case MODULECACHE_LIST:
+        case MODULECACHE_TUPLE:
+        case MODULECACHE_DICTIONARY:
+            out=modulecache_readliteral(l, tag);
+            break;
+#ifdef MORPHO_INCLUDE_LINALG
+        case MODULECACHE_MATRIX: {
+            unsigned int nrows = modulecache_readu32(in), ncols = modulecache_readu32(in);
+            if ((uint64_t) nrows*ncols*sizeof(double)>in->length-in->posn) { in->ok=false; break; }
+            objectmatrix *m = object_newmatrix(nrows, ncols, false);
+            if (!m) { in->ok=false; break; }
+            for (unsigned int i=0; i<nrows*ncols; i++) m->elements[i]=modulecache_readdouble(in);
+            program_bindobject(l->p, (object *) m);
+            out=MORPHO_OBJECT(m);
+        }
+            break;
+#endif
+        default:
+            in->ok=false;
+    }
+
+    return out;
+}
+
+/** Reads a constant list, tuple or dictionary created from a literal */
+static value modulecache_readliteral(mcload *l, int tag) {
+    mcreader *in = &l->in;
+    unsigned int n = modulecache_readcount(in);
+    object *new=NULL;
+
+    varray_value val;
+    varray_valueinit(&val);
+    for (unsigned int i=0; i<(tag==MODULECACHE_DICTIONARY ? 2*n : n) && in->ok; i++) {
+        value v = modulecache_readvalue(l);
+        varray_valuewrite(&val, v);
+    }
+
+    if (in->ok) {
+        if (tag==MODULECACHE_LIST) {
+            new=(object *) object_newlist(val.count, val.data);
+        } else if (tag==MODULECACHE_TUPLE) {
+            new=(object *) object_newtuple(val.count, val.data);
+        } else {
+            objectdictionary *dict = object_newdictionary();
+            for (unsigned int i=0; dict && i<val.count; i+=2) dictionary_insert(&dict->dict, val.data[i], val.data[i+1]);
+            new=(object *) dict;
+        }
+    }
+    varray_valueclear(&val);
+
+    if (!new) { in->ok=false; return MORPHO_NIL; }
+    program_bindobject(l->p, new);
+    return MORPHO_OBJECT(new);
+}
+
+/** Reads a value that must be an object of a given kind, or nil */
+static object *modulecache_readobject(mcload *l, objecttype type) {
+    value v = modulecache_readvalue(l);
+    if (MORPHO_ISNIL(v)) return NULL;
+    if (!MORPHO_ISOBJECT(v) || MORPHO_GETOBJECTTYPE(v)!=type) { l->in.ok=false; return NULL; }
+    return MORPHO_GETOBJECT(v);
+}
+
+/** Reads a list of values into a varray */
+static void modulecache_readvaluelist(mcload *l, varray_value *out) {
+    unsigned int n = modulecache_readcount(&l->in);
+    for (unsigned int i=0; i<n && l->in.ok; i++) {
+        value v = modulecache_readvalue(l);
+        varray_valuewrite(out, v);
+    }
+}
+
+/** Reads an instruction position, converting it to an absolute index */
+static instructionindx modulecache_readposition(mcload *l) {
+    int seg = modulecache_readint(&l->in);
+    int off = modulecache_readint(&l->in);
+    if (seg<0 || 2*seg>=l->segcode.count || off<0 || off>l->segcode.data[2*seg+1]) { l->in.ok=false; return 0; }
+    return l->segcode.data[2*seg]+off;
+}
+
+/** Reads an upvalue prototype */
+static void modulecache_readprototype(mcload *l, varray_upvalue *proto) {
+    unsigned int n = modulecache_readcount(&l->in);
+    for (unsigned int i=0; i<n && l->in.ok; i++) {
+        upvalue up;
+        up.islocal=modulecache_readbyte(&l->in);
+        up.reg=modulecache_readint(&l->in);
+        varray_upvaluewrite(proto, up);
+    }
+}
+
+/** Checks the header and trailer of a cache file */
+static bool modulecache_checkfile(mcreader *in, uint64_t hash, size_t length) {
+    if (in->length<sizeof(uint64_t)) return false;
+
+    mcreader trailer = { .data=in->data, .length=in->length, .posn=in->length-sizeof(uint64_t), .ok=true };
+    if (modulecache_readu64(&trailer)!=modulecache_hash(MODULECACHE_FNVOFFSET, in->data, in->length-sizeof(uint64_t))) return false;
+    in->length-=sizeof(uint64_t);
+
+    char magic[sizeof(MODULECACHE_MAGIC)];
+    modulecache_readbytes(in, magic, strlen(MODULECACHE_MAGIC));
+    if (!in->ok || strncmp(magic, MODULECACHE_MAGIC, strlen(MODULECACHE_MAGIC))!=0) return false;
+    if (modulecache_readu32(in)!=MODULECACHE_FORMATVERSION) return false;
+
+    char *version = modulecache_readcstring(in, NULL);
+    if (!version || strcmp(version, MORPHO_VERSIONSTRING)!=0) return false;
+
+    return (modulecache_readu64(in)==hash &&
+            modulecache_readu64(in)==length && in->ok);
+}
+
+/** Checks that a dependency is unchanged */
+static bool modulecache_checkdependency(compiler *c, char *name, char *fname, size_t flen, uint64_t hash) {
+    if (name && *name) { // Check the module name still refers to the same file
+        varray_char found;
+        varray_charinit(&found);
+        bool success = (compiler_findmodule(name, &found) && strcmp(found.data, fname)==0);
+        varray_charclear(&found);
+        if (!success) return false;
+    }
+
+    objectstring fstr = MORPHO_STATICSTRINGWITHLENGTH(fname, flen);
+    uint64_t current;
+    if (modulecache_registeredhash(c, MORPHO_OBJECT(&fstr), &current)) return current==hash;
+
+    bool success=false;
+    FILE *f = file_openrelative(fname, "r");
+    if (f) {
+        varray_char src;
+        varray_charinit(&src);
+        if (file_readintovarray(f, &src)) {
+            success=(modulecache_sourcehash(src.data, strlen(src.data))==hash);
+        }
+        varray_charclear(&src);
+        fclose(f);
+    }
+    return success;
+}
+
+/** Checks that the module can be loaded into the current context, before any changes are made to the program */
+static bool modulecache_checkcontext(compiler *c, mcload *l, varray_mcdependency *deps) {
+    mcreader *in = &l->in;
+    compiler *root = modulecache_root(c);
+
+    // Dependencies must be unchanged and imported in the same order
+    unsigned int ndeps = modulecache_readcount(in);
+    for (unsigned int i=0; i<ndeps && in->ok; i++) {
+        size_t nlen, flen;
+        char *name = modulecache_readcstring(in, &nlen);
+        char *fname = modulecache_readcstring(in, &flen);
+        uint64_t hash = modulecache_readu64(in);
+        bool preexisting = modulecache_readbyte(in);
+        if (!in->ok) return false;
+
+        objectstring fstr = MORPHO_STATICSTRINGWITHLENGTH(fname, flen);
+        if (dictionary_get(&root->modules, MORPHO_OBJECT(&fstr), NULL)!=preexisting) return false;
+        if (!modulecache_checkdependency(c, name, fname, flen, hash)) return false;
+
+        mcdependency dep = { .name = (nlen>0 ? object_stringfromcstring(name, nlen) : MORPHO_NIL),
+                             .fname = object_stringfromcstring(fname, flen), .hash=hash };
+        varray_mcdependencywrite(deps, dep);
+    }
+
+    // Symbols that weren't found when the module was compiled must still not be found
+    unsigned int nlookups = modulecache_readcount(in);
+    for (unsigned int i=0; i<nlookups && in->ok; i++) {
+        int mask = modulecache_readint(in);
+        MODULECACHE_READSTATICSTRING(in, symbol);
+        if (!in->ok) return false;
+
+        if ((mask & MODULECACHE_LOOKUPMASK(MODULECACHE_LOOKUPGLOBAL)) &&
+            compiler_findglobal(c, MORPHO_OBJECT(&symbol), true)!=GLOBAL_UNALLOCATED) return false;
+        if ((mask & MODULECACHE_LOOKUPMASK(MODULECACHE_LOOKUPCLASS)) &&
+            compiler_findclass(c, MORPHO_OBJECT(&symbol))) return false;
+    }
+
+    // Classes found in compilers that import the module must be defined by the same modules as before
+    unsigned int nancestors = modulecache_readcount(in);
+    for (unsigned int i=0; i<nancestors && in->ok; i++) {
+        MODULECACHE_READSTATICSTRING(in, symbol);
+        MODULECACHE_READSTATICSTRING(in, module);
+        if (!in->ok) return false;
+
+        objectclass *klass = compiler_findclass(c, MORPHO_OBJECT(&symbol));
+        if (!klass || !MORPHO_ISEQUAL(modulecache_classmodule(l->p, klass), MORPHO_OBJECT(&module))) return false;
+    }
+
+    // Builtin functions and classes must still exist
+    size_t start = in->posn;
+    unsigned int next = modulecache_readcount(in);
+    for (unsigned int i=0; i<next && in->ok; i++) {
+        int tag = modulecache_readbyte(in);
+        switch (tag) {
+            case MODULECACHE_BUILTINFN: case MODULECACHE_BUILTINCLASS: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                value v = (tag==MODULECACHE_BUILTINFN ? builtin_findfunction(MORPHO_OBJECT(&name)) : builtin_findclass(MORPHO_OBJECT(&name)));
+                if (MORPHO_ISNIL(v)) return false;
+            }
+                break;
+            case MODULECACHE_CLASS: case MODULECACHE_ANCESTORCLASS:
+            case MODULECACHE_FUNCREF:
+                modulecache_readcstring(in, NULL);
+                if (tag==MODULECACHE_FUNCREF) modulecache_readint(in);
+                break;
+            case MODULECACHE_NSCLASS: case MODULECACHE_NSSYMBOL:
+                modulecache_readcstring(in, NULL);
+                modulecache_readcstring(in, NULL);
+                break;
+            case MODULECACHE_METHOD:
+                modulecache_readint(in);
+                modulecache_readcstring(in, NULL);
+                break;
+            case MODULECACHE_ELEMENT: case MODULECACHE_LINEARIZATION:
+                modulecache_readint(in);
+                modulecache_readint(in);
+                break;
+            default: in->ok=false;
+        }
+    }
+    l->externals=start;
+
+    return in->ok;
+}
+
+/** Resolves references to objects defined elsewhere */
+static bool modulecache_readexternals(mcload *l) {
+    mcreader *in = &l->in;
+    compiler *c = l->c;
+
+    unsigned int n = modulecache_readcount(in);
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        value out=MORPHO_NIL;
+        int tag = modulecache_readbyte(in);
+
+        switch (tag) {
+            case MODULECACHE_BUILTINFN: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                out=builtin_findfunction(MORPHO_OBJECT(&name));
+            }
+                break;
+            case MODULECACHE_BUILTINCLASS: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                out=builtin_findclass(MORPHO_OBJECT(&name));
+            }
+                break;
+            case MODULECACHE_CLASS: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                dictionary_get(&c->classes, MORPHO_OBJECT(&name), &out);
+            }
+                break;
+            case MODULECACHE_ANCESTORCLASS: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                objectclass *klass = compiler_findclass(c, MORPHO_OBJECT(&name));
+                if (klass) out=MORPHO_OBJECT(klass);
+            }
+                break;
+            case MODULECACHE_NSCLASS: case MODULECACHE_NSSYMBOL: {
+                MODULECACHE_READSTATICSTRING(in, label);
+                MODULECACHE_READSTATICSTRING(in, name);
+                namespc *spc = compiler_isnamespace(c, MORPHO_OBJECT(&label));
+                if (spc) dictionary_get((tag==MODULECACHE_NSCLASS ? &spc->classes : &spc->symbols), MORPHO_OBJECT(&name), &out);
+            }
+                break;
+            case MODULECACHE_FUNCREF: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                int ordinal = modulecache_readint(in);
+                varray_functionref *refs = &c->fstack[0].functionref;
+                for (int j=0; j<refs->count; j++) {
+                    if (!MORPHO_ISEQUAL(refs->data[j].symbol, MORPHO_OBJECT(&name))) continue;
+                    if (ordinal==0) { out=MORPHO_OBJECT(refs->data[j].function); break; }
+                    ordinal--;
+                }
+            }
+                break;
+            case MODULECACHE_METHOD: {
+                int k = modulecache_readint(in);
+                MODULECACHE_READSTATICSTRING(in, name);
+                if (k>=0 && k<l->ext.count && MORPHO_ISCLASS(l->ext.data[k])) {
+                    dictionary_get(&MORPHO_GETCLASS(l->ext.data[k])->methods, MORPHO_OBJECT(&name), &out);
+                }
+            }
+                break;
+            case MODULECACHE_LINEARIZATION: {
+                int k = modulecache_readint(in);
+                int indx = modulecache_readint(in);
+                if (k>=0 && k<l->ext.count && MORPHO_ISCLASS(l->ext.data[k])) {
+                    varray_value *lin = &MORPHO_GETCLASS(l->ext.data[k])->linearization;
+                    if (indx>=0 && indx<lin->count) out=lin->data[indx];
+                }
+            }
+                break;
+            case MODULECACHE_ELEMENT: {
+                int k = modulecache_readint(in);
+                int indx = modulecache_readint(in);
+                if (k>=0 && k<l->ext.count && MORPHO_ISMETAFUNCTION(l->ext.data[k])) {
+                    objectmetafunction *mf = MORPHO_GETMETAFUNCTION(l->ext.data[k]);
+                    if (indx>=0 && indx<mf->fns.count) out=mf->fns.data[indx];
+                }
+            }
+                break;
+            default: in->ok=false;
+        }
+
+        if (!MORPHO_ISOBJECT(out)) in->ok=false;
+        varray_valuewrite(&l->ext, out);
+    }
+
+    return in->ok;
+}
+
+/** Creates the objects defined by the module; their contents are filled in later */
+static bool modulecache_readshells(mcload *l) {
+    mcreader *in = &l->in;
+    unsigned int n = modulecache_readcount(in);
+
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        int type = modulecache_readbyte(in);
+        bool hasname = modulecache_readbyte(in);
+        value name = MORPHO_NIL;
+        objectstring str;
+        if (hasname) {
+            size_t len;
+            char *cstr = modulecache_readcstring(in, &len);
+            if (!cstr) break;
+            str = (objectstring) MORPHO_STATICSTRINGWITHLENGTH(cstr, len);
+            name = MORPHO_OBJECT(&str);
+        }
+
+        object *obj=NULL;
+        switch (type) {
+            case MODULECACHE_OBJFUNCTION: obj=(object *) object_newfunction(0, name, NULL, 0); break;
+            case MODULECACHE_OBJCLASS: obj=(object *) object_newclass(name); break;
+            case MODULECACHE_OBJMETAFUNCTION: obj=(object *) object_newmetafunction(name); break;
+            case MODULECACHE_OBJDICTIONARY: obj=(object *) object_newdictionary(); break;
+            default: break;
+        }
+        if (!obj) { in->ok=false; break; }
+
+        program_bindobject(l->p, obj);
+        varray_valuewrite(&l->own, MORPHO_OBJECT(obj));
+    }
+
+    return in->ok;
+}
+
+/** Reads a segment of code and its annotations, appending them to the program */
+static bool modulecache_readsegment(mcload *l) {
+    mcreader *in = &l->in;
+    program *p = l->p;
+
+    unsigned int ncode = modulecache_readcount(in);
+    varray_intwrite(&l->segcode, p->code.count);
+    varray_intwrite(&l->segcode, ncode);
+    for (unsigned int i=0; i<ncode && in->ok; i++) {
+        instruction instr = modulecache_readu32(in);
+        varray_instructionwrite(&p->code, instr);
+    }
+
+    unsigned int nann = modulecache_readcount(in);
+    varray_intwrite(&l->segann, p->annotations.count);
+    varray_intwrite(&l->segann, nann);
+    for (unsigned int i=0; i<nann && in->ok; i++) {
+        debugannotation ann = { .type = modulecache_readbyte(in) };
+        switch (ann.type) {
+            case DEBUG_FUNCTION:
+                ann.content.function.function=(objectfunction *) modulecache_readobject(l, OBJECT_FUNCTION);
+                break;
+            case DEBUG_CLASS:
+                ann.content.klass.klass=(objectclass *) modulecache_readobject(l, OBJECT_CLASS);
+                break;
+            case DEBUG_PUSHERR:
+                ann.content.errorhandler.handler=(objectdictionary *) modulecache_readobject(l, OBJECT_DICTIONARY);
+                break;
+            case DEBUG_POPERR:
+                break;
+            case DEBUG_PUSHINLINE:
+                ann.content.inlined.function=(objectfunction *) modulecache_readobject(l, OBJECT_FUNCTION);
+                ann.content.inlined.line=modulecache_readint(in);
+                ann.content.inlined.posn=modulecache_readint(in);
+                break;
+            case DEBUG_POPINLINE:
+                break;
+            case DEBUG_REGISTER:
+            case DEBUG_GLOBAL: {
+                int indx = modulecache_readint(in);
+                size_t len;
+                char *symbol = modulecache_readcstring(in, &len);
+                if (!symbol) break;
+                value sym = object_stringfromcstring(symbol, len);
+                if (ann.type==DEBUG_REGISTER) {
+                    ann.content.reg.reg=indx;
+                    ann.content.reg.symbol=sym;
+                } else {
+                    ann.content.global.gindx=indx; // Refers to the table of global references until relocated
+                    ann.content.global.symbol=sym;
+                }
+            }
+                break;
+            case DEBUG_ELEMENT:
+                ann.content.element.ninstr=modulecache_readint(in);
+                ann.content.element.line=modulecache_readint(in);
+                ann.content.element.posn=modulecache_readint(in);
+                break;
+            default:
+                in->ok=false;
+        }
+        if (in->ok) debugannotation_add(&p->annotations, &ann);
+    }
+
+    return in->ok;
+}
+
+/** Replays an import statement made by the module */
+static bool modulecache_readdirective(mcload *l, syntaxtreenode *node) {
+    mcreader *in = &l->in;
+    compiler *c = l->c;
+
+    bool issymbol = modulecache_readbyte(in);
+    size_t len;
+    char *module = modulecache_readcstring(in, &len);
+    value label = MORPHO_NIL;
+    if (modulecache_readbyte(in)) {
+        MODULECACHE_READSTATICSTRING(in, lbl);
+        if (in->ok) label=program_internsymbol(l->p, MORPHO_OBJECT(&lbl));
+    }
+
+    dictionary fordict;
+    dictionary_init(&fordict);
+    unsigned int nfor = modulecache_readcount(in);
+    for (unsigned int i=0; i<nfor && in->ok; i++) {
+        size_t flen;
+        char *name = modulecache_readcstring(in, &flen);
+        if (name) dictionary_insert(&fordict, object_stringfromcstring(name, flen), MORPHO_NIL);
+    }
+
+    if (in->ok && module) {
+        value mod = object_stringfromcstring(module, len);
+        compiler_importmodule(c, node, mod, issymbol, label, &fordict);
+        morpho_freeobject(mod);
+    }
+
+    dictionary_freecontents(&fordict, true, false);
+    dictionary_clear(&fordict);
+
+    return in->ok && ERROR_SUCCEEDED(c->err);
+}
+
+/** Allocates the globals created by the module */
+static bool modulecache_readglobals(mcload *l) {
+    mcreader *in = &l->in;
+    unsigned int n = modulecache_readcount(in);
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        MODULECACHE_READSTATICSTRING(in, symbol);
+        value type = modulecache_readvalue(l);
+        if (!in->ok) break;
+        globalindx g = program_addglobal(l->p, MORPHO_OBJECT(&symbol));
+        program_globalsettype(l->p, g, type);
+        varray_intwrite(&l->globals, g);
+    }
+    return in->ok;
+}
+
+/** Resolves references to globals */
+static bool modulecache_readglobalrefs(mcload *l) {
+    mcreader *in = &l->in;
+    compiler *c = l->c;
+    unsigned int n = modulecache_readcount(in);
+
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        value indx = MORPHO_NIL;
+        switch (modulecache_readbyte(in)) {
+            case MODULECACHE_GLOBALOWN: {
+                int k = modulecache_readint(in);
+                if (k>=0 && k<l->globals.count) indx=MORPHO_INTEGER(l->globals.data[k]);
+            }
+                break;
+            case MODULECACHE_GLOBALNAME: {
+                MODULECACHE_READSTATICSTRING(in, name);
+                dictionary_get(&c->globals, MORPHO_OBJECT(&name), &indx);
+            }
+                break;
+            case MODULECACHE_GLOBALNS: {
+                MODULECACHE_READSTATICSTRING(in, label);
+                MODULECACHE_READSTATICSTRING(in, name);
+                namespc *spc = compiler_isnamespace(c, MORPHO_OBJECT(&label));
+                if (spc) dictionary_get(&spc->symbols, MORPHO_OBJECT(&name), &indx);
+            }
+                break;
+            default: break;
+        }
+        if (!MORPHO_ISINTEGER(indx)) { in->ok=false; break; }
+        varray_intwrite(&l->grefs, MORPHO_GETINTEGERVALUE(indx));
+    }
+
+    return in->ok;
+}
+
+/** Checks whether two constants are identical */
+static bool modulecache_isidenticalconstant(value a, value b) {
+    if (MORPHO_ISSTRING(a) && MORPHO_ISSTRING(b)) {
+        return (MORPHO_GETSTRINGLENGTH(a)==MORPHO_GETSTRINGLENGTH(b) &&
+                memcmp(MORPHO_GETCSTRING(a), MORPHO_GETCSTRING(b), MORPHO_GETSTRINGLENGTH(a))==0);
+    }
+    if (MORPHO_ISCOMPLEX(a) && MORPHO_ISCOMPLEX(b)) {
+        return MCSame(MORPHO_GETDOUBLECOMPLEX(a), MORPHO_GETDOUBLECOMPLEX(b));
+    }
+    return MORPHO_ISSAME(a, b);
+}
+
+/** Finds or adds the module's constants in the global constant table */
+static bool modulecache_readconstants(mcload *l) {
+    mcreader *in = &l->in;
+    varray_value *konst = &l->p->global->konst;
+    unsigned int n = modulecache_readcount(in);
+
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        value v = modulecache_readvalue(l);
+        if (!in->ok) break;
+
+        bool symbol = MORPHO_ISSTRING(v) && modulecache_issymbol(l->p, v);
+        int k;
+        for (k=0; k<konst->count; k++) {
+            value w = konst->data[k];
+            if (symbol ? MORPHO_ISSAME(v, w) : modulecache_isidenticalconstant(v, w)) break;
+        }
+        if (k==konst->count) {
+            if (konst->count>=MORPHO_MAXCONSTANTS) { in->ok=false; break; }
+            varray_valuewrite(konst, v);
+        }
+        varray_intwrite(&l->konst, k);
+    }
+
+    return in->ok;
+}
+
+/** Adds upvalue prototypes to the global function */
+static bool modulecache_readprototypes(mcload *l) {
+    mcreader *in = &l->in;
+    unsigned int n = modulecache_readcount(in);
+
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        varray_upvalue proto;
+        varray_upvalueinit(&proto);
+        modulecache_readprototype(l, &proto);
+        indx ix=0;
+        if (in->ok && !object_functionaddprototype(l->p->global, &proto, &ix)) in->ok=false;
+        varray_upvalueclear(&proto);
+        varray_intwrite(&l->protos, (int) ix);
+    }
+
+    return in->ok;
+}
+
+/** Patches instruction operands that refer to global tables */
+static bool modulecache_readrelocations(mcload *l) {
+    mcreader *in = &l->in;
+    program *p = l->p;
+    unsigned int n = modulecache_readcount(in);
+
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        int seg = modulecache_readint(in);
+        int off = modulecache_readint(in);
+        int type = modulecache_readbyte(in);
+        int k = modulecache_readint(in);
+        if (!in->ok || seg<0 || 2*seg>=l->segcode.count || off<0 || off>=l->segcode.data[2*seg+1]) { in->ok=false; break; }
+
+        instruction *instr = &p->code.data[l->segcode.data[2*seg]+off];
+        int indx=-1, max=0xffff;
+        switch (type) {
+            case MODULECACHE_RELOCKONST: if (k>=0 && k<l->konst.count) indx=l->konst.data[k]; break;
+            case MODULECACHE_RELOCGLOBAL: if (k>=0 && k<l->grefs.count) indx=l->grefs.data[k]; break;
+            case MODULECACHE_RELOCPROTO: if (k>=0 && k<l->protos.count) indx=l->protos.data[k]; max=0xff; break;
+            default: break;
+        }
+        if (indx<0 || indx>max) { in->ok=false; break; }
+
+        if (type==MODULECACHE_RELOCPROTO) *instr = (*instr & ~((instruction) MASK_B)) | ((instruction) indx << 16);
+        else *instr = (*instr & 0xffff) | ((instruction) indx << 16);
+    }
+
+    // Relocate annotations that refer to globals
+    for (int seg=0; 2*seg<l->segann.count && in->ok; seg++) {
+        for (int j=0; j<l->segann.data[2*seg+1]; j++) {
+            debugannotation *ann = &p->annotations.data[l->segann.data[2*seg]+j];
+            if (ann->type!=DEBUG_GLOBAL) continue;
+            indx k = ann->content.global.gindx;
+            if (k<0 || k>=l->grefs.count) { in->ok=false; break; }
+            ann->content.global.gindx=l->grefs.data[k];
+        }
+    }
+
+    return in->ok;
+}
+
+/** Fills in the contents of a function */
+static void modulecache_readfunction(mcload *l, objectfunction *func) {
+    mcreader *in = &l->in;
+    func->nargs=modulecache_readint(in);
+    func->nopt=modulecache_readint(in);
+    func->varg=modulecache_readint(in);
+    func->entry=modulecache_readposition(l);
+    func->creg=modulecache_readint(in);
+    func->parent=(objectfunction *) modulecache_readobject(l, OBJECT_FUNCTION);
+    func->nregs=modulecache_readint(in);
+    func->klass=(objectclass *) modulecache_readobject(l, OBJECT_CLASS);
+    modulecache_readvaluelist(l, &func->konst);
+
+    unsigned int nproto = modulecache_readcount(in);
+    for (unsigned int i=0; i<nproto && in->ok; i++) {
+        varray_upvalue proto;
+        varray_upvalueinit(&proto);
+        modulecache_readprototype(l, &proto);
+        object_functionaddprototype(func, &proto, NULL);
+        varray_upvalueclear(&proto);
+    }
+
+    unsigned int nopt = modulecache_readcount(in);
+    for (unsigned int i=0; i<nopt && in->ok; i++) {
+        optionalparam param;
+        param.symbol=modulecache_readvalue(l);
+        param.def=modulecache_readint(in);
+        param.reg=modulecache_readint(in);
+        varray_optionalparamwrite(&func->opt, param);
+    }
+
+    modulecache_readvaluelist(l, &func->sig.types);
+    func->sig.ret=modulecache_readvalue(l);
+    func->sig.varg=modulecache_readbyte(in);
+}
+
+/** Fills in the contents of a class */
+static void modulecache_readclass(mcload *l, objectclass *klass) {
+    mcreader *in = &l->in;
+    klass->superclass=(objectclass *) modulecache_readobject(l, OBJECT_CLASS);
+
+    modulecache_readvaluelist(l, &klass->parents);
+    for (int i=0; i<klass->parents.count && in->ok; i++) {
+        if (!MORPHO_ISCLASS(klass->parents.data[i])) { in->ok=false; break; }
+        varray_valuewrite(&MORPHO_GETCLASS(klass->parents.data[i])->children, MORPHO_OBJECT(klass));
+    }
+
+    modulecache_readvaluelist(l, &klass->linearization);
+
+    unsigned int n = modulecache_readcount(in);
+    for (unsigned int i=0; i<n && in->ok; i++) {
+        value key = modulecache_readvalue(l);
+        value method = modulecache_readvalue(l);
+        if (in->ok) dictionary_insert(&klass->methods, key, method);
+    }
+
+    klass->uid=program_addclass(l->p, MORPHO_OBJECT(klass));
+}
+
+/** Fills in the contents of a metafunction */
+static void modulecache_readmetafunction(mcload *l, objectmetafunction *mf, varray_value *compile) {
+    mf->klass=(objectclass *) modulecache_readobject(l, OBJECT_CLASS);
+    modulecache_readvaluelist(l, &mf->fns);
+    if (modulecache_readbyte(&l->in)) varray_valuewrite(compile, MORPHO_OBJECT(mf));
+}
+
+/** Fills in the contents of an error handler dictionary */
+static void modulecache_readhandler(mcload *l, objectdictionary *dict) {
+    unsigned int n = modulecache_readcount(&l->in);
+    for (unsigned int i=0; i<n && l->in.ok; i++) {
+        value key = modulecache_readvalue(l);
+        instructionindx indx = modulecache_readposition(l);
+        if (l->in.ok) dictionary_insert(&dict->dict, key, MORPHO_INTEGER((int) indx));
+    }
+}
+
+/** Fills in the contents of the objects created by the module */
+static bool modulecache_readbodies(mcload *l) {
+    varray_value compile;
+    varray_valueinit(&compile);
+
+    for (int i=0; i<l->own.count && l->in.ok; i++) {
+        value v = l->own.data[i];
+        if (MORPHO_ISFUNCTION(v)) modulecache_readfunction(l, MORPHO_GETFUNCTION(v));
+        else if (MORPHO_ISCLASS(v)) modulecache_readclass(l, MORPHO_GETCLASS(v));
+        else if (MORPHO_ISMETAFUNCTION(v)) modulecache_readmetafunction(l, MORPHO_GETMETAFUNCTION(v), &compile);
+        else modulecache_readhandler(l, MORPHO_GETDICTIONARY(v));
+    }
+
+    // Metafunctions are compiled once all classes are complete
+    for (int i=0; i<compile.count && l->in.ok; i++) {
+        if (!metafunction_compile(MORPHO_GETMETAFUNCTION(compile.data[i]), &l->c->err)) l->in.ok=false;
+    }
+
+    varray_valueclear(&compile);
+    return l->in.ok;
+}
+
+/** Rebuilds the symbol tables that the module makes available to the compiler that imports it */
+static bool modulecache_readexports(mcload *l) {
+    mcreader *in = &l->in;
+    compiler *c = l->c;
+
+    unsigned int nglobals = modulecache_readcount(in);
+    for (unsigned int i=0; i<nglobals && in->ok; i++) {
+        MODULECACHE_READSTATICSTRING(in, name);
+        int k = modulecache_readint(in);
+        if (!in->ok || k<0 || k>=l->grefs.count) { in->ok=false; break; }
+        value key = program_internsymbol(l->p, MORPHO_OBJECT(&name));
+        dictionary_insert(&c->globals, key, MORPHO_INTEGER(l->grefs.data[k]));
+    }
+
+    unsigned int nclasses = modulecache_readcount(in);
+    for (unsigned int i=0; i<nclasses && in->ok; i++) {
+        MODULECACHE_READSTATICSTRING(in, name);
+        value klass = modulecache_readvalue(l);
+        if (!in->ok || !MORPHO_ISCLASS(klass)) { in->ok=false; break; }
+
+        value prev=MORPHO_NIL;
+        if (dictionary_get(&c->classes, MORPHO_OBJECT(&name), &prev) && MORPHO_ISSAME(prev, klass)) continue;
+
+        if (MORPHO_ISEQUAL(MORPHO_GETCLASS(klass)->name, MORPHO_OBJECT(&name))) {
+            dictionary_insert(&c->classes, MORPHO_GETCLASS(klass)->name, klass);
+        } else in->ok=false;
+    }
+
+    varray_functionref *refs = &c->fstack[0].functionref;
+    refs->count=0;
+    unsigned int nrefs = modulecache_readcount(in);
+    for (unsigned int i=0; i<nrefs && in->ok; i++) {
+        objectfunction *func = (objectfunction *) modulecache_readobject(l, OBJECT_FUNCTION);
+        int scopedepth = modulecache_readint(in);
+        if (!func) { in->ok=false; break; }
+        functionref ref = { .function = func, .symbol = func->name, .scopedepth = scopedepth };
+        varray_functionrefwrite(refs, ref);
+    }
+
+    int nregs = modulecache_readint(in);
+    if (nregs>l->p->global->nregs) l->p->global->nregs=nregs;
+
+    return in->ok;
+}
+
+/** Loads a module from the cache file, once the context has been checked */
+static bool modulecache_loadmodule(mcload *l, syntaxtreenode *node) {
+    mcreader *in = &l->in;
+    if (!modulecache_readshells(l)) return false;
+
+    // Replay the code and import statements in order
+    instructionindx entry = l->p->code.count;
+    unsigned int ndirectives = modulecache_readcount(in);
+    if (!modulecache_readsegment(l)) return false;
+    for (unsigned int i=0; i<ndirectives; i++) {
+        if (!modulecache_readdirective(l, node) ||
+            !modulecache_readsegment(l)) return false;
+    }
+    size_t end = in->posn;
+
+    // References to objects defined elsewhere can only be resolved once the imports have been replayed
+    in->posn=l->externals;
+    if (!modulecache_readexternals(l)) return false;
+    in->posn=end;
+
+    return (modulecache_readglobals(l) &&
+            modulecache_readglobalrefs(l) &&
+            modulecache_readconstants(l) &&
+            modulecache_readprototypes(l) &&
+            modulecache_readrelocations(l) &&
+            modulecache_readbodies(l) &&
+            modulecache_readexports(l) &&
+            (program_setentry(l->p, entry), true));
+}
+
+/** Reads a file into memory */
+static bool modulecache_readfile(const char *path, varray_char *out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+
+    bool success=false;
+    if (fseek(f, 0, SEEK_END)==0) {
+        long size = ftell(f);
+        if (size>0 && size<INT_MAX && fseek(f, 0, SEEK_SET)==0 &&
+            varray_charresize(out, (int) size)) {
+            out->count=(int) fread(out->data, sizeof(char), size, f);
+            success=(out->count==size);
+        }
+    }
+    fclose(f);
+
+    return success;
+}
+
+/** Attempts to load a module from the cache
+ * @param[in]  c      compiler, set up to compile the module
+ * @param[in]  node   syntax tree node of the import statement, used for error reporting
+ * @param[in]  src    source of the module
+ * @param[in]  name   module name, if imported by name, or nil
+ * @param[out] err    error block
+ * @returns true if the module was handled, i.e. it was either loaded or loading failed with an error;
+ *          false if the module should be compiled from source */
+bool modulecache_load(compiler *c, syntaxtreenode *node, char *src, value name, error *err) {
+    size_t length = strlen(src);
+    uint64_t hash = modulecache_sourcehash(src, length);
+    bool handled=false;
+
+    varray_char path, data;
+    varray_charinit(&path);
+    varray_charinit(&data);
+
+    if (!modulecache_path(modulecache_key(hash), false, &path) ||
+        !modulecache_readfile(path.data, &data)) goto modulecache_load_cleanup;
+
+    mcload l = { .c=c, .p=c->out };
+    l.in = (mcreader) { .data=(unsigned char *) data.data, .length=data.count, .posn=0, .ok=true };
+    varray_valueinit(&l.own);
+    varray_valueinit(&l.ext);
+    varray_intinit(&l.globals);
+    varray_intinit(&l.grefs);
+    varray_intinit(&l.konst);
+    varray_intinit(&l.protos);
+    varray_intinit(&l.segcode);
+    varray_intinit(&l.segann);
+
+    varray_mcdependency deps;
+    varray_mcdependencyinit(&deps);
+
+    if (modulecache_checkfile(&l.in, hash, length) &&
+        modulecache_checkcontext(c, &l, &deps)) {
+        handled=true;
+
+        if (modulecache_loadmodule(&l, node)) {
+            varray_mcdependency closure;
+            varray_mcdependencyinit(&closure);
+            mcdependency self = { .name=name, .fname=c->currentmodule, .hash=hash };
+            varray_mcdependencywrite(&closure, self);
+            varray_mcdependencyadd(&closure, deps.data, deps.count);
+            if (MORPHO_ISSTRING(c->currentmodule)) modulecache_register(c, c->currentmodule, true, &closure);
+            varray_mcdependencyclear(&closure);
+        } else if (!ERROR_SUCCEEDED(c->err)) {
+            *err = c->err;
+        } else {
+            morpho_writeerrorwithid(err, COMPILE_IMPORTFLD, NULL, (node ? node->line : ERROR_POSNUNIDENTIFIABLE), (node ? node->posn : ERROR_POSNUNIDENTIFIABLE), (MORPHO_ISSTRING(c->currentmodule) ? MORPHO_GETCSTRING(c->currentmodule) : ""));
+            remove(path.data); // The cache file is unusable, so ensure the module is recompiled next time
+        }
+    }
+
+    modulecache_cleardependencies(&deps);
+    varray_valueclear(&l.own);
+    varray_valueclear(&l.ext);
+    varray_intclear(&l.globals);
+    varray_intclear(&l.grefs);
+    varray_intclear(&l.konst);
+    varray_intclear(&l.protos);
+    varray_intclear(&l.segcode);
+    varray_intclear(&l.segann);
+
+modulecache_load_cleanup:
+    varray_charclear(&path);
+    varray_charclear(&data);
+
+    return handled;
+}
+
+#else
+
+/* **********************************************************************
+ * Module cache disabled
+ * ********************************************************************** */
+
+void modulecache_lookup(compiler *c, compiler *found, modulecachelookup type, value symbol) {}
+void modulecache_begindirective(compiler *c, value module, bool issymbol, value label, dictionary *fordict) {}
+void modulecache_enddirective(compiler *c, value fname) {}
+bool modulecache_load(compiler *c, syntaxtreenode *node, char *src, value name, error *err) { return false; }
+void modulecache_record(compiler *c, char *src, value name) {}
+void modulecache_save(compiler *c, bool success) {}
+void modulecache_clearrecord(compiler *c) {}
+
+#endif
@@ -0,0 +1,45 @@
+/** @file modulecache.h
+ *  @author T J Atherton
+ *
+ *  @brief Caches compiled modules so that later imports can skip the compiler
+*/
+
+#ifndef modulecache_h
+#define modulecache_h
+
+#include "compile.h"
+
+/* **********************************************************************
+ * Module cache file format
+ * ********************************************************************** */
+
+/** @brief Identifies a module cache file */
+#define MODULECACHE_MAGIC "MORPHOBC"
+
+/** @brief Version of the cache file format; increment whenever the format or the code generated by the compiler changes */
+#define MODULECACHE_FORMATVERSION 3
+
+/* **********************************************************************
+ * Recording
+ * ********************************************************************** */
+
+/** @brief Kinds of symbol lookup that can escape from a module into the compiler that imports it */
+typedef enum {
+    MODULECACHE_LOOKUPGLOBAL,
+    MODULECACHE_LOOKUPCLASS
+} modulecachelookup;
+
+/* **********************************************************************
+ * Interface
+ * ********************************************************************** */
+
+void modulecache_lookup(compiler *c, compiler *found, modulecachelookup type, value symbol);
+void modulecache_begindirective(compiler *c, value module, bool issymbol, value label, dictionary *fordict);
+void modulecache_enddirective(compiler *c, value fname);
+
+bool modulecache_load(compiler *c, syntaxtreenode *node, char *src, value name, error *err);
+void modulecache_record(compiler *c, char *src, value name);
+void modulecache_save(compiler *c, bool success);
+void modulecache_clearrecord(compiler *c);
+
+#endif /* modulecache_h */
@@ -15,6 +15,9 @@ OPCODE(MOV)
 /** Moves a constant into a register */
 OPCODE(LCT)
 
+/** Copies a constant list, dictionary or matrix into a register */
+OPCODE(CLONE)
+
 /** Add the contents of two registers */
 OPCODE(ADD)
 
@@ -42,6 +45,21 @@ OPCODE(LT)
 /** Comparison test */
 OPCODE(LE)
 
+/** Arithmetic and comparison specialised to floats; other operands are handled as for the general instruction */
+OPCODE(ADDF)
+OPCODE(SUBF)
+OPCODE(MULF)
+OPCODE(DIVF)
+OPCODE(LTF)
+OPCODE(LEF)
+
+/** Arithmetic and comparison specialised to integers; other operands are handled as for the general instruction */
+OPCODE(ADDI)
+OPCODE(SUBI)
+OPCODE(MULI)
+OPCODE(LTI)
+OPCODE(LEI)
+
 /** Logical NOT of a register */
 OPCODE(NOT)
 
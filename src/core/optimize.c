@@ -0,0 +1,2101 @@
+/** @file optimize.c
+ *  @author T J Atherton
+ *
+ *  @brief Optimizer for compiled morpho bytecode
+ *
+ *  @details The optimizer works on the code generated by the most recent call to
+ *  morpho_compile, i.e. from the program entry point to the end of the program,
+ *  so that it can be called repeatedly on the same program (e.g. from the REPL).
+ *  Each sweep performs the following passes:
+ *  1. Jump threading: branches to unconditional branches are retargeted and
+ *     branches to the following instruction are removed.
+ *  2. Constant folding and propagation, together with copy propagation, within
+ *     each basic block. Conditional branches on known values are resolved.
+ *  3. Dead store and redundant move elimination using register liveness.
+ *  4. Removal of unreachable code.
+ *  Instructions are deleted by replacing them with NOP; a final compaction pass
+ *  then removes these and fixes branch offsets, function entry points, error
+ *  handler tables and debug annotations.
+ *
+ *  Once the sweeps have converged, calls to small functions, and methods invoked
+ *  on objects whose class is known, are replaced by the body of the function
+ *  called, which runs in the caller's register frame; the sweeps are then repeated
+ *  to clean up the result. Inlined code is attributed to the line of the call.
+ *
+ *  Finally, loads of globals, upvalues and properties that cannot change within a
+ *  loop are moved ahead of the loop into new registers. Loops that may call other
+ *  code only keep loads of variables and properties that no function assigns.
+ *  Since loading a property can fail, these are only hoisted if they would be
+ *  executed on the first iteration; the test at the start of a loop is copied
+ *  ahead of the hoisted loads where necessary.
+ *
+ *  Registers captured as upvalues are never tracked, and liveness based passes
+ *  are skipped for functions that contain error handlers or breakpoints.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "optimize.h"
+#include "morpho.h"
+#include "classes.h"
+
+/** Statistics from the last run of the optimizer */
+static optimizerstatistics optimize_stats;
+
+/* **********************************************************************
+ * Register sets
+ * ********************************************************************** */
+
+#define OPTIMIZE_NREGISTERS 256
+#define OPTIMIZE_REGSETWORDS (OPTIMIZE_NREGISTERS/64)
+
+/** A set of registers */
+typedef struct {
+    uint64_t bits[OPTIMIZE_REGSETWORDS];
+} regset;
+
+static inline void regset_clear(regset *s) {
+    for (int i=0; i<OPTIMIZE_REGSETWORDS; i++) s->bits[i]=0;
+}
+
+static inline void regset_fill(regset *s) {
+    for (int i=0; i<OPTIMIZE_REGSETWORDS; i++) s->bits[i]=~((uint64_t) 0);
+}
+
+static inline void regset_add(regset *s, int r) {
+    if (r>=0 && r<OPTIMIZE_NREGISTERS) s->bits[r/64] |= ((uint64_t) 1) << (r%64);
+}
+
+static inline void regset_addrange(regset *s, int r0, int r1) {
+    for (int r=r0; r<=r1 && r<OPTIMIZE_NREGISTERS; r++) regset_add(s, r);
+}
+
+static inline void regset_remove(regset *s, int r) {
+    if (r>=0 && r<OPTIMIZE_NREGISTERS) s->bits[r/64] &= ~(((uint64_t) 1) << (r%64));
+}
+
+static inline bool regset_contains(regset *s, int r) {
+    if (r<0 || r>=OPTIMIZE_NREGISTERS) return false;
+    return (s->bits[r/64] >> (r%64)) & 1;
+}
+
+static inline void regset_union(regset *dest, regset *src) {
+    for (int i=0; i<OPTIMIZE_REGSETWORDS; i++) dest->bits[i] |= src->bits[i];
+}
+
+static inline bool regset_equal(regset *a, regset *b) {
+    for (int i=0; i<OPTIMIZE_REGSETWORDS; i++) if (a->bits[i]!=b->bits[i]) return false;
+    return true;
+}
+
+/* **********************************************************************
+ * Optimizer state
+ * ********************************************************************** */
+
+/** Information about each function whose code is being optimized */
+typedef struct {
+    objectfunction *func;
+    regset captured; /** Registers captured as upvalues by closures */
+    bool haserrorhandler; /** Function contains a PUSHERR instruction */
+    bool hasbreakpoint; /** Function contains a BREAK instruction */
+    int first; /** Offset of this function's instructions in the order list */
+    int count; /** Number of instructions belonging to the function */
+} optimizefunction;
+
+/** @brief What is known about the registers within the current basic block.
+ *  Entries are only valid if stamped with the current block number, so that resetting at a block boundary is cheap. */
+typedef struct {
+    int konst[OPTIMIZE_NREGISTERS]; /** Constant table index of the value held by each register, or -1 */
+    int copy[OPTIMIZE_NREGISTERS]; /** Register that each register is a copy of, or -1 */
+    unsigned int stamp[OPTIMIZE_NREGISTERS]; /** Block in which each register's entries were last written */
+    unsigned int block; /** Current block number */
+    int copies[OPTIMIZE_NREGISTERS]; /** Registers that may hold a copy */
+    int ncopies;
+} blockstate;
+
+/** Initializes a blockstate */
+static void blockstate_init(blockstate *s) {
+    for (int r=0; r<OPTIMIZE_NREGISTERS; r++) s->stamp[r]=0;
+    s->block=0;
+    s->ncopies=0;
+}
+
+/** State of the optimizer */
+typedef struct {
+    program *prog;
+    instructionindx start; /** First instruction to optimize */
+    instructionindx end; /** One past the last instruction to optimize */
+
+    optimizefunction *functions; /** Functions with code in the range */
+    int nfunctions;
+
+    varray_value handlers; /** Error handler dictionaries referenced by the code */
+
+    int *fid; /** Function that owns each instruction */
+    int *order; /** Instructions grouped by function and in ascending order */
+    bool *leader; /** Whether an instruction begins a basic block */
+    bool *reached; /** Whether an instruction is reachable */
+    int *stack; /** Worklist used to find reachable instructions */
+    regset *livein; /** Registers live on entry to each instruction */
+    regset *liveout; /** Registers live on exit from each instruction */
+    instructionindx *map; /** Map from old to new instruction indices used in compaction */
+    blockstate state; /** Register contents tracked during constant propagation */
+    bool persistglobal; /** Whether registers in the global frame are treated as live at END */
+} optimizer;
+
+/** Gets the instruction at index i */
+#define OPTIMIZE_CODE(o, i) ((o)->prog->code.data[(i)])
+
+/** Converts an instruction index into an offset into the per-instruction arrays */
+#define OPTIMIZE_OFFSET(o, i) ((i)-(o)->start)
+
+/** Tests whether an instruction index lies in the range being optimized */
+#define OPTIMIZE_INRANGE(o, i) ((i)>=(o)->start && (i)<(o)->end)
+
+/* **********************************************************************
+ * Instruction utility functions
+ * ********************************************************************** */
+
+/** Tests whether an instruction is a branch */
+static inline bool optimize_isbranch(instruction instr) {
+    int op=DECODE_OP(instr);
+    return (op==OP_B || op==OP_BIF || op==OP_BIFF || op==OP_POPERR);
+}
+
+/** Tests whether control can pass from an instruction to the next */
+static inline bool optimize_fallsthrough(instruction instr) {
+    int op=DECODE_OP(instr);
+    return !(op==OP_B || op==OP_POPERR || op==OP_RETURN || op==OP_END);
+}
+
+/** Finds the destination of a branch located at index i */
+static inline instructionindx optimize_branchtarget(instruction instr, instructionindx i) {
+    return i+1+DECODE_sBx(instr);
+}
+
+/** Returns a copy of the branch instruction instr located at i that branches to target */
+static inline instruction optimize_setbranch(instruction instr, instructionindx i, instructionindx target) {
+    int sbx = (int) target - (int) i - 1;
+    return (instr & 0xffffu) | (((instruction) sbx & 0xffffu) << 16);
+}
+
+/** Replaces operands of an instruction */
+static inline instruction optimize_setA(instruction instr, int r) {
+    return (instr & ~(0xffu << 8)) | (((instruction) r & 0xffu) << 8);
+}
+
+static inline instruction optimize_setB(instruction instr, int r) {
+    return (instr & ~(0xffu << 16)) | (((instruction) r & 0xffu) << 16);
+}
+
+static inline instruction optimize_setC(instruction instr, int r) {
+    return (instr & ~(0xffu << 24)) | (((instruction) r & 0xffu) << 24);
+}
+
+/** Determines which registers an instruction reads and which register, if any, it always writes
+ * @param[in] instr - the instruction
+ * @param[in] isglobal - whether the instruction belongs to the global function
+ * @param[out] use - registers read by the instruction
+ * @param[out] def - register written by the instruction or -1 */
+static void optimize_registereffects(instruction instr, bool isglobal, regset *use, int *def) {
+    int a=DECODE_A(instr), b=DECODE_B(instr), c=DECODE_C(instr);
+    regset_clear(use);
+    *def=-1;
+
+    switch (DECODE_OP(instr)) {
+        case OP_MOV: case OP_NOT:
+            regset_add(use, b); *def=a;
+            break;
+        case OP_LCT: case OP_CLONE: case OP_LGL: case OP_LUP:
+            *def=a;
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_LE:
+        case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF: case OP_LTF: case OP_LEF:
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_LTI: case OP_LEI:
+        case OP_LPR: case OP_LIXL:
+            regset_add(use, b); regset_add(use, c); *def=a;
+            break;
+        case OP_CAT:
+            regset_addrange(use, b, c); *def=a;
+            break;
+        case OP_BIF: case OP_BIFF: case OP_PRINT: case OP_SGL:
+            regset_add(use, a);
+            break;
+        case OP_SUP:
+            regset_add(use, b);
+            break;
+        case OP_SPR:
+            regset_add(use, a); regset_add(use, b); regset_add(use, c);
+            break;
+        case OP_SIX:
+            regset_add(use, a); regset_addrange(use, b, c);
+            break;
+        case OP_LIX:
+            regset_add(use, a); regset_addrange(use, b, c); *def=b;
+            break;
+        case OP_CALL:
+            regset_addrange(use, a, a+b+2*c); *def=a;
+            break;
+        case OP_INVOKE:
+            regset_add(use, 0); // Methods invoked on a class use self
+            regset_addrange(use, a, a+1+b+2*c); *def=a+1;
+            break;
+        case OP_METHOD:
+            regset_addrange(use, a, a+1+b+2*c); *def=a+1;
+            break;
+        case OP_CLOSURE:
+            regset_add(use, a); *def=a;
+            break;
+        case OP_RETURN:
+            if (a>0) regset_add(use, b);
+            break;
+        case OP_END: // Registers in the global frame persist, e.g. between REPL entries
+            if (isglobal) regset_fill(use);
+            break;
+        case OP_BREAK:
+            regset_fill(use);
+            break;
+        default:
+            break;
+    }
+}
+
+/** Tests whether an instruction writes only register A and reads registers independently;
+ *  such instructions can be redirected to write a different register */
+static bool optimize_isretargetable(instruction instr) {
+    switch (DECODE_OP(instr)) {
+        case OP_MOV: case OP_LCT: case OP_CLONE: case OP_LGL: case OP_LUP: case OP_NOT:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_LE:
+        case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF: case OP_LTF: case OP_LEF:
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_LTI: case OP_LEI:
+        case OP_LPR: case OP_LIXL: case OP_CAT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/** Tests whether an instruction has no effect other than writing its output register */
+static bool optimize_ispure(instruction instr) {
+    switch (DECODE_OP(instr)) {
+        case OP_MOV: case OP_LCT: case OP_CLONE: case OP_LGL: case OP_LUP: case OP_NOT:
+        case OP_EQ: case OP_NEQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* **********************************************************************
+ * Setup
+ * ********************************************************************** */
+
+/** Finds or adds a function to the optimizer's function list */
+static int optimize_functionid(optimizer *o, objectfunction *func, int last) {
+    if (last>=0 && o->functions[last].func==func) return last;
+    for (int i=0; i<o->nfunctions; i++) if (o->functions[i].func==func) return i;
+
+    optimizefunction *new=MORPHO_REALLOC(o->functions, sizeof(optimizefunction)*(o->nfunctions+1));
+    if (!new) return -1;
+    o->functions=new;
+
+    optimizefunction *f=&o->functions[o->nfunctions];
+    f->func=func;
+    f->haserrorhandler=false;
+    f->hasbreakpoint=false;
+    f->first=0;
+    f->count=0;
+    regset_clear(&f->captured);
+
+    /* Registers captured by closures created in this function */
+    for (unsigned int i=0; i<func->prototype.count; i++) {
+        varray_upvalue *proto=&func->prototype.data[i];
+        for (unsigned int j=0; j<proto->count; j++) {
+            if (proto->data[j].islocal) regset_add(&f->captured, (int) proto->data[j].reg);
+        }
+    }
+
+    return o->nfunctions++;
+}
+
+/** Initializes the optimizer for the code generated since the program entry point */
+static bool optimize_init(optimizer *o, program *p) {
+    o->prog=p;
+    o->start=program_getentry(p);
+    o->end=p->code.count;
+    o->functions=NULL;
+    o->nfunctions=0;
+    varray_valueinit(&o->handlers);
+    blockstate_init(&o->state);
+    o->persistglobal=true;
+
+    int n=(int) (o->end-o->start);
+    o->fid=MORPHO_MALLOC(sizeof(int)*(n+1));
+    o->order=MORPHO_MALLOC(sizeof(int)*(n+1));
+    o->leader=MORPHO_MALLOC(sizeof(bool)*(n+1));
+    o->livein=MORPHO_MALLOC(sizeof(regset)*(n+1));
+    o->liveout=MORPHO_MALLOC(sizeof(regset)*(n+1));
+    o->reached=MORPHO_MALLOC(sizeof(bool)*(n+1));
+    o->stack=MORPHO_MALLOC(sizeof(int)*(n+1));
+    o->map=MORPHO_MALLOC(sizeof(instructionindx)*(n+1));
+
+    return (o->fid && o->order && o->leader && o->reached && o->stack &&
+            o->livein && o->liveout && o->map);
+}
+
+/** Clears the optimizer's state */
+static void optimize_clear(optimizer *o) {
+    if (o->functions) MORPHO_FREE(o->functions);
+    if (o->fid) MORPHO_FREE(o->fid);
+    if (o->order) MORPHO_FREE(o->order);
+    if (o->leader) MORPHO_FREE(o->leader);
+    if (o->reached) MORPHO_FREE(o->reached);
+    if (o->stack) MORPHO_FREE(o->stack);
+    if (o->livein) MORPHO_FREE(o->livein);
+    if (o->liveout) MORPHO_FREE(o->liveout);
+    if (o->map) MORPHO_FREE(o->map);
+    varray_valueclear(&o->handlers);
+}
+
+/** Uses the debug annotations to determine which function owns each instruction;
+ *  also collects the error handler tables. Returns false if the annotations don't match the code. */
+static bool optimize_findfunctions(optimizer *o) {
+    varray_debugannotation *list=&o->prog->annotations;
+    objectfunction *func=o->prog->global;
+    instructionindx i=0;
+    int last=-1;
+
+    for (unsigned int k=0; k<list->count; k++) {
+        debugannotation *ann=&list->data[k];
+        if (ann->type==DEBUG_FUNCTION) {
+            func=ann->content.function.function;
+        } else if (ann->type==DEBUG_ELEMENT) {
+            for (int j=0; j<ann->content.element.ninstr; j++, i++) {
+                if (!OPTIMIZE_INRANGE(o, i)) continue;
+                last=optimize_functionid(o, func, last);
+                if (last<0) return false;
+                o->fid[OPTIMIZE_OFFSET(o, i)]=last;
+            }
+        }
+    }
+    if (i!=o->end) return false;
+
+    for (instructionindx i=o->start; i<o->end; i++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        optimizefunction *f=&o->functions[o->fid[OPTIMIZE_OFFSET(o, i)]];
+        switch (DECODE_OP(instr)) {
+            case OP_PUSHERR:
+            {
+                f->haserrorhandler=true;
+                indx k=DECODE_Bx(instr);
+                if (k<f->func->konst.count &&
+                    MORPHO_ISDICTIONARY(f->func->konst.data[k])) {
+                    varray_valuewrite(&o->handlers, f->func->konst.data[k]);
+                }
+            }
+                break;
+            case OP_BREAK:
+                f->hasbreakpoint=true;
+                break;
+            default: break;
+        }
+    }
+
+    return true;
+}
+
+/** Groups the instructions by function */
+static void optimize_orderinstructions(optimizer *o) {
+    for (int k=0; k<o->nfunctions; k++) o->functions[k].count=0;
+    for (instructionindx i=o->start; i<o->end; i++) o->functions[o->fid[OPTIMIZE_OFFSET(o, i)]].count++;
+
+    int first=0;
+    for (int k=0; k<o->nfunctions; k++) {
+        o->functions[k].first=first;
+        first+=o->functions[k].count;
+        o->functions[k].count=0;
+    }
+
+    for (instructionindx i=o->start; i<o->end; i++) {
+        optimizefunction *f=&o->functions[o->fid[OPTIMIZE_OFFSET(o, i)]];
+        o->order[f->first+f->count]=(int) i;
+        f->count++;
+    }
+}
+
+/** Calls fn for each target of an error handler table */
+static void optimize_handlertargets(optimizer *o, void (*fn) (optimizer *o, value *target)) {
+    for (unsigned int k=0; k<o->handlers.count; k++) {
+        objectdictionary *dict=MORPHO_GETDICTIONARY(o->handlers.data[k]);
+        for (unsigned int j=0; j<dict->dict.capacity; j++) {
+            dictionaryentry *e=&dict->dict.contents[j];
+            if (!MORPHO_ISNIL(e->key) && MORPHO_ISINTEGER(e->val)) (*fn) (o, &e->val);
+        }
+    }
+}
+
+static void optimize_markleader(optimizer *o, value *target) {
+    instructionindx t=MORPHO_GETINTEGERVALUE(*target);
+    if (OPTIMIZE_INRANGE(o, t)) o->leader[OPTIMIZE_OFFSET(o, t)]=true;
+}
+
+/** Identifies instructions that begin a basic block */
+static void optimize_findleaders(optimizer *o) {
+    for (instructionindx i=o->start; i<o->end; i++) o->leader[OPTIMIZE_OFFSET(o, i)]=false;
+    if (o->end>o->start) o->leader[0]=true;
+
+    for (int k=0; k<o->nfunctions; k++) {
+        instructionindx entry=o->functions[k].func->entry;
+        if (OPTIMIZE_INRANGE(o, entry)) o->leader[OPTIMIZE_OFFSET(o, entry)]=true;
+    }
+
+    for (instructionindx i=o->start; i<o->end; i++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (optimize_isbranch(instr)) {
+            instructionindx t=optimize_branchtarget(instr, i);
+            if (OPTIMIZE_INRANGE(o, t)) o->leader[OPTIMIZE_OFFSET(o, t)]=true;
+        }
+        if ((optimize_isbranch(instr) || !optimize_fallsthrough(instr)) &&
+            OPTIMIZE_INRANGE(o, i+1)) o->leader[OPTIMIZE_OFFSET(o, i+1)]=true;
+    }
+
+    optimize_handlertargets(o, optimize_markleader);
+}
+
+/* **********************************************************************
+ * Jump threading
+ * ********************************************************************** */
+
+/** Follows a chain of NOPs and unconditional branches to the final destination */
+static instructionindx optimize_followbranch(optimizer *o, instructionindx from, instructionindx t) {
+    for (int hops=0; hops<OPTIMIZE_MAXTHREADING && OPTIMIZE_INRANGE(o, t); hops++) {
+        instruction instr=OPTIMIZE_CODE(o, t);
+        if (DECODE_OP(instr)==OP_NOP) {
+            t++;
+        } else if (DECODE_OP(instr)==OP_B) {
+            instructionindx next=optimize_branchtarget(instr, t);
+            if (next==t || next==from) break; // Avoid following infinite loops
+            t=next;
+        } else break;
+    }
+    return t;
+}
+
+/** Retargets branches to their final destination and removes branches to the next instruction */
+static int optimize_threadjumps(optimizer *o) {
+    int nchanged=0;
+
+    for (instructionindx i=o->start; i<o->end; i++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (!optimize_isbranch(instr)) continue;
+
+        instructionindx t=optimize_branchtarget(instr, i);
+        if (!OPTIMIZE_INRANGE(o, t)) continue;
+
+        instructionindx dest=optimize_followbranch(o, i, t);
+
+        /* Find the instruction that would be reached by falling through */
+        instructionindx next=i+1;
+        while (OPTIMIZE_INRANGE(o, next) && DECODE_OP(OPTIMIZE_CODE(o, next))==OP_NOP) next++;
+
+        if (DECODE_OP(instr)!=OP_POPERR && (dest==next || t==next)) {
+            OPTIMIZE_CODE(o, i)=ENCODE_BYTE(OP_NOP);
+            nchanged++;
+        } else if (dest!=t) {
+            OPTIMIZE_CODE(o, i)=optimize_setbranch(instr, i, dest);
+            nchanged++;
+        }
+    }
+
+    optimize_stats.nthreaded+=nchanged;
+    return nchanged;
+}
+
+/* **********************************************************************
+ * Constant folding and propagation
+ * ********************************************************************** */
+
+/** Adds a constant to a function's constant table, reusing an existing entry if possible */
+static bool optimize_addconstant(objectfunction *func, value val, indx *out) {
+    varray_value *konst=&func->konst;
+    for (unsigned int i=0; i<konst->count; i++) {
+        if (MORPHO_ISSAME(konst->data[i], val)) { *out=i; return true; }
+    }
+    if (konst->count>=MORPHO_MAXCONSTANTS) return false;
+    *out=varray_valuewrite(konst, val);
+    return true;
+}
+
+/** Maps instructions specialised to particular operand types onto the general instruction, which gives the same result */
+static int optimize_generalop(int op) {
+    switch (op) {
+        case OP_ADDF: case OP_ADDI: return OP_ADD;
+        case OP_SUBF: case OP_SUBI: return OP_SUB;
+        case OP_MULF: case OP_MULI: return OP_MUL;
+        case OP_DIVF: return OP_DIV;
+        case OP_LTF: case OP_LTI: return OP_LT;
+        case OP_LEF: case OP_LEI: return OP_LE;
+        default: return op;
+    }
+}
+
+/** Evaluates an arithmetic operation on constants, following the VM's rules */
+static bool optimize_foldarithmetic(int op, value left, value right, value *out) {
+    if (!(MORPHO_ISNUMBER(left) && MORPHO_ISNUMBER(right))) return false;
+
+    if (MORPHO_ISINTEGER(left) && MORPHO_ISINTEGER(right) &&
+        (op==OP_ADD || op==OP_SUB || op==OP_MUL)) {
+        long long l=MORPHO_GETINTEGERVALUE(left), r=MORPHO_GETINTEGERVALUE(right), x;
+        switch (op) {
+            case OP_ADD: x=l+r; break;
+            case OP_SUB: x=l-r; break;
+            default: x=l*r; break;
+        }
+        if (x<INT_MIN || x>INT_MAX) return false; // Leave overflow to the VM
+        *out=MORPHO_INTEGER((int) x);
+        return true;
+    }
+
+    double l, r, x;
+    if (!morpho_valuetofloat(left, &l) || !morpho_valuetofloat(right, &r)) return false;
+    switch (op) {
+        case OP_ADD: x=l+r; break;
+        case OP_SUB: x=l-r; break;
+        case OP_MUL: x=l*r; break;
+        case OP_DIV: x=l/r; break;
+        case OP_POW: x=pow(l, r); break;
+        default: return false;
+    }
+    if (!isfinite(x)) return false;
+    *out=MORPHO_FLOAT(x);
+    return true;
+}
+
+/** Evaluates a comparison on constants, following the VM's rules */
+static bool optimize_foldcomparison(int op, value left, value right, value *out) {
+    bool isnum=(MORPHO_ISNUMBER(left) && MORPHO_ISNUMBER(right));
+    bool issimple=((MORPHO_ISNUMBER(left) || MORPHO_ISBOOL(left) || MORPHO_ISNIL(left)) &&
+                   (MORPHO_ISNUMBER(right) || MORPHO_ISBOOL(right) || MORPHO_ISNIL(right)));
+
+    if ((op==OP_LT || op==OP_LE) ? !isnum : !issimple) return false;
+
+    int cmp=morpho_extendedcomparevalue(left, right);
+    switch (op) {
+        case OP_EQ: *out=MORPHO_BOOL(cmp==0); break;
+        case OP_NEQ: *out=MORPHO_BOOL(cmp!=0); break;
+        case OP_LT: *out=MORPHO_BOOL(cmp>0); break;
+        case OP_LE: *out=MORPHO_BOOL(cmp>=0); break;
+        default: return false;
+    }
+    return true;
+}
+
+/** Forgets everything known at the start of a new basic block */
+static inline void blockstate_reset(blockstate *s) {
+    s->block++;
+    s->ncopies=0;
+}
+
+/** Ensures the entries for register r belong to the current block */
+static inline void blockstate_touch(blockstate *s, int r) {
+    if (s->stamp[r]!=s->block) {
+        s->stamp[r]=s->block;
+        s->konst[r]=-1;
+        s->copy[r]=-1;
+    }
+}
+
+static inline int blockstate_konst(blockstate *s, int r) {
+    return (s->stamp[r]==s->block ? s->konst[r] : -1);
+}
+
+static inline int blockstate_copy(blockstate *s, int r) {
+    return (s->stamp[r]==s->block ? s->copy[r] : -1);
+}
+
+static inline void blockstate_setkonst(blockstate *s, int r, int k) {
+    blockstate_touch(s, r);
+    s->konst[r]=k;
+}
+
+static inline void blockstate_setcopy(blockstate *s, int r, int src) {
+    blockstate_touch(s, r);
+    if (s->copy[r]<0) s->copies[s->ncopies++]=r;
+    s->copy[r]=src;
+}
+
+/** Forgets everything known about a register, including any copies made of it */
+static void blockstate_invalidate(blockstate *s, int r) {
+    if (r<0) return;
+    if (s->stamp[r]==s->block) { s->konst[r]=-1; s->copy[r]=-1; }
+
+    int n=0;
+    for (int i=0; i<s->ncopies; i++) {
+        int x=s->copies[i];
+        if (s->copy[x]==r) s->copy[x]=-1;
+        if (s->copy[x]>=0) s->copies[n++]=x;
+    }
+    s->ncopies=n;
+}
+
+/** Replaces a register read with the register it was copied from */
+static inline int optimize_copyof(blockstate *s, int r) {
+    int c=blockstate_copy(s, r);
+    return (c>=0 ? c : r);
+}
+
+/** Rewrites register reads in an instruction to use the original of any copies */
+static instruction optimize_propagatecopies(instruction instr, blockstate *s) {
+    if (!s->ncopies) return instr;
+    int a=DECODE_A(instr), b=DECODE_B(instr), c=DECODE_C(instr);
+
+    switch (DECODE_OP(instr)) {
+        case OP_MOV: case OP_NOT:
+            return optimize_setB(instr, optimize_copyof(s, b));
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_LE:
+        case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF: case OP_LTF: case OP_LEF:
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_LTI: case OP_LEI:
+        case OP_LPR: case OP_LIXL:
+            instr=optimize_setB(instr, optimize_copyof(s, b));
+            return optimize_setC(instr, optimize_copyof(s, c));
+        case OP_BIF: case OP_BIFF: case OP_PRINT: case OP_SGL:
+            return optimize_setA(instr, optimize_copyof(s, a));
+        case OP_SUP:
+            return optimize_setB(instr, optimize_copyof(s, b));
+        case OP_SPR:
+            instr=optimize_setA(instr, optimize_copyof(s, a));
+            instr=optimize_setB(instr, optimize_copyof(s, b));
+            return optimize_setC(instr, optimize_copyof(s, c));
+        case OP_RETURN:
+            if (a>0) return optimize_setB(instr, optimize_copyof(s, b));
+            return instr;
+        default:
+            return instr;
+    }
+}
+
+/** Generates an instruction that loads a constant value into register a */
+static bool optimize_loadconstant(objectfunction *func, int a, value val, instruction *out) {
+    indx k;
+    if (!optimize_addconstant(func, val, &k)) return false;
+    *out=ENCODE_LONG(OP_LCT, a, k);
+    return true;
+}
+
+/** Performs constant folding, constant propagation and copy propagation on the basic blocks of a function */
+static int optimize_constants(optimizer *o, optimizefunction *f) {
+    blockstate *s=&o->state;
+    int nchanged=0;
+    bool isglobal=(f->func==o->prog->global);
+    instructionindx prev=o->start;
+
+    for (int k=0; k<f->count; k++) {
+        instructionindx i=o->order[f->first+k];
+        instruction instr=OPTIMIZE_CODE(o, i);
+        int op=DECODE_OP(instr);
+
+        /* Reset at the start of each basic block */
+        if (k==0 || i!=prev+1 || o->leader[OPTIMIZE_OFFSET(o, i)]) blockstate_reset(s);
+        prev=i;
+
+        if (op==OP_NOP) continue;
+
+        instruction new=optimize_propagatecopies(instr, s);
+        int a=DECODE_A(new), b=DECODE_B(new), c=DECODE_C(new);
+        bool iscaptured=regset_contains(&f->captured, a);
+        value *kt=f->func->konst.data;
+        value result;
+        int kb, kc;
+
+        switch (op) {
+            case OP_MOV:
+                kb=blockstate_konst(s, b);
+                if (a==b) new=ENCODE_BYTE(OP_NOP);
+                else if (kb>=0) new=ENCODE_LONG(OP_LCT, a, kb);
+                break;
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+            case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF:
+            case OP_ADDI: case OP_SUBI: case OP_MULI:
+                kb=blockstate_konst(s, b); kc=blockstate_konst(s, c);
+                if (kb>=0 && kc>=0 &&
+                    optimize_foldarithmetic(optimize_generalop(op), kt[kb], kt[kc], &result) &&
+                    optimize_loadconstant(f->func, a, result, &new)) optimize_stats.nfolded++;
+                break;
+            case OP_EQ: case OP_NEQ: case OP_LT: case OP_LE:
+            case OP_LTF: case OP_LEF: case OP_LTI: case OP_LEI:
+                kb=blockstate_konst(s, b); kc=blockstate_konst(s, c);
+                if (kb>=0 && kc>=0 &&
+                    optimize_foldcomparison(optimize_generalop(op), kt[kb], kt[kc], &result) &&
+                    optimize_loadconstant(f->func, a, result, &new)) optimize_stats.nfolded++;
+                break;
+            case OP_NOT:
+                kb=blockstate_konst(s, b);
+                if (kb>=0) {
+                    value left=kt[kb];
+                    result=MORPHO_BOOL(MORPHO_ISBOOL(left) ? !MORPHO_GETBOOLVALUE(left) : MORPHO_ISNIL(left));
+                    if (optimize_loadconstant(f->func, a, result, &new)) optimize_stats.nfolded++;
+                }
+                break;
+            case OP_BIF: case OP_BIFF:
+                kb=blockstate_konst(s, a);
+                if (kb>=0) {
+                    bool cond=MORPHO_ISTRUE(kt[kb]);
+                    if (op==OP_BIFF) cond=!cond;
+                    new=(cond ? optimize_setbranch(ENCODE_BYTE(OP_B), i, optimize_branchtarget(instr, i)) : ENCODE_BYTE(OP_NOP));
+                    optimize_stats.nfolded++;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (new!=instr) {
+            OPTIMIZE_CODE(o, i)=new;
+            nchanged++;
+        }
+
+        /* Update what is known about the registers */
+        regset use;
+        int def;
+        int newop=DECODE_OP(new);
+        optimize_registereffects(new, isglobal, &use, &def);
+
+        if (newop==OP_LCT) {
+            blockstate_invalidate(s, a);
+            if (!iscaptured) blockstate_setkonst(s, a, (int) DECODE_Bx(new));
+        } else if (newop==OP_MOV) {
+            blockstate_invalidate(s, a);
+            if (!iscaptured && !regset_contains(&f->captured, b)) blockstate_setcopy(s, a, b);
+        } else blockstate_invalidate(s, def);
+    }
+
+    return nchanged;
+}
+
+/* **********************************************************************
+ * Dead store elimination
+ * ********************************************************************** */
+
+/** Computes the registers live on entry to and exit from each instruction of a function */
+static void optimize_liveness(optimizer *o, optimizefunction *f) {
+    bool isglobal=(f->func==o->prog->global && o->persistglobal);
+    int id=o->fid[OPTIMIZE_OFFSET(o, o->order[f->first])];
+
+    for (int k=0; k<f->count; k++) {
+        instructionindx i=o->order[f->first+k];
+        regset_clear(&o->livein[OPTIMIZE_OFFSET(o, i)]);
+        regset_clear(&o->liveout[OPTIMIZE_OFFSET(o, i)]);
+    }
+
+    bool changed;
+    do {
+        changed=false;
+        for (int k=f->count-1; k>=0; k--) {
+            instructionindx i=o->order[f->first+k];
+            instruction instr=OPTIMIZE_CODE(o, i);
+            instructionindx succ[2];
+            int nsucc=0;
+
+            if (optimize_fallsthrough(instr)) succ[nsucc++]=i+1;
+            if (optimize_isbranch(instr)) succ[nsucc++]=optimize_branchtarget(instr, i);
+
+            regset out, in, use;
+            int def;
+            regset_clear(&out);
+            for (int s=0; s<nsucc; s++) {
+                if (OPTIMIZE_INRANGE(o, succ[s]) && o->fid[OPTIMIZE_OFFSET(o, succ[s])]==id) {
+                    regset_union(&out, &o->livein[OPTIMIZE_OFFSET(o, succ[s])]);
+                } else regset_fill(&out); // Be conservative if control leaves the function's code
+            }
+
+            optimize_registereffects(instr, isglobal, &use, &def);
+            in=out;
+            regset_remove(&in, def);
+            regset_union(&in, &use);
+            regset_union(&in, &f->captured);
+
+            if (!regset_equal(&in, &o->livein[OPTIMIZE_OFFSET(o, i)])) changed=true;
+            o->livein[OPTIMIZE_OFFSET(o, i)]=in;
+            o->liveout[OPTIMIZE_OFFSET(o, i)]=out;
+        }
+    } while (changed);
+}
+
+/** Removes stores to registers that are never read, and folds moves into the instruction that computed the value */
+static int optimize_deadstores(optimizer *o, optimizefunction *f) {
+    bool isglobal=(f->func==o->prog->global);
+    int nchanged=0;
+
+    optimize_liveness(o, f);
+
+    for (int k=0; k<f->count; k++) {
+        instructionindx i=o->order[f->first+k];
+        instruction instr=OPTIMIZE_CODE(o, i);
+        regset use;
+        int def;
+
+        if (!optimize_ispure(instr)) continue;
+        optimize_registereffects(instr, isglobal, &use, &def);
+        if (def<0 || regset_contains(&f->captured, def)) continue;
+
+        if (!regset_contains(&o->liveout[OPTIMIZE_OFFSET(o, i)], def)) {
+            OPTIMIZE_CODE(o, i)=ENCODE_BYTE(OP_NOP);
+            nchanged++;
+        }
+    }
+
+    /* Fold X t, ... ; MOV r, t into X r, ... where t is not used afterwards */
+    for (int k=1; k<f->count; k++) {
+        instructionindx i=o->order[f->first+k], j=o->order[f->first+k-1];
+        instruction mov=OPTIMIZE_CODE(o, i), instr=OPTIMIZE_CODE(o, j);
+
+        if (DECODE_OP(mov)!=OP_MOV || j+1!=i || o->leader[OPTIMIZE_OFFSET(o, i)]) continue;
+        if (!optimize_isretargetable(instr)) continue;
+
+        int r=DECODE_A(mov), t=DECODE_B(mov);
+        regset use;
+        int def;
+        optimize_registereffects(instr, isglobal, &use, &def);
+
+        if (def!=t || r==t ||
+            regset_contains(&use, r) ||
+            regset_contains(&f->captured, r) ||
+            regset_contains(&f->captured, t) ||
+            regset_contains(&o->liveout[OPTIMIZE_OFFSET(o, i)], t)) continue;
+
+        OPTIMIZE_CODE(o, j)=optimize_setA(instr, r);
+        OPTIMIZE_CODE(o, i)=ENCODE_BYTE(OP_NOP);
+        nchanged++;
+    }
+
+    optimize_stats.nstores+=nchanged;
+    return nchanged;
+}
+
+/* **********************************************************************
+ * Unreachable code
+ * ********************************************************************** */
+
+static void optimize_pushreachable(optimizer *o, instructionindx i, bool *reached, int *stack, int *n) {
+    if (!OPTIMIZE_INRANGE(o, i) || reached[OPTIMIZE_OFFSET(o, i)]) return;
+    reached[OPTIMIZE_OFFSET(o, i)]=true;
+    stack[(*n)++]=(int) i;
+}
+
+/** Removes instructions that cannot be reached from the program entry point, a function entry point or an error handler */
+static int optimize_unreachable(optimizer *o) {
+    int n=(int) (o->end-o->start), nstack=0, nchanged=0;
+    bool *reached=o->reached;
+    int *stack=o->stack;
+
+    for (int k=0; k<n; k++) reached[k]=false;
+
+    optimize_pushreachable(o, o->start, reached, stack, &nstack);
+    for (int k=0; k<o->nfunctions; k++) optimize_pushreachable(o, o->functions[k].func->entry, reached, stack, &nstack);
+    for (unsigned int k=0; k<o->handlers.count; k++) {
+        objectdictionary *dict=MORPHO_GETDICTIONARY(o->handlers.data[k]);
+        for (unsigned int j=0; j<dict->dict.capacity; j++) {
+            dictionaryentry *e=&dict->dict.contents[j];
+            if (!MORPHO_ISNIL(e->key) && MORPHO_ISINTEGER(e->val)) {
+                optimize_pushreachable(o, MORPHO_GETINTEGERVALUE(e->val), reached, stack, &nstack);
+            }
+        }
+    }
+
+    while (nstack>0) {
+        instructionindx i=stack[--nstack];
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (optimize_fallsthrough(instr)) optimize_pushreachable(o, i+1, reached, stack, &nstack);
+        if (optimize_isbranch(instr)) optimize_pushreachable(o, optimize_branchtarget(instr, i), reached, stack, &nstack);
+    }
+
+    for (instructionindx i=o->start; i<o->end; i++) {
+        int op=DECODE_OP(OPTIMIZE_CODE(o, i));
+        if (!reached[OPTIMIZE_OFFSET(o, i)] && op!=OP_NOP && op!=OP_END) {
+            OPTIMIZE_CODE(o, i)=ENCODE_BYTE(OP_NOP);
+            nchanged++;
+        }
+    }
+
+    optimize_stats.nunreachable+=nchanged;
+    return nchanged;
+}
+
+/* **********************************************************************
+ * Compaction
+ * ********************************************************************** */
+
+static void optimize_remaphandler(optimizer *o, value *target) {
+    instructionindx t=MORPHO_GETINTEGERVALUE(*target);
+    if (t>=o->start && t<=o->end) *target=MORPHO_INTEGER((int) o->map[OPTIMIZE_OFFSET(o, t)]);
+}
+
+/** Removes NOP instructions, fixing up everything that refers to an instruction index.
+ *  @returns the number of instructions removed */
+static int optimize_compact(optimizer *o) {
+    int n=(int) (o->end-o->start);
+    instructionindx k=o->start;
+
+    for (instructionindx i=o->start; i<o->end; i++) {
+        o->map[OPTIMIZE_OFFSET(o, i)]=k;
+        if (DECODE_OP(OPTIMIZE_CODE(o, i))!=OP_NOP) k++;
+    }
+    o->map[n]=k;
+
+    int nremoved=(int) (o->end-k);
+    if (!nremoved) return 0;
+
+    /* Move instructions and correct branches */
+    for (instructionindx i=o->start; i<o->end; i++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (DECODE_OP(instr)==OP_NOP) continue;
+
+        instructionindx newi=o->map[OPTIMIZE_OFFSET(o, i)];
+        if (optimize_isbranch(instr)) {
+            instructionindx t=optimize_branchtarget(instr, i);
+            if (t>=o->start && t<=o->end) instr=optimize_setbranch(instr, newi, o->map[OPTIMIZE_OFFSET(o, t)]);
+        }
+        OPTIMIZE_CODE(o, newi)=instr;
+    }
+
+    /* Correct the debug annotations */
+    varray_debugannotation *list=&o->prog->annotations;
+    instructionindx i=0;
+    for (unsigned int j=0; j<list->count; j++) {
+        debugannotation *ann=&list->data[j];
+        if (ann->type!=DEBUG_ELEMENT) continue;
+
+        int ninstr=ann->content.element.ninstr;
+        for (int l=0; l<ninstr; l++, i++) {
+            if (OPTIMIZE_INRANGE(o, i) &&
+                o->map[OPTIMIZE_OFFSET(o, i)]==o->map[OPTIMIZE_OFFSET(o, i)+1]) ann->content.element.ninstr--;
+        }
+    }
+
+    /* Correct function entry points and error handlers */
+    for (int l=0; l<o->nfunctions; l++) {
+        objectfunction *func=o->functions[l].func;
+        if (func->entry>=o->start && func->entry<=o->end) func->entry=o->map[OPTIMIZE_OFFSET(o, func->entry)];
+    }
+    optimize_handlertargets(o, optimize_remaphandler);
+
+    o->prog->code.count-=nremoved;
+    o->end-=nremoved;
+
+    /* Instructions have moved, so recompute their owners */
+    int *fid=o->fid;
+    for (instructionindx i=o->start; i<o->end+nremoved; i++) {
+        int id=fid[OPTIMIZE_OFFSET(o, i)];
+        if (o->map[OPTIMIZE_OFFSET(o, i)]!=o->map[OPTIMIZE_OFFSET(o, i)+1]) fid[OPTIMIZE_OFFSET(o, o->map[OPTIMIZE_OFFSET(o, i)])]=id;
+    }
+
+    return nremoved;
+}
+
+/* **********************************************************************
+ * Inlining
+ * ********************************************************************** */
+
+/** A call that will be replaced by the body of the function called */
+typedef struct {
+    instructionindx i; /** Index of the CALL or INVOKE instruction */
+    objectfunction *caller; /** Function containing the call */
+    objectfunction *callee; /** Function to be inlined */
+    int base; /** Register of the caller that corresponds to the callee's r0 */
+    int ninstr; /** Number of instructions in the callee */
+    int size; /** Number of instructions that replace the call */
+} inlinesite;
+
+/** Tests whether an instruction may appear in an inlined function; the others refer to the
+ *  callee's own frame (upvalues, closures, error handlers and methods invoked on self) or stop the VM */
+static bool optimize_isinlinableop(int op) {
+    switch (op) {
+        case OP_NOP: case OP_MOV: case OP_LCT: case OP_CLONE: case OP_NOT:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_LE:
+        case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF: case OP_LTF: case OP_LEF:
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_LTI: case OP_LEI:
+        case OP_PRINT: case OP_B: case OP_BIF: case OP_BIFF:
+        case OP_CALL: case OP_RETURN:
+        case OP_LPR: case OP_SPR: case OP_LIX: case OP_LIXL: case OP_SIX:
+        case OP_LGL: case OP_SGL: case OP_CAT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/** Offsets the registers referred to by an instruction of an inlined function */
+static instruction optimize_remap(instruction instr, int base) {
+    int a=DECODE_A(instr)+base, b=DECODE_B(instr)+base, c=DECODE_C(instr)+base;
+
+    switch (DECODE_OP(instr)) {
+        case OP_MOV: case OP_NOT:
+            return optimize_setB(optimize_setA(instr, a), b);
+        case OP_LCT: case OP_CLONE: case OP_LGL: case OP_SGL: case OP_PRINT:
+        case OP_BIF: case OP_BIFF: case OP_CALL:
+            return optimize_setA(instr, a);
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POW:
+        case OP_EQ: case OP_NEQ: case OP_LT: case OP_LE:
+        case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF: case OP_LTF: case OP_LEF:
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_LTI: case OP_LEI:
+        case OP_LPR: case OP_SPR: case OP_LIX: case OP_LIXL: case OP_SIX: case OP_CAT:
+            return optimize_setC(optimize_setB(optimize_setA(instr, a), b), c);
+        default:
+            return instr;
+    }
+}
+
+/** Number of instructions that replace an instruction of an inlined function;
+ *  a return becomes a move of the result followed by a branch past the inlined code */
+static int optimize_expandedlength(instruction instr, bool islast) {
+    switch (DECODE_OP(instr)) {
+        case OP_NOP:
+            return 0;
+        case OP_RETURN:
+            return (islast ? 0 : 1) + (DECODE_A(instr)==0 || DECODE_B(instr)!=0 ? 1 : 0);
+        default:
+            return 1;
+    }
+}
+
+/** Determines whether a function can be inlined: it must be small, take a fixed number of arguments,
+ *  create no closures, refer to no upvalues and not call itself, and its code must be contiguous */
+static bool optimize_caninline(optimizer *o, objectfunction *func) {
+    if (func==o->prog->global || func->varg>=0 || func->opt.count>0 ||
+        func->prototype.count>0 || !OPTIMIZE_INRANGE(o, func->entry)) return false;
+
+    optimizefunction *f=&o->functions[o->fid[OPTIMIZE_OFFSET(o, func->entry)]];
+    if (f->func!=func || f->count>OPTIMIZE_INLINESIZE ||
+        o->order[f->first]!=func->entry ||
+        o->order[f->first+f->count-1]!=func->entry+f->count-1) return false;
+
+    for (unsigned int k=0; k<func->konst.count; k++) {
+        if (MORPHO_ISSAME(func->konst.data[k], MORPHO_OBJECT(func))) return false;
+    }
+
+    for (instructionindx i=func->entry; i<func->entry+f->count; i++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (!optimize_isinlinableop(DECODE_OP(instr))) return false;
+        if (optimize_isbranch(instr)) {
+            instructionindx t=optimize_branchtarget(instr, i);
+            if (t<func->entry || t>=func->entry+f->count) return false;
+        }
+    }
+
+    /* Registers other than the arguments must be written before they are read */
+    optimize_liveness(o, f);
+    regset *in=&o->livein[OPTIMIZE_OFFSET(o, func->entry)];
+    for (int r=func->nargs+1; r<OPTIMIZE_NREGISTERS; r++) if (regset_contains(in, r)) return false;
+
+    return true;
+}
+
+/** Determines whether a global variable is only assigned a constant, by a single definition */
+static bool optimize_globalconstant(optimizer *o, indx g, value *out) {
+    int n=0;
+    for (instructionindx i=o->start; i<o->end; i++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (DECODE_OP(instr)!=OP_SGL || DECODE_Bx(instr)!=g) continue;
+        if (n++ || o->leader[OPTIMIZE_OFFSET(o, i)]) return false;
+
+        instruction prev=OPTIMIZE_CODE(o, i-1);
+        if (DECODE_OP(prev)!=OP_LCT || DECODE_A(prev)!=DECODE_A(instr)) return false;
+
+        objectfunction *func=o->functions[o->fid[OPTIMIZE_OFFSET(o, i)]].func;
+        *out=func->konst.data[DECODE_Bx(prev)];
+    }
+    return (n==1);
+}
+
+/** Determines whether a global variable is only assigned a class, by the class definition */
+static bool optimize_globalclass(optimizer *o, indx g, value *out) {
+    return (optimize_globalconstant(o, g, out) && MORPHO_ISCLASS(*out));
+}
+
+/** Follows the instructions from j back to the start of its basic block to find what register r holds after j
+ * @param[out] out - the constant found, or the class of the object if isinstance is set
+ * @param[out] isinstance - set if the register holds an object constructed from the class in out
+ * @returns true if the contents of the register were determined */
+static bool optimize_resolvefrom(optimizer *o, optimizefunction *f, instructionindx j, int r, value *out, bool *isinstance) {
+    bool isglobal=(f->func==o->prog->global);
+    *isinstance=false;
+
+    for (;; j--) {
+        if (regset_contains(&f->captured, r)) return false;
+
+        instruction instr=OPTIMIZE_CODE(o, j);
+        regset use;
+        int def;
+        optimize_registereffects(instr, isglobal, &use, &def);
+
+        if (def==r) switch (DECODE_OP(instr)) {
+            case OP_MOV:
+                r=DECODE_B(instr);
+                break;
+            case OP_CALL: // A constructor leaves the object where the class was
+                if (*isinstance) return false;
+                *isinstance=true;
+                break;
+            case OP_LCT:
+                *out=f->func->konst.data[DECODE_Bx(instr)];
+                return (!*isinstance || MORPHO_ISCLASS(*out));
+            case OP_LGL:
+                return optimize_globalclass(o, DECODE_Bx(instr), out);
+            default:
+                return false;
+        }
+
+        if (o->leader[OPTIMIZE_OFFSET(o, j)]) return false;
+    }
+}
+
+/** Follows the instructions that precede i in its basic block to find what register r holds */
+static bool optimize_resolveregister(optimizer *o, optimizefunction *f, instructionindx i, int r, value *out, bool *isinstance) {
+    *isinstance=false;
+    if (o->leader[OPTIMIZE_OFFSET(o, i)]) return false;
+    return optimize_resolvefrom(o, f, i-1, r, out, isinstance);
+}
+
+/** Identifies the function called by a CALL or INVOKE instruction, if it can be determined */
+static bool optimize_findcallee(optimizer *o, optimizefunction *f, instructionindx i, inlinesite *site) {
+    instruction instr=OPTIMIZE_CODE(o, i);
+    int a=DECODE_A(instr);
+    bool isinstance;
+    value fn=MORPHO_NIL;
+
+    if (DECODE_C(instr)!=0) return false;
+
+    if (DECODE_OP(instr)==OP_CALL) {
+        if (!optimize_resolveregister(o, f, i, a, &fn, &isinstance) || isinstance) return false;
+        site->base=a;
+    } else if (DECODE_OP(instr)==OP_INVOKE) {
+        value symbol, klass;
+        if (!optimize_resolveregister(o, f, i, a, &symbol, &isinstance) || isinstance ||
+            !MORPHO_ISSTRING(symbol)) return false;
+        if (!optimize_resolveregister(o, f, i, a+1, &klass, &isinstance) || !isinstance) return false;
+        if (!dictionary_get(&MORPHO_GETCLASS(klass)->methods, symbol, &fn)) return false;
+        site->base=a+1;
+    } else return false;
+
+    if (!MORPHO_ISFUNCTION(fn)) return false;
+
+    site->i=i;
+    site->caller=f->func;
+    site->callee=MORPHO_GETFUNCTION(fn);
+    return (site->callee!=f->func &&
+            site->callee->nargs==DECODE_B(instr) &&
+            OPTIMIZE_INRANGE(o, site->callee->entry));
+}
+
+/** Checks that the callee's registers, moved into the caller's frame, don't overwrite anything the caller still needs,
+ *  and that the constants the callee uses can be added to the caller's constant table. Also computes the size of the expansion. */
+static bool optimize_checksite(optimizer *o, optimizefunction *f, inlinesite *site) {
+    objectfunction *callee=site->callee;
+    regset *out=&o->liveout[OPTIMIZE_OFFSET(o, site->i)];
+
+    if (site->base+callee->nregs>OPTIMIZE_NREGISTERS) return false;
+    for (int r=site->base+1; r<site->base+callee->nregs; r++) {
+        if (regset_contains(out, r) || regset_contains(&f->captured, r)) return false;
+    }
+
+    site->size=0;
+    for (int k=0; k<site->ninstr; k++) {
+        instruction instr=OPTIMIZE_CODE(o, callee->entry+k);
+        indx kindx;
+        if ((DECODE_OP(instr)==OP_LCT || DECODE_OP(instr)==OP_CLONE) &&
+            !optimize_addconstant(site->caller, callee->konst.data[DECODE_Bx(instr)], &kindx)) return false;
+        if (DECODE_OP(instr)==OP_RETURN && DECODE_A(instr)==0 &&
+            !optimize_addconstant(site->caller, MORPHO_NIL, &kindx)) return false;
+        site->size+=optimize_expandedlength(instr, k==site->ninstr-1);
+    }
+
+    return true;
+}
+
+/** Writes the instructions that replace an inlined call, which will be located starting at index at
+ *  @returns false if a constant the callee uses couldn't be added to the caller's constant table */
+static bool optimize_expand(optimizer *o, inlinesite *site, instruction *out, instructionindx at) {
+    objectfunction *callee=site->callee;
+    int offset[OPTIMIZE_INLINESIZE+1];
+    int n=0;
+
+    for (int k=0; k<site->ninstr; k++) {
+        offset[k]=n;
+        n+=optimize_expandedlength(OPTIMIZE_CODE(o, callee->entry+k), k==site->ninstr-1);
+    }
+    offset[site->ninstr]=n;
+
+    for (int k=0; k<site->ninstr; k++) {
+        instructionindx i=callee->entry+k, pos=at+offset[k];
+        instruction instr=OPTIMIZE_CODE(o, i);
+        instruction *dest=out+offset[k];
+        int a=site->base+DECODE_A(instr), b=site->base+DECODE_B(instr);
+        indx kindx;
+
+        switch (DECODE_OP(instr)) {
+            case OP_NOP:
+                break;
+            case OP_RETURN:
+                if (DECODE_A(instr)==0) {
+                    if (!optimize_loadconstant(site->caller, site->base, MORPHO_NIL, dest++)) return false;
+                    pos++;
+                } else if (b!=site->base) {
+                    *(dest++)=ENCODE_DOUBLE(OP_MOV, site->base, b);
+                    pos++;
+                }
+                if (k<site->ninstr-1) *dest=optimize_setbranch(ENCODE_BYTE(OP_B), pos, at+n);
+                break;
+            case OP_LCT: case OP_CLONE:
+                if (!optimize_addconstant(site->caller, callee->konst.data[DECODE_Bx(instr)], &kindx)) return false;
+                *dest=ENCODE_LONG(DECODE_OP(instr), a, kindx);
+                break;
+            default:
+                if (optimize_isbranch(instr)) {
+                    instructionindx t=at+offset[optimize_branchtarget(instr, i)-callee->entry];
+                    instr=optimize_setbranch(instr, pos, t);
+                }
+                *dest=optimize_remap(instr, site->base);
+                break;
+        }
+    }
+    return true;
+}
+
+/** Copies the annotations of an inlined function, bracketed by the location of the call,
+ *  so that stack traces can report the function; elements cover the instructions they expand to */
+static void optimize_inlineannotations(optimizer *o, inlinesite *site, debugannotation *call, value module, varray_debugannotation *out) {
+    varray_debugannotation *list=&o->prog->annotations;
+    instructionindx start=site->callee->entry, end=start+site->ninstr, i=0;
+    value calleemodule=MORPHO_NIL;
+    bool switchmodule=false;
+    int depth=0;
+
+    debugannotation_pushinline(out, site->callee, call->content.element.line, call->content.element.posn);
+    for (unsigned int j=0; j<list->count && (i<end || depth>0); j++) {
+        debugannotation ann=list->data[j];
+        switch (ann.type) {
+            case DEBUG_MODULE: // The callee may have been imported from another module
+                if (i<=start) calleemodule=ann.content.module.module;
+                break;
+            case DEBUG_ELEMENT: {
+                int n=0;
+                for (int l=0; l<ann.content.element.ninstr; l++, i++) {
+                    if (i>=start && i<end) n+=optimize_expandedlength(OPTIMIZE_CODE(o, i), i==end-1);
+                }
+                if (n==0) break;
+                if (!switchmodule && !MORPHO_ISEQUAL(calleemodule, module)) {
+                    debugannotation_setmodule(out, calleemodule);
+                    switchmodule=true;
+                }
+                ann.content.element.ninstr=n;
+                debugannotation_add(out, &ann);
+            }
+                break;
+            case DEBUG_PUSHINLINE: // Calls inlined into the callee earlier
+                if (i<start || i>=end) break;
+                depth++;
+                debugannotation_add(out, &ann);
+                break;
+            case DEBUG_POPINLINE:
+                if (depth==0) break;
+                depth--;
+                debugannotation_add(out, &ann);
+                break;
+            default:
+                break;
+        }
+    }
+    if (switchmodule) debugannotation_setmodule(out, module);
+    debugannotation_popinline(out);
+}
+
+static int optimize_comparesites(const void *a, const void *b) {
+    instructionindx x=((inlinesite *) a)->i, y=((inlinesite *) b)->i;
+    return (x<y ? -1 : (x>y ? 1 : 0));
+}
+
+/** Replaces calls with the body of the function called, fixing up everything that refers to an instruction index */
+static bool optimize_applyinline(optimizer *o, inlinesite *sites, int nsites, int growth) {
+    int n=(int) (o->end-o->start);
+    instruction *code=MORPHO_MALLOC(sizeof(instruction)*(n+growth+1));
+    if (!code || !varray_instructionresize(&o->prog->code, growth)) {
+        if (code) MORPHO_FREE(code);
+        return false;
+    }
+
+    qsort(sites, nsites, sizeof(inlinesite), optimize_comparesites);
+
+    instructionindx k=o->start;
+    for (int i=0, s=0; i<n; i++) {
+        o->map[i]=k;
+        if (s<nsites && sites[s].i==o->start+i) k+=sites[(s++)].size;
+        else k++;
+    }
+    o->map[n]=k;
+
+    /* Generate the new code, correcting branches */
+    for (instructionindx i=o->start, s=0; i<o->end; i++) {
+        instructionindx newi=o->map[OPTIMIZE_OFFSET(o, i)];
+        if (s<nsites && sites[s].i==i) {
+            if (!optimize_expand(o, &sites[s], code+OPTIMIZE_OFFSET(o, newi), newi)) {
+                MORPHO_FREE(code);
+                return false;
+            }
+            s++;
+            continue;
+        }
+
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (optimize_isbranch(instr)) {
+            instructionindx t=optimize_branchtarget(instr, i);
+            if (t>=o->start && t<=o->end) instr=optimize_setbranch(instr, newi, o->map[OPTIMIZE_OFFSET(o, t)]);
+        }
+        code[OPTIMIZE_OFFSET(o, newi)]=instr;
+    }
+
+    /* The element that contained a call is split around the inlined code, which keeps the callee's annotations */
+    varray_debugannotation *list=&o->prog->annotations, ann;
+    varray_debugannotationinit(&ann);
+    value module=MORPHO_NIL;
+    instructionindx i=0;
+    int s=0;
+    for (unsigned int j=0; j<list->count; j++) {
+        debugannotation *el=&list->data[j];
+        if (el->type==DEBUG_MODULE) module=el->content.module.module;
+
+        instructionindx end=i+(el->type==DEBUG_ELEMENT ? el->content.element.ninstr : 0);
+        if (el->type!=DEBUG_ELEMENT || s>=nsites || sites[s].i>=end) {
+            debugannotation_add(&ann, el);
+            i=end;
+            continue;
+        }
+
+        debugannotation part=*el;
+        for (; s<nsites && sites[s].i<end; s++) {
+            part.content.element.ninstr=(int) (sites[s].i-i);
+            if (part.content.element.ninstr>0) debugannotation_add(&ann, &part);
+            optimize_inlineannotations(o, &sites[s], el, module, &ann);
+            i=sites[s].i+1;
+        }
+        part.content.element.ninstr=(int) (end-i);
+        if (part.content.element.ninstr>0) debugannotation_add(&ann, &part);
+        i=end;
+    }
+    varray_debugannotationclear(list);
+    *list=ann;
+
+    memcpy(o->prog->code.data+o->start, code, sizeof(instruction)*(n+growth));
+    o->prog->code.count+=growth;
+    MORPHO_FREE(code);
+
+    /* Correct function entry points, error handlers and the size of the callers' frames */
+    for (int l=0; l<o->nfunctions; l++) {
+        objectfunction *func=o->functions[l].func;
+        if (func->entry>=o->start && func->entry<=o->end) func->entry=o->map[OPTIMIZE_OFFSET(o, func->entry)];
+    }
+    optimize_handlertargets(o, optimize_remaphandler);
+
+    for (int l=0; l<nsites; l++) {
+        int nregs=sites[l].base+sites[l].callee->nregs;
+        if (sites[l].caller->nregs<nregs) sites[l].caller->nregs=nregs;
+    }
+
+    o->end+=growth;
+    return true;
+}
+
+/** Replaces calls to small functions, and to methods of objects whose class is known, with the body of the function called
+ *  @returns the number of calls inlined */
+static int optimize_inline(optimizer *o) {
+    int n=(int) (o->end-o->start), nsites=0, growth=0;
+    inlinesite *sites=MORPHO_MALLOC(sizeof(inlinesite)*(n+1));
+    signed char *caninline=MORPHO_MALLOC(sizeof(signed char)*(o->nfunctions+1));
+
+    if (sites && caninline) {
+        for (int k=0; k<o->nfunctions; k++) caninline[k]=-1;
+
+        optimize_orderinstructions(o);
+        optimize_findleaders(o);
+
+        /* Registers above a call in the global frame hold only temporaries, so needn't persist */
+        o->persistglobal=false;
+
+        for (int k=0; k<o->nfunctions; k++) {
+            optimizefunction *f=&o->functions[k];
+            bool haslive=false;
+            if (f->haserrorhandler || f->hasbreakpoint) continue;
+
+            for (int l=0; l<f->count; l++) {
+                inlinesite *site=&sites[nsites];
+                if (!optimize_findcallee(o, f, o->order[f->first+l], site)) continue;
+
+                int id=o->fid[OPTIMIZE_OFFSET(o, site->callee->entry)];
+                if (caninline[id]<0) caninline[id]=optimize_caninline(o, site->callee);
+                if (!caninline[id]) continue;
+                site->ninstr=o->functions[id].count;
+
+                if (!haslive) {
+                    optimize_liveness(o, f);
+                    haslive=true;
+                }
+
+                if (!optimize_checksite(o, f, site) ||
+                    growth+site->size-1>n*(OPTIMIZE_INLINEGROWTH-1)) continue;
+
+                growth+=site->size-1;
+                nsites++;
+            }
+        }
+
+        o->persistglobal=true;
+
+        if (nsites && !optimize_applyinline(o, sites, nsites, growth)) nsites=0;
+    }
+
+    if (sites) MORPHO_FREE(sites);
+    if (caninline) MORPHO_FREE(caninline);
+
+    optimize_stats.ninlined+=nsites;
+    return nsites;
+}
+
+/* **********************************************************************
+ * Loop invariant code motion
+ * ********************************************************************** */
+
+/** A loop, comprising the instructions from its header to the last branch back to the header */
+typedef struct {
+    instructionindx start; /** First instruction of the loop, to which the loop branches back */
+    instructionindx end; /** Last branch back to the start of the loop */
+    instructionindx exit; /** Branch that leaves the loop from the header, or -1 if there is none */
+    optimizefunction *f; /** Function containing the loop */
+    bool rotate; /** Whether the header is copied ahead of the hoisted loads */
+    int first; /** Index of the first load hoisted from this loop */
+    int nhoisted; /** Number of loads hoisted from this loop */
+    bool anyproperty; /** Whether code called from the loop could assign any property */
+    int size; /** Number of instructions inserted ahead of the loop */
+} loopinfo;
+
+/** A load that is moved out of a loop */
+typedef struct {
+    instructionindx i; /** Index of the load */
+    int reg; /** Register that holds the loaded value throughout the loop */
+    int name; /** Constant index of a property name to be loaded before the property, or -1 */
+} hoistedload;
+
+/** What code called from within a loop could change */
+typedef struct {
+    bool *global; /** Globals assigned by functions other than the global function */
+    bool upvalue; /** Whether any function assigns to an upvalue */
+    varray_value setters; /** Functions that assign properties; any of their string constants may name the property */
+    bool anyproperty; /** Whether a function other than the global function could assign a property whose name isn't known */
+} hoistcontext;
+
+/** Determines whether register r holds a string constant when the instruction at i in func is executed, looking back
+ *  through the straight line code that precedes it */
+static bool optimize_namedbyconstant(optimizer *o, objectfunction *func, instructionindx i, int r) {
+    bool isglobal=(func==o->prog->global);
+    if (OPTIMIZE_INRANGE(o, i) && o->leader[OPTIMIZE_OFFSET(o, i)]) return false;
+    for (instructionindx j=i-1; j>=func->entry && j>=0; j--) {
+        instruction instr=OPTIMIZE_CODE(o, j);
+        regset use;
+        int def;
+        if (optimize_isbranch(instr)) return false;
+        optimize_registereffects(instr, isglobal, &use, &def);
+        if (def==r) return (DECODE_OP(instr)==OP_LCT && MORPHO_ISSTRING(func->konst.data[DECODE_Bx(instr)]));
+        if (OPTIMIZE_INRANGE(o, j) && o->leader[OPTIMIZE_OFFSET(o, j)]) return false;
+    }
+    return false;
+}
+
+/** Finds what the code of the whole program assigns to, including code compiled previously */
+static void optimize_findassignments(optimizer *o, hoistcontext *ctx) {
+    varray_debugannotation *list=&o->prog->annotations;
+    objectfunction *func=o->prog->global, *last=NULL;
+    instructionindx i=0;
+
+    for (int g=0; g<o->prog->globals.count; g++) ctx->global[g]=false;
+    ctx->upvalue=false;
+    ctx->anyproperty=false;
+
+    for (unsigned int k=0; k<list->count; k++) {
+        debugannotation *ann=&list->data[k];
+        if (ann->type==DEBUG_FUNCTION) {
+            func=ann->content.function.function;
+        } else if (ann->type==DEBUG_ELEMENT) {
+            for (int j=0; j<ann->content.element.ninstr && i<o->end; j++, i++) {
+                instruction instr=OPTIMIZE_CODE(o, i);
+                switch (DECODE_OP(instr)) {
+                    case OP_SGL:
+                        if (func!=o->prog->global && DECODE_Bx(instr)<o->prog->globals.count) ctx->global[DECODE_Bx(instr)]=true;
+                        break;
+                    case OP_SUP:
+                        ctx->upvalue=true;
+                        break;
+                    case OP_SPR: case OP_SIX:
+                        if (func!=last) varray_valuewrite(&ctx->setters, MORPHO_OBJECT(func));
+                        last=func;
+                        
+                        /* Objects can be indexed by a property name computed at runtime */
+                        if (func!=o->prog->global &&
+                            (DECODE_OP(instr)==OP_SIX ||
+                             !optimize_namedbyconstant(o, func, i, DECODE_B(instr)))) ctx->anyproperty=true;
+                        break;
+                    default: break;
+                }
+            }
+        }
+    }
+}
+
+/** Determines whether a method of a class defined by the program, rather than a builtin, could be called with a given selector */
+static bool optimize_hasmethod(optimizer *o, value selector) {
+    for (unsigned int k=0; k<o->prog->classes.count; k++) {
+        value klass=o->prog->classes.data[k], fn;
+        if (MORPHO_ISCLASS(klass) &&
+            dictionary_get(&MORPHO_GETCLASS(klass)->methods, selector, &fn) &&
+            !MORPHO_ISBUILTINFUNCTION(fn)) return true;
+    }
+    return false;
+}
+
+static bool optimize_hasnamedmethod(optimizer *o, char *name) {
+    objectstring str = MORPHO_STATICSTRING(name);
+    return optimize_hasmethod(o, MORPHO_OBJECT(&str));
+}
+
+/** Finds the string constant held by register r at instruction i of a loop; a register that the loop doesn't write
+ *  holds whatever it held on entry to the loop */
+static bool optimize_resolvename(optimizer *o, loopinfo *loop, regset *defs, instructionindx i, int r, value *out) {
+    bool isinstance=false, found;
+    
+    if (regset_contains(defs, r)) found=optimize_resolveregister(o, loop->f, i, r, out, &isinstance);
+    else found=(loop->start>o->start && loop->start!=loop->f->func->entry &&
+                optimize_resolvefrom(o, loop->f, loop->start-1, r, out, &isinstance));
+    
+    return (found && !isinstance && MORPHO_ISSTRING(*out));
+}
+
+/** Determines whether an instruction could run code other than builtin functions. Arithmetic, indexing and printing
+ *  only do so if the program defines the corresponding method; invocations are assumed to call code unless they
+ *  are the enumerate and count methods used by for..in loops, and the program doesn't define these. */
+static bool optimize_maycall(optimizer *o, loopinfo *loop, regset *defs, instructionindx i) {
+    instruction instr=OPTIMIZE_CODE(o, i);
+
+    switch (DECODE_OP(instr)) {
+        case OP_CALL: case OP_METHOD:
+            return true;
+        case OP_INVOKE:
+        {
+            value selector;
+            if (!optimize_resolvename(o, loop, defs, i, DECODE_A(instr), &selector)) return true;
+            
+            char *name=MORPHO_GETCSTRING(selector);
+            if (strcmp(name, MORPHO_ENUMERATE_METHOD)!=0 &&
+                strcmp(name, MORPHO_COUNT_METHOD)!=0) return true;
+            return optimize_hasmethod(o, selector);
+        }
+        case OP_ADD: case OP_ADDF: case OP_ADDI:
+            return optimize_hasnamedmethod(o, MORPHO_ADD_METHOD) || optimize_hasnamedmethod(o, MORPHO_ADDR_METHOD);
+        case OP_SUB: case OP_SUBF: case OP_SUBI:
+            return optimize_hasnamedmethod(o, MORPHO_SUB_METHOD) || optimize_hasnamedmethod(o, MORPHO_SUBR_METHOD);
+        case OP_MUL: case OP_MULF: case OP_MULI:
+            return optimize_hasnamedmethod(o, MORPHO_MUL_METHOD) || optimize_hasnamedmethod(o, MORPHO_MULR_METHOD);
+        case OP_DIV: case OP_DIVF:
+            return optimize_hasnamedmethod(o, MORPHO_DIV_METHOD) || optimize_hasnamedmethod(o, MORPHO_DIVR_METHOD);
+        case OP_POW:
+            return optimize_hasnamedmethod(o, MORPHO_POW_METHOD) || optimize_hasnamedmethod(o, MORPHO_POWR_METHOD);
+        case OP_LIX:
+            return optimize_hasnamedmethod(o, MORPHO_GETINDEX_METHOD);
+        case OP_SIX:
+            return optimize_hasnamedmethod(o, MORPHO_SETINDEX_METHOD);
+        case OP_PRINT:
+            return optimize_hasnamedmethod(o, MORPHO_PRINT_METHOD);
+        default:
+            return false;
+    }
+}
+
+/** Determines whether a value called by a loop is a function or class of the program, or a builtin function */
+static bool optimize_iscallable(value fn) {
+    return (MORPHO_ISFUNCTION(fn) || MORPHO_ISCLASS(fn) || MORPHO_ISBUILTINFUNCTION(fn));
+}
+
+/** Determines whether the code run by a call in a loop can be identified, following the callee back to the constant
+ *  or global that it was loaded from. Other calls, and invocations of setindex, could assign any property. */
+static bool optimize_knowncallee(optimizer *o, loopinfo *loop, regset *defs, instructionindx i) {
+    optimizefunction *f=loop->f;
+    instruction instr=OPTIMIZE_CODE(o, i);
+    bool isglobal=(f->func==o->prog->global);
+    value fn;
+
+    switch (DECODE_OP(instr)) {
+        case OP_CALL: break;
+        case OP_INVOKE:
+            return (optimize_resolvename(o, loop, defs, i, DECODE_A(instr), &fn) &&
+                    strcmp(MORPHO_GETCSTRING(fn), MORPHO_SETINDEX_METHOD)!=0);
+        case OP_METHOD: return false;
+        default: return true;
+    }
+
+    int r=DECODE_A(instr);
+    instructionindx j=i-1;
+    if (!regset_contains(defs, r)) { // The callee was loaded ahead of the loop
+        if (loop->start<=o->start || loop->start==f->func->entry) return false;
+        j=loop->start-1;
+    } else if (o->leader[OPTIMIZE_OFFSET(o, i)]) return false;
+
+    for (;; j--) {
+        if (regset_contains(&f->captured, r)) return false;
+
+        regset use;
+        int def;
+        instr=OPTIMIZE_CODE(o, j);
+        optimize_registereffects(instr, isglobal, &use, &def);
+
+        if (def==r) switch (DECODE_OP(instr)) {
+            case OP_MOV:
+                r=DECODE_B(instr);
+                break;
+            case OP_LCT:
+                return optimize_iscallable(f->func->konst.data[DECODE_Bx(instr)]);
+            case OP_LGL:
+                return (optimize_globalconstant(o, DECODE_Bx(instr), &fn) && optimize_iscallable(fn));
+            default:
+                return false;
+        }
+
+        if (o->leader[OPTIMIZE_OFFSET(o, j)]) return false;
+    }
+}
+
+/** Determines whether a property could be assigned by a function called from a loop; an unknown name is given as nil */
+static bool optimize_maysetproperty(hoistcontext *ctx, value name) {
+    if (ctx->anyproperty) return true;
+    if (ctx->setters.count && MORPHO_ISNIL(name)) return true;
+    for (unsigned int k=0; k<ctx->setters.count; k++) {
+        objectfunction *func=MORPHO_GETFUNCTION(ctx->setters.data[k]);
+        for (unsigned int j=0; j<func->konst.count; j++) {
+            if (MORPHO_ISSTRING(func->konst.data[j]) && MORPHO_ISEQUAL(func->konst.data[j], name)) return true;
+        }
+    }
+    return false;
+}
+
+/** Determines whether an instruction in a loop is executed on every iteration that reaches the end of the loop, and hence
+ *  whenever the loop is entered if the loop's header is copied ahead of it. Other loads of properties can't be hoisted,
+ *  as they might raise an error. */
+static bool optimize_isguaranteed(optimizer *o, loopinfo *loop, instructionindx i, bool rotate) {
+    for (instructionindx j=loop->start; j<i; j++) {
+        instruction instr=OPTIMIZE_CODE(o, j);
+        if (!optimize_isbranch(instr) || (rotate && j==loop->exit)) continue;
+        if (optimize_branchtarget(instr, j)>i) return false;
+    }
+    return true;
+}
+
+/** Determines whether a load in a loop always yields the same value, and can be executed ahead of the loop
+ * @param[in] defs - registers written by the loop
+ * @param[in] calls - whether the loop may call other code
+ * @param[out] name - constant index of a property name that must be loaded ahead of the loop, or -1
+ * @param[out] rotate - set if the load can only be hoisted if the loop header is copied ahead of it */
+static bool optimize_isinvariant(optimizer *o, hoistcontext *ctx, loopinfo *loop, regset *defs, bool calls, instructionindx i, int *name, bool *rotate) {
+    optimizefunction *f=loop->f;
+    instruction instr=OPTIMIZE_CODE(o, i);
+    int op=DECODE_OP(instr);
+    value property=MORPHO_NIL;
+
+    *name=-1;
+    *rotate=false;
+
+    if (op==OP_LPR) {
+        int b=DECODE_B(instr), c=DECODE_C(instr);
+        if (regset_contains(defs, b) || regset_contains(&f->captured, b)) return false;
+
+        if (regset_contains(defs, c) || regset_contains(&f->captured, c)) {
+            indx k;
+            if (!optimize_resolvename(o, loop, defs, i, c, &property) ||
+                !optimize_addconstant(f->func, property, &k)) return false;
+            *name=(int) k;
+        } else if (!optimize_resolvename(o, loop, defs, i, c, &property)) property=MORPHO_NIL;
+
+        if (!optimize_isguaranteed(o, loop, i, false)) {
+            if (loop->exit<0 || loop->exit>=i ||
+                !optimize_isguaranteed(o, loop, i, true)) return false;
+            *rotate=true;
+        }
+
+        if (calls && (loop->anyproperty || optimize_maysetproperty(ctx, property))) return false;
+    } else if (op==OP_LGL) {
+        if (calls && ctx->global[DECODE_Bx(instr)]) return false;
+    } else if (op==OP_LUP) {
+        if (calls && ctx->upvalue) return false;
+    } else return false;
+
+    /* Look for assignments within the loop */
+    for (instructionindx j=loop->start; j<=loop->end; j++) {
+        instruction store=OPTIMIZE_CODE(o, j);
+        switch (DECODE_OP(store)) {
+            case OP_SGL:
+                if (op==OP_LGL && DECODE_Bx(store)==DECODE_Bx(instr)) return false;
+                break;
+            case OP_SUP:
+                if (op==OP_LUP && DECODE_A(store)==DECODE_B(instr)) return false;
+                break;
+            case OP_SPR:
+            {
+                value setname;
+                if (op==OP_LPR &&
+                    (MORPHO_ISNIL(property) ||
+                     !optimize_resolvename(o, loop, defs, j, DECODE_B(store), &setname) ||
+                     MORPHO_ISEQUAL(setname, property))) return false;
+            }
+                break;
+            case OP_SIX:
+                if (op==OP_LPR) return false;
+                break;
+            default: break;
+        }
+    }
+
+    return true;
+}
+
+/** Finds the loops of a function. Loops are only considered if they can only be entered through their first instruction. */
+static int optimize_findloops(optimizer *o, optimizefunction *f, loopinfo *loops, int nloops) {
+    int id=o->fid[OPTIMIZE_OFFSET(o, o->order[f->first])];
+
+    for (int k=0; k<f->count; k++) {
+        instructionindx i=o->order[f->first+k];
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (!optimize_isbranch(instr)) continue;
+
+        instructionindx t=optimize_branchtarget(instr, i);
+        if (t>i || !OPTIMIZE_INRANGE(o, t)) continue;
+
+        int l;
+        for (l=0; l<nloops; l++) if (loops[l].start==t) break;
+        if (l==nloops) {
+            loops[nloops++]=(loopinfo) { .start=t, .end=i, .exit=-1, .f=f };
+        } else if (loops[l].end<i) loops[l].end=i;
+    }
+
+    /* Check each loop's code belongs to the function and that the loop is only entered through its header */
+    int n=0;
+    for (int l=0; l<nloops; l++) {
+        loopinfo *loop=&loops[l];
+        bool valid=(loop->start==f->func->entry || loop->start==o->start ||
+                    o->fid[OPTIMIZE_OFFSET(o, loop->start-1)]==id);
+        if (f->func->entry>loop->start && f->func->entry<=loop->end) valid=false;
+
+        for (instructionindx i=loop->start; valid && i<=loop->end; i++) {
+            if (o->fid[OPTIMIZE_OFFSET(o, i)]!=id || DECODE_OP(OPTIMIZE_CODE(o, i))==OP_PUSHERR) valid=false;
+        }
+        for (int k=0; valid && k<f->count; k++) {
+            instructionindx i=o->order[f->first+k];
+            instruction instr=OPTIMIZE_CODE(o, i);
+            if (i>=loop->start && i<=loop->end) continue;
+            if (optimize_isbranch(instr)) {
+                instructionindx t=optimize_branchtarget(instr, i);
+                if (t>loop->start && t<=loop->end) valid=false;
+            }
+        }
+
+        if (!valid) continue;
+
+        /* A header that tests whether to leave the loop can be copied */
+        for (instructionindx i=loop->start; i<=loop->end; i++) {
+            instruction instr=OPTIMIZE_CODE(o, i);
+            if (!optimize_isbranch(instr)) continue;
+            instructionindx t=optimize_branchtarget(instr, i);
+            if ((DECODE_OP(instr)==OP_BIF || DECODE_OP(instr)==OP_BIFF) &&
+                t>loop->end && OPTIMIZE_INRANGE(o, t)) loop->exit=i;
+            break;
+        }
+
+        loops[n++]=*loop;
+    }
+    return n;
+}
+
+static int optimize_compareloops(const void *a, const void *b) {
+    const loopinfo *x=a, *y=b;
+    instructionindx lx=x->end-x->start, ly=y->end-y->start;
+    return (lx>ly ? -1 : (lx<ly ? 1 : (x->start<y->start ? -1 : 1)));
+}
+
+static int optimize_compareloopstarts(const void *a, const void *b) {
+    const loopinfo *x=a, *y=b;
+    return (x->start<y->start ? -1 : (x->start>y->start ? 1 : 0));
+}
+
+/** Identifies the loads that can be hoisted from a loop, allocating a new register to hold each value */
+static void optimize_hoistloads(optimizer *o, hoistcontext *ctx, loopinfo *loop, hoistedload *loads, int *nloads, int *hoisted) {
+    optimizefunction *f=loop->f;
+    bool isglobal=(f->func==o->prog->global);
+    regset defs, use;
+    bool calls=false;
+    int def;
+
+    regset_clear(&defs);
+    for (instructionindx i=loop->start; i<=loop->end; i++) {
+        optimize_registereffects(OPTIMIZE_CODE(o, i), isglobal, &use, &def);
+        regset_add(&defs, def);
+    }
+    for (instructionindx i=loop->start; i<=loop->end && !calls; i++) calls=optimize_maycall(o, loop, &defs, i);
+
+    loop->anyproperty=false;
+    for (instructionindx i=loop->start; i<=loop->end && calls && !loop->anyproperty; i++) {
+        loop->anyproperty=!optimize_knowncallee(o, loop, &defs, i);
+    }
+
+    loop->first=*nloads;
+    loop->nhoisted=0;
+    loop->rotate=false;
+    for (instructionindx i=loop->start; i<=loop->end; i++) {
+        int name;
+        bool rotate;
+        if (hoisted[OPTIMIZE_OFFSET(o, i)]>=0 ||
+            f->func->nregs>=MORPHO_MAXREGISTERS ||
+            !optimize_isinvariant(o, ctx, loop, &defs, calls, i, &name, &rotate)) continue;
+
+        hoisted[OPTIMIZE_OFFSET(o, i)]=*nloads;
+        loads[(*nloads)++]=(hoistedload) { .i=i, .reg=f->func->nregs++, .name=name };
+        loop->nhoisted++;
+        if (rotate) loop->rotate=true;
+    }
+
+    loop->size=0;
+    if (!loop->nhoisted) return;
+    for (int k=loop->first; k<loop->first+loop->nhoisted; k++) loop->size+=(loads[k].name>=0 ? 2 : 1);
+    if (loop->rotate) loop->size+=(int) (loop->exit-loop->start)+2;
+}
+
+/** Finds the new location of the destination t of a branch at from; branches that enter a loop from outside go to the code inserted ahead of it */
+static instructionindx optimize_hoisttarget(optimizer *o, loopinfo *loops, int nloops, instructionindx from, instructionindx t) {
+    instructionindx target=o->map[OPTIMIZE_OFFSET(o, t)];
+    for (int l=0; l<nloops; l++) {
+        if (loops[l].start==t && (from<loops[l].start || from>loops[l].end)) target-=loops[l].size;
+    }
+    return target;
+}
+
+/** Writes the instructions inserted ahead of a loop, which will be located starting at index at */
+static void optimize_expandpreheader(optimizer *o, loopinfo *loops, int nloops, loopinfo *loop, hoistedload *loads, instruction *out, instructionindx at) {
+    instructionindx pos=at;
+
+    /* Copy the loop header */
+    if (loop->rotate) for (instructionindx i=loop->start; i<=loop->exit; i++, pos++) {
+        instruction instr=OPTIMIZE_CODE(o, i);
+        if (i==loop->exit) instr=optimize_setbranch(instr, pos, optimize_hoisttarget(o, loops, nloops, i, optimize_branchtarget(instr, i)));
+        *(out++)=instr;
+    }
+
+    for (int k=loop->first; k<loop->first+loop->nhoisted; k++, pos++) {
+        hoistedload *load=&loads[k];
+        instruction instr=OPTIMIZE_CODE(o, load->i);
+        if (load->name>=0) {
+            *(out++)=ENCODE_LONG(OP_LCT, load->reg, load->name);
+            instr=optimize_setC(instr, load->reg);
+            pos++;
+        }
+        *(out++)=optimize_setA(instr, load->reg);
+    }
+
+    /* Continue with the body of the loop */
+    if (loop->rotate) *out=optimize_setbranch(ENCODE_BYTE(OP_B), pos, optimize_hoisttarget(o, loops, nloops, loop->exit, loop->exit+1));
+}
+
+/** Inserts the loads hoisted ahead of each loop and replaces them in the loop with moves, fixing up everything that refers to an instruction index */
+static bool optimize_applyhoist(optimizer *o, loopinfo *loops, int nloops, hoistedload *loads, int *hoisted, int growth) {
+    int n=(int) (o->end-o->start);
+    instruction *code=MORPHO_MALLOC(sizeof(instruction)*(n+growth+1));
+    if (!code || !varray_instructionresize(&o->prog->code, growth)) {
+        if (code) MORPHO_FREE(code);
+        return false;
+    }
+
+    qsort(loops, nloops, sizeof(loopinfo), optimize_compareloopstarts);
+
+    /* Instructions are mapped to their new location, after any code inserted ahead of them */
+    instructionindx k=o->start;
+    for (int i=0, l=0; i<n; i++) {
+        if (l<nloops && loops[l].start==o->start+i) k+=loops[(l++)].size;
+        o->map[i]=k++;
+    }
+    o->map[n]=k;
+
+    for (instructionindx i=o->start, l=0; i<o->end; i++) {
+        instructionindx newi=o->map[OPTIMIZE_OFFSET(o, i)];
+        if (l<nloops && loops[l].start==i) {
+            optimize_expandpreheader(o, loops, nloops, &loops[l], loads, code+OPTIMIZE_OFFSET(o, newi-loops[l].size), newi-loops[l].size);
+            l++;
+        }
+
+        instruction instr=OPTIMIZE_CODE(o, i);
+        int h=hoisted[OPTIMIZE_OFFSET(o, i)];
+        if (h>=0) {
+            instr=ENCODE_DOUBLE(OP_MOV, DECODE_A(instr), loads[h].reg);
+        } else if (optimize_isbranch(instr)) {
+            instructionindx t=optimize_branchtarget(instr, i);
+            if (t>=o->start && t<=o->end) instr=optimize_setbranch(instr, newi, optimize_hoisttarget(o, loops, nloops, i, t));
+        }
+        code[OPTIMIZE_OFFSET(o, newi)]=instr;
+    }
+
+    memcpy(o->prog->code.data+o->start, code, sizeof(instruction)*(n+growth));
+    o->prog->code.count+=growth;
+    MORPHO_FREE(code);
+
+    /* Inserted code is attributed to the element that contains the start of the loop */
+    varray_debugannotation *list=&o->prog->annotations;
+    instructionindx i=0;
+    int l=0;
+    for (unsigned int j=0; j<list->count; j++) {
+        debugannotation *ann=&list->data[j];
+        if (ann->type!=DEBUG_ELEMENT) continue;
+
+        int ninstr=ann->content.element.ninstr;
+        for (int m=0; m<ninstr; m++, i++) {
+            if (l<nloops && loops[l].start==i) ann->content.element.ninstr+=loops[(l++)].size;
+        }
+    }
+
+    /* A function that begins with a loop should begin with the inserted code */
+    for (int m=0; m<o->nfunctions; m++) {
+        objectfunction *func=o->functions[m].func;
+        if (func->entry>=o->start && func->entry<=o->end) func->entry=optimize_hoisttarget(o, loops, nloops, func->entry-1, func->entry);
+    }
+    optimize_handlertargets(o, optimize_remaphandler);
+
+    o->end+=growth;
+    return true;
+}
+
+/** Moves loads of globals, upvalues and properties that don't change within a loop ahead of the loop
+ *  @returns the number of loads hoisted */
+static int optimize_hoist(optimizer *o) {
+    int n=(int) (o->end-o->start), nloops=0, nloads=0, growth=0;
+    loopinfo *loops=MORPHO_MALLOC(sizeof(loopinfo)*(n+1));
+    hoistedload *loads=MORPHO_MALLOC(sizeof(hoistedload)*(n+1));
+    int *hoisted=MORPHO_MALLOC(sizeof(int)*(n+1));
+    hoistcontext ctx;
+    ctx.global=MORPHO_MALLOC(sizeof(bool)*(o->prog->globals.count+1));
+    varray_valueinit(&ctx.setters);
+
+    if (loops && loads && hoisted && ctx.global) {
+        optimize_orderinstructions(o);
+        optimize_findleaders(o);
+        optimize_findassignments(o, &ctx);
+
+        for (int k=0; k<n; k++) hoisted[k]=-1;
+
+        int nhoistloops=0;
+        for (int k=0; k<o->nfunctions; k++) {
+            optimizefunction *f=&o->functions[k];
+            if (f->haserrorhandler || f->hasbreakpoint || !f->count) continue;
+
+            int nfound=optimize_findloops(o, f, loops+nloops, 0);
+
+            /* Loads are hoisted from the outermost loop in which they are invariant */
+            qsort(loops+nloops, nfound, sizeof(loopinfo), optimize_compareloops);
+            for (int l=nloops; l<nloops+nfound; l++) {
+                optimize_hoistloads(o, &ctx, &loops[l], loads, &nloads, hoisted);
+                if (loops[l].nhoisted) {
+                    growth+=loops[l].size;
+                    loops[nhoistloops++]=loops[l];
+                }
+            }
+            nloops=nhoistloops;
+        }
+
+        if (nloops && !optimize_applyhoist(o, loops, nloops, loads, hoisted, growth)) nloads=0;
+    }
+
+    if (loops) MORPHO_FREE(loops);
+    if (loads) MORPHO_FREE(loads);
+    if (hoisted) MORPHO_FREE(hoisted);
+    if (ctx.global) MORPHO_FREE(ctx.global);
+    varray_valueclear(&ctx.setters);
+
+    optimize_stats.nhoisted+=nloads;
+    return nloads;
+}
+
+/* **********************************************************************
+ * Interface
+ * ********************************************************************** */
+
+/** Sweeps over the code repeatedly until no further changes are made */
+static void optimize_sweep(optimizer *o) {
+    for (int pass=0; pass<OPTIMIZE_MAXPASSES; pass++) {
+        int nchanged=0;
+
+        nchanged+=optimize_threadjumps(o);
+
+        optimize_orderinstructions(o);
+        optimize_findleaders(o);
+
+        for (int k=0; k<o->nfunctions; k++) {
+            optimizefunction *f=&o->functions[k];
+            if (f->hasbreakpoint || !f->count) continue;
+            nchanged+=optimize_constants(o, f);
+            if (!f->haserrorhandler) nchanged+=optimize_deadstores(o, f);
+        }
+
+        nchanged+=optimize_unreachable(o);
+        nchanged+=optimize_compact(o);
+
+        if (!nchanged) break;
+    }
+}
+
+/** Rebuilds the optimizer's state after the code has been rewritten and sweeps over it again */
+static bool optimize_restart(optimizer *o, program *in) {
+    optimize_clear(o);
+    if (!optimize_init(o, in) ||
+        !optimize_findfunctions(o)) return false;
+    optimize_sweep(o);
+    return true;
+}
+
+/** Optimizes the code compiled since the program's entry point; can be used with morpho_setoptimizer */
+bool optimize_program(program *in) {
+    optimizer o;
+    bool success=false;
+
+    optimize_stats=(optimizerstatistics) { .ninstructionsin=(int) (in->code.count-program_getentry(in)) };
+
+    if (optimize_init(&o, in) &&
+        optimize_findfunctions(&o)) {
+        optimize_sweep(&o);
+
+        /* Inlining and hoisting invalidate the optimizer's state, so rebuild it before sweeping again */
+        bool ready=true;
+        if (optimize_inline(&o)) ready=optimize_restart(&o, in);
+        if (ready && optimize_hoist(&o)) optimize_restart(&o, in);
+        success=true;
+    }
+
+    optimize_clear(&o);
+
+    optimize_stats.ninstructionsout=(int) (in->code.count-program_getentry(in));
+
+#ifdef MORPHO_DEBUG_LOGOPTIMIZER
+    printf("[Optimizer] %i instructions -> %i instructions (%i folded, %i branches threaded, %i stores eliminated, %i unreachable removed, %i calls inlined, %i loads hoisted)\n", optimize_stats.ninstructionsin, optimize_stats.ninstructionsout, optimize_stats.nfolded, optimize_stats.nthreaded, optimize_stats.nstores, optimize_stats.nunreachable, optimize_stats.ninlined, optimize_stats.nhoisted);
+#endif
+
+    return success;
+}
+
+/** Retrieves statistics from the most recent run of the optimizer */
+void optimize_getstatistics(optimizerstatistics *stats) {
+    *stats=optimize_stats;
+}
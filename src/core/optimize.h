@@ -0,0 +1,51 @@
+/** @file optimize.h
+ *  @author T J Atherton
+ *
+ *  @brief Optimizer for compiled morpho bytecode
+*/
+
+#ifndef optimize_h
+#define optimize_h
+
+#include "compile.h"
+
+/* **********************************************************************
+ * Optimizer settings
+ * ********************************************************************** */
+
+/** @brief Maximum number of sweeps the optimizer makes over newly compiled code */
+#define OPTIMIZE_MAXPASSES 8
+
+/** @brief Maximum length of a chain of branches that will be threaded */
+#define OPTIMIZE_MAXTHREADING 16
+
+/** @brief Maximum number of instructions in a function that will be inlined */
+#define OPTIMIZE_INLINESIZE 24
+
+/** @brief Maximum factor by which inlining may increase the size of the code */
+#define OPTIMIZE_INLINEGROWTH 2
+
+/* **********************************************************************
+ * Optimizer statistics
+ * ********************************************************************** */
+
+/** @brief Records what the most recent run of the optimizer achieved */
+typedef struct {
+    int ninstructionsin; /** Number of instructions presented to the optimizer */
+    int ninstructionsout; /** Number of instructions remaining after optimization */
+    int nfolded; /** Number of constant expressions and conditional branches resolved */
+    int nthreaded; /** Number of branches retargeted or removed */
+    int nstores; /** Number of dead stores and redundant moves eliminated */
+    int nunreachable; /** Number of unreachable instructions removed */
+    int ninlined; /** Number of calls replaced by the body of the function called */
+    int nhoisted; /** Number of loads moved out of loops */
+} optimizerstatistics;
+
+/* **********************************************************************
+ * Interface
+ * ********************************************************************** */
+
+bool optimize_program(program *in);
+void optimize_getstatistics(optimizerstatistics *stats);
+
+#endif /* optimize_h */
@@ -85,13 +85,13 @@ static void vm_init(vm *v) {
 
 /** Clears a virtual machine */
 static void vm_clear(vm *v) {
+    vm_freeobjects(v); // Free objects first, as some may wait on subkernels still using the globals
     varray_valueclear(&v->stack);
     varray_valueclear(&v->globals);
     varray_valueclear(&v->tlvars);
     varray_valueclear(&v->retain);
     vm_graylistclear(&v->gray);
     varray_charclear(&v->buffer);
-    vm_freeobjects(v);
     
     for (int i=0; i<v->subkernels.count; i++) {
         vm *subkernel = v->subkernels.data[i];
@@ -218,6 +218,62 @@ static void vm_bindobjectwithoutcollect(vm *v, value obj) {
     v->bound+=size;
 }
 
+static value vm_cloneconstant(vm *v, value in);
+
+/** @brief Replaces a list, dictionary or tuple nested within a copied constant with a copy of its own */
+static bool vm_clonenested(vm *v, value *el) {
+    if (!MORPHO_ISLIST(*el) && !MORPHO_ISDICTIONARY(*el) && !MORPHO_ISTUPLE(*el)) return true;
+    *el=vm_cloneconstant(v, *el);
+    if (MORPHO_ISNIL(*el)) return false;
+    vm_bindobjectwithoutcollect(v, *el);
+    return true;
+}
+
+/** @brief Copies a constant list, dictionary, tuple or matrix
+ *  @details Lists, dictionaries and tuples nested within the constant are copied too; these are bound to the VM as they are created
+ *  @param v      the virtual machine
+ *  @param in     the constant to copy
+ *  @returns the copy, which is not yet bound to the VM, or MORPHO_NIL if allocation failed */
+static value vm_cloneconstant(vm *v, value in) {
+    object *out=NULL;
+    bool success=true;
+
+    if (MORPHO_ISLIST(in)) {
+        objectlist *list = list_clone(MORPHO_GETLIST(in));
+        if (list) for (unsigned int i=0; i<list->val.count && success; i++) {
+            success=vm_clonenested(v, &list->val.data[i]);
+        }
+        out=(object *) list;
+    } else if (MORPHO_ISDICTIONARY(in)) {
+        objectdictionary *dict = object_newdictionary();
+        if (dict) {
+            success=dictionary_copy(&MORPHO_GETDICTIONARY(in)->dict, &dict->dict);
+            for (unsigned int i=0; i<dict->dict.capacity && success; i++) {
+                if (!MORPHO_ISNIL(dict->dict.contents[i].key)) success=vm_clonenested(v, &dict->dict.contents[i].val);
+            }
+        }
+        out=(object *) dict;
+    } else if (MORPHO_ISTUPLE(in)) {
+        objecttuple *tuple = MORPHO_GETTUPLE(in);
+        objecttuple *new = object_newtuple(tuple->length, tuple->tuple);
+        if (new) for (unsigned int i=0; i<new->length && success; i++) {
+            success=vm_clonenested(v, &new->tuple[i]);
+        }
+        out=(object *) new;
+#ifdef MORPHO_INCLUDE_LINALG
+    } else if (MORPHO_ISMATRIX(in)) {
+        out=(object *) object_clonematrix(MORPHO_GETMATRIX(in));
+#endif
+    }
+
+    if (out && !success) {
+        object_free(out);
+        out=NULL;
+    }
+
+    return (out ? MORPHO_OBJECT(out) : MORPHO_NIL);
+}
+
 /* **********************************************************************
 * Virtual machine
 * ********************************************************************** */
@@ -730,10 +786,18 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             reg[a] = v->konst[b];
             DISPATCH();
 
+        CASE_CODE(CLONE):
+            a=DECODE_A(bc); b=DECODE_Bx(bc);
+            reg[a] = vm_cloneconstant(v, v->konst[b]);
+            if (MORPHO_ISNIL(reg[a])) ERROR(ERROR_ALLOCATIONFAILED);
+            vm_bindobject(v, reg[a]);
+            DISPATCH();
+
         CASE_CODE(ADD):
             a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
             left = reg[b];
             right = reg[c];
+addvalues: // Specialised instructions jump here if their operands are of other types
 
             if (MORPHO_ISFLOAT(left)) {
                 if (MORPHO_ISFLOAT(right)) {
@@ -771,6 +835,7 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
             left = reg[b];
             right = reg[c];
+subvalues:
 
             if (MORPHO_ISFLOAT(left)) {
                 if (MORPHO_ISFLOAT(right)) {
@@ -799,6 +864,7 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
             left = reg[b];
             right = reg[c];
+mulvalues:
 
             if (MORPHO_ISFLOAT(left)) {
                 if (MORPHO_ISFLOAT(right)) {
@@ -827,6 +893,7 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
             left = reg[b];
             right = reg[c];
+divvalues:
 
             if (MORPHO_ISFLOAT(left)) {
                 if (MORPHO_ISFLOAT(right)) {
@@ -911,7 +978,7 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
             left = reg[b];
             right = reg[c];
-
+ltvalues:
             if ( !( (MORPHO_ISFLOAT(left) || MORPHO_ISINTEGER(left)) &&
                    (MORPHO_ISFLOAT(right) || MORPHO_ISINTEGER(right)) ) ) {
                 OPERROR("Compare");
@@ -924,7 +991,7 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
             left = reg[b];
             right = reg[c];
-
+levalues:
             if ( !( (MORPHO_ISFLOAT(left) || MORPHO_ISINTEGER(left)) &&
                    (MORPHO_ISFLOAT(right) || MORPHO_ISINTEGER(right)) ) ) {
                 OPERROR("Compare");
@@ -933,6 +1000,100 @@ bool morpho_interpret(vm *v, value *rstart, instructionindx istart) {
             reg[a] = (morpho_extendedcomparevalue(left, right)>=0 ? MORPHO_BOOL(true) : MORPHO_BOOL(false));
             DISPATCH();
 
+        CASE_CODE(ADDF):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISFLOAT(left) && MORPHO_ISFLOAT(right))) goto addvalues;
+            reg[a] = MORPHO_FLOAT( MORPHO_GETFLOATVALUE(left) + MORPHO_GETFLOATVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(SUBF):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISFLOAT(left) && MORPHO_ISFLOAT(right))) goto subvalues;
+            reg[a] = MORPHO_FLOAT( MORPHO_GETFLOATVALUE(left) - MORPHO_GETFLOATVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(MULF):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISFLOAT(left) && MORPHO_ISFLOAT(right))) goto mulvalues;
+            reg[a] = MORPHO_FLOAT( MORPHO_GETFLOATVALUE(left) * MORPHO_GETFLOATVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(DIVF):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISFLOAT(left) && MORPHO_ISFLOAT(right))) goto divvalues;
+            reg[a] = MORPHO_FLOAT( MORPHO_GETFLOATVALUE(left) / MORPHO_GETFLOATVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(LTF):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISFLOAT(left) && MORPHO_ISFLOAT(right))) goto ltvalues;
+            {   /* Floats that agree to within the comparison tolerance are equal */
+                double l = MORPHO_GETFLOATVALUE(left), r = MORPHO_GETFLOATVALUE(right);
+                reg[a] = MORPHO_BOOL(l<r && !morpho_doubleeqtest(l, r));
+            }
+            DISPATCH();
+
+        CASE_CODE(LEF):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISFLOAT(left) && MORPHO_ISFLOAT(right))) goto levalues;
+            {
+                double l = MORPHO_GETFLOATVALUE(left), r = MORPHO_GETFLOATVALUE(right);
+                reg[a] = MORPHO_BOOL(l<r || morpho_doubleeqtest(l, r));
+            }
+            DISPATCH();
+
+        CASE_CODE(ADDI):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISINTEGER(left) && MORPHO_ISINTEGER(right))) goto addvalues;
+            reg[a] = MORPHO_INTEGER( MORPHO_GETINTEGERVALUE(left) + MORPHO_GETINTEGERVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(SUBI):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISINTEGER(left) && MORPHO_ISINTEGER(right))) goto subvalues;
+            reg[a] = MORPHO_INTEGER( MORPHO_GETINTEGERVALUE(left) - MORPHO_GETINTEGERVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(MULI):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISINTEGER(left) && MORPHO_ISINTEGER(right))) goto mulvalues;
+            reg[a] = MORPHO_INTEGER( MORPHO_GETINTEGERVALUE(left) * MORPHO_GETINTEGERVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(LTI):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISINTEGER(left) && MORPHO_ISINTEGER(right))) goto ltvalues;
+            reg[a] = MORPHO_BOOL( MORPHO_GETINTEGERVALUE(left) < MORPHO_GETINTEGERVALUE(right));
+            DISPATCH();
+
+        CASE_CODE(LEI):
+            a=DECODE_A(bc); b=DECODE_B(bc); c=DECODE_C(bc);
+            left = reg[b];
+            right = reg[c];
+            if (!(MORPHO_ISINTEGER(left) && MORPHO_ISINTEGER(right))) goto levalues;
+            reg[a] = MORPHO_BOOL( MORPHO_GETINTEGERVALUE(left) <= MORPHO_GETINTEGERVALUE(right));
+            DISPATCH();
+
         CASE_CODE(B):
             b=DECODE_sBx(bc);
             pc+=b;
@@ -1991,11 +2152,14 @@ bool vm_subkernels(vm *v, int nkernels, vm **subkernels) {
     int nk=0;
     
     /* Check for unused subkernels */
-    for (int i=0; i<v->subkernels.count; i++) {
+    for (int i=0; i<v->subkernels.count && nk<nkernels; i++) {
         vm *kernel=v->subkernels.data[i];
         if (!kernel->parent) { // Check whether subkernel is unused
             subkernels[nk]=kernel;
             kernel->parent=v;
+            error_clear(&kernel->err); // Any error was passed on when the subkernel was released
+            kernel->globals.count=v->globals.count; // Globals may have been reallocated since last use
+            kernel->globals.data=v->globals.data;
             nk++;
         }
     }
@@ -2024,7 +2188,10 @@ void vm_releasesubkernel(vm *subkernel) {
     if (subkernel->objects) {
         object *obj;
     
+        /* Objects may have been marked while they belonged to the subkernel, e.g. by a task's result; the parent's
+           collector never unmarks them, and would skip tracing them if they remained marked */
         for (obj=subkernel->objects; obj!=NULL; obj=obj->next) {
+            obj->status=OBJECT_ISUNMARKED;
             if (obj->next==NULL) break;
         }
         
@@ -2049,6 +2216,16 @@ void vm_releasesubkernel(vm *subkernel) {
     subkernel->parent=NULL;
 }
 
+/** Checks whether a vm is a subkernel in use by another vm */
+bool vm_issubkernel(vm *v) {
+    return (v->parent!=NULL);
+}
+
+/** Clears marks left on a subkernel's objects by a collection in the parent, whose sweep doesn't reach them */
+void vm_unmarksubkernel(vm *subkernel) {
+    for (object *obj=subkernel->objects; obj!=NULL; obj=obj->next) obj->status=OBJECT_ISUNMARKED;
+}
+
 /** Clean out attached objects from a subkernel */
 void vm_cleansubkernel(vm *subkernel) {
     object *next=NULL;
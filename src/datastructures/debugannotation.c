@@ -74,6 +74,18 @@ void debugannotation_poperr(varray_debugannotation *list) {
     debugannotation_add(list, &ann);
 }
 
+/** Begins the code of a function inlined at a call on a given line */
+void debugannotation_pushinline(varray_debugannotation *list, objectfunction *func, int line, int posn) {
+    debugannotation ann = { .type = DEBUG_PUSHINLINE, .content.inlined.function = func, .content.inlined.line = line, .content.inlined.posn = posn };
+    debugannotation_add(list, &ann);
+}
+
+/** Ends the code of an inlined function */
+void debugannotation_popinline(varray_debugannotation *list) {
+    debugannotation ann = { .type = DEBUG_POPINLINE };
+    debugannotation_add(list, &ann);
+}
+
 /** Uses information from a syntaxtreenode to associate a sequence of instructions with source */
 void debugannotation_addnode(varray_debugannotation *list, syntaxtreenode *node) {
     if (!node) return;
@@ -146,6 +158,14 @@ void debugannotation_showannotations(varray_debugannotation *list) {
             case DEBUG_POPERR:
                 printf("Poperr: ");
                 break;
+            case DEBUG_PUSHINLINE:
+                printf("Pushinline: ");
+                morpho_printvalue(NULL, MORPHO_OBJECT(ann->content.inlined.function));
+                printf(" line: %i posn: %i", ann->content.inlined.line, ann->content.inlined.posn);
+                break;
+            case DEBUG_POPINLINE:
+                printf("Popinline: ");
+                break;
             case DEBUG_REGISTER:
                 printf("Register: %ti ", ann->content.reg.reg);
                 morpho_printvalue(NULL, ann->content.reg.symbol);
@@ -25,7 +25,9 @@ typedef struct {
         DEBUG_GLOBAL, // Associates a symbol with a global
         DEBUG_ELEMENT, // Associates a sequence of instructions with a code element
         DEBUG_PUSHERR, // Push an error handler
-        DEBUG_POPERR // Pop an error handler
+        DEBUG_POPERR, // Pop an error handler
+        DEBUG_PUSHINLINE, // Begin the code of a function inlined at a call
+        DEBUG_POPINLINE // End the code of an inlined function
     } type;
     union {
         struct {
@@ -53,6 +55,11 @@ typedef struct {
             int line;
             int posn;
         } element;
+        struct {
+            objectfunction *function;
+            int line;
+            int posn;
+        } inlined;
     } content;
 } debugannotation;
 
@@ -72,6 +79,8 @@ void debugannotation_setreg(varray_debugannotation *list, indx reg, value symbol
 void debugannotation_setglobal(varray_debugannotation *list, indx gindx, value symbol);
 void debugannotation_pusherr(varray_debugannotation *list, objectdictionary *dict);
 void debugannotation_poperr(varray_debugannotation *list);
+void debugannotation_pushinline(varray_debugannotation *list, objectfunction *func, int line, int posn);
+void debugannotation_popinline(varray_debugannotation *list);
 void debugannotation_addnode(varray_debugannotation *list, syntaxtreenode *node);
 void debugannotation_clear(varray_debugannotation *list);
 
@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include "dictionary.h"
 #include "common.h"
@@ -432,9 +433,16 @@ bool dictionary_remove(dictionary *dict, value key) {
     return false;
 }
 
-/** @brief Copies the entries of one dictionary to another */
+/** @brief Copies the entries of one dictionary to another
+ *  @details If the destination is empty, the table is duplicated rather than rebuilt entry by entry */
 bool dictionary_copy(dictionary *src, dictionary *dest) {
-    if (src->contents) {
+    if (src->contents && !dest->contents) {
+        dest->contents=MORPHO_MALLOC(src->capacity * sizeof(dictionaryentry));
+        if (!dest->contents) return false;
+        memcpy(dest->contents, src->contents, src->capacity * sizeof(dictionaryentry));
+        dest->capacity=src->capacity;
+        dest->count=src->count;
+    } else if (src->contents) {
         for (unsigned int i=0; i<src->capacity; i++) {
             dictionaryentry *e = &src->contents[i];
             if (!MORPHO_ISNIL(e->key)) {
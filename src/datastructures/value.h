@@ -208,6 +208,9 @@ int morpho_comparevalue(value a, value b);
 /** Compare two values, even if they have inequivalent types e.g. int and float */
 int morpho_extendedcomparevalue(value a, value b);
 
+/** Test if two doubles are equal to within the tolerance used to compare values */
+bool morpho_doubleeqtest(double a, double b);
+
 /** Macro to test if two values are equal, checking contents of objects where supported */
 #define MORPHO_ISEQUAL(a,b) (!morpho_comparevalue(a,b))
 
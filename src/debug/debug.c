@@ -195,32 +195,84 @@ bool debug_symbolforglobal(program *p, indx id, value *symbol) {
  * Stack traces
  * ********************************************************************** */
 
-/** Prints a stacktrace */
+/** Finds the calls that were inlined where the instruction at indx is, outermost first, together with the module each call was made from
+ * @returns the number of calls found, at most max */
+static int debug_inlinedfromindx(program *code, instructionindx indx, int max, debugannotation **out, value *module) {
+    value current=MORPHO_NIL;
+    instructionindx i=0;
+    int depth=0;
+    
+    for (unsigned int j=0; j<code->annotations.count; j++) {
+        debugannotation *ann = &code->annotations.data[j];
+        switch (ann->type) {
+            case DEBUG_ELEMENT:
+                if (i+ann->content.element.ninstr>indx) return (depth<max ? depth : max);
+                i+=ann->content.element.ninstr;
+                break;
+            case DEBUG_MODULE:
+                current=ann->content.module.module;
+                break;
+            case DEBUG_PUSHINLINE:
+                if (depth<max) {
+                    out[depth]=ann;
+                    module[depth]=current;
+                }
+                depth++;
+                break;
+            case DEBUG_POPINLINE:
+                if (depth>0) depth--;
+                break;
+            default: break;
+        }
+    }
+    
+    return 0;
+}
+
+/** Prints one entry of a stacktrace */
+static void debug_printtraceentry(vm *v, bool current, value name, bool hasline, int line, value module) {
+    morpho_printf(v, "  ");
+    morpho_printf(v, "%s", (current ? "  in " : "from "));
+    
+    if (!MORPHO_ISNIL(name)) morpho_printvalue(v, name);
+    else morpho_printf(v, "global");
+    
+    if (hasline) {
+        morpho_printf(v, " at line %u", line);
+        
+        if (!MORPHO_ISNIL(module)) {
+            morpho_printf(v, " in module '");
+            morpho_printvalue(v, module);
+            morpho_printf(v, "'");
+        }
+    }
+    
+    morpho_printf(v, "\n");
+}
+
+/** Prints a stacktrace; functions inlined into a frame are listed as if they had been called */
 void morpho_stacktrace(vm *v) {
     for (callframe *f = (v->errfp ? v->errfp : v->fp); f!=NULL && f>=v->frame; f--) {
         instructionindx indx = f->pc-v->current->code.data;
         if (indx>0) indx--; /* Because the pc always points to the NEXT instr. */
         
-        morpho_printf(v, "  ");
-        morpho_printf(v, "%s", (f==v->fp ? "  in " : "from "));
-        
-        if (!MORPHO_ISNIL(f->function->name)) morpho_printvalue(v, f->function->name);
-        else morpho_printf(v, "global");
-        
+        bool current=(f==v->fp);
         int line=0;
         
         value module = MORPHO_NIL;
-        if (debug_infofromindx(v->current, indx, &module, &line, NULL, NULL, NULL)) {
-            morpho_printf(v, " at line %u", line);
-            
-            if (!MORPHO_ISNIL(module)) {
-                morpho_printf(v, " in module '");
-                morpho_printvalue(v, module);
-                morpho_printf(v, "'");
-            }
+        bool hasline=debug_infofromindx(v->current, indx, &module, &line, NULL, NULL, NULL);
+        
+        debugannotation *inlined[DEBUG_MAXINLINEDEPTH];
+        value callermodule[DEBUG_MAXINLINEDEPTH];
+        int n = (hasline ? debug_inlinedfromindx(v->current, indx, DEBUG_MAXINLINEDEPTH, inlined, callermodule) : 0);
+        for (int k=n-1; k>=0; k--) {
+            debug_printtraceentry(v, current, inlined[k]->content.inlined.function->name, true, line, module);
+            line=inlined[k]->content.inlined.line;
+            module=callermodule[k];
+            current=false;
         }
         
-        morpho_printf(v, "\n");
+        debug_printtraceentry(v, current, f->function->name, hasline, line, module);
     }
 }
 
@@ -332,6 +384,7 @@ assemblyrule assemblyrules[] ={
     { OP_NOP, "nop", "" },
     { OP_MOV, "mov", "rA, rB" },
     { OP_LCT, "lct", "rA, cX" },
+    { OP_CLONE, "clone", "rA, cX" },
     { OP_ADD, "add", "rA, rB, rC" },
     { OP_SUB, "sub", "rA, rB, rC" },
     { OP_MUL, "mul", "rA, rB, rC" },
@@ -344,6 +397,19 @@ assemblyrule assemblyrules[] ={
     { OP_LT, "lt ", "rA, rB, rC" },
     { OP_LE, "le ", "rA, rB, rC" },
     
+    { OP_ADDF, "addf", "rA, rB, rC" },
+    { OP_SUBF, "subf", "rA, rB, rC" },
+    { OP_MULF, "mulf", "rA, rB, rC" },
+    { OP_DIVF, "divf", "rA, rB, rC" },
+    { OP_LTF, "ltf", "rA, rB, rC" },
+    { OP_LEF, "lef", "rA, rB, rC" },
+    
+    { OP_ADDI, "addi", "rA, rB, rC" },
+    { OP_SUBI, "subi", "rA, rB, rC" },
+    { OP_MULI, "muli", "rA, rB, rC" },
+    { OP_LTI, "lti", "rA, rB, rC" },
+    { OP_LEI, "lei", "rA, rB, rC" },
+    
     { OP_PRINT, "print", "rA" },
     
     { OP_B, "b", "+" },
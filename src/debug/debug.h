@@ -15,6 +15,9 @@
 
 #define DEBUG_ISSINGLESTEP(d) ((d) && (d->singlestep))
 
+/** Maximum depth of inlined calls reported in a stacktrace */
+#define DEBUG_MAXINLINEDEPTH 16
+
 /* -------------------------------------------------------
  * Debugger error messages
  * ------------------------------------------------------- */
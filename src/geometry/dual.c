@@ -0,0 +1,212 @@
+/** @file dual.c
+ *  @author T J Atherton
+ *
+ *  @brief Hyper-dual numbers for evaluating exact first and second derivatives
+*/
+
+#include "build.h"
+#ifdef MORPHO_INCLUDE_GEOMETRY
+
+#include <math.h>
+#include "dual.h"
+
+/* **********************************************************************
+ * Creating dual numbers
+ * ********************************************************************** */
+
+/** Creates a dual number that doesn't depend on any variable */
+void dual_constant(double val, dual *out) {
+    out->val=val;
+    out->n=0;
+    out->hessian=false;
+}
+
+/** Creates a dual number for variable i
+ * @param[in] val - value of the variable
+ * @param[in] i - index of the variable
+ * @param[in] hessian - whether to track second derivatives
+ * @param[out] out - the dual number
+ * @returns false if i exceeds the maximum number of variables */
+bool dual_variable(double val, int i, bool hessian, dual *out) {
+    if (i<0 || i>=DUAL_MAXVARIABLES) return false;
+    out->val=val;
+    out->n=i+1;
+    out->hessian=hessian;
+    for (int k=0; k<i; k++) out->grad[k]=0.0;
+    out->grad[i]=1.0;
+    if (hessian) for (int k=0; k<DUAL_HESSIANINDEX(0, i+1); k++) out->hess[k]=0.0;
+    return true;
+}
+
+/** Gets the derivative with respect to variable i */
+double dual_gradient(dual *a, int i) {
+    return (i<a->n ? a->grad[i] : 0.0);
+}
+
+/** Gets the second derivative with respect to variables i and j */
+double dual_hessian(dual *a, int i, int j) {
+    if (!a->hessian) return 0.0;
+    if (i>j) { int t=i; i=j; j=t; }
+    return (j<a->n ? a->hess[DUAL_HESSIANINDEX(i, j)] : 0.0);
+}
+
+/* **********************************************************************
+ * Applying functions
+ * ********************************************************************** */
+
+/** Applies a function of one argument by the chain rule, given its value and derivatives at a; out may be the same as a */
+void dual_unary(dual *a, double f, double df, double d2f, dual *out) {
+    int n=a->n;
+
+    if (a->hessian) { // Second derivatives must be found before the first derivatives are overwritten
+        for (int j=0; j<n; j++) {
+            for (int i=0; i<=j; i++) {
+                int k=DUAL_HESSIANINDEX(i, j);
+                out->hess[k]=df*a->hess[k]+d2f*a->grad[i]*a->grad[j];
+            }
+        }
+    }
+
+    for (int i=0; i<n; i++) out->grad[i]=df*a->grad[i];
+
+    out->val=f;
+    out->n=n;
+    out->hessian=a->hessian;
+}
+
+/** Applies a function of two arguments by the chain rule, given its value, first derivatives fa and fb, and second derivatives faa, fab and fbb; out may be the same as a or b */
+void dual_binary(dual *a, dual *b, double f, double fa, double fb, double faa, double fab, double fbb, dual *out) {
+    int na=a->n, nb=b->n, n=(na>nb ? na : nb);
+    bool ha=a->hessian, hb=b->hessian;
+
+    if (ha || hb) {
+        for (int j=0; j<n; j++) {
+            double gaj=(j<na ? a->grad[j] : 0.0), gbj=(j<nb ? b->grad[j] : 0.0);
+            for (int i=0; i<=j; i++) {
+                int k=DUAL_HESSIANINDEX(i, j);
+                double gai=(i<na ? a->grad[i] : 0.0), gbi=(i<nb ? b->grad[i] : 0.0);
+                double h=faa*gai*gaj+fab*(gai*gbj+gbi*gaj)+fbb*gbi*gbj;
+                if (ha && j<na) h+=fa*a->hess[k];
+                if (hb && j<nb) h+=fb*b->hess[k];
+                out->hess[k]=h;
+            }
+        }
+    }
+
+    for (int i=0; i<n; i++) {
+        out->grad[i]=(i<na ? fa*a->grad[i] : 0.0)+(i<nb ? fb*b->grad[i] : 0.0);
+    }
+
+    out->val=f;
+    out->n=n;
+    out->hessian=(ha || hb);
+}
+
+/* **********************************************************************
+ * Arithmetic
+ * ********************************************************************** */
+
+/** Adds two dual numbers */
+void dual_add(dual *a, dual *b, dual *out) {
+    dual_binary(a, b, a->val+b->val, 1.0, 1.0, 0.0, 0.0, 0.0, out);
+}
+
+/** Subtracts b from a */
+void dual_sub(dual *a, dual *b, dual *out) {
+    dual_binary(a, b, a->val-b->val, 1.0, -1.0, 0.0, 0.0, 0.0, out);
+}
+
+/** Multiplies two dual numbers */
+void dual_mul(dual *a, dual *b, dual *out) {
+    dual_binary(a, b, a->val*b->val, b->val, a->val, 0.0, 1.0, 0.0, out);
+}
+
+/** Divides a by b */
+void dual_div(dual *a, dual *b, dual *out) {
+    double x=a->val, y=b->val;
+    dual_binary(a, b, x/y, 1.0/y, -x/(y*y), 0.0, -1.0/(y*y), 2*x/(y*y*y), out);
+}
+
+/** Multiplies a dual number by a constant */
+void dual_scale(dual *a, double lambda, dual *out) {
+    dual_unary(a, lambda*a->val, lambda, 0.0, out);
+}
+
+/* **********************************************************************
+ * Elementary functions
+ * ********************************************************************** */
+
+/** Square root */
+void dual_sqrt(dual *a, dual *out) {
+    double r=sqrt(a->val);
+    dual_unary(a, r, 0.5/r, -0.25/(r*a->val), out);
+}
+
+/** Absolute value */
+void dual_fabs(dual *a, dual *out) {
+    dual_unary(a, fabs(a->val), (a->val<0 ? -1.0 : 1.0), 0.0, out);
+}
+
+/** Inverse sine */
+void dual_asin(dual *a, dual *out) {
+    double x=a->val, c=1.0/sqrt(1-x*x);
+    dual_unary(a, asin(x), c, x*c*c*c, out);
+}
+
+/** Inverse cosine */
+void dual_acos(dual *a, dual *out) {
+    double x=a->val, c=1.0/sqrt(1-x*x);
+    dual_unary(a, acos(x), -c, -x*c*c*c, out);
+}
+
+/** Two argument inverse tangent of y/x */
+void dual_atan2(dual *y, dual *x, dual *out) {
+    double yv=y->val, xv=x->val, r2=xv*xv+yv*yv, r4=r2*r2;
+    dual_binary(y, x, atan2(yv, xv), xv/r2, -yv/r2, -2*xv*yv/r4, (yv*yv-xv*xv)/r4, 2*xv*yv/r4, out);
+}
+
+/* **********************************************************************
+ * Vectors
+ * ********************************************************************** */
+
+/** Difference of two vectors of n dual numbers */
+void dual_vecsub(int n, dual *a, dual *b, dual *out) {
+    for (int i=0; i<n; i++) dual_sub(&a[i], &b[i], &out[i]);
+}
+
+/** Dot product of two vectors of n dual numbers */
+void dual_vecdot(int n, dual *a, dual *b, dual *out) {
+    dual t;
+    dual_constant(0.0, out);
+    for (int i=0; i<n; i++) {
+        dual_mul(&a[i], &b[i], &t);
+        dual_add(out, &t, out);
+    }
+}
+
+/** Norm of a vector of n dual numbers */
+void dual_vecnorm(int n, dual *a, dual *out) {
+    dual_vecdot(n, a, a, out);
+    dual_sqrt(out, out);
+}
+
+/** 3D cross product; out must be distinct from a and b */
+void dual_veccross(dual *a, dual *b, dual *out) {
+    dual t;
+    for (int i=0; i<3; i++) {
+        int j=(i+1)%3, k=(i+2)%3;
+        dual_mul(&a[j], &b[k], &out[i]);
+        dual_mul(&a[k], &b[j], &t);
+        dual_sub(&out[i], &t, &out[i]);
+    }
+}
+
+/** 2D cross product */
+void dual_veccross2d(dual *a, dual *b, dual *out) {
+    dual t;
+    dual_mul(&a[0], &b[1], out);
+    dual_mul(&a[1], &b[0], &t);
+    dual_sub(out, &t, out);
+}
+
+#endif
@@ -0,0 +1,70 @@
+/** @file dual.h
+ *  @author T J Atherton
+ *
+ *  @brief Hyper-dual numbers for evaluating exact first and second derivatives
+*/
+
+#ifndef dual_h
+#define dual_h
+
+#include "build.h"
+#ifdef MORPHO_INCLUDE_GEOMETRY
+
+#include <stdbool.h>
+
+/* -------------------------------------------------------
+ * Dual numbers
+ * ------------------------------------------------------- */
+
+/** Maximum number of variables a dual number can depend on */
+#define DUAL_MAXVARIABLES 24
+
+/** Number of independent second derivatives */
+#define DUAL_HESSIANSIZE (DUAL_MAXVARIABLES*(DUAL_MAXVARIABLES+1)/2)
+
+/** Index of the second derivative with respect to variables i<=j in packed storage */
+#define DUAL_HESSIANINDEX(i, j) ((j)*((j)+1)/2+(i))
+
+/** A dual number holds a value together with its derivatives with respect to variables 0...n-1;
+    derivatives with respect to later variables are zero. Second derivatives are only tracked if hessian is set. */
+typedef struct {
+    double val; /* Value */
+    int n; /* Number of variables with nonzero derivatives */
+    bool hessian; /* Whether second derivatives are tracked */
+    double grad[DUAL_MAXVARIABLES]; /* First derivatives */
+    double hess[DUAL_HESSIANSIZE]; /* Second derivatives, packed by column */
+} dual;
+
+/* -------------------------------------------------------
+ * Interface
+ * ------------------------------------------------------- */
+
+void dual_constant(double val, dual *out);
+bool dual_variable(double val, int i, bool hessian, dual *out);
+double dual_gradient(dual *a, int i);
+double dual_hessian(dual *a, int i, int j);
+
+void dual_unary(dual *a, double f, double df, double d2f, dual *out);
+void dual_binary(dual *a, dual *b, double f, double fa, double fb, double faa, double fab, double fbb, dual *out);
+
+void dual_add(dual *a, dual *b, dual *out);
+void dual_sub(dual *a, dual *b, dual *out);
+void dual_mul(dual *a, dual *b, dual *out);
+void dual_div(dual *a, dual *b, dual *out);
+void dual_scale(dual *a, double lambda, dual *out);
+
+void dual_sqrt(dual *a, dual *out);
+void dual_fabs(dual *a, dual *out);
+void dual_asin(dual *a, dual *out);
+void dual_acos(dual *a, dual *out);
+void dual_atan2(dual *y, dual *x, dual *out);
+
+void dual_vecsub(int n, dual *a, dual *b, dual *out);
+void dual_vecdot(int n, dual *a, dual *b, dual *out);
+void dual_vecnorm(int n, dual *a, dual *out);
+void dual_veccross(dual *a, dual *b, dual *out);
+void dual_veccross2d(dual *a, dual *b, dual *out);
+
+#endif
+
+#endif /* dual_h */
@@ -9,6 +9,7 @@
 
 #include <float.h>
 #include <math.h>
+#include <stdatomic.h>
 
 #include "functional.h"
 #include "morpho.h"
@@ -20,6 +21,7 @@
 #include "matrix.h"
 #include "sparse.h"
 #include "geometry.h"
+#include "native.h"
 
 #ifndef M_PI
     #define M_PI 3.14159265358979323846
@@ -59,6 +61,7 @@ static void functional_clearmapinfo(functional_mapinfo *info) {
     info->id=0;
     info->integrand=NULL;
     info->grad=NULL;
+    info->hess=NULL;
     info->dependencies=NULL;
     info->cloneref=NULL;
     info->freeref=NULL;
@@ -115,6 +118,11 @@ static bool functional_countelements(vm *v, objectmesh *mesh, grade g, int *n, o
     return true;
 }
 
+/** Caches the geometry of the elements before mapping over the whole mesh, so that it can be shared with other functionals */
+static void functional_cachegeometry(functional_mapinfo *info) {
+    if (!info->sel) functional_preparegeometry(info->mesh, info->g, false);
+}
+
 static int functional_symmetryimagelistfn(const void *a, const void *b) {
     elementid i=*(elementid *) a; elementid j=*(elementid *) b;
     return (int) i-j;
@@ -197,6 +205,7 @@ bool functional_sumintegrandX(vm *v, functional_mapinfo *info, value *out) {
     int n=0;
 
     if (!functional_countelements(v, mesh, g, &n, &s)) return false;
+    functional_cachegeometry(info);
 
     /* Find any image elements so we can skip over them */
     varray_elementid imageids;
@@ -271,6 +280,7 @@ bool functional_mapintegrandX(vm *v, functional_mapinfo *info, value *out) {
 
     /* How many elements? */
     if (!functional_countelements(v, mesh, g, &n, &s)) return false;
+    functional_cachegeometry(info);
 
     /* Find any image elements so we can skip over them */
     varray_elementid imageids;
@@ -352,8 +362,14 @@ bool functional_mapgradientX(vm *v, functional_mapinfo *info, value *out) {
     bool ret=false;
     int n=0;
 
+    /* Find any image elements so we can skip over them */
+    varray_elementid imageids;
+    varray_elementidinit(&imageids);
+    functional_symmetryimagelist(mesh, g, true, &imageids);
+
     /* How many elements? */
     if (!functional_countelements(v, mesh, g, &n, &s)) return false;
+    functional_cachegeometry(info);
 
     /* Create the output matrix */
     if (n>0) {
@@ -365,7 +381,7 @@ bool functional_mapgradientX(vm *v, functional_mapinfo *info, value *out) {
         int vertexid; // Use this if looping over grade 0
         int *vid=(g==0 ? &vertexid : NULL),
             nv=(g==0 ? 1 : 0); // The vertex indices
-
+        int sindx=0; // Index into imageids array
 
         if (sel) { // Loop over selection
             if (sel->selected[g].count>0) for (unsigned int k=0; k<sel->selected[g].capacity; k++) {
@@ -375,12 +391,18 @@ bool functional_mapgradientX(vm *v, functional_mapinfo *info, value *out) {
                 if (s) sparseccs_getrowindices(&s->ccs, i, &nv, &vid);
                 else vertexid=i;
 
+                // Skip this element if it's an image element
+                if ((imageids.count>0) && (sindx<imageids.count) && imageids.data[sindx]==i) { sindx++; continue; }
+
                 if (vid && nv>0) {
                     if (!(*grad) (v, mesh, i, nv, vid, ref, frc)) goto functional_mapgradient_cleanup;
                 }
             }
         } else { // Loop over elements
             for (elementid i=0; i<n; i++) {
+                // Skip this element if it's an image element
+                if ((imageids.count>0) && (sindx<imageids.count) && imageids.data[sindx]==i) { sindx++; continue; }
+
                 if (s) sparseccs_getrowindices(&s->ccs, i, &nv, &vid);
                 else vertexid=i;
 
@@ -397,6 +419,7 @@ bool functional_mapgradientX(vm *v, functional_mapinfo *info, value *out) {
     }
 
 functional_mapgradient_cleanup:
+    varray_elementidclear(&imageids);
     if (!ret) object_free((object *) frc);
 
     return ret;
@@ -421,6 +444,7 @@ bool functional_mapfieldgradientX(vm *v, functional_mapinfo *info, value *out) {
 
     /* How many elements? */
     if (!functional_countelements(v, mesh, g, &n, &s)) return false;
+    functional_cachegeometry(info);
 
     /* Create the output field */
     if (n>0) {
@@ -717,12 +741,27 @@ functional_mapnumericalfieldgradient_cleanup:
 threadpool functional_pool;
 bool functional_poolinitialized;
 
+/** Number of elements claimed by a task at once; zero selects a size automatically */
+static atomic_int functional_grainsize = MORPHO_FUNCTIONALGRAINSIZE;
+
+/** Statistics recorded for each task by the most recent map; maps may run on several threads at once, so these are protected by a lock */
+static MorphoMutex functional_statslock;
+static functional_taskstatistics *functional_stats = NULL;
+static int functional_nstats = 0;
+
 /** Gradient function */
 typedef bool (functional_mapfn) (vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, void *out);
 
 /** Optionally process results from mapfn */
 typedef bool (functional_processfn) (void *task);
 
+/** Tasks claim chunks of elements from a shared cursor until none remain */
+typedef struct {
+    atomic_int next; /* Start of the next unclaimed chunk */
+    elementid start, end; /* Range of elements to process */
+    int grain; /* Number of elements in a chunk */
+} functional_schedule;
+
 /** Work to be done is divided into "tasks" which are then dispatched to the threadpool for execution. */
 typedef struct {
     elementid start, end; /* Start and end indices for the task */
@@ -730,13 +769,17 @@ typedef struct {
     elementid nel; /* Current element id */
     
     varray_elementid *skip; /* Sorted list of element ids to skip; set to NULL if not needed */
-    unsigned int sindx;
     
     grade g; /* Grade of element */
     objectsparse *conn; /* Connectivity matrix */
     
     functional_mapfn *mapfn; /* Map function */
     functional_processfn *processfn; /* Post process results */
+    functional_processfn *chunkfn; /* Optionally called once each chunk is complete */
+    
+    functional_schedule *schedule; /* Shared by all tasks in a map */
+    int chunk; /* Index of the current chunk */
+    elementid *elements; /* If set, the range indexes this list of element ids rather than the elements themselves */
     
     vm *v; /* Virtual machine in use */
     objectmesh *mesh; /* Mesh in use */
@@ -746,6 +789,9 @@ typedef struct {
     
     void *result; /* Result of individual element as an opaque pointer */
     void *out; /* Overall output as an opaque pointer */
+    objectmatrix *touch; /* If set, zeroed by the worker before mapping so its memory is first touched on the worker's NUMA node */
+    
+    functional_taskstatistics stats; /* Work done by this task */
     _MORPHO_PADDING;
 } functional_task;
 
@@ -758,12 +804,17 @@ void functionaltask_init(functional_task *task, elementid start, elementid end,
     task->g=(info ? info->g : 0);
     
     task->skip=NULL;
-    task->sindx=0;
     
     task->conn=NULL;
     
     task->mapfn=NULL;
     task->processfn=NULL;
+    task->chunkfn=NULL;
+    
+    task->schedule=NULL;
+    task->chunk=0;
+    task->elements=NULL;
+    task->touch=NULL;
     
     task->mesh=(info ? info->mesh : NULL);
     task->field=(info ? info->field : NULL);
@@ -773,43 +824,91 @@ void functionaltask_init(functional_task *task, elementid start, elementid end,
     task->ref=(info ? info->ref : NULL);
     task->out=NULL;
     task->result=NULL;
+    
+    task->stats.nelements=0;
+    task->stats.nchunks=0;
+    task->stats.time=0.0;
 }
 
 /** Check if we should skip element id */
 bool functional_checkskip(functional_task *task) {
-    if ((task->skip) &&
-        (task->sindx<task->skip->count) &&
-        task->skip->data[task->sindx]==task->id) {
-        task->sindx++;
-        return true;
+    if (!task->skip) return false;
+    
+    /* Binary search, as chunks may be visited in any order */
+    int lo=0, hi=task->skip->count-1;
+    while (lo<=hi) {
+        int mid=(lo+hi)/2;
+        elementid sid=task->skip->data[mid];
+        if (sid==task->id) return true;
+        if (sid<task->id) lo=mid+1; else hi=mid-1;
     }
     return false;
 }
 
-/** Worker function to map a function over elements */
-bool functional_mapfn_elements(void *arg) {
-    functional_task *task = (functional_task *) arg;
-    dictionary *selected=NULL;
-    elementid *vid=&task->id; /* Will hold element definition */
-    int nv=1; /* Number of vertices per element; default to 1  */
+/** Sets the number of elements claimed by a task at once; zero selects a size automatically */
+void functional_setgrainsize(int grain) {
+    atomic_store(&functional_grainsize, (grain>0 ? grain : 0));
+}
+
+/** Gets the number of elements claimed by a task at once, or zero if a size is selected automatically */
+int functional_getgrainsize(void) {
+    return atomic_load(&functional_grainsize);
+}
+
+/** Determines the grain size to use for a range of elements */
+static int functional_grain(int nel, int ntasks) {
+    int grainsize=atomic_load(&functional_grainsize);
+    if (grainsize>0) return grainsize;
+    int grain=nel/(FUNCTIONAL_CHUNKSPERTASK*(ntasks>0 ? ntasks : 1));
+    return (grain>0 ? grain : 1);
+}
+
+/** Counts the chunks that the elements assigned to a set of tasks will be divided into */
+static int functional_countchunks(int ntasks, functional_task *tasks) {
+    int nel=tasks[0].end-tasks[0].start;
+    int grain=functional_grain(nel, ntasks);
+    return (nel+grain-1)/grain;
+}
+
+/** Claims the next chunk of elements for a task, returning false when none remain */
+static bool functional_claimchunk(functional_task *task) {
+    functional_schedule *s=task->schedule;
+    int start=atomic_fetch_add_explicit(&s->next, s->grain, memory_order_relaxed);
+    if (start>=s->end) return false;
     
-    if (task->selection) {
-        selected=&task->selection->selected[task->g];
-        if (selected->count==0) return true;
+    task->start=start;
+    task->end=(start+s->grain<s->end ? start+s->grain : s->end);
+    task->chunk=(start-s->start)/s->grain;
+    return true;
+}
+
+/** Sets the id of the element at index i of a task's range, returning false if there is no element to process there */
+static bool functional_elementat(functional_task *task, dictionary *selected, elementid i) {
+    if (task->elements) {
+        task->id = task->elements[i];
+        return true;
     }
     
+    if (selected) {
+        // Skip empty dictionary entries
+        if (!MORPHO_ISINTEGER(selected->contents[i].key)) return false;
+        
+        // Fetch the element id from the dictionary
+        task->id = MORPHO_GETINTEGERVALUE(selected->contents[i].key);
+    } else task->id = i;
+    
+    // Skip this element if it's an image element
+    return !functional_checkskip(task);
+}
+
+/** Maps a function over the elements in the current chunk */
+static bool functional_mapchunk(functional_task *task, dictionary *selected) {
+    elementid *vid=&task->id; /* Will hold element definition */
+    int nv=1; /* Number of vertices per element; default to 1  */
+    
     // Loop over required elements
     for (elementid i=task->start; i<task->end; i++) {
-        if (selected) {
-            // Skip empty dictionary entries
-            if (!MORPHO_ISINTEGER(selected->contents[i].key)) continue;
-            
-            // Fetch the element id from the dictionary
-            task->id = MORPHO_GETINTEGERVALUE(selected->contents[i].key);
-        } else task->id = i;
-        
-        // Skip this element if it's an image element
-        if (functional_checkskip(task)) continue;
+        if (!functional_elementat(task, selected, i)) continue;
         
         // Fetch element definition
         if (task->conn) {
@@ -824,47 +923,262 @@ bool functional_mapfn_elements(void *arg) {
         
         // Clean out temporary objects
         vm_cleansubkernel(task->v);
+        task->stats.nelements++;
     }
+    
     return true;
 }
 
-/** Dispatches tasks to threadpool */
+/** Zeroes a task's output matrix from the thread that will use it */
+static void functional_zerotouched(functional_task *task) {
+    memset(task->touch->elements, 0, sizeof(double)*task->touch->nrows*task->touch->ncols);
+    task->touch=NULL;
+}
+
+/** Worker function to map a function over elements */
+bool functional_mapfn_elements(void *arg) {
+    functional_task *task = (functional_task *) arg;
+    dictionary *selected=NULL;
+    bool success=true;
+    
+    if (task->touch) functional_zerotouched(task);
+    
+    if (task->selection && !task->elements) {
+        selected=&task->selection->selected[task->g];
+        if (selected->count==0) return true;
+    }
+    
+    double start=platform_clock();
+    while (success && functional_claimchunk(task)) {
+        success=functional_mapchunk(task, selected);
+        if (success && task->chunkfn) success=(*task->chunkfn) (task);
+        task->stats.nchunks++;
+    }
+    task->stats.time=platform_clock()-start;
+    
+    return success;
+}
+
+/** Records the work done by each task */
+static void functional_recordstatistics(int ntasks, functional_task *tasks) {
+    MorphoMutex_lock(&functional_statslock);
+    functional_taskstatistics *new=MORPHO_REALLOC(functional_stats, sizeof(functional_taskstatistics)*ntasks);
+    if (new) {
+        functional_stats=new;
+        functional_nstats=ntasks;
+        for (int i=0; i<ntasks; i++) functional_stats[i]=tasks[i].stats;
+    }
+    MorphoMutex_unlock(&functional_statslock);
+    
+#ifdef MORPHO_DEBUG_LOGFUNCTIONALMAP
+    for (int i=0; i<ntasks; i++) {
+        fprintf(stderr, "Task %i: %i elements in %i chunks, %g s\n", i, tasks[i].stats.nelements, tasks[i].stats.nchunks, tasks[i].stats.time);
+    }
+#endif
+}
+
+/** Gets statistics for each task in the most recent map
+ * @param[in] nmax - maximum number of entries to write
+ * @param[out] stats - filled out with statistics for each task
+ * @returns the number of tasks used by the most recent map */
+int functional_getmapstatistics(int nmax, functional_taskstatistics *stats) {
+    MorphoMutex_lock(&functional_statslock);
+    int n=functional_nstats;
+    for (int i=0; i<nmax && i<n; i++) stats[i]=functional_stats[i];
+    MorphoMutex_unlock(&functional_statslock);
+    return n;
+}
+
+/** Dispatches tasks to threadpool; the tasks share the range of elements given by the first task */
 bool functional_parallelmap(int ntasks, functional_task *tasks) {
     int nthreads = morpho_threadnumber();
     if (!nthreads) nthreads=1;
     
-    if (!functional_poolinitialized) {
-        functional_poolinitialized=threadpool_init(&functional_pool, nthreads);
-        if (!functional_poolinitialized) return false;
+    if (!threadpool_prepare(&functional_pool, &functional_poolinitialized, nthreads)) {
+        for (int i=0; i<ntasks; i++) if (tasks[i].touch) functional_zerotouched(&tasks[i]);
+        return false;
     }
     
+    functional_schedule schedule;
+    schedule.start=tasks[0].start;
+    schedule.end=tasks[0].end;
+    schedule.grain=functional_grain(schedule.end-schedule.start, ntasks);
+    atomic_init(&schedule.next, schedule.start);
+    
     for (int i=0; i<ntasks; i++) {
+       tasks[i].schedule=&schedule;
        threadpool_add_task(&functional_pool, functional_mapfn_elements, (void *) &tasks[i]);
     }
     threadpool_fence(&functional_pool);
+    threadpool_release(&functional_pool);
+    
+    functional_recordstatistics(ntasks, tasks);
+    
+    return true;
+}
+
+/* ----------------------------
+ * Conflict-free assembly
+ * ---------------------------- */
+
+/** Elements grouped into colours, such that no two elements of the same colour touch the same vertex */
+typedef struct {
+    int ncolours;
+    int colourstart[FUNCTIONAL_MAXCOLOURS+1]; /* Start of each colour in the list of elements */
+    varray_elementid elements; /* Element ids sorted by colour */
+} functional_colouring;
+
+/** Size in bytes above which gradients are assembled by colouring elements rather than in one matrix per task */
+static atomic_size_t functional_replicationlimit = MORPHO_FUNCTIONALREPLICATIONLIMIT;
+
+/** Sets the size in bytes above which gradients are assembled by colouring elements; zero always colours them */
+void functional_setreplicationlimit(size_t limit) {
+    atomic_store(&functional_replicationlimit, limit);
+}
+
+/** Gets the size in bytes above which gradients are assembled by colouring elements */
+size_t functional_getreplicationlimit(void) {
+    return atomic_load(&functional_replicationlimit);
+}
+
+/** Decides whether per-task output matrices would use too much memory, so that elements should be coloured instead */
+static bool functional_usecolouring(int ntask, functional_mapinfo *info) {
+    if (ntask<2) return false;
+    objectmatrix *vert=info->mesh->vert;
+    return ((size_t) ntask)*vert->nrows*vert->ncols*sizeof(double) > atomic_load(&functional_replicationlimit);
+}
+
+/** Colours the elements that a set of tasks will process. Each element touches its vertices and any dependencies.
+ * @param[in] info - map info
+ * @param[in] task - tasks prepared by functional_preparetasks
+ * @param[out] out - the colouring
+ * @returns true on success; false if too many colours are needed */
+static bool functional_colourelements(functional_mapinfo *info, functional_task *task, functional_colouring *out) {
+    int nverts=info->mesh->vert->ncols;
+    bool success=false;
+    
+    uint64_t *used=MORPHO_MALLOC(sizeof(uint64_t)*nverts); /* Colours that touch each vertex */
+    varray_elementid ids, colours, dependencies;
+    varray_elementidinit(&ids);
+    varray_elementidinit(&colours);
+    varray_elementidinit(&dependencies);
+    varray_elementidinit(&out->elements);
+    if (!used) return false;
+    for (int i=0; i<nverts; i++) used[i]=0;
+    
+    dictionary *selected=(info->sel ? &info->sel->selected[info->g] : NULL);
+    int count[FUNCTIONAL_MAXCOLOURS];
+    for (int c=0; c<FUNCTIONAL_MAXCOLOURS; c++) count[c]=0;
+    out->ncolours=0;
+    
+    for (elementid i=task->start; i<task->end; i++) {
+        if (!functional_elementat(task, selected, i)) continue;
+        elementid id=task->id, *vid=&id;
+        int nv=1;
+        
+        if (task->conn && !sparseccs_getrowindices(&task->conn->ccs, id, &nv, &vid)) goto functional_colourelements_cleanup;
+        
+        dependencies.count=0;
+        varray_elementidadd(&dependencies, vid, nv);
+        if (info->dependencies) (info->dependencies) (info, id, &dependencies);
+        
+        /* Choose the first colour not yet used by any vertex the element touches */
+        uint64_t mask=0;
+        for (int k=0; k<dependencies.count; k++) mask|=used[dependencies.data[k]];
+        int c=0;
+        while (c<FUNCTIONAL_MAXCOLOURS && (mask & (((uint64_t) 1)<<c))) c++;
+        if (c>=FUNCTIONAL_MAXCOLOURS) goto functional_colourelements_cleanup;
+        
+        for (int k=0; k<dependencies.count; k++) used[dependencies.data[k]]|=((uint64_t) 1)<<c;
+        varray_elementidwrite(&ids, id);
+        varray_elementidwrite(&colours, c);
+        count[c]++;
+        if (c>=out->ncolours) out->ncolours=c+1;
+    }
+    
+    /* Sort the elements by colour, preserving their order within each colour */
+    out->colourstart[0]=0;
+    for (int c=0; c<out->ncolours; c++) out->colourstart[c+1]=out->colourstart[c]+count[c];
+    if (!varray_elementidresize(&out->elements, ids.count)) goto functional_colourelements_cleanup;
+    out->elements.count=ids.count;
+    
+    int posn[FUNCTIONAL_MAXCOLOURS];
+    for (int c=0; c<out->ncolours; c++) posn[c]=out->colourstart[c];
+    for (int k=0; k<ids.count; k++) out->elements.data[posn[colours.data[k]]++]=ids.data[k];
+    
+    success=true;
     
+functional_colourelements_cleanup:
+    if (!success) varray_elementidclear(&out->elements);
+    MORPHO_FREE(used);
+    varray_elementidclear(&ids);
+    varray_elementidclear(&colours);
+    varray_elementidclear(&dependencies);
+    
+    return success;
+}
+
+/** Dispatches tasks one colour at a time, so that no two tasks write to the same vertex concurrently */
+static bool functional_parallelmapcoloured(int ntasks, functional_task *tasks, functional_colouring *colouring) {
+    for (int c=0; c<colouring->ncolours; c++) {
+        for (int i=0; i<ntasks; i++) {
+            tasks[i].elements=colouring->elements.data;
+            tasks[i].start=colouring->colourstart[c];
+            tasks[i].end=colouring->colourstart[c+1];
+        }
+        if (!functional_parallelmap(ntasks, tasks)) return false;
+    }
     return true;
 }
 
-/** Calculate bin sizes */
-void functional_binbounds(int nel, int nbins, int *binbounds) {
-    int binsizes[nbins+1];
+/** A block of entries to sum across a set of matrices */
+typedef struct {
+    int n; /* Number of matrices */
+    objectmatrix **in; /* Matrices to sum; the result is stored in the first */
+    unsigned int start, end; /* Range of entries */
+} functional_reducetask;
+
+/** Worker function that sums a block of entries */
+static bool functional_reducefn(void *arg) {
+    functional_reducetask *task = (functional_reducetask *) arg;
+    double *out=task->in[0]->elements;
     
-    int defsize = nel / nbins;
-    for (int i=0; i<nbins; i++) binsizes[i]=defsize;
+    for (int k=1; k<task->n; k++) {
+        double *in=task->in[k]->elements;
+        for (unsigned int j=task->start; j<task->end; j++) out[j]+=in[j];
+    }
+    return true;
+}
+
+/** Sums a set of matrices of the same size into the first, dividing the entries between threads */
+static void functional_reducematrices(int n, objectmatrix **in) {
+    if (n<2) return;
+    unsigned int nel=in[0]->nrows*in[0]->ncols;
+    functional_reducetask tasks[n];
+    bool pooled=threadpool_prepare(&functional_pool, &functional_poolinitialized, morpho_threadnumber());
     
-    int rem = nel % nbins;
-    while (rem>0) {
-        for (int i=0; i<nbins && rem>0; i++) { binsizes[i]++; rem--; }
+    for (int i=0; i<n; i++) {
+        tasks[i].n=n;
+        tasks[i].in=in;
+        tasks[i].start=(unsigned int) (((size_t) nel)*i/n);
+        tasks[i].end=(unsigned int) (((size_t) nel)*(i+1)/n);
+        if (pooled) threadpool_add_task(&functional_pool, functional_reducefn, (void *) &tasks[i]);
+        else functional_reducefn((void *) &tasks[i]);
     }
     
-    int bindx=0;
-    for (int i=0; i<=nbins; i++) {
-        binbounds[i]=bindx;
-        bindx+=binsizes[i];
+    if (pooled) {
+        threadpool_fence(&functional_pool);
+        threadpool_release(&functional_pool);
     }
 }
 
+/** Sums a set of fields with the same shape into the first using their underlying data stores */
+static void functional_reducefields(int n, objectfield **in) {
+    objectmatrix *data[n];
+    for (int i=0; i<n; i++) data[i]=&in[i]->data;
+    functional_reducematrices(n, data);
+}
+
 /** Prepare tasks for submitting
  * @param[in] v - Virtual machine to use
  * @param[in] info - Info structure with functional information
@@ -883,9 +1197,6 @@ int functional_preparetasks(vm *v, functional_mapinfo *info, int ntask, function
         cmax=info->sel->selected[info->g].capacity;
     }
     
-    int bins[ntask+1];
-    functional_binbounds(cmax, ntask, bins);
-    
     /* Ensure all mesh topology matrices have CCS */
     int maxgrade=mesh_maxgrade(info->mesh);
     for (int i=0; i<=maxgrade; i++) {
@@ -904,7 +1215,7 @@ int functional_preparetasks(vm *v, functional_mapinfo *info, int ntask, function
     
     /** Initialize task structures */
     for (int i=0; i<ntask; i++) {
-        functionaltask_init(task+i, bins[i], bins[i+1], info); // Setup the task
+        functionaltask_init(task+i, 0, cmax, info); // Setup the task; elements are claimed in chunks once running
         
         task[i].v=subkernels[i];
         task[i].nel=nel;
@@ -931,6 +1242,7 @@ typedef struct {
     double result;
     double c;
     double sum;
+    double *chunks; /* Sum for each chunk */
     _MORPHO_PADDING;
 } functional_sumintermediate;
 
@@ -945,6 +1257,15 @@ bool functional_sumintegrandprocessfn(void *arg) {
     return true;
 }
 
+/** Store the sum for a completed chunk so that the total doesn't depend on which task processed it */
+bool functional_sumintegrandchunkfn(void *arg) {
+    functional_task *task = (functional_task *) arg;
+    functional_sumintermediate *ks = (functional_sumintermediate *) task->out;
+    ks->chunks[task->chunk]=ks->sum;
+    ks->sum=0.0; ks->c=0.0;
+    return true;
+}
+
 /** Sum the integrand, mapping over integrand function */
 bool functional_sumintegrand(vm *v, functional_mapinfo *info, value *out) {
     int ntask=morpho_threadnumber();
@@ -955,28 +1276,33 @@ bool functional_sumintegrand(vm *v, functional_mapinfo *info, value *out) {
     varray_elementid imageids;
     varray_elementidinit(&imageids);
     
+    functional_cachegeometry(info);
     if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
     
     functional_sumintermediate sums[ntask];
     
+    int nchunks=functional_countchunks(ntask, task);
+    double *chunks=MORPHO_MALLOC(sizeof(double)*(nchunks+1));
+    if (!chunks) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); functional_cleanuptasks(v, ntask, task); return false; }
+    for (int i=0; i<nchunks; i++) chunks[i]=0.0;
+    
     for (int i=0; i<ntask; i++) {
         task[i].mapfn=(functional_mapfn *) info->integrand;
         task[i].processfn=functional_sumintegrandprocessfn;
+        task[i].chunkfn=functional_sumintegrandchunkfn;
         
         task[i].result=(void *) &sums[i].result;
         task[i].out=(void *) &sums[i];
         sums[i].c=0.0; sums[i].sum=0.0;
+        sums[i].chunks=chunks;
     }
     
     functional_parallelmap(ntask, task);
     
-    // Sum up the results from each task...
-    double sumlist[ntask];
-    for (int i=0; i<ntask; i++) sumlist[i]=sums[i].sum;
-    
-    // ...and return the result
-    *out = MORPHO_FLOAT(functional_sumlist(sumlist, ntask));
+    // Sum up the results from each chunk in order and return the result
+    *out = MORPHO_FLOAT(functional_sumlist(chunks, nchunks));
     
+    MORPHO_FREE(chunks);
     functional_cleanuptasks(v, ntask, task);
     varray_elementidclear(&imageids);
     return true;
@@ -1043,6 +1369,7 @@ bool functional_mapintegrand(vm *v, functional_mapinfo *info, value *out) {
     
     objectmatrix *new = NULL;
     
+    functional_cachegeometry(info);
     if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
     
     /* Create output matrix */
@@ -1088,23 +1415,41 @@ bool functional_mapgradient(vm *v, functional_mapinfo *info, value *out) {
     objectmatrix *new[ntask];
     for (int i=0; i<ntask; i++) new[i]=NULL;
     
+    functional_cachegeometry(info);
     if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
     
-    /* Create output matrix */
-    for (int i=0; i<ntask; i++) {
-        // Create one per thread
-        new[i]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, true);
-        if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapgradient_cleanup; }
+    functional_colouring colouring;
+    if (functional_usecolouring(ntask, info) &&
+        functional_colourelements(info, task, &colouring)) {
+        /* Scatter directly into a single output matrix */
+        new[0]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, true);
+        if (!new[0]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); varray_elementidclear(&colouring.elements); goto functional_mapgradient_cleanup; }
         
-        task[i].mapfn=(functional_mapfn *) info->grad;
-        task[i].result=(void *) new[i];
+        for (int i=0; i<ntask; i++) {
+            task[i].mapfn=(functional_mapfn *) info->grad;
+            task[i].result=(void *) new[0];
+        }
+        
+        functional_parallelmapcoloured(ntask, task, &colouring);
+        varray_elementidclear(&colouring.elements);
+    } else {
+        /* Create output matrix */
+        for (int i=0; i<ntask; i++) {
+            // Create one per thread; each is zeroed by the worker that uses it
+            new[i]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, false);
+            if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapgradient_cleanup; }
+            
+            task[i].mapfn=(functional_mapfn *) info->grad;
+            task[i].result=(void *) new[i];
+            task[i].touch=new[i];
+        }
+        
+        functional_parallelmap(ntask, task);
+        
+        /* Then add up all the matrices */
+        functional_reducematrices(ntask, new);
     }
     
-    functional_parallelmap(ntask, task);
-    
-    /* Then add up all the matrices */
-    for (int i=1; i<ntask; i++) matrix_add(new[0], new[i], new[0]);
-    
     // Use symmetry actions
     if (info->sym==SYMMETRY_ADD) functional_symmetrysumforces(info->mesh, new[0]);
     
@@ -1190,29 +1535,49 @@ bool functional_mapnumericalgradient(vm *v, functional_mapinfo *info, value *out
     for (int i=0; i<ntask; i++) new[i]=NULL;
     
     objectmesh meshclones[ntask]; // Create shallow clones of the mesh with different vertex matrices
+    for (int i=0; i<ntask; i++) meshclones[i].vert=NULL;
     
     if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
     
-    for (int i=0; i<ntask; i++) {
-        // Create one output matrix per thread
-        new[i]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, true);
-        if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapgradient_cleanup; }
+    functional_colouring colouring;
+    if (functional_usecolouring(ntask, info) &&
+        functional_colourelements(info, task, &colouring)) {
+        /* Elements of the same colour touch different vertices, so tasks can perturb the
+           vertex matrix in place and scatter directly into a single output matrix */
+        new[0]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, true);
+        if (!new[0]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); varray_elementidclear(&colouring.elements); goto functional_mapgradient_cleanup; }
         
-        // Clone the vertex matrix for each thread
-        meshclones[i]=*info->mesh;
-        meshclones[i].vert=object_clonematrix(info->mesh->vert);
-        task[i].mesh=&meshclones[i];
+        for (int i=0; i<ntask; i++) {
+            task[i].ref=(void *) info; // Use this to pass the info structure
+            task[i].mapfn=functional_numericalgradientmapfn;
+            task[i].result=(void *) new[0];
+        }
         
-        task[i].ref=(void *) info; // Use this to pass the info structure
-        task[i].mapfn=functional_numericalgradientmapfn;
-        task[i].result=(void *) new[i];
+        functional_parallelmapcoloured(ntask, task, &colouring);
+        varray_elementidclear(&colouring.elements);
+    } else {
+        for (int i=0; i<ntask; i++) {
+            // Create one output matrix per thread; each is zeroed by the worker that uses it
+            new[i]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, false);
+            if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapgradient_cleanup; }
+            
+            // Clone the vertex matrix for each thread
+            meshclones[i]=*info->mesh;
+            meshclones[i].vert=object_clonematrix(info->mesh->vert);
+            task[i].mesh=&meshclones[i];
+            
+            task[i].ref=(void *) info; // Use this to pass the info structure
+            task[i].mapfn=functional_numericalgradientmapfn;
+            task[i].result=(void *) new[i];
+            task[i].touch=new[i];
+        }
+        
+        functional_parallelmap(ntask, task);
+        
+        /* Then add up all the matrices */
+        functional_reducematrices(ntask, new);
     }
     
-    functional_parallelmap(ntask, task);
-    
-    /* Then add up all the matrices */
-    for (int i=1; i<ntask; i++) matrix_add(new[0], new[i], new[0]);
-    
     success=true;
     
     // Use symmetry actions
@@ -1223,7 +1588,7 @@ bool functional_mapnumericalgradient(vm *v, functional_mapinfo *info, value *out
     
 functional_mapgradient_cleanup:
     // Free the temporary copies of the vertex matrices
-    for (int i=0; i<ntask; i++) object_free((object *) meshclones[i].vert);
+    for (int i=0; i<ntask; i++) if (meshclones[i].vert) object_free((object *) meshclones[i].vert);
     // Free spare output matrices
     for (int i=1; i<ntask; i++) if (new[i]) object_free((object *) new[i]);
     
@@ -1234,50 +1599,234 @@ functional_mapgradient_cleanup:
 }
 
 /* ----------------------------
- * Map field gradients
+ * Total and gradient
  * ---------------------------- */
 
-/** Compute the field gradient */
-bool functional_mapfieldgradient(vm *v, functional_mapinfo *info, value *out) {
-    int success=false;
+/** Locations to which the fused map writes an element's integrand and gradient */
+typedef struct {
+    double *value; /* Integrand of the element */
+    objectmatrix *frc; /* Gradient is accumulated here */
+} functional_totalandgradientresult;
+
+/** Evaluates the integrand and gradient of an element together; ref is the info structure.
+ *  The gradient is found with info->grad if provided, and numerically from info->integrand otherwise. */
+static bool functional_totalandgradientmapfn(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, void *out) {
+    functional_mapinfo *info=(functional_mapinfo *) ref;
+    functional_totalandgradientresult *res=(functional_totalandgradientresult *) out;
+    
+    if (!(*info->integrand) (v, mesh, id, nv, vid, info->ref, res->value)) return false;
+    
+    if (info->grad) return (*info->grad) (v, mesh, id, nv, vid, info->ref, res->frc);
+    return functional_numericalgradientmapfn(v, mesh, id, nv, vid, ref, res->frc);
+}
+
+/** Sums the integrand and computes the gradient in a single pass over the elements
+ * @param[in] v - virtual machine in use
+ * @param[in] info - map info; integrand must be set, and grad if an analytic gradient is available
+ * @param[out] out - out[0] is set to the total and out[1] to the gradient
+ * @returns true on success, false otherwise. Error reporting through VM. */
+bool functional_maptotalandgradientX(vm *v, functional_mapinfo *info, value *out) {
+    objectmesh *mesh = info->mesh;
+    objectselection *sel = info->sel;
+    grade g = info->g;
+    objectsparse *s=NULL;
+    objectmatrix *frc=NULL;
+    bool ret=false;
+    int n=0;
+    
+    /* How many elements? */
+    if (!functional_countelements(v, mesh, g, &n, &s)) return false;
+    functional_cachegeometry(info);
+    
+    /* Find any image elements so we can skip over them */
+    varray_elementid imageids;
+    varray_elementidinit(&imageids);
+    functional_symmetryimagelist(mesh, g, true, &imageids);
+    
+    /* Create the output matrix */
+    frc=object_newmatrix(mesh->vert->nrows, mesh->vert->ncols, true);
+    if (!frc) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maptotalandgradient_cleanup; }
+    
+    int vertexid; // Use this if looping over grade 0
+    int *vid=(g==0 ? &vertexid : NULL),
+        nv=(g==0 ? 1 : 0); // The vertex indices
+    int sindx=0; // Index into imageids array
+    double sum=0.0, c=0.0, y, t, result;
+    functional_totalandgradientresult res = { .value=&result, .frc=frc };
+    
+    int nel=(sel ? sel->selected[g].capacity : n);
+    if (sel && sel->selected[g].count==0) nel=0;
+    
+    for (int k=0; k<nel; k++) {
+        elementid i=k;
+        if (sel) {
+            if (!MORPHO_ISINTEGER(sel->selected[g].contents[k].key)) continue;
+            i = MORPHO_GETINTEGERVALUE(sel->selected[g].contents[k].key);
+        }
+        
+        // Skip this element if it's an image element
+        if ((imageids.count>0) && (sindx<imageids.count) && imageids.data[sindx]==i) { sindx++; continue; }
+        
+        if (s) sparseccs_getrowindices(&s->ccs, i, &nv, &vid);
+        else vertexid=i;
+        
+        if (vid && nv>0) {
+            if (!functional_totalandgradientmapfn(v, mesh, i, nv, vid, (void *) info, &res)) goto functional_maptotalandgradient_cleanup;
+            y=result-c; t=sum+y; c=(t-sum)-y; sum=t; // Kahan summation
+        }
+    }
+    
+    if (info->sym==SYMMETRY_ADD) functional_symmetrysumforces(mesh, frc);
+    
+    out[0]=MORPHO_FLOAT(sum);
+    out[1]=MORPHO_OBJECT(frc);
+    ret=true;
+    
+functional_maptotalandgradient_cleanup:
+    varray_elementidclear(&imageids);
+    if (!ret && frc) object_free((object *) frc);
+    
+    return ret;
+}
+
+/** Sums the integrand and computes the gradient in a single parallel pass over the elements, so that
+ *  the elements are traversed, fetched and dispatched once rather than once for each quantity
+ * @param[in] v - virtual machine in use
+ * @param[in] info - map info; integrand must be set, and grad if an analytic gradient is available
+ * @param[out] out - out[0] is set to the total and out[1] to the gradient
+ * @returns true on success, false otherwise. Error reporting through VM. */
+bool functional_maptotalandgradient(vm *v, functional_mapinfo *info, value *out) {
+    bool success=false;
     int ntask=morpho_threadnumber();
-    if (!ntask) return functional_mapfieldgradientX(v, info, out);
+    if (!ntask) return functional_maptotalandgradientX(v, info, out);
     functional_task task[ntask];
     
     varray_elementid imageids;
     varray_elementidinit(&imageids);
     
-    objectfield *new[ntask];
+    objectmatrix *new[ntask]; // Create an output matrix for each thread
     for (int i=0; i<ntask; i++) new[i]=NULL;
     
+    objectmesh meshclones[ntask]; // Numerical gradients need a vertex matrix for each thread to perturb
+    for (int i=0; i<ntask; i++) meshclones[i].vert=NULL;
+    
+    functional_cachegeometry(info);
     if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
     
-    /* Create output fields */
+    functional_sumintermediate sums[ntask];
+    functional_totalandgradientresult res[ntask];
+    
+    int nchunks=functional_countchunks(ntask, task);
+    double *chunks=MORPHO_MALLOC(sizeof(double)*(nchunks+1));
+    if (!chunks) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maptotalandgradient_cleanup; }
+    for (int i=0; i<nchunks; i++) chunks[i]=0.0;
+    
     for (int i=0; i<ntask; i++) {
-        // Create one per thread
-        new[i]=object_newfield(info->mesh, info->field->prototype, info->field->fnspc, info->field->dof);
-        if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapfieldgradient_cleanup; }
-        field_zero(new[i]);
+        // Each output matrix is zeroed by the worker that uses it
+        new[i]=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, false);
+        if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maptotalandgradient_cleanup; }
         
-        task[i].mapfn=(functional_mapfn *) info->fieldgrad;
-        task[i].result=(void *) new[i];
+        if (!info->grad) {
+            meshclones[i]=*info->mesh;
+            meshclones[i].vert=object_clonematrix(info->mesh->vert);
+            if (!meshclones[i].vert) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maptotalandgradient_cleanup; }
+            task[i].mesh=&meshclones[i];
+        }
+        
+        res[i].value=&sums[i].result;
+        res[i].frc=new[i];
+        sums[i].c=0.0; sums[i].sum=0.0;
+        sums[i].chunks=chunks;
+        
+        task[i].ref=(void *) info; // Use this to pass the info structure
+        task[i].mapfn=functional_totalandgradientmapfn;
+        task[i].processfn=functional_sumintegrandprocessfn;
+        task[i].chunkfn=functional_sumintegrandchunkfn;
+        task[i].result=(void *) &res[i];
+        task[i].out=(void *) &sums[i];
+        task[i].touch=new[i];
     }
     
-    functional_parallelmap(ntask, task);
-    
-    /* Then add up all the fields using their underlying data stores */
-    for (int i=1; i<ntask; i++) matrix_add(&new[0]->data, &new[1]->data, &new[0]->data);
-    
-    // TODO: Use symmetry actions
-    //if (info->sym==SYMMETRY_ADD) functional_symmetrysumforces(info->mesh, new[0]);
+    success=functional_parallelmap(ntask, task);
+    if (!success) goto functional_maptotalandgradient_cleanup;
     
-    success=true;
+    /* Add up the gradients from each thread, and the totals from each chunk in order */
+    functional_reducematrices(ntask, new);
+    if (info->sym==SYMMETRY_ADD) functional_symmetrysumforces(info->mesh, new[0]);
     
-functional_mapfieldgradient_cleanup:
-    for (int i=1; i<ntask; i++) if (new[i]) object_free((object *) new[i]);
+    out[0]=MORPHO_FLOAT(functional_sumlist(chunks, nchunks));
+    out[1]=MORPHO_OBJECT(new[0]);
     
-    // ...and return the result
-    *out = MORPHO_OBJECT(new[0]);
+functional_maptotalandgradient_cleanup:
+    for (int i=0; i<ntask; i++) if (meshclones[i].vert) object_free((object *) meshclones[i].vert);
+    for (int i=(success ? 1 : 0); i<ntask; i++) if (new[i]) object_free((object *) new[i]);
+    if (chunks) MORPHO_FREE(chunks);
+    
+    functional_cleanuptasks(v, ntask, task);
+    varray_elementidclear(&imageids);
+    return success;
+}
+
+/** Binds the total and gradient found by functional_maptotalandgradient and returns them as a list */
+value functional_totalandgradientlist(vm *v, value *res) {
+    objectlist *new = object_newlist(2, res);
+    if (!new) {
+        morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+        object_free(MORPHO_GETOBJECT(res[1]));
+        return MORPHO_NIL;
+    }
+    
+    value bind[2] = { res[1], MORPHO_OBJECT(new) };
+    morpho_bindobjects(v, 2, bind);
+    return bind[1];
+}
+
+/* ----------------------------
+ * Map field gradients
+ * ---------------------------- */
+
+/** Compute the field gradient */
+bool functional_mapfieldgradient(vm *v, functional_mapinfo *info, value *out) {
+    int success=false;
+    int ntask=morpho_threadnumber();
+    if (!ntask) return functional_mapfieldgradientX(v, info, out);
+    functional_task task[ntask];
+    
+    varray_elementid imageids;
+    varray_elementidinit(&imageids);
+    
+    objectfield *new[ntask];
+    for (int i=0; i<ntask; i++) new[i]=NULL;
+    
+    functional_cachegeometry(info);
+    if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
+    
+    /* Create output fields */
+    for (int i=0; i<ntask; i++) {
+        // Create one per thread
+        new[i]=object_newfield(info->mesh, info->field->prototype, info->field->fnspc, info->field->dof);
+        if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapfieldgradient_cleanup; }
+        task[i].touch=&new[i]->data; // Zeroed by the worker that uses it
+        
+        task[i].mapfn=(functional_mapfn *) info->fieldgrad;
+        task[i].result=(void *) new[i];
+    }
+    
+    functional_parallelmap(ntask, task);
+    
+    /* Then add up all the fields using their underlying data stores */
+    functional_reducefields(ntask, new);
+    
+    // TODO: Use symmetry actions
+    //if (info->sym==SYMMETRY_ADD) functional_symmetrysumforces(info->mesh, new[0]);
+    
+    success=true;
+    
+functional_mapfieldgradient_cleanup:
+    for (int i=1; i<ntask; i++) if (new[i]) object_free((object *) new[i]);
+    
+    // ...and return the result
+    *out = MORPHO_OBJECT(new[0]);
     
     functional_cleanuptasks(v, ntask, task);
     varray_elementidclear(&imageids);
@@ -1368,7 +1917,7 @@ bool functional_mapnumericalfieldgradient(vm *v, functional_mapinfo *info, value
         // Create one output field per thread
         new[i]=object_newfield(info->mesh, info->field->prototype, info->field->fnspc, info->field->dof);
         if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_mapfieldgradient_cleanup; }
-        field_zero(new[i]);
+        task[i].touch=&new[i]->data; // Zeroed by the worker that uses it
         
         // Clone the vertex matrix for each thread
         fieldclones[i]=field_clone(info->field);
@@ -1394,7 +1943,7 @@ bool functional_mapnumericalfieldgradient(vm *v, functional_mapinfo *info, value
     functional_parallelmap(ntask, task);
     
     /* Then add up all the fields */
-    for (int i=1; i<ntask; i++) matrix_add(&new[0]->data, &new[i]->data, &new[0]->data);
+    functional_reducefields(ntask, new);
     
     success=true;
     
@@ -1436,8 +1985,42 @@ bool functional_sparseaccumulate(objectsparse *A, int i, int j, double val) {
     return true;
 }
 
+DEFINE_VARRAY(functionaltriplet, functionaltriplet);
+
+/** Collects the contributions to a hessian made by one task */
+typedef struct s_functional_hessianaccumulator {
+    varray_functionaltriplet triplets; /* Contributions as (row, col, value) triplets */
+    sparseccs *pattern; /* If set, contributions are added directly to this matrix instead */
+    bool missing; /* Set if a contribution fell outside the pattern */
+    objectmatrix *scratch; /* Zeroed matrix that gradients are evaluated into when differencing the gradient */
+} functional_hessianaccumulator;
+
+/** Adds a contribution to a hessian */
+static void functional_hessianaccumulate(functional_hessianaccumulator *hess, int i, int j, double val) {
+    sparseccs *ccs=hess->pattern;
+    if (ccs) { // Locate the entry by bisection within column j
+        int lo=ccs->cptr[j], hi=ccs->cptr[j+1]-1;
+        while (lo<=hi) {
+            int mid=(lo+hi)/2;
+            if (ccs->rix[mid]==i) { ccs->values[mid]+=val; return; }
+            if (ccs->rix[mid]<i) lo=mid+1; else hi=mid-1;
+        }
+        hess->missing=true;
+    } else {
+        functionaltriplet t = { .row=i, .col=j, .val=val };
+        varray_functionaltripletwrite(&hess->triplets, t);
+    }
+}
+
+/** Adds a dim x dim block, stored in row major order, to the rows of vertex i and columns of vertex j */
+void functional_hessianaddblock(functional_hessianaccumulator *hess, int dim, elementid i, elementid j, double *block) {
+    for (int k=0; k<dim; k++) {
+        for (int l=0; l<dim; l++) functional_hessianaccumulate(hess, i*dim+k, j*dim+l, block[k*dim+l]);
+    }
+}
+
 /** Computes the contribution to the hessian of element eid with respect to vertices i and j */
-bool functional_numericalhess(vm *v, objectmesh *mesh, elementid eid, elementid i, elementid j, int nv, int *vid, functional_integrand *integrand, void *ref, objectsparse *hess) {
+static bool functional_numericalhess(vm *v, objectmesh *mesh, elementid eid, elementid i, elementid j, int nv, int *vid, functional_integrand *integrand, void *ref, functional_hessianaccumulator *hess) {
     double x0,y0,epsx=1e-4,epsy=1e-4;
     
     for (unsigned int k=0; k<mesh->dim; k++) { // Loop over coordinates in vertex i
@@ -1456,7 +2039,7 @@ bool functional_numericalhess(vm *v, objectmesh *mesh, elementid eid, elementid
             
             matrix_setelement(mesh->vert, k, i, x0); // Restore vertex to original position
             
-            functional_sparseaccumulate(hess, i*mesh->dim+k, i*mesh->dim+k, (fr + fl - 2*fc)/(epsx*epsx));
+            functional_hessianaccumulate(hess, i*mesh->dim+k, i*mesh->dim+k, (fr + fl - 2*fc)/(epsx*epsx));
         }
         
         // Loop over coordinates in vertex j
@@ -1484,19 +2067,91 @@ bool functional_numericalhess(vm *v, objectmesh *mesh, elementid eid, elementid
             matrix_setelement(mesh->vert, k, i, x0); // Restore vertices to original position
             matrix_setelement(mesh->vert, l, j, y0);
             
-            functional_sparseaccumulate(hess, i*mesh->dim+k, j*mesh->dim+l, (frr + fll - flr - frl)/(4*epsx*epsy));
-            //functional_sparseaccumulate(hess, j*mesh->dim+l, i*mesh->dim+k, (frr + fll - flr - frl)/(4*epsx*epsy));
+            functional_hessianaccumulate(hess, i*mesh->dim+k, j*mesh->dim+l, (frr + fll - flr - frl)/(4*epsx*epsy));
         }
     }
     
     return true;
 }
 
-/** Computes the gradient of element id with respect to its constituent vertices and any dependencies */
+/** Computes the hessian of element id by differencing its analytic gradient with respect to the vertices in vlist */
+static bool functional_gradienthessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, functional_mapinfo *info, varray_elementid *vlist, functional_hessianaccumulator *hess) {
+    int dim=mesh->dim, n=vlist->count*dim;
+    objectmatrix *frc=hess->scratch;
+    double *H=MORPHO_MALLOC(sizeof(double)*n*n), *gp=MORPHO_MALLOC(sizeof(double)*n);
+    bool success=false;
+    if (!H || !gp) goto functional_gradienthessian_cleanup;
+
+    for (int i=0; i<vlist->count; i++) {
+        for (int k=0; k<dim; k++) {
+            int col=i*dim+k;
+            double x0, eps;
+            matrix_getelement(mesh->vert, k, vlist->data[i], &x0);
+            eps=functional_fdstepsize(x0, 1);
+
+            for (int sgn=1; sgn>=-1; sgn-=2) {
+                matrix_setelement(mesh->vert, k, vlist->data[i], x0+sgn*eps);
+                bool ok=(*info->grad) (v, mesh, id, nv, vid, info->ref, frc);
+
+                for (int j=0; j<vlist->count; j++) { // Collect the gradient and zero the scratch matrix for reuse
+                    double *g;
+                    matrix_getcolumn(frc, vlist->data[j], &g);
+                    for (int l=0; l<dim; l++) {
+                        if (sgn>0) gp[j*dim+l]=g[l];
+                        else H[(j*dim+l)*n+col]=(gp[j*dim+l]-g[l])/(2*eps);
+                        g[l]=0.0;
+                    }
+                }
+
+                if (!ok) {
+                    matrix_setelement(mesh->vert, k, vlist->data[i], x0);
+                    goto functional_gradienthessian_cleanup;
+                }
+            }
+
+            matrix_setelement(mesh->vert, k, vlist->data[i], x0); // Restore vertex to original position
+        }
+    }
+
+    /* Differencing the gradient leaves the result slightly asymmetric, so add the symmetric part */
+    for (int r=0; r<n; r++) {
+        for (int c=0; c<n; c++) {
+            functional_hessianaccumulate(hess, vlist->data[r/dim]*dim+r%dim, vlist->data[c/dim]*dim+c%dim, 0.5*(H[r*n+c]+H[c*n+r]));
+        }
+    }
+    success=true;
+
+functional_gradienthessian_cleanup:
+    if (H) MORPHO_FREE(H);
+    if (gp) MORPHO_FREE(gp);
+    return success;
+}
+
+/** Computes the hessian of element id with respect to its constituent vertices and any dependencies */
 bool functional_numericalhessianmapfn(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, void *out) {
     bool success=true;
     functional_mapinfo *info=(functional_mapinfo *) ref;
     
+    if (info->grad && ((functional_hessianaccumulator *) out)->scratch) { // Difference the analytic gradient if there is one
+        varray_elementid vlist;
+        varray_elementidinit(&vlist);
+        
+        varray_elementidadd(&vlist, vid, nv);
+        if (info->dependencies) success=(info->dependencies) (info, id, &vlist);
+        
+        int k=0; // Dependencies may repeat the element's own vertices
+        for (int i=0; i<vlist.count; i++) {
+            bool repeated=false;
+            for (int j=0; j<k; j++) if (vlist.data[j]==vlist.data[i]) repeated=true;
+            if (!repeated) vlist.data[k++]=vlist.data[i];
+        }
+        vlist.count=k;
+        
+        if (success) success=functional_gradienthessian(v, mesh, id, nv, vid, info, &vlist, out);
+        varray_elementidclear(&vlist);
+        return success;
+    }
+    
     // TODO: Exploit symmetry of hessian to reduce work
     
     for (int i=0; i<nv; i++) {
@@ -1526,14 +2181,282 @@ bool functional_numericalhessianmapfn(vm *v, objectmesh *mesh, elementid id, int
     return success;
 }
 
-static int _sparsecmp(const void *a, const void *b) {
-    objectsparse *aa = *(objectsparse **) a;
-    objectsparse *bb = *(objectsparse **) b;
-    return bb->dok.dict.count - aa->dok.dict.count;
+/** Computes the hessian of element id from the functional's analytic hessian function */
+static bool functional_hessianmapfn(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, void *out) {
+    functional_mapinfo *info=(functional_mapinfo *) ref;
+    return (info->hess) (v, mesh, id, nv, vid, info->ref, (functional_hessianaccumulator *) out);
 }
 
-/** Compute the hessian numerically */
-bool functional_mapnumericalhessian(vm *v, functional_mapinfo *info, value *out) {
+/* ----------------------------
+ * Hessian sparsity patterns
+ * ---------------------------- */
+
+/** A sparsity pattern produced by an earlier hessian, together with what it was computed for */
+typedef struct {
+    objectmesh *mesh; /* Mesh, connectivity and selection used; these identify the pattern but are never dereferenced */
+    objectsparse *conn;
+    objectselection *sel;
+    functional_integrand *integrand; /* Integrand, hessian and dependencies of the functional */
+    functional_hessian *hess;
+    functional_dependencies *dependencies;
+    grade g;
+    int n; /* Dimension of the hessian */
+    int nentries;
+    int *cptr; /* Column pointers and row indices of the pattern */
+    int *rix;
+} functional_hessianpattern;
+
+static functional_hessianpattern functional_patterns[FUNCTIONAL_NHESSIANPATTERNS];
+static int functional_nextpattern = 0;
+
+/** Checks whether a stored pattern was computed for a given map */
+static bool functional_matchpattern(functional_hessianpattern *p, functional_mapinfo *info, objectsparse *conn, int n) {
+    return (p->cptr && p->mesh==info->mesh && p->conn==conn && p->sel==info->sel &&
+            p->integrand==info->integrand && p->hess==info->hess && p->dependencies==info->dependencies &&
+            p->g==info->g && p->n==n);
+}
+
+/** Finds a stored pattern for a given map, returning NULL if there is none */
+static functional_hessianpattern *functional_findpattern(functional_mapinfo *info, objectsparse *conn, int n) {
+    for (int i=0; i<FUNCTIONAL_NHESSIANPATTERNS; i++) {
+        if (functional_matchpattern(&functional_patterns[i], info, conn, n)) return &functional_patterns[i];
+    }
+    return NULL;
+}
+
+/** Frees a stored pattern */
+static void functional_clearpattern(functional_hessianpattern *p) {
+    if (p->cptr) MORPHO_FREE(p->cptr);
+    if (p->rix) MORPHO_FREE(p->rix);
+    p->cptr=NULL;
+    p->rix=NULL;
+}
+
+/** Stores the pattern of a hessian for reuse, replacing the oldest stored pattern if necessary */
+static void functional_storepattern(functional_mapinfo *info, objectsparse *conn, sparseccs *ccs) {
+    functional_hessianpattern *p=functional_findpattern(info, conn, ccs->ncols);
+    if (!p) {
+        p=&functional_patterns[functional_nextpattern];
+        functional_nextpattern=(functional_nextpattern+1) % FUNCTIONAL_NHESSIANPATTERNS;
+    }
+    functional_clearpattern(p);
+    
+    p->cptr=MORPHO_MALLOC(sizeof(int)*(ccs->ncols+1));
+    p->rix=MORPHO_MALLOC(sizeof(int)*(ccs->nentries ? ccs->nentries : 1));
+    if (!p->cptr || !p->rix) { functional_clearpattern(p); return; }
+    
+    memcpy(p->cptr, ccs->cptr, sizeof(int)*(ccs->ncols+1));
+    memcpy(p->rix, ccs->rix, sizeof(int)*ccs->nentries);
+    p->mesh=info->mesh;
+    p->conn=conn;
+    p->sel=info->sel;
+    p->integrand=info->integrand;
+    p->hess=info->hess;
+    p->dependencies=info->dependencies;
+    p->g=info->g;
+    p->n=ccs->ncols;
+    p->nentries=ccs->nentries;
+}
+
+/** Initializes a matrix with a stored pattern and zero values */
+static bool functional_usepattern(functional_hessianpattern *p, sparseccs *ccs) {
+    if (!sparseccs_resize(ccs, p->n, p->n, p->nentries, true)) return false;
+    memcpy(ccs->cptr, p->cptr, sizeof(int)*(p->n+1));
+    memcpy(ccs->rix, p->rix, sizeof(int)*p->nentries);
+    for (int i=0; i<p->nentries; i++) ccs->values[i]=0.0;
+    return true;
+}
+
+/* ----------------------------
+ * Triplet assembly
+ * ---------------------------- */
+
+/** An entry of a column being assembled */
+typedef struct {
+    int row;
+    double val;
+} functional_columnentry;
+
+/** Shared state for assembling triplets from several tasks into a CCS matrix */
+typedef struct {
+    int ntask;
+    int n; /* Dimension of the matrix */
+    functional_hessianaccumulator *acc; /* Triplets from each task */
+    int *offset; /* Offset of each task's entries within each column: offset[t*(n+1)+col] */
+    functional_columnentry *entries; /* Entries sorted by column */
+    int *colstart; /* Start of each column in entries */
+    int *nunique; /* Number of distinct rows in each column */
+    sparseccs *out;
+} functional_assembly;
+
+/** Work done by one thread during assembly */
+typedef struct {
+    functional_assembly *assembly;
+    int task; /* Task whose triplets to count or scatter */
+    int colstart, colend; /* Range of columns to sort or compact */
+} functional_assemblytask;
+
+/** Counts the entries one task contributes to each column */
+static bool functional_assemblecountfn(void *arg) {
+    functional_assemblytask *atask = (functional_assemblytask *) arg;
+    functional_assembly *a = atask->assembly;
+    int *count = a->offset + atask->task*(a->n+1);
+    varray_functionaltriplet *t=&a->acc[atask->task].triplets;
+    
+    for (int i=0; i<=a->n; i++) count[i]=0;
+    for (int i=0; i<t->count; i++) count[t->data[i].col]++;
+    return true;
+}
+
+/** Scatters one task's triplets into their columns */
+static bool functional_assemblescatterfn(void *arg) {
+    functional_assemblytask *atask = (functional_assemblytask *) arg;
+    functional_assembly *a = atask->assembly;
+    int *posn = a->offset + atask->task*(a->n+1);
+    varray_functionaltriplet *t=&a->acc[atask->task].triplets;
+    
+    for (int i=0; i<t->count; i++) {
+        functional_columnentry e = { .row=t->data[i].row, .val=t->data[i].val };
+        a->entries[posn[t->data[i].col]++]=e;
+    }
+    return true;
+}
+
+/** Orders column entries by row, keeping entries with the same row in the order they were scattered */
+static int functional_columnentrycmp(const void *a, const void *b) {
+    const functional_columnentry *aa = a, *bb = b;
+    if (aa->row!=bb->row) return (aa->row<bb->row ? -1 : 1);
+    return (aa<bb ? -1 : (aa>bb ? 1 : 0));
+}
+
+/** Sorts a range of columns by row and sums entries with the same row */
+static bool functional_assemblesortfn(void *arg) {
+    functional_assemblytask *atask = (functional_assemblytask *) arg;
+    functional_assembly *a = atask->assembly;
+    
+    for (int col=atask->colstart; col<atask->colend; col++) {
+        functional_columnentry *e = a->entries+a->colstart[col];
+        int n = a->colstart[col+1]-a->colstart[col], k=0;
+        
+        qsort(e, n, sizeof(functional_columnentry), functional_columnentrycmp);
+        for (int i=0; i<n; i++) {
+            if (k>0 && e[k-1].row==e[i].row) e[k-1].val+=e[i].val;
+            else e[k++]=e[i];
+        }
+        a->nunique[col]=k;
+    }
+    return true;
+}
+
+/** Copies a range of reduced columns into the output matrix */
+static bool functional_assemblecompactfn(void *arg) {
+    functional_assemblytask *atask = (functional_assemblytask *) arg;
+    functional_assembly *a = atask->assembly;
+    
+    for (int col=atask->colstart; col<atask->colend; col++) {
+        functional_columnentry *e = a->entries+a->colstart[col];
+        int k=a->out->cptr[col];
+        for (int i=0; i<a->nunique[col]; i++) {
+            a->out->rix[k+i]=e[i].row;
+            a->out->values[k+i]=e[i].val;
+        }
+    }
+    return true;
+}
+
+/** Runs one phase of the assembly on each thread */
+static void functional_assemblephase(functional_assembly *a, functional_assemblytask *tasks, workfn fn) {
+    if (!threadpool_prepare(&functional_pool, &functional_poolinitialized, morpho_threadnumber())) {
+        for (int i=0; i<a->ntask; i++) (*fn) ((void *) &tasks[i]);
+        return;
+    }
+    
+    for (int i=0; i<a->ntask; i++) threadpool_add_task(&functional_pool, fn, (void *) &tasks[i]);
+    threadpool_fence(&functional_pool);
+    threadpool_release(&functional_pool);
+}
+
+/** Assembles triplets collected by several tasks into an n x n CCS matrix, summing duplicate entries
+ * @param[in] ntask - number of tasks
+ * @param[in] acc - triplets collected by each task
+ * @param[in] n - dimension of the matrix
+ * @param[out] out - the assembled matrix
+ * @returns true on success */
+static bool functional_assembletriplets(int ntask, functional_hessianaccumulator *acc, int n, sparseccs *out) {
+    bool success=false;
+    functional_assembly a = { .ntask=ntask, .n=n, .acc=acc, .out=out };
+    functional_assemblytask tasks[ntask];
+    
+    unsigned int ntriplets=0;
+    for (int t=0; t<ntask; t++) ntriplets+=acc[t].triplets.count;
+    
+    a.offset=MORPHO_MALLOC(sizeof(int)*ntask*(n+1));
+    a.entries=MORPHO_MALLOC(sizeof(functional_columnentry)*(ntriplets ? ntriplets : 1));
+    a.colstart=MORPHO_MALLOC(sizeof(int)*(n+1));
+    a.nunique=MORPHO_MALLOC(sizeof(int)*(n+1));
+    if (!a.offset || !a.entries || !a.colstart || !a.nunique) goto functional_assembletriplets_cleanup;
+    
+    for (int t=0; t<ntask; t++) {
+        tasks[t].assembly=&a;
+        tasks[t].task=t;
+        tasks[t].colstart=(int) (((long) n)*t/ntask);
+        tasks[t].colend=(int) (((long) n)*(t+1)/ntask);
+    }
+    
+    /* Count entries in each column, then convert counts into offsets so each task scatters into its own slots */
+    functional_assemblephase(&a, tasks, functional_assemblecountfn);
+    
+    int posn=0;
+    for (int col=0; col<n; col++) {
+        a.colstart[col]=posn;
+        for (int t=0; t<ntask; t++) {
+            int *cnt=a.offset+t*(n+1)+col;
+            int c=*cnt;
+            *cnt=posn;
+            posn+=c;
+        }
+    }
+    a.colstart[n]=posn;
+    
+    functional_assemblephase(&a, tasks, functional_assemblescatterfn);
+    functional_assemblephase(&a, tasks, functional_assemblesortfn);
+    
+    int nentries=0;
+    for (int col=0; col<n; col++) nentries+=a.nunique[col];
+    if (!sparseccs_resize(out, n, n, nentries, true)) goto functional_assembletriplets_cleanup;
+    
+    out->cptr[0]=0;
+    for (int col=0; col<n; col++) out->cptr[col+1]=out->cptr[col]+a.nunique[col];
+    
+    functional_assemblephase(&a, tasks, functional_assemblecompactfn);
+    success=true;
+    
+functional_assembletriplets_cleanup:
+    if (a.offset) MORPHO_FREE(a.offset);
+    if (a.entries) MORPHO_FREE(a.entries);
+    if (a.colstart) MORPHO_FREE(a.colstart);
+    if (a.nunique) MORPHO_FREE(a.nunique);
+    
+    return success;
+}
+
+/* ----------------------------
+ * Map hessians
+ * ---------------------------- */
+
+/** Maps the hessian over elements, either one colour at a time or over the whole range [start, end) */
+static void functional_runhessian(int ntask, functional_task *task, functional_colouring *colouring, elementid start, elementid end) {
+    if (colouring) {
+        functional_parallelmapcoloured(ntask, task, colouring);
+    } else {
+        task[0].start=start;
+        task[0].end=end;
+        functional_parallelmap(ntask, task);
+    }
+}
+
+/** Maps a hessian function over the elements; perturbs indicates that mapfn perturbs the vertex matrix in place */
+static bool functional_maphessianwith(vm *v, functional_mapinfo *info, functional_mapfn *mapfn, bool perturbs, value *out) {
     int success=false;
     int ntask=morpho_threadnumber();
     if (ntask==0) ntask = 1;
@@ -1542,73 +2465,99 @@ bool functional_mapnumericalhessian(vm *v, functional_mapinfo *info, value *out)
     varray_elementid imageids;
     varray_elementidinit(&imageids);
     
-    objectsparse *new[ntask]; // Create an output matrix for each thread
-    objectmesh meshclones[ntask]; // Create shallow clones of the mesh with different vertex matrices
+    objectsparse *new=NULL; // Output matrix
+    functional_hessianaccumulator acc[ntask]; // Contributions from each thread
+    objectmesh meshclones[ntask]; // Shallow clones of the mesh, used only if elements can't be coloured
+    
+    functional_colouring colouring;
+    bool coloured=false;
     
     for (int i=0; i<ntask; i++) {
-        new[i]=NULL;
+        varray_functionaltripletinit(&acc[i].triplets);
+        acc[i].pattern=NULL;
+        acc[i].missing=false;
+        acc[i].scratch=NULL;
         meshclones[i].vert=NULL;
     }
     
     if (!functional_preparetasks(v, info, ntask, task, &imageids)) return false;
+    elementid start=task[0].start, end=task[0].end;
+    objectsparse *conn=task[0].conn;
+    int N = info->mesh->dim*mesh_nvertices(info->mesh);
+    
+    new=object_newsparse(&N, &N);
+    if (!new) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maphessian_cleanup; }
+    
+    /* Threads share the vertex matrix, perturbing it in place, if they work on elements that
+       touch distinct vertices; otherwise each thread needs its own copy */
+    functional_hessianpattern *pattern=functional_findpattern(info, conn, N);
+    if (ntask>1 && (perturbs || pattern)) coloured=functional_colourelements(info, task, &colouring);
     
     for (int i=0; i<ntask; i++) {
-        int N = info->mesh->dim*mesh_nvertices(info->mesh);
-        
-        // Create one output matrix per thread
-        new[i]=object_newsparse(&N, &N);
-        if (!new[i]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maphessian_cleanup; }
+        if (ntask>1 && perturbs && !coloured) {
+            meshclones[i]=*info->mesh;
+            meshclones[i].vert=object_clonematrix(info->mesh->vert);
+            if (!meshclones[i].vert) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maphessian_cleanup; }
+            task[i].mesh=&meshclones[i];
+        }
         
-        // Clone the vertex matrix for each thread
-        meshclones[i]=*info->mesh;
-        meshclones[i].vert=object_clonematrix(info->mesh->vert);
-        if (!meshclones[i].vert) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maphessian_cleanup; }
-        task[i].mesh=&meshclones[i];
+        /* Gradients are evaluated into a scratch matrix if the hessian is found by differencing the gradient */
+        if (perturbs && info->grad) {
+            acc[i].scratch=object_newmatrix(info->mesh->vert->nrows, info->mesh->vert->ncols, true);
+            if (!acc[i].scratch) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functional_maphessian_cleanup; }
+        }
         
         task[i].ref=(void *) info; // Use this to pass the info structure
-        task[i].mapfn=functional_numericalhessianmapfn;
-        task[i].result=(void *) new[i];
+        task[i].mapfn=mapfn;
+        task[i].result=(void *) &acc[i];
     }
     
-    functional_parallelmap(ntask, task);
-    
-    qsort(new, ntask, sizeof(objectsparse *), _sparsecmp);
-    
-    if (!sparse_checkformat(new[0], SPARSE_CCS, true, true)) {
-        morpho_runtimeerror(v, SPARSE_OPFAILEDERR);
-        goto functional_maphessian_cleanup;
+    /* If the sparsity pattern is known and threads can't write to the same entries, add directly to the output */
+    if (pattern && (ntask==1 || coloured) &&
+        functional_usepattern(pattern, &new->ccs)) {
+        for (int i=0; i<ntask; i++) acc[i].pattern=&new->ccs;
+        
+        functional_runhessian(ntask, task, (coloured ? &colouring : NULL), start, end);
+        
+        bool missing=false;
+        for (int i=0; i<ntask; i++) {
+            missing |= acc[i].missing;
+            acc[i].pattern=NULL;
+        }
+        
+        if (!missing) success=true;
+        else sparseccs_clear(&new->ccs); // The pattern is stale, so rebuild from triplets
     }
     
-    /* Then add up all the matrices */
-    for (int i=1; i<ntask; i++) {
-        if (!new[i]->dok.dict.count) continue;
-        objectsparse out = MORPHO_STATICSPARSE();
-        sparsedok_init(&out.dok);
-        sparseccs_init(&out.ccs);
+    if (!success) {
+        functional_runhessian(ntask, task, (coloured ? &colouring : NULL), start, end);
         
-        if (sparse_add(new[0], new[i], 1.0, 1.0, &out)==SPARSE_OK) {
-            sparseccs_clear(&new[0]->ccs);
-            new[0]->ccs = out.ccs;
-        } else {
+        if (!functional_assembletriplets(ntask, acc, N, &new->ccs)) {
             morpho_runtimeerror(v, SPARSE_OPFAILEDERR);
             goto functional_maphessian_cleanup;
         }
+        
+        functional_storepattern(info, conn, &new->ccs);
+        success=true;
     }
-    success=true;
     
     // Use symmetry actions
     //if (info->sym==SYMMETRY_ADD) functional_symmetrysumforces(info->mesh, new[0]);
     
-    sparsedok_clear(&new[0]->dok); // Remove dok info
+    sparsedok_clear(&new->dok); // Remove dok info
     
     // ...and return the result
-    *out = MORPHO_OBJECT(new[0]);
+    *out = MORPHO_OBJECT(new);
     
 functional_maphessian_cleanup:
-    // Free the temporary copies of the vertex matrices
-    for (int i=0; i<ntask; i++) object_free((object *) meshclones[i].vert);
-    // Free spare output matrices
-    for (int i=1; i<ntask; i++) if (new[i]) object_free((object *) new[i]);
+    if (!success && new) object_free((object *) new);
+    if (coloured) varray_elementidclear(&colouring.elements);
+    for (int i=0; i<ntask; i++) {
+        // Free the temporary copies of the vertex matrices
+        if (meshclones[i].vert) object_free((object *) meshclones[i].vert);
+        if (acc[i].scratch) object_free((object *) acc[i].scratch);
+        varray_functionaltripletclear(&acc[i].triplets);
+    }
     
     functional_cleanuptasks(v, ntask, task);
     varray_elementidclear(&imageids);
@@ -1616,6 +2565,88 @@ functional_maphessian_cleanup:
     return success;
 }
 
+/** Compute the hessian from the functional's analytic hessian function */
+bool functional_maphessian(vm *v, functional_mapinfo *info, value *out) {
+    return functional_maphessianwith(v, info, functional_hessianmapfn, false, out);
+}
+
+/** Compute the hessian numerically */
+bool functional_mapnumericalhessian(vm *v, functional_mapinfo *info, value *out) {
+    return functional_maphessianwith(v, info, functional_numericalhessianmapfn, true, out);
+}
+
+/* ----------------------------
+ * Exact derivatives
+ * ---------------------------- */
+
+/** Gets the position of a vertex as dual numbers, making its coordinates variables of the computation
+ * @param[in] x - dual vertex positions
+ * @param[in] id - vertex id
+ * @param[out] out - mesh->dim dual numbers
+ * @returns false if the vertex doesn't exist or too many vertices have been requested */
+bool functional_dualposition(functional_dualvertices *x, elementid id, dual *out) {
+    int dim=x->mesh->dim, k;
+    double *pos;
+    if (!matrix_getcolumn(x->mesh->vert, id, &pos)) return false;
+
+    for (k=0; k<x->nvert; k++) if (x->vert[k]==id) break;
+    if (k==x->nvert) {
+        if ((k+1)*dim>DUAL_MAXVARIABLES) { x->overflow=true; return false; }
+        x->vert[x->nvert++]=id;
+    }
+
+    for (int l=0; l<dim; l++) dual_variable(pos[l], k*dim+l, x->hessian, &out[l]);
+    return true;
+}
+
+/** Evaluates a dual integrand, raising an error if it needed too many variables */
+static bool functional_dualevaluate(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualintegrand *integrand, functional_dualvertices *x, dual *out) {
+    x->mesh=mesh;
+    x->overflow=false;
+    x->nvert=0;
+
+    if ((*integrand) (v, mesh, id, nv, vid, ref, x, out)) return true;
+    if (x->overflow) morpho_runtimeerror(v, FUNCTIONAL_DUALVARS);
+    return false;
+}
+
+/** Computes the gradient of an element exactly from a dual integrand */
+bool functional_dualgradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualintegrand *integrand, objectmatrix *frc) {
+    int dim=mesh->dim;
+    functional_dualvertices x = { .hessian=false };
+    dual out;
+    double grad[dim];
+
+    if (!functional_dualevaluate(v, mesh, id, nv, vid, ref, integrand, &x, &out)) return false;
+
+    for (int k=0; k<x.nvert; k++) {
+        for (int l=0; l<dim; l++) grad[l]=dual_gradient(&out, k*dim+l);
+        matrix_addtocolumn(frc, x.vert[k], 1.0, grad);
+    }
+
+    return true;
+}
+
+/** Computes the hessian of an element exactly from a dual integrand */
+bool functional_dualhessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualintegrand *integrand, functional_hessianaccumulator *hess) {
+    int dim=mesh->dim;
+    functional_dualvertices x = { .hessian=true };
+    dual out;
+    double block[dim*dim];
+
+    if (!functional_dualevaluate(v, mesh, id, nv, vid, ref, integrand, &x, &out)) return false;
+
+    for (int k=0; k<x.nvert; k++) {
+        for (int m=0; m<x.nvert; m++) {
+            for (int a=0; a<dim; a++) {
+                for (int b=0; b<dim; b++) block[a*dim+b]=dual_hessian(&out, k*dim+a, m*dim+b);
+            }
+            functional_hessianaddblock(hess, dim, x.vert[k], x.vert[m], block);
+        }
+    }
+
+    return true;
+}
 
 /* **********************************************************************
  * Common library functions
@@ -1705,48 +2736,207 @@ bool functional_elementgradient(vm *v, objectmesh *mesh, grade g, elementid id,
     return false;
 }
 
-/* ----------------------------------------------
- * Length
- * ---------------------------------------------- */
-
-/** Calculate area */
-bool length_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
-    if (nv!=2) return false;
-    double *x[nv], s0[mesh->dim];
-    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
-
-    functional_vecsub(mesh->dim, x[1], x[0], s0);
+bool integral_prepareinvjacobian(unsigned int dim, grade g, double **x, objectmatrix *invj);
 
-    *out=functional_vecnorm(mesh->dim, s0);
+/** Computes the size and normal, and optionally the inverse jacobian, of every element of grade g and caches them in the mesh
+ *  so that functionals can share them until the vertices move. Must not be called while elements are mapped over in parallel.
+ * @param[in] mesh - the mesh
+ * @param[in] g - grade of element
+ * @param[in] jacobian - whether inverse jacobians are also required
+ * @returns true if the cache is up to date */
+bool functional_preparegeometry(objectmesh *mesh, grade g, bool jacobian) {
+    if (g<MESH_GRADE_LINE || g>MESH_GRADE_VOLUME) return false;
+    
+    meshgeometry *geo = mesh_getgeometry(mesh, g);
+    if (geo && (!jacobian || geo->invj)) return true;
+    
+    geo=mesh_newgeometry(mesh, g, jacobian); // Invalid until filled in, so the size functions below don't use it
+    if (!geo) return false;
+    
+    objectsparse *conn = mesh_getconnectivityelement(mesh, 0, g);
+    int dim = mesh->dim;
+    
+    for (elementid id=0; id<geo->nel; id++) {
+        int nv, *vid;
+        if (!mesh_getconnectivity(conn, id, &nv, &vid) ||
+            nv!=g+1 ||
+            !functional_elementsize(NULL, mesh, g, id, nv, vid, &geo->size[id])) return false;
+        
+        double *x[nv];
+        for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+        
+        if (geo->normal) { // Calculated as in integral_evaluatenormal
+            double s0[dim], s1[dim], *n=geo->normal+id*dim;
+            functional_vecsub(dim, x[1], x[0], s0);
+            functional_vecsub(dim, x[2], x[1], s1);
+            functional_veccross(s0, s1, n);
+            
+            double nnorm=functional_vecnorm(dim, n);
+            if (fabs(nnorm)>MORPHO_EPS) functional_vecscale(dim, 1.0/nnorm, n, n);
+        }
+        
+        if (geo->invj) {
+            objectmatrix invj = MORPHO_STATICMATRIX(geo->invj+id*dim*g, g, dim);
+            integral_prepareinvjacobian(dim, g, x, &invj);
+        }
+    }
+    
+    mesh_validategeometry(mesh, geo);
     return true;
 }
 
-/** Calculate scaled gradient */
-bool length_gradient_scale(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc, double scale) {
-    double *x[nv], s0[mesh->dim], norm;
-    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
-
-    functional_vecsub(mesh->dim, x[1], x[0], s0);
-    norm=functional_vecnorm(mesh->dim, s0);
-    if (norm<MORPHO_EPS) return false;
+/** Adds the hessian of a function of k vectors s_p to the hessian, where s_p=x_{p+1}-x_0 if relative is set or s_p=x_p otherwise;
+ *  hs holds the (k*dim) x (k*dim) second derivatives with respect to the components of the s_p in row major order */
+static void functional_hessianaddvectors(functional_hessianaccumulator *hess, int dim, int nv, int *vid, int k, bool relative, double *hs) {
+    int n=k*dim;
+    double c[k][nv], block[dim*dim];
 
-    matrix_addtocolumn(frc, vid[0], -1.0/norm*scale, s0);
-    matrix_addtocolumn(frc, vid[1], 1./norm*scale, s0);
+    for (int p=0; p<k; p++) { // Derivative of s_p with respect to each vertex
+        for (int i=0; i<nv; i++) {
+            if (relative) c[p][i]=(i==p+1 ? 1.0 : (i==0 ? -1.0 : 0.0));
+            else c[p][i]=(i==p ? 1.0 : 0.0);
+        }
+    }
 
-    return true;
-}
+    for (int i=0; i<nv; i++) {
+        for (int j=0; j<nv; j++) {
+            for (int l=0; l<dim*dim; l++) block[l]=0.0;
+
+            for (int p=0; p<k; p++) {
+                if (c[p][i]==0.0) continue;
+                for (int q=0; q<k; q++) {
+                    double cc=c[p][i]*c[q][j];
+                    if (cc==0.0) continue;
+                    for (int a=0; a<dim; a++) {
+                        for (int b=0; b<dim; b++) block[a*dim+b]+=cc*hs[(p*dim+a)*n+q*dim+b];
+                    }
+                }
+            }
+
+            functional_hessianaddblock(hess, dim, vid[i], vid[j], block);
+        }
+    }
+}
+
+/** Hessian of the area 1/2 sqrt(|s0|^2 |s1|^2 - (s0.s1)^2) of the triangle spanned by s0 and s1 */
+static bool functional_gramhessian(int dim, double *s0, double *s1, double *hs) {
+    int n=2*dim;
+    double a=functional_vecdot(dim, s0, s0), b=functional_vecdot(dim, s0, s1), c=functional_vecdot(dim, s1, s1);
+    double D=a*c-b*b;
+    if (D<MORPHO_EPS*MORPHO_EPS) return false;
+
+    double rD=sqrt(D), alpha=1.0/(4*rD), beta=1.0/(8*D*rD);
+    double g[n]; // Gradient of D
+
+    for (int x=0; x<dim; x++) {
+        g[x]=2*c*s0[x]-2*b*s1[x];
+        g[dim+x]=2*a*s1[x]-2*b*s0[x];
+    }
+
+    for (int x=0; x<dim; x++) {
+        for (int y=0; y<dim; y++) {
+            double delta=(x==y ? 1.0 : 0.0);
+            hs[x*n+y]=alpha*(2*c*delta-2*s1[x]*s1[y]);
+            hs[(dim+x)*n+dim+y]=alpha*(2*a*delta-2*s0[x]*s0[y]);
+            hs[x*n+dim+y]=alpha*(4*s0[x]*s1[y]-2*s1[x]*s0[y]-2*b*delta);
+            hs[(dim+x)*n+y]=alpha*(4*s1[x]*s0[y]-2*s0[x]*s1[y]-2*b*delta);
+        }
+    }
+
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<n; j++) hs[i*n+j]-=beta*g[i]*g[j];
+    }
+
+    return true;
+}
+
+/** Levi-Civita symbol for indices in 0...2 */
+static int functional_levicivita(int a, int b, int c) {
+    return (a-b)*(b-c)*(c-a)/2;
+}
+
+/** Hessian of scale*s0.(s1 x s2) with respect to the three vectors */
+static void functional_tripleproducthessian(double *s[3], double scale, double *hs) {
+    for (int p=0; p<3; p++) {
+        for (int q=0; q<3; q++) {
+            int r=3-p-q, sgn=(p==q ? 0 : functional_levicivita(p, q, r));
+            for (int a=0; a<3; a++) {
+                for (int b=0; b<3; b++) {
+                    double val=0.0;
+                    if (sgn) for (int c=0; c<3; c++) val+=functional_levicivita(a, b, c)*s[r][c];
+                    hs[(p*3+a)*9+q*3+b]=scale*sgn*val;
+                }
+            }
+        }
+    }
+}
+
+/* ----------------------------------------------
+ * Length
+ * ---------------------------------------------- */
+
+/** Calculate area */
+bool length_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    if (nv!=2) return false;
+    meshgeometry *geo = mesh_getgeometry(mesh, MESH_GRADE_LINE);
+    if (geo && id<geo->nel) { *out=geo->size[id]; return true; }
+    
+    double *x[nv], s0[mesh->dim];
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    functional_vecsub(mesh->dim, x[1], x[0], s0);
+
+    *out=functional_vecnorm(mesh->dim, s0);
+    return true;
+}
+
+/** Calculate scaled gradient */
+bool length_gradient_scale(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc, double scale) {
+    double *x[nv], s0[mesh->dim], norm;
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    functional_vecsub(mesh->dim, x[1], x[0], s0);
+    norm=functional_vecnorm(mesh->dim, s0);
+    if (norm<MORPHO_EPS) return false;
+
+    matrix_addtocolumn(frc, vid[0], -1.0/norm*scale, s0);
+    matrix_addtocolumn(frc, vid[1], 1./norm*scale, s0);
+
+    return true;
+}
 
 /** Calculate gradient */
 bool length_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
     return length_gradient_scale(v, mesh, id, nv, vid, NULL, frc, 1.0);
 }
 
+/** Calculate hessian */
+bool length_hessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_hessianaccumulator *hess) {
+    if (nv!=2) return false;
+    int dim=mesh->dim;
+    double *x[nv], s0[dim], hs[dim*dim], norm;
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    functional_vecsub(dim, x[1], x[0], s0);
+    norm=functional_vecnorm(dim, s0);
+    if (norm<MORPHO_EPS) return false;
+
+    for (int a=0; a<dim; a++) {
+        for (int b=0; b<dim; b++) hs[a*dim+b]=((a==b ? 1.0 : 0.0) - s0[a]*s0[b]/(norm*norm))/norm;
+    }
+
+    functional_hessianaddvectors(hess, dim, nv, vid, 1, true, hs);
+    return true;
+}
+
 FUNCTIONAL_INIT(Length, MESH_GRADE_LINE)
 FUNCTIONAL_INTEGRAND(Length, MESH_GRADE_LINE, length_integrand)
 FUNCTIONAL_INTEGRANDFORELEMENT(Length, MESH_GRADE_LINE, length_integrand)
 FUNCTIONAL_GRADIENT(Length, MESH_GRADE_LINE, length_gradient, SYMMETRY_ADD)
 FUNCTIONAL_TOTAL(Length, MESH_GRADE_LINE, length_integrand)
-FUNCTIONAL_HESSIAN(Length, MESH_GRADE_LINE, length_integrand)
+FUNCTIONAL_TOTALANDGRADIENT(Length, MESH_GRADE_LINE, length_integrand, length_gradient, SYMMETRY_ADD)
+FUNCTIONAL_SETPREPARE(Length, MESH_GRADE_LINE, length_integrand, length_gradient, SYMMETRY_ADD)
+FUNCTIONAL_ANALYTICHESSIAN(Length, MESH_GRADE_LINE, length_hessian)
 
 MORPHO_BEGINCLASS(Length)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, Length_init, BUILTIN_FLAGSEMPTY),
@@ -1754,7 +2944,8 @@ MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, Length_integrand, BUILTIN_FLAGSEMPTY)
 MORPHO_METHOD(FUNCTIONAL_INTEGRANDFORELEMENT_METHOD, Length_integrandForElement, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, Length_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, Length_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, Length_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, Length_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, Length_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -1779,37 +2970,53 @@ bool areaenclosed_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *
     return true;
 }
 
-/** Calculate gradient */
-bool areaenclosed_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
-    double *x[nv], cx[3], s[3];
-    double norm;
-    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+/** Calculate area enclosed on dual numbers */
+static bool areaenclosed_dualintegrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualvertices *x, dual *out) {
+    int dim=mesh->dim;
+    if (nv!=2 || dim<2 || dim>3) return false;
+    dual x0[dim], x1[dim], cx[3];
 
-    if (mesh->dim==3) {
-        functional_veccross(x[0], x[1], cx);
-        norm=functional_vecnorm(mesh->dim, cx);
-        if (norm<MORPHO_EPS) return false;
+    if (!functional_dualposition(x, vid[0], x0) ||
+        !functional_dualposition(x, vid[1], x1)) return false;
 
-        functional_veccross(x[1], cx, s);
-        matrix_addtocolumn(frc, vid[0], 0.5/norm, s);
+    if (dim==2) {
+        dual_veccross2d(x0, x1, out);
+        dual_fabs(out, out);
+    } else {
+        dual_veccross(x0, x1, cx);
+        dual_vecdot(3, cx, cx, out);
+        if (out->val<MORPHO_EPS*MORPHO_EPS) { dual_constant(0.0, out); return true; } // The norm isn't differentiable at zero
+        dual_sqrt(out, out);
+    }
 
-        functional_veccross(cx, x[0], s);
-        matrix_addtocolumn(frc, vid[1], 0.5/norm, s);
-    } else if (mesh->dim==2) {
-        functional_veccross2d(x[0], x[1], cx);
+    dual_scale(out, 0.5, out);
+    return true;
+}
 
-    }
+/** Calculate gradient */
+FUNCTIONAL_DUALGRADIENTFN(areaenclosed_gradient, areaenclosed_dualintegrand)
+
+/** Calculate hessian */
+bool areaenclosed_hessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_hessianaccumulator *hess) {
+    if (nv!=2) return false;
+    int dim=mesh->dim;
+    double *x[nv], hs[4*dim*dim];
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    if (!functional_gramhessian(dim, x[0], x[1], hs)) return false;
 
+    functional_hessianaddvectors(hess, dim, nv, vid, 2, false, hs);
     return true;
 }
 
 FUNCTIONAL_INIT(AreaEnclosed, MESH_GRADE_LINE)
 FUNCTIONAL_INTEGRAND(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand)
 FUNCTIONAL_INTEGRANDFORELEMENT(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand)
-FUNCTIONAL_NUMERICALGRADIENT(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand, SYMMETRY_ADD)
-//FUNCTIONAL_GRADIENT(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_gradient, SYMMETRY_ADD)
+FUNCTIONAL_GRADIENT(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_gradient, SYMMETRY_ADD)
 FUNCTIONAL_TOTAL(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand)
-FUNCTIONAL_HESSIAN(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand)
+FUNCTIONAL_TOTALANDGRADIENT(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand, areaenclosed_gradient, SYMMETRY_ADD)
+FUNCTIONAL_SETPREPARE(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_integrand, areaenclosed_gradient, SYMMETRY_ADD)
+FUNCTIONAL_ANALYTICHESSIAN(AreaEnclosed, MESH_GRADE_LINE, areaenclosed_hessian)
 
 MORPHO_BEGINCLASS(AreaEnclosed)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, AreaEnclosed_init, BUILTIN_FLAGSEMPTY),
@@ -1817,7 +3024,8 @@ MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, AreaEnclosed_integrand, BUILTIN_FLAGS
 MORPHO_METHOD(FUNCTIONAL_INTEGRANDFORELEMENT_METHOD, AreaEnclosed_integrandForElement, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, AreaEnclosed_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, AreaEnclosed_hessian, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, AreaEnclosed_total, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, AreaEnclosed_total, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, AreaEnclosed_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -1827,6 +3035,9 @@ MORPHO_ENDCLASS
 /** Calculate area */
 bool area_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
     if (nv!=3) return false;
+    meshgeometry *geo = mesh_getgeometry(mesh, MESH_GRADE_AREA);
+    if (geo && id<geo->nel) { *out=geo->size[id]; return true; }
+    
     double *x[nv], s0[3], s1[3], cx[3];
     for (int j=0; j<3; j++) { s0[j]=0; s1[j]=0; cx[j]=0; }
     for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
@@ -1872,12 +3083,29 @@ bool area_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void
     return area_gradient_scale(v, mesh, id, nv, vid, NULL, frc, 1.0);
 }
 
+/** Calculate hessian */
+bool area_hessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_hessianaccumulator *hess) {
+    if (nv!=3) return false;
+    int dim=mesh->dim;
+    double *x[nv], s0[dim], s1[dim], hs[4*dim*dim];
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    functional_vecsub(dim, x[1], x[0], s0);
+    functional_vecsub(dim, x[2], x[0], s1);
+    if (!functional_gramhessian(dim, s0, s1, hs)) return false;
+
+    functional_hessianaddvectors(hess, dim, nv, vid, 2, true, hs);
+    return true;
+}
+
 FUNCTIONAL_INIT(Area, MESH_GRADE_AREA)
 FUNCTIONAL_INTEGRAND(Area, MESH_GRADE_AREA, area_integrand)
 FUNCTIONAL_INTEGRANDFORELEMENT(Area, MESH_GRADE_AREA, area_integrand)
 FUNCTIONAL_GRADIENT(Area, MESH_GRADE_AREA, area_gradient, SYMMETRY_ADD)
 FUNCTIONAL_TOTAL(Area, MESH_GRADE_AREA, area_integrand)
-FUNCTIONAL_HESSIAN(Area, MESH_GRADE_AREA, area_integrand)
+FUNCTIONAL_TOTALANDGRADIENT(Area, MESH_GRADE_AREA, area_integrand, area_gradient, SYMMETRY_ADD)
+FUNCTIONAL_SETPREPARE(Area, MESH_GRADE_AREA, area_integrand, area_gradient, SYMMETRY_ADD)
+FUNCTIONAL_ANALYTICHESSIAN(Area, MESH_GRADE_AREA, area_hessian)
 
 MORPHO_BEGINCLASS(Area)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, Area_init, BUILTIN_FLAGSEMPTY),
@@ -1885,7 +3113,8 @@ MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, Area_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRANDFORELEMENT_METHOD, Area_integrandForElement, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, Area_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, Area_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, Area_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, Area_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, Area_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -1928,18 +3157,35 @@ bool volumeenclosed_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int
     return true;
 }
 
+/** Calculate hessian */
+bool volumeenclosed_hessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_hessianaccumulator *hess) {
+    if (nv!=3 || mesh->dim!=3) return false;
+    double *x[nv], cx[3], hs[81];
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    functional_veccross(x[0], x[1], cx);
+    double sgn=(functional_vecdot(3, cx, x[2])<0 ? -1.0 : 1.0);
+
+    functional_tripleproducthessian(x, sgn/6.0, hs);
+    functional_hessianaddvectors(hess, 3, nv, vid, 3, false, hs);
+    return true;
+}
+
 FUNCTIONAL_INIT(VolumeEnclosed, MESH_GRADE_AREA)
 FUNCTIONAL_INTEGRAND(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_integrand)
 FUNCTIONAL_GRADIENT(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_gradient, SYMMETRY_ADD)
 FUNCTIONAL_TOTAL(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_integrand)
-FUNCTIONAL_HESSIAN(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_integrand)
+FUNCTIONAL_TOTALANDGRADIENT(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_integrand, volumeenclosed_gradient, SYMMETRY_ADD)
+FUNCTIONAL_SETPREPARE(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_integrand, volumeenclosed_gradient, SYMMETRY_ADD)
+FUNCTIONAL_ANALYTICHESSIAN(VolumeEnclosed, MESH_GRADE_AREA, volumeenclosed_hessian)
 
 MORPHO_BEGINCLASS(VolumeEnclosed)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, VolumeEnclosed_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, VolumeEnclosed_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, VolumeEnclosed_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, VolumeEnclosed_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, VolumeEnclosed_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, VolumeEnclosed_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, VolumeEnclosed_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -1948,6 +3194,9 @@ MORPHO_ENDCLASS
 
 /** Calculate enclosed volume */
 bool volume_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    meshgeometry *geo = mesh_getgeometry(mesh, MESH_GRADE_VOLUME);
+    if (geo && id<geo->nel) { *out=geo->size[id]; return true; }
+    
     double *x[nv], s10[mesh->dim], s20[mesh->dim], s30[mesh->dim], cx[mesh->dim];
     for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
 
@@ -1996,18 +3245,40 @@ bool volume_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, vo
     return volume_gradient_scale(v, mesh, id, nv, vid, NULL, frc, 1.0);
 }
 
+/** Calculate hessian */
+bool volume_hessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_hessianaccumulator *hess) {
+    if (nv!=4 || mesh->dim!=3) return false;
+    double *x[nv], s10[3], s20[3], s30[3], cx[3], hs[81];
+    for (int j=0; j<nv; j++) matrix_getcolumn(mesh->vert, vid[j], &x[j]);
+
+    functional_vecsub(3, x[1], x[0], s10);
+    functional_vecsub(3, x[2], x[0], s20);
+    functional_vecsub(3, x[3], x[0], s30);
+
+    functional_veccross(s20, s30, cx);
+    double sgn=(functional_vecdot(3, s10, cx)<0 ? -1.0 : 1.0);
+
+    double *s[3] = { s10, s20, s30 };
+    functional_tripleproducthessian(s, sgn/6.0, hs);
+    functional_hessianaddvectors(hess, 3, nv, vid, 3, true, hs);
+    return true;
+}
+
 FUNCTIONAL_INIT(Volume, MESH_GRADE_VOLUME)
 FUNCTIONAL_INTEGRAND(Volume, MESH_GRADE_VOLUME, volume_integrand)
 FUNCTIONAL_GRADIENT(Volume, MESH_GRADE_VOLUME, volume_gradient, SYMMETRY_ADD)
 FUNCTIONAL_TOTAL(Volume, MESH_GRADE_VOLUME, volume_integrand)
-FUNCTIONAL_HESSIAN(Volume, MESH_GRADE_VOLUME, volume_integrand)
+FUNCTIONAL_TOTALANDGRADIENT(Volume, MESH_GRADE_VOLUME, volume_integrand, volume_gradient, SYMMETRY_ADD)
+FUNCTIONAL_SETPREPARE(Volume, MESH_GRADE_VOLUME, volume_integrand, volume_gradient, SYMMETRY_ADD)
+FUNCTIONAL_ANALYTICHESSIAN(Volume, MESH_GRADE_VOLUME, volume_hessian)
 
 MORPHO_BEGINCLASS(Volume)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, Volume_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, Volume_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, Volume_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, Volume_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, Volume_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, Volume_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, Volume_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -2514,11 +3785,16 @@ FUNCTIONAL_METHOD(Hydrogel, integrand, (ref.grade), hydrogelref, hydrogel_prepar
 
 FUNCTIONAL_METHOD(Hydrogel, total, (ref.grade), hydrogelref, hydrogel_prepareref, functional_sumintegrand, hydrogel_integrand, NULL, HYDROGEL_PRP, SYMMETRY_NONE)
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(Hydrogel, (ref.grade), hydrogelref, hydrogel_prepareref, hydrogel_integrand, hydrogel_gradient, NULL, HYDROGEL_PRP, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODSETPREPARE(Hydrogel, (ref.grade), hydrogelref, hydrogel_prepareref, hydrogel_integrand, hydrogel_gradient, NULL, HYDROGEL_PRP, SYMMETRY_ADD)
+
 MORPHO_BEGINCLASS(Hydrogel)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, Hydrogel_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, Hydrogel_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, Hydrogel_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, Hydrogel_gradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, Hydrogel_gradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, Hydrogel_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -2553,6 +3829,9 @@ bool equielement_prepareref(objectinstance *self, objectmesh *mesh, grade g, obj
         ref->eltov=mesh_addconnectivityelement(mesh, 0, ref->grade);
 
         if (ref->vtoel && ref->eltov) success=true;
+        
+        // Each element's size is used once for each of its vertices
+        if (success) functional_preparegeometry(mesh, ref->grade, false);
     }
 
     if (objectinstance_getpropertyinterned(self, equielement_weightproperty, &weight) &&
@@ -2653,6 +3932,57 @@ bool equielement_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *v
     return true;
 }
 
+/** Calculate the gradient of the equielement energy */
+bool equielement_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *r, objectmatrix *frc) {
+    equielementref *ref = (equielementref *) r;
+    int nconn, *conn;
+
+    if (!sparseccs_getrowindices(&ref->vtoel->ccs, id, &nconn, &conn)) return true;
+    if (nconn==1) return true;
+
+    double size[nconn], weight[nconn], mean=0.0, wmean=1.0;
+
+    for (int i=0; i<nconn; i++) {
+        int nv, *vid;
+        sparseccs_getrowindices(&ref->eltov->ccs, conn[i], &nv, &vid);
+        functional_elementsize(v, mesh, ref->grade, conn[i], nv, vid, &size[i]);
+        mean+=size[i];
+        weight[i]=1.0;
+    }
+
+    mean /= ((double) nconn);
+
+    if (fabs(mean)<MORPHO_EPS) return false;
+
+    if (ref->weight && fabs(ref->mean)>=MORPHO_EPS) {
+        wmean=0.0;
+        for (int i=0; i<nconn; i++) {
+            matrix_getelement(ref->weight, 0, conn[i], &weight[i]);
+            wmean+=weight[i];
+        }
+
+        wmean /= ((double) nconn);
+        if (fabs(wmean)<MORPHO_EPS) wmean = 1.0;
+    }
+
+    /* E = sum_i t_i^2 with t_i = 1 - w_i s_i/(mean wmean); the mean also depends on each size */
+    double term[nconn], dmean=0.0;
+    for (int i=0; i<nconn; i++) {
+        term[i] = 1.0-weight[i]*size[i]/mean/wmean;
+        dmean += 2*term[i]*weight[i]*size[i]/(mean*mean*wmean);
+    }
+    dmean /= ((double) nconn);
+
+    for (int i=0; i<nconn; i++) {
+        int nv, *vid;
+        double scale = -2*term[i]*weight[i]/(mean*wmean) + dmean;
+        sparseccs_getrowindices(&ref->eltov->ccs, conn[i], &nv, &vid);
+        if (!functional_elementgradient_scale(v, mesh, ref->grade, conn[i], nv, vid, frc, scale)) return false;
+    }
+
+    return true;
+}
+
 value EquiElement_init(vm *v, int nargs, value *args) {
     objectinstance *self = MORPHO_GETINSTANCE(MORPHO_SELF(args));
     int nfixed;
@@ -2671,16 +4001,21 @@ FUNCTIONAL_METHOD(EquiElement, integrand, MESH_GRADE_VERTEX, equielementref, equ
 
 FUNCTIONAL_METHOD(EquiElement, total, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, functional_sumintegrand, equielement_integrand, NULL, EQUIELEMENT_ARGS, SYMMETRY_NONE)
 
-FUNCTIONAL_METHOD(EquiElement, gradient, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, functional_mapnumericalgradient, equielement_integrand, equielement_dependencies, EQUIELEMENT_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODGRADIENT(EquiElement, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, equielement_gradient, equielement_dependencies, EQUIELEMENT_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODTOTALANDGRADIENT(EquiElement, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, equielement_integrand, equielement_gradient, equielement_dependencies, EQUIELEMENT_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODSETPREPARE(EquiElement, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, equielement_integrand, equielement_gradient, equielement_dependencies, EQUIELEMENT_ARGS, SYMMETRY_ADD)
 
-FUNCTIONAL_METHOD(EquiElement, hessian, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, functional_mapnumericalhessian, equielement_integrand, equielement_dependencies, EQUIELEMENT_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODGRADIENTHESSIAN(EquiElement, MESH_GRADE_VERTEX, equielementref, equielement_prepareref, equielement_integrand, equielement_gradient, equielement_dependencies, EQUIELEMENT_ARGS)
 
 MORPHO_BEGINCLASS(EquiElement)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, EquiElement_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, EquiElement_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, EquiElement_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, EquiElement_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, EquiElement_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, EquiElement_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, EquiElement_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* **********************************************************************
@@ -2750,56 +4085,113 @@ linecurvsq_dependencies_cleanup:
     return success;
 }
 
-/** Calculate the integral of the curvature squared  */
-bool linecurvsq_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
-    curvatureref *cref = (curvatureref *) ref;
-    double result = 0.0;
+/** Finds the two edges that meet at a vertex
+ * @param[in] mesh - the mesh
+ * @param[in] cref - reference structure
+ * @param[in] id - vertex id
+ * @param[out] edges - vertex ids of each edge; s[i] = x[edges[i][0]] - x[edges[i][1]]
+ * @param[out] s - separation vectors of each edge
+ * @param[out] sgn - sign that orients the edges consistently
+ * @returns true if the vertex lies between exactly two edges */
+static bool linecurvsq_edges(objectmesh *mesh, curvatureref *cref, elementid id, int edges[2][2], double *s[2], double *sgn) {
+    bool success=false;
     varray_elementid nbrs;
     varray_elementid synid;
     varray_elementidinit(&nbrs);
     varray_elementidinit(&synid);
-
-    double s0[mesh->dim], s1[mesh->dim], *s[2] = { s0, s1}, sgn=-1.0;
-
-    if (mesh_findneighbors(mesh, MESH_GRADE_VERTEX, id, MESH_GRADE_LINE, &nbrs)>0 &&
+    
+    *sgn=-1.0;
+    
+    if (mesh_findneighbors(mesh, MESH_GRADE_VERTEX, id, MESH_GRADE_LINE, &nbrs)==2 &&
         mesh_getsynonyms(mesh, MESH_GRADE_VERTEX, id, &synid)) {
-        if (nbrs.count!=2) goto linecurvsq_integrand_cleanup;
-
-        for (unsigned int i=0; i<2; i++) {
+        success=true;
+        
+        for (unsigned int i=0; i<2 && success; i++) {
             int nentries, *entries; // Get the vertices for this edge
-            if (!sparseccs_getrowindices(&cref->lineel->ccs, nbrs.data[i], &nentries, &entries)) break;
-
             double *x0, *x1;
-            if (mesh_getvertexcoordinatesaslist(mesh, entries[0], &x0) &&
-                mesh_getvertexcoordinatesaslist(mesh, entries[1], &x1)) {
-                functional_vecsub(mesh->dim, x0, x1, s[i]);
-            }
-            if (!(entries[0]==id || functional_inlist(&synid, entries[0]))) sgn*=-1;
+            
+            success=(sparseccs_getrowindices(&cref->lineel->ccs, nbrs.data[i], &nentries, &entries) &&
+                     mesh_getvertexcoordinatesaslist(mesh, entries[0], &x0) &&
+                     mesh_getvertexcoordinatesaslist(mesh, entries[1], &x1));
+            if (!success) break;
+            
+            functional_vecsub(mesh->dim, x0, x1, s[i]);
+            edges[i][0]=entries[0]; edges[i][1]=entries[1];
+            if (!(entries[0]==id || functional_inlist(&synid, entries[0]))) *sgn*=-1;
         }
+    }
+    
+    varray_elementidclear(&nbrs);
+    varray_elementidclear(&synid);
+    
+    return success;
+}
 
-        double s0s0=functional_vecdot(mesh->dim, s0, s0),
-               s0s1=functional_vecdot(mesh->dim, s0, s1),
-               s1s1=functional_vecdot(mesh->dim, s1, s1);
+/** Calculate the integral of the curvature squared  */
+bool linecurvsq_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    curvatureref *cref = (curvatureref *) ref;
+    double s0[mesh->dim], s1[mesh->dim], *s[2] = { s0, s1 }, sgn;
+    int edges[2][2];
+    
+    *out = 0.0;
+    if (!linecurvsq_edges(mesh, cref, id, edges, s, &sgn)) return true;
 
-        s0s0=sqrt(s0s0); s1s1=sqrt(s1s1);
+    double s0s0=functional_vecdot(mesh->dim, s0, s0),
+           s0s1=functional_vecdot(mesh->dim, s0, s1),
+           s1s1=functional_vecdot(mesh->dim, s1, s1);
 
-        if (s0s0<MORPHO_EPS || s1s1<MORPHO_EPS) return false;
+    s0s0=sqrt(s0s0); s1s1=sqrt(s1s1);
 
-        double u=sgn*s0s1/s0s0/s1s1,
-               len=0.5*(s0s0+s1s1);
+    if (s0s0<MORPHO_EPS || s1s1<MORPHO_EPS) return false;
 
-        if (u<1) u=acos(u); else u=0;
+    double u=sgn*s0s1/s0s0/s1s1,
+           len=0.5*(s0s0+s1s1);
 
-        result = u*u/len;
-        if (cref->integrandonly) result /= len; // Get the bare curvature.
-    }
+    if (u<1) u=acos(u); else u=0;
 
-linecurvsq_integrand_cleanup:
+    *out = u*u/len;
+    if (cref->integrandonly) *out /= len; // Get the bare curvature.
 
-    *out = result;
-    varray_elementidclear(&nbrs);
-    varray_elementidclear(&synid);
+    return true;
+}
 
+/** Calculate the gradient of the curvature squared */
+bool linecurvsq_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
+    curvatureref *cref = (curvatureref *) ref;
+    int dim=mesh->dim;
+    double s0[dim], s1[dim], *s[2] = { s0, s1 }, sgn;
+    int edges[2][2];
+    
+    if (!linecurvsq_edges(mesh, cref, id, edges, s, &sgn)) return true;
+    
+    double n0=functional_vecnorm(dim, s0),
+           n1=functional_vecnorm(dim, s1);
+    
+    if (n0<MORPHO_EPS || n1<MORPHO_EPS) return false;
+    
+    double c=sgn*functional_vecdot(dim, s0, s1)/n0/n1,
+           u=(c<1 ? acos(c) : 0),
+           len=0.5*(n0+n1);
+    
+    /* u/sin(u) tends to 1 as the edges straighten; the angle is singular if they fold back */
+    double sinu=sqrt(fmax(1-c*c, 0.0)), usinu;
+    if (sinu>MORPHO_EPS) usinu=u/sinu;
+    else usinu=(c>0 ? 1.0 : 0.0);
+    
+    /* E = u^2/len [or u^2/len^2]; dE/dc = dE/du du/dc with du/dc = -1/sin(u) */
+    double dEdc=-2*usinu/len, dEdlen=-u*u/(len*len);
+    if (cref->integrandonly) { dEdc/=len; dEdlen*=2/len; }
+    
+    /* dc/ds0 = sgn s1/(n0 n1) - c s0/n0^2 and dlen/ds0 = s0/(2 n0); similarly for s1 */
+    double g[2][dim], *sj[2] = { s1, s0 }, ni[2] = { n0, n1 };
+    for (int i=0; i<2; i++) {
+        functional_vecscale(dim, dEdc*sgn/(n0*n1), sj[i], g[i]);
+        functional_vecaddscale(dim, g[i], -dEdc*c/(ni[i]*ni[i]) + 0.5*dEdlen/ni[i], s[i], g[i]);
+        
+        matrix_addtocolumn(frc, edges[i][0], 1.0, g[i]);
+        matrix_addtocolumn(frc, edges[i][1], -1.0, g[i]);
+    }
+    
     return true;
 }
 
@@ -2807,8 +4199,12 @@ FUNCTIONAL_INIT(LineCurvatureSq, MESH_GRADE_VERTEX)
 FUNCTIONAL_METHOD(LineCurvatureSq, integrand, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, functional_mapintegrand, linecurvsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
 FUNCTIONAL_METHOD(LineCurvatureSq, integrandForElement, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, functional_mapintegrandforelement, linecurvsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
 FUNCTIONAL_METHOD(LineCurvatureSq, total, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, functional_sumintegrand, linecurvsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
-FUNCTIONAL_METHOD(LineCurvatureSq, gradient, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, functional_mapnumericalgradient, linecurvsq_integrand, linecurvsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
-FUNCTIONAL_METHOD(LineCurvatureSq, hessian, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, functional_mapnumericalhessian, linecurvsq_integrand, linecurvsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODGRADIENT(LineCurvatureSq, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, linecurvsq_gradient, linecurvsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODTOTALANDGRADIENT(LineCurvatureSq, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, linecurvsq_integrand, linecurvsq_gradient, linecurvsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODSETPREPARE(LineCurvatureSq, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, linecurvsq_integrand, linecurvsq_gradient, linecurvsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODGRADIENTHESSIAN(LineCurvatureSq, MESH_GRADE_VERTEX, curvatureref, curvature_prepareref, linecurvsq_integrand, linecurvsq_gradient, linecurvsq_dependencies, FUNCTIONAL_ARGS)
 
 MORPHO_BEGINCLASS(LineCurvatureSq)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, LineCurvatureSq_init, BUILTIN_FLAGSEMPTY),
@@ -2816,7 +4212,8 @@ MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, LineCurvatureSq_integrand, BUILTIN_FL
 MORPHO_METHOD(FUNCTIONAL_INTEGRANDFORELEMENT_METHOD, LineCurvatureSq_integrandForElement, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, LineCurvatureSq_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, LineCurvatureSq_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, LineCurvatureSq_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, LineCurvatureSq_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, LineCurvatureSq_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -2853,40 +4250,42 @@ linetorsionsq_dependencies_cleanup:
 }
 
 
-/** Calculate the integral of the torsion squared  */
-bool linetorsionsq_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
-    curvatureref *cref = (curvatureref *) ref;
+/** Finds an ordered list of the vertices of a line element and its neighbors:
+ *               v the element
+ *    0 --- 1/2 --- 3/4 --- 5
+ * Where 1/2 and 3/4 are the same vertex, but could have different indices due to symmetries
+ * @param[in] mesh - the mesh
+ * @param[in] cref - reference structure
+ * @param[in] id - element id
+ * @param[in] vid - vertices of the element
+ * @param[out] vlist - ordered vertex ids
+ * @param[out] complete - set to false if the element doesn't have two neighbors
+ * @returns true on success */
+static bool linetorsionsq_vertices(objectmesh *mesh, curvatureref *cref, elementid id, int *vid, elementid *vlist, bool *complete) {
     int tmpi; elementid tmpid;
     bool success=false;
 
-    //double result = 0.0;
     varray_elementid nbrs;
     varray_elementid synid;
     varray_elementidinit(&nbrs);
     varray_elementidinit(&synid);
-    elementid vlist[6]; // List of vertices in order  n
     int type[6];
     for (unsigned int i=0; i<6; i++) type[i]=-1;
 
-    /* We want an ordered list of vertex indices:
-     *               v the element
-     *    0 --- 1/2 --- 3/4 --- 5
-     * Where 1/2 and 3/4 are the same vertex, but could have different indices due to symmetries */
-     vlist[2] = vid[0]; vlist[3] = vid[1]; // Copy the current element into place
+    vlist[2] = vid[0]; vlist[3] = vid[1]; // Copy the current element into place
 
     /* First identify neighbors and get the vertex ids for each element */
-    if (mesh_findneighbors(mesh, MESH_GRADE_LINE, id, MESH_GRADE_LINE, &nbrs)>0) {
-        if (nbrs.count<2) {
-            *out = 0; success=true;
-            goto linecurvsq_torsion_cleanup;
-        }
+    *complete = (mesh_findneighbors(mesh, MESH_GRADE_LINE, id, MESH_GRADE_LINE, &nbrs)>=2);
+    if (!*complete) {
+        success=true;
+        goto linetorsionsq_vertices_cleanup;
+    }
 
-        for (unsigned int i=0; i<nbrs.count; i++) {
-            int nentries, *entries; // Get the vertices for this edge
-            if (!sparseccs_getrowindices(&cref->lineel->ccs, nbrs.data[i], &nentries, &entries)) goto linecurvsq_torsion_cleanup;
-            for (unsigned int j=0; j<nentries; j++) { // Copy the vertexids
-                vlist[4*i+j] = entries[j];
-            }
+    for (unsigned int i=0; i<2; i++) {
+        int nentries, *entries; // Get the vertices for this edge
+        if (!sparseccs_getrowindices(&cref->lineel->ccs, nbrs.data[i], &nentries, &entries)) goto linetorsionsq_vertices_cleanup;
+        for (unsigned int j=0; j<nentries; j++) { // Copy the vertexids
+            vlist[4*i+j] = entries[j];
         }
     }
 
@@ -2913,16 +4312,21 @@ bool linetorsionsq_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int
         SWAP(type, 4, 5, tmpi);
     }
 #undef SWAP
+    success=true;
 
-    /* We now have an ordered list of vertices.
-       Get the vertex positions */
-    double *x[6];
-    for (int i=0; i<6; i++) matrix_getcolumn(mesh->vert, vlist[i], &x[i]);
+linetorsionsq_vertices_cleanup:
+    varray_elementidclear(&nbrs);
+    varray_elementidclear(&synid);
 
-    double A[3], B[3], C[3], crossAB[3], crossBC[3];
-    functional_vecsub(3, x[1], x[0], A);
-    functional_vecsub(3, x[3], x[2], B);
-    functional_vecsub(3, x[5], x[4], C);
+    return success;
+}
+
+/** Evaluates the torsion squared given the separation vectors A = x1-x0, B = x3-x2 and C = x5-x4 between ordered vertices
+ * @param[in] A, B, C - separation vectors
+ * @param[out] out - the torsion squared
+ * @param[out] grad - if not NULL, filled out with the derivative with respect to A, B and C */
+static void linetorsionsq_evaluate(double *A, double *B, double *C, double *out, double grad[3][3]) {
+    double crossAB[3], crossBC[3];
 
     functional_veccross(A, B, crossAB);
     functional_veccross(B, C, crossBC);
@@ -2931,65 +4335,199 @@ bool linetorsionsq_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int
            normAB=functional_vecnorm(3, crossAB),
            normBC=functional_vecnorm(3, crossBC);
 
-    double S = functional_vecdot(3, A, crossBC)*normB;
-    if (normAB>MORPHO_EPS) S/=normAB;
-    if (normBC>MORPHO_EPS) S/=normBC;
+    double T = functional_vecdot(3, A, crossBC), P=1.0, Q=1.0;
+    if (normAB>MORPHO_EPS) P=normAB;
+    if (normBC>MORPHO_EPS) Q=normBC;
 
-    S=asin(S);
+    double S0 = T*normB/P/Q;
+    double S=asin(S0);
     *out=S*S/normB;
-    success=true;
 
-linecurvsq_torsion_cleanup:
-    varray_elementidclear(&nbrs);
-    varray_elementidclear(&synid);
+    if (!grad) return;
+    for (int i=0; i<3; i++) for (int k=0; k<3; k++) grad[i][k]=0.0;
 
-    return success;
-}
+    double cosS = sqrt(fmax(1-S0*S0, 0.0));
+    if (cosS<MORPHO_EPS) return; // The torsion angle is singular
 
-FUNCTIONAL_INIT(LineTorsionSq, MESH_GRADE_LINE)
-FUNCTIONAL_METHOD(LineTorsionSq, integrand, MESH_GRADE_LINE, curvatureref, curvature_prepareref, functional_mapintegrand, linetorsionsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
-FUNCTIONAL_METHOD(LineTorsionSq, total, MESH_GRADE_LINE, curvatureref, curvature_prepareref, functional_sumintegrand, linetorsionsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
-FUNCTIONAL_METHOD(LineTorsionSq, gradient, MESH_GRADE_LINE, curvatureref, curvature_prepareref, functional_mapnumericalgradient, linetorsionsq_integrand, linetorsionsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
-FUNCTIONAL_METHOD(LineTorsionSq, hessian, MESH_GRADE_LINE, curvatureref, curvature_prepareref, functional_mapnumericalhessian, linetorsionsq_integrand, linetorsionsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+    /* S0 = T |B|/(|A x B| |B x C|) with T = A.(B x C); E = asin(S0)^2/|B| */
+    double dEdS0 = 2*S/normB/cosS, dEdnB = -S*S/(normB*normB), t[3];
 
-MORPHO_BEGINCLASS(LineTorsionSq)
-MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, LineTorsionSq_init, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, LineTorsionSq_integrand, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, LineTorsionSq_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, LineTorsionSq_total, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, LineTorsionSq_hessian, BUILTIN_FLAGSEMPTY)
-MORPHO_ENDCLASS
+    /* dT/dA = B x C, dT/dB = C x A, dT/dC = A x B */
+    functional_vecscale(3, dEdS0*normB/(P*Q), crossBC, grad[0]);
+    functional_veccross(C, A, t);
+    functional_vecscale(3, dEdS0*normB/(P*Q), t, grad[1]);
+    functional_vecscale(3, dEdS0*normB/(P*Q), crossAB, grad[2]);
 
-/* ----------------------------------------------
- * MeanCurvatureSq
- * ---------------------------------------------- */
+    /* d|B|/dB = B/|B|, which enters through S0 and the prefactor */
+    functional_vecaddscale(3, grad[1], (dEdS0*S0/normB + dEdnB)/normB, B, grad[1]);
 
-static value curvature_geodesicproperty;
+    if (normAB>MORPHO_EPS) { // d|A x B|/dA = B x u, d|A x B|/dB = u x A with u the unit normal
+        double u[3];
+        functional_vecscale(3, 1.0/normAB, crossAB, u);
+        functional_veccross(B, u, t);
+        functional_vecaddscale(3, grad[0], -dEdS0*S0/normAB, t, grad[0]);
+        functional_veccross(u, A, t);
+        functional_vecaddscale(3, grad[1], -dEdS0*S0/normAB, t, grad[1]);
+    }
 
-typedef struct {
-    objectsparse *areael; // Areas
-    objectselection *selection; // Selection
-    bool integrandonly; // Output integrated curvature or 'bare' curvature.
-    bool geodesic; // Compute the geodesic curvature instead of the Gauss curvature (see https://cuhkmath.wordpress.com/2016/06/21/the-discrete-gauss-bonnet-theorem/)
-} areacurvatureref;
+    if (normBC>MORPHO_EPS) { // d|B x C|/dB = C x w, d|B x C|/dC = w x B with w the unit normal
+        double w[3];
+        functional_vecscale(3, 1.0/normBC, crossBC, w);
+        functional_veccross(C, w, t);
+        functional_vecaddscale(3, grad[1], -dEdS0*S0/normBC, t, grad[1]);
+        functional_veccross(w, B, t);
+        functional_vecaddscale(3, grad[2], -dEdS0*S0/normBC, t, grad[2]);
+    }
+}
 
-bool areacurvature_prepareref(objectinstance *self, objectmesh *mesh, grade g, objectselection *sel, areacurvatureref *ref) {
-    bool success = true;
+/** Calculate the integral of the torsion squared  */
+bool linetorsionsq_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    curvatureref *cref = (curvatureref *) ref;
+    elementid vlist[6]; // List of vertices in order
+    bool complete;
 
-    ref->selection=sel;
+    if (!linetorsionsq_vertices(mesh, cref, id, vid, vlist, &complete)) return false;
+    if (!complete) { *out = 0; return true; }
 
-    ref->areael = mesh_getconnectivityelement(mesh, MESH_GRADE_VERTEX, MESH_GRADE_AREA);
-    if (ref->areael) success=sparse_checkformat(ref->areael, SPARSE_CCS, true, false);
+    /* We now have an ordered list of vertices.
+       Get the vertex positions */
+    double *x[6];
+    for (int i=0; i<6; i++) matrix_getcolumn(mesh->vert, vlist[i], &x[i]);
 
-    if (success) {
-        objectsparse *s = mesh_getconnectivityelement(mesh, MESH_GRADE_AREA, MESH_GRADE_VERTEX);
-        if (!s) s=mesh_addconnectivityelement(mesh, MESH_GRADE_AREA, MESH_GRADE_VERTEX);
-        success=s;
-    }
+    double A[3], B[3], C[3];
+    functional_vecsub(3, x[1], x[0], A);
+    functional_vecsub(3, x[3], x[2], B);
+    functional_vecsub(3, x[5], x[4], C);
 
-    if (success) {
-        value integrandonly=MORPHO_FALSE;
-        objectinstance_getpropertyinterned(self, curvature_integrandonlyproperty, &integrandonly);
+    linetorsionsq_evaluate(A, B, C, out, NULL);
+
+    return true;
+}
+
+/** Calculate the integral of the torsion squared on dual numbers */
+static bool linetorsionsq_dualintegrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualvertices *x, dual *out) {
+    curvatureref *cref = (curvatureref *) ref;
+    elementid vlist[6]; // List of vertices in order
+    bool complete;
+
+    if (mesh->dim!=3) return false;
+    if (!linetorsionsq_vertices(mesh, cref, id, vid, vlist, &complete)) return false;
+
+    dual_constant(0.0, out);
+    if (!complete) return true;
+
+    dual p[6][3], A[3], B[3], C[3], crossAB[3], crossBC[3];
+    for (int i=0; i<6; i++) if (!functional_dualposition(x, vlist[i], p[i])) return false;
+
+    dual_vecsub(3, p[1], p[0], A);
+    dual_vecsub(3, p[3], p[2], B);
+    dual_vecsub(3, p[5], p[4], C);
+
+    dual_veccross(A, B, crossAB);
+    dual_veccross(B, C, crossBC);
+
+    dual normB, P, Q, T, S;
+    dual_vecnorm(3, B, &normB);
+
+    /* As in linetorsionsq_evaluate, degenerate cross products are replaced by 1 */
+    dual_vecnorm(3, crossAB, &P);
+    if (!(P.val>MORPHO_EPS)) dual_constant(1.0, &P);
+    dual_vecnorm(3, crossBC, &Q);
+    if (!(Q.val>MORPHO_EPS)) dual_constant(1.0, &Q);
+
+    dual_vecdot(3, A, crossBC, &T);
+
+    dual_mul(&T, &normB, &S); // S = asin(T |B|/(P Q))
+    dual_div(&S, &P, &S);
+    dual_div(&S, &Q, &S);
+    dual_asin(&S, &S);
+
+    dual_mul(&S, &S, out);
+    dual_div(out, &normB, out);
+
+    return true;
+}
+
+/** Calculate the hessian of the integral of the torsion squared */
+FUNCTIONAL_DUALHESSIANFN(linetorsionsq_hessian, linetorsionsq_dualintegrand)
+
+/** Calculate the gradient of the integral of the torsion squared  */
+bool linetorsionsq_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
+    curvatureref *cref = (curvatureref *) ref;
+    elementid vlist[6]; // List of vertices in order
+    bool complete;
+
+    if (!linetorsionsq_vertices(mesh, cref, id, vid, vlist, &complete)) return false;
+    if (!complete) return true;
+
+    double *x[6];
+    for (int i=0; i<6; i++) matrix_getcolumn(mesh->vert, vlist[i], &x[i]);
+
+    double A[3], B[3], C[3], E, grad[3][3];
+    functional_vecsub(3, x[1], x[0], A);
+    functional_vecsub(3, x[3], x[2], B);
+    functional_vecsub(3, x[5], x[4], C);
+
+    linetorsionsq_evaluate(A, B, C, &E, grad);
+
+    /* Each separation vector is the difference of a pair of vertices */
+    for (int i=0; i<3; i++) {
+        matrix_addtocolumn(frc, vlist[2*i+1], 1.0, grad[i]);
+        matrix_addtocolumn(frc, vlist[2*i], -1.0, grad[i]);
+    }
+
+    return true;
+}
+
+FUNCTIONAL_INIT(LineTorsionSq, MESH_GRADE_LINE)
+FUNCTIONAL_METHOD(LineTorsionSq, integrand, MESH_GRADE_LINE, curvatureref, curvature_prepareref, functional_mapintegrand, linetorsionsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
+FUNCTIONAL_METHOD(LineTorsionSq, total, MESH_GRADE_LINE, curvatureref, curvature_prepareref, functional_sumintegrand, linetorsionsq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
+FUNCTIONAL_METHODGRADIENT(LineTorsionSq, MESH_GRADE_LINE, curvatureref, curvature_prepareref, linetorsionsq_gradient, linetorsionsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODTOTALANDGRADIENT(LineTorsionSq, MESH_GRADE_LINE, curvatureref, curvature_prepareref, linetorsionsq_integrand, linetorsionsq_gradient, linetorsionsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODSETPREPARE(LineTorsionSq, MESH_GRADE_LINE, curvatureref, curvature_prepareref, linetorsionsq_integrand, linetorsionsq_gradient, linetorsionsq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODHESSIAN(LineTorsionSq, MESH_GRADE_LINE, curvatureref, curvature_prepareref, linetorsionsq_hessian, linetorsionsq_dependencies, FUNCTIONAL_ARGS)
+
+MORPHO_BEGINCLASS(LineTorsionSq)
+MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, LineTorsionSq_init, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, LineTorsionSq_integrand, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, LineTorsionSq_gradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, LineTorsionSq_total, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, LineTorsionSq_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, LineTorsionSq_totalAndGradient, BUILTIN_FLAGSEMPTY)
+MORPHO_ENDCLASS
+
+/* ----------------------------------------------
+ * MeanCurvatureSq
+ * ---------------------------------------------- */
+
+static value curvature_geodesicproperty;
+
+typedef struct {
+    objectsparse *areael; // Areas
+    objectselection *selection; // Selection
+    bool integrandonly; // Output integrated curvature or 'bare' curvature.
+    bool geodesic; // Compute the geodesic curvature instead of the Gauss curvature (see https://cuhkmath.wordpress.com/2016/06/21/the-discrete-gauss-bonnet-theorem/)
+} areacurvatureref;
+
+bool areacurvature_prepareref(objectinstance *self, objectmesh *mesh, grade g, objectselection *sel, areacurvatureref *ref) {
+    bool success = true;
+
+    ref->selection=sel;
+
+    ref->areael = mesh_getconnectivityelement(mesh, MESH_GRADE_VERTEX, MESH_GRADE_AREA);
+    if (ref->areael) success=sparse_checkformat(ref->areael, SPARSE_CCS, true, false);
+
+    if (success) {
+        objectsparse *s = mesh_getconnectivityelement(mesh, MESH_GRADE_AREA, MESH_GRADE_VERTEX);
+        if (!s) s=mesh_addconnectivityelement(mesh, MESH_GRADE_AREA, MESH_GRADE_VERTEX);
+        success=s;
+    }
+
+    if (success) {
+        value integrandonly=MORPHO_FALSE;
+        objectinstance_getpropertyinterned(self, curvature_integrandonlyproperty, &integrandonly);
         ref->integrandonly=MORPHO_ISTRUE(integrandonly);
 
         value geodesic=MORPHO_FALSE;
@@ -3109,16 +4647,120 @@ meancurvsq_cleanup:
     return success;
 }
 
+/** Calculate the gradient of the integral of the mean curvature squared */
+bool meancurvaturesq_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
+    areacurvatureref *cref = (areacurvatureref *) ref;
+    double areasum = 0;
+    bool success=false;
+
+    varray_elementid nbrs;
+    varray_elementid synid;
+    varray_elementidinit(&nbrs);
+    varray_elementidinit(&synid);
+
+    mesh_getsynonyms(mesh, MESH_GRADE_VERTEX, id, &synid);
+    varray_elementidwriteunique(&synid, id);
+
+    mesh_findneighbors(mesh, MESH_GRADE_VERTEX, id, MESH_GRADE_AREA, &nbrs);
+
+    int ntri=nbrs.count;
+    int tvids[ntri+1][3]; // Ordered vertices of each triangle
+    double s0[ntri+1][3], s1[ntri+1][3], nhat[ntri+1][3], norm[ntri+1];
+    double F[3] = { 0.0, 0.0, 0.0 }; // Total force due to the triangles present
+
+    /* First pass: compute the force and area as in the integrand, retaining the geometry of each triangle */
+    for (unsigned int i=0; i<ntri; i++) {
+        int nvert, *ovids;
+        if (!sparseccs_getrowindices(&cref->areael->ccs, nbrs.data[i], &nvert, &ovids)) goto meancurvsqgrad_cleanup;
+
+        int vids[nvert]; // Copy so we can reorder
+        for (int j=0; j<nvert; j++) vids[j]=ovids[j];
+        if (!curvature_ordervertices(&synid, nvert, vids)) goto meancurvsqgrad_cleanup;
+        for (int j=0; j<3; j++) tvids[i][j]=vids[j];
+
+        double *x[3], n[3], s101[3];
+        for (int j=0; j<3; j++) matrix_getcolumn(mesh->vert, vids[j], &x[j]);
+
+        /* s0 = x1-x0; s1 = x2-x1 */
+        functional_vecsub(mesh->dim, x[1], x[0], s0[i]);
+        functional_vecsub(mesh->dim, x[2], x[1], s1[i]);
+
+        functional_veccross(s0[i], s1[i], n);
+        norm[i]=functional_vecnorm(mesh->dim, n);
+        if (norm[i]<MORPHO_EPS) goto meancurvsqgrad_cleanup;
+        functional_vecscale(3, 1.0/norm[i], n, nhat[i]);
+
+        areasum+=norm[i]/2;
+        functional_veccross(s1[i], n, s101);
+        functional_vecaddscale(3, F, 0.5/norm[i], s101, F);
+    }
+
+    if (areasum<MORPHO_EPS) { success=true; goto meancurvsqgrad_cleanup; }
+
+    /* E = (3/4) F.F/A [or (9/4) F.F/A^2]; find dE/dF = g and dE/dA = h */
+    double FF=functional_vecdot(3, F, F), g[3], h;
+    if (cref->integrandonly) {
+        functional_vecscale(3, 4.5/(areasum*areasum), F, g);
+        h = -4.5*FF/(areasum*areasum*areasum);
+    } else {
+        functional_vecscale(3, 1.5/areasum, F, g);
+        h = -0.75*FF/(areasum*areasum);
+    }
+
+    /* Second pass: each triangle contributes f = (s1 x nhat)/2 to F and |s0 x s1|/2 to A */
+    for (unsigned int i=0; i<ntri; i++) {
+        double gs1[3], m[3], t[3], G0[3], G1[3];
+
+        /* Component of (g x s1)/|n| perpendicular to nhat */
+        functional_veccross(g, s1[i], gs1);
+        functional_vecaddscale(3, gs1, -functional_vecdot(3, nhat[i], gs1), nhat[i], m);
+        functional_vecscale(3, 1.0/norm[i], m, m);
+
+        /* dE/ds0 = (s1 x m)/2 + (h/2) s1 x nhat */
+        functional_veccross(s1[i], m, G0);
+        functional_veccross(s1[i], nhat[i], t);
+        functional_vecscale(3, 0.5, G0, G0);
+        functional_vecaddscale(3, G0, 0.5*h, t, G0);
+
+        /* dE/ds1 = (m x s0 + nhat x g)/2 + (h/2) nhat x s0 */
+        functional_veccross(m, s0[i], G1);
+        functional_veccross(nhat[i], g, t);
+        functional_vecadd(3, G1, t, G1);
+        functional_veccross(nhat[i], s0[i], t);
+        functional_vecscale(3, 0.5, G1, G1);
+        functional_vecaddscale(3, G1, 0.5*h, t, G1);
+
+        /* s0 = x1-x0 and s1 = x2-x1 */
+        matrix_addtocolumn(frc, tvids[i][0], -1.0, G0);
+        matrix_addtocolumn(frc, tvids[i][1], 1.0, G0);
+        matrix_addtocolumn(frc, tvids[i][1], -1.0, G1);
+        matrix_addtocolumn(frc, tvids[i][2], 1.0, G1);
+    }
+
+    success=true;
+
+meancurvsqgrad_cleanup:
+    varray_elementidclear(&nbrs);
+    varray_elementidclear(&synid);
+
+    return success;
+}
+
 FUNCTIONAL_INIT(MeanCurvatureSq, MESH_GRADE_VERTEX)
 FUNCTIONAL_METHOD(MeanCurvatureSq, integrand, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, functional_mapintegrand, meancurvaturesq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
 FUNCTIONAL_METHOD(MeanCurvatureSq, total, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, functional_sumintegrand, meancurvaturesq_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
-FUNCTIONAL_METHOD(MeanCurvatureSq, gradient, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, functional_mapnumericalgradient, meancurvaturesq_integrand, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODGRADIENT(MeanCurvatureSq, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, meancurvaturesq_gradient, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODTOTALANDGRADIENT(MeanCurvatureSq, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, meancurvaturesq_integrand, meancurvaturesq_gradient, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODSETPREPARE(MeanCurvatureSq, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, meancurvaturesq_integrand, meancurvaturesq_gradient, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
 
 MORPHO_BEGINCLASS(MeanCurvatureSq)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, MeanCurvatureSq_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, MeanCurvatureSq_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, MeanCurvatureSq_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, MeanCurvatureSq_total, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, MeanCurvatureSq_total, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, MeanCurvatureSq_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -3180,16 +4822,107 @@ gausscurv_cleanup:
     return success;
 }
 
+/** Calculate the gradient of the integral of the gaussian curvature */
+bool gausscurvature_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
+    areacurvatureref *cref = (areacurvatureref *) ref;
+    double anglesum = 0, areasum = 0;
+    bool success=false;
+
+    varray_elementid nbrs;
+    varray_elementid synid;
+    varray_elementidinit(&nbrs);
+    varray_elementidinit(&synid);
+
+    mesh_getsynonyms(mesh, MESH_GRADE_VERTEX, id, &synid);
+    varray_elementidwriteunique(&synid, id);
+
+    mesh_findneighbors(mesh, MESH_GRADE_VERTEX, id, MESH_GRADE_AREA, &nbrs);
+
+    int ntri=nbrs.count;
+    int tvids[ntri+1][3]; // Ordered vertices of each triangle
+    double s0[ntri+1][3], s1[ntri+1][3], nhat[ntri+1][3], area[ntri+1], dot[ntri+1];
+
+    /* First pass: compute the angles and areas as in the integrand */
+    for (unsigned int i=0; i<ntri; i++) {
+        int nvert, *ovids;
+        if (!sparseccs_getrowindices(&cref->areael->ccs, nbrs.data[i], &nvert, &ovids)) goto gausscurvgrad_cleanup;
+
+        int vids[nvert]; // Copy so we can reorder
+        for (int j=0; j<nvert; j++) vids[j]=ovids[j];
+        if (!curvature_ordervertices(&synid, nvert, vids)) goto gausscurvgrad_cleanup;
+        for (int j=0; j<3; j++) tvids[i][j]=vids[j];
+
+        double *x[3], n[3];
+        for (int j=0; j<3; j++) matrix_getcolumn(mesh->vert, vids[j], &x[j]);
+
+        /* s0 = x1-x0; s1 = x2-x0 */
+        functional_vecsub(mesh->dim, x[1], x[0], s0[i]);
+        functional_vecsub(mesh->dim, x[2], x[0], s1[i]);
+
+        functional_veccross(s0[i], s1[i], n);
+        area[i] = functional_vecnorm(mesh->dim, n);
+        dot[i] = functional_vecdot(mesh->dim, s0[i], s1[i]);
+        if (area[i]>MORPHO_EPS) functional_vecscale(3, 1.0/area[i], n, nhat[i]);
+
+        anglesum+=atan2(area[i], dot[i]);
+        areasum+=area[i]/2;
+    }
+
+    /* E = C - sum(angles) [or 3 (C - sum(angles))/A]; find dE/dangle = a and dE/d|n| = b */
+    double a=-1.0, b=0.0;
+    if (cref->integrandonly) {
+        if (areasum<MORPHO_EPS) goto gausscurvgrad_cleanup;
+        double E0 = (cref->geodesic ? M_PI : 2*M_PI)-anglesum;
+        a = -3.0/areasum;
+        b = -1.5*E0/(areasum*areasum);
+    }
+
+    /* Second pass: each angle is atan2(|n|, s0.s1) with n = s0 x s1 */
+    for (unsigned int i=0; i<ntri; i++) {
+        if (area[i]<MORPHO_EPS) continue;
+        double r2 = area[i]*area[i]+dot[i]*dot[i];
+
+        double dN0[3], dN1[3], G0[3], G1[3];
+        functional_veccross(s1[i], nhat[i], dN0); // d|n|/ds0
+        functional_veccross(nhat[i], s0[i], dN1); // d|n|/ds1
+
+        /* dangle/ds0 = (s0.s1 d|n|/ds0 - |n| s1)/(|n|^2 + (s0.s1)^2); similarly for s1 */
+        functional_vecscale(3, a*dot[i]/r2 + b, dN0, G0);
+        functional_vecaddscale(3, G0, -a*area[i]/r2, s1[i], G0);
+        functional_vecscale(3, a*dot[i]/r2 + b, dN1, G1);
+        functional_vecaddscale(3, G1, -a*area[i]/r2, s0[i], G1);
+
+        /* s0 = x1-x0 and s1 = x2-x0 */
+        matrix_addtocolumn(frc, tvids[i][0], -1.0, G0);
+        matrix_addtocolumn(frc, tvids[i][0], -1.0, G1);
+        matrix_addtocolumn(frc, tvids[i][1], 1.0, G0);
+        matrix_addtocolumn(frc, tvids[i][2], 1.0, G1);
+    }
+
+    success=true;
+
+gausscurvgrad_cleanup:
+    varray_elementidclear(&nbrs);
+    varray_elementidclear(&synid);
+
+    return success;
+}
+
 FUNCTIONAL_INIT(GaussCurvature, MESH_GRADE_VERTEX)
 FUNCTIONAL_METHOD(GaussCurvature, integrand, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, functional_mapintegrand, gausscurvature_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
 FUNCTIONAL_METHOD(GaussCurvature, total, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, functional_sumintegrand, gausscurvature_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE)
-FUNCTIONAL_METHOD(GaussCurvature, gradient, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, functional_mapnumericalgradient, gausscurvature_integrand, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+FUNCTIONAL_METHODGRADIENT(GaussCurvature, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, gausscurvature_gradient, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODTOTALANDGRADIENT(GaussCurvature, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, gausscurvature_integrand, gausscurvature_gradient, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
+
+FUNCTIONAL_METHODSETPREPARE(GaussCurvature, MESH_GRADE_VERTEX, areacurvatureref, areacurvature_prepareref, gausscurvature_integrand, gausscurvature_gradient, meancurvaturesq_dependencies, FUNCTIONAL_ARGS, SYMMETRY_ADD)
 
 MORPHO_BEGINCLASS(GaussCurvature)
 MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, GaussCurvature_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, GaussCurvature_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, GaussCurvature_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, GaussCurvature_total, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, GaussCurvature_total, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, GaussCurvature_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* **********************************************************************
@@ -3427,6 +5160,10 @@ FUNCTIONAL_METHOD(GradSq, total, (ref.grade), fieldref, gradsq_prepareref, funct
 
 FUNCTIONAL_METHOD(GradSq, gradient, (ref.grade), fieldref, gradsq_prepareref, functional_mapnumericalgradient, gradsq_integrand, NULL, GRADSQ_ARGS, SYMMETRY_ADD);
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(GradSq, (ref.grade), fieldref, gradsq_prepareref, gradsq_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_ADD);
+
+FUNCTIONAL_METHODSETPREPARE(GradSq, (ref.grade), fieldref, gradsq_prepareref, gradsq_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_ADD);
+
 value GradSq_fieldgradient(vm *v, int nargs, value *args) {
     functional_mapinfo info;
     fieldref ref;
@@ -3452,7 +5189,8 @@ MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, GradSq_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, GradSq_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, GradSq_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, GradSq_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, GradSq_fieldgradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, GradSq_fieldgradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, GradSq_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -3674,6 +5412,10 @@ FUNCTIONAL_METHOD(Nematic, total, (ref.grade), nematicref, nematic_prepareref, f
 
 FUNCTIONAL_METHOD(Nematic, gradient, (ref.grade), nematicref, nematic_prepareref, functional_mapnumericalgradient, nematic_integrand, NULL, NEMATIC_ARGS, SYMMETRY_NONE);
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(Nematic, (ref.grade), nematicref, nematic_prepareref, nematic_integrand, NULL, NULL, NEMATIC_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODSETPREPARE(Nematic, (ref.grade), nematicref, nematic_prepareref, nematic_integrand, NULL, NULL, NEMATIC_ARGS, SYMMETRY_NONE);
+
 value Nematic_fieldgradient(vm *v, int nargs, value *args) {
     functional_mapinfo info;
     nematicref ref;
@@ -3697,7 +5439,8 @@ MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, Nematic_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, Nematic_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, Nematic_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, Nematic_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, Nematic_fieldgradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, Nematic_fieldgradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, Nematic_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -3820,6 +5563,10 @@ FUNCTIONAL_METHOD(NematicElectric, total, (ref.grade), nematicelectricref, nemat
 
 FUNCTIONAL_METHOD(NematicElectric, gradient, (ref.grade), nematicelectricref, nematicelectric_prepareref, functional_mapnumericalgradient, nematicelectric_integrand, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE);
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(NematicElectric, (ref.grade), nematicelectricref, nematicelectric_prepareref, nematicelectric_integrand, NULL, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODSETPREPARE(NematicElectric, (ref.grade), nematicelectricref, nematicelectric_prepareref, nematicelectric_integrand, NULL, NULL, FUNCTIONAL_ARGS, SYMMETRY_NONE);
+
 value NematicElectric_fieldgradient(vm *v, int nargs, value *args) {
     functional_mapinfo info;
     nematicelectricref ref;
@@ -3843,7 +5590,8 @@ MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, NematicElectric_init, BUILTIN_FLAGSEMPT
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, NematicElectric_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, NematicElectric_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, NematicElectric_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, NematicElectric_fieldgradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, NematicElectric_fieldgradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, NematicElectric_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -3870,6 +5618,10 @@ FUNCTIONAL_METHOD(NormSq, total, MESH_GRADE_VERTEX, fieldref, gradsq_prepareref,
 
 FUNCTIONAL_METHOD(NormSq, gradient, MESH_GRADE_VERTEX, fieldref, gradsq_prepareref, functional_mapnumericalgradient, normsq_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(NormSq, MESH_GRADE_VERTEX, fieldref, gradsq_prepareref, normsq_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODSETPREPARE(NormSq, MESH_GRADE_VERTEX, fieldref, gradsq_prepareref, normsq_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
 value NormSq_fieldgradient(vm *v, int nargs, value *args) {
     functional_mapinfo info;
     fieldref ref;
@@ -3894,7 +5646,8 @@ MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, GradSq_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, NormSq_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, NormSq_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, NormSq_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, NormSq_fieldgradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, NormSq_fieldgradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, NormSq_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* **********************************************************************
@@ -3915,6 +5668,9 @@ typedef struct {
     objectmesh *mref; // Reference mesh
     vm *v;
     bool weightbyref; // Use reference mesh for the element
+    bool batch; // Call the integrand once per batch of quadrature points
+    objectkernel *kernel; // Compiled integrand, if available
+    objectnative *native; // Native integrand provided by an extension, if any
 } integralref;
 
 /* ----------------------------------------------
@@ -4046,12 +5802,17 @@ void integral_evaluatenormal(vm *v, value *out) {
         return;
     }
     
-    functional_vecsub(dim, elref->vertexposn[1], elref->vertexposn[0], s0);
-    functional_vecsub(dim, elref->vertexposn[2], elref->vertexposn[1], s1);
-    functional_veccross(s0, s1, mnormal->elements);
-    
-    double nnorm=functional_vecnorm(dim, mnormal->elements);
-    if (fabs(nnorm)>MORPHO_EPS) functional_vecscale(dim, 1.0/nnorm, mnormal->elements, mnormal->elements);
+    meshgeometry *geo = (elref->g==MESH_GRADE_AREA ? mesh_getgeometry(elref->mesh, MESH_GRADE_AREA) : NULL);
+    if (geo && geo->normal) {
+        memcpy(mnormal->elements, geo->normal+elref->id*dim, sizeof(double)*dim);
+    } else {
+        functional_vecsub(dim, elref->vertexposn[1], elref->vertexposn[0], s0);
+        functional_vecsub(dim, elref->vertexposn[2], elref->vertexposn[1], s1);
+        functional_veccross(s0, s1, mnormal->elements);
+        
+        double nnorm=functional_vecnorm(dim, mnormal->elements);
+        if (fabs(nnorm)>MORPHO_EPS) functional_vecscale(dim, 1.0/nnorm, mnormal->elements, mnormal->elements);
+    }
     
     vm_settlvar(v, normlhandle, MORPHO_OBJECT(mnormal));
     *out = MORPHO_OBJECT(mnormal);
@@ -4190,7 +5951,7 @@ bool integral_evaluategradient(vm *v, value q, value *out) {
     int ifld, xfld=-1;
     for (ifld=0; ifld<elref->iref->nfields; ifld++) {
         if (MORPHO_ISFIELD(q) && MORPHO_ISSAME(elref->iref->originalfields[ifld], q)) break;
-        else if (MORPHO_ISSAME(elref->qinterpolated[ifld], q)) {
+        else if (elref->qinterpolated && MORPHO_ISSAME(elref->qinterpolated[ifld], q)) {
             if (xfld>=0) { morpho_runtimeerror(v, INTEGRAL_AMBGSFLD); return false; }
             // @warning: This will fail if two fields happen to have the same value(!)
             xfld=ifld;
@@ -4218,10 +5979,15 @@ bool integral_evaluategradient(vm *v, value q, value *out) {
     
     // Evaluate gradient
     if (MORPHO_ISFESPACE(fld->fnspc)) {
+        if (!elref->lambda) { morpho_runtimeerror(v, INTEGRAL_BTCHGRD); return false; }
+        
         if (!elref->invj) {
             elref->invj=object_newmatrix(elref->g, elref->mesh->dim, false);
             
-            if (elref->invj) {
+            meshgeometry *geo = mesh_getgeometry(elref->mesh, elref->g);
+            if (elref->invj && geo && geo->invj) {
+                memcpy(elref->invj->elements, geo->invj+elref->id*elref->g*dim, sizeof(double)*elref->g*dim);
+            } else if (elref->invj) {
                 integral_prepareinvjacobian(elref->mesh->dim, elref->g, elref->vertexposn, elref->invj);
             } else {
                 morpho_runtimeerror(v, INTEGRAL_GRDEVL);
@@ -4364,6 +6130,8 @@ void integral_freetlvars(vm *v) {
  * ---------------------------------------------- */
 
 value functional_methodproperty;
+value integral_batchproperty;
+value integral_kernelproperty;
 
 /** Prepares an integral reference */
 bool integral_prepareref(objectinstance *self, objectmesh *mesh, grade g, objectselection *sel, integralref *ref) {
@@ -4373,16 +6141,27 @@ bool integral_prepareref(objectinstance *self, objectmesh *mesh, grade g, object
     value wtbyref=MORPHO_NIL;
     value field=MORPHO_NIL;
     value method=MORPHO_NIL;
+    value batch=MORPHO_NIL;
+    value kernel=MORPHO_NIL;
     ref->v=NULL;
     ref->nfields=0;
     ref->method=MORPHO_NIL;
     ref->mref=NULL;
     ref->weightbyref=false;
+    ref->batch=false;
+    ref->kernel=NULL;
+    ref->native=NULL;
 
-    if (objectinstance_getpropertyinterned(self, scalarpotential_functionproperty, &func) &&
-        MORPHO_ISCALLABLE(func)) {
-        ref->integrand=func;
-        success=true;
+    if (objectinstance_getpropertyinterned(self, scalarpotential_functionproperty, &func)) {
+        if (MORPHO_ISCALLABLE(func)) {
+            ref->integrand=func;
+            success=true;
+        } else if (MORPHO_ISNATIVE(func) &&
+                   (MORPHO_GETNATIVE(func)->defn->integrand || MORPHO_GETNATIVE(func)->defn->batch)) {
+            ref->integrand=func;
+            ref->native=MORPHO_GETNATIVE(func);
+            success=true;
+        }
     }
     if (objectinstance_getpropertyinterned(self, linearelasticity_referenceproperty, &mref) &&
         MORPHO_ISMESH(mref)) {
@@ -4394,6 +6173,9 @@ bool integral_prepareref(objectinstance *self, objectmesh *mesh, grade g, object
     if (objectinstance_getpropertyinterned(self, functional_methodproperty, &method)) {
         ref->method=method;
     }
+    if (objectinstance_getpropertyinterned(self, integral_batchproperty, &batch)) {
+        ref->batch=!morpho_isfalse(batch);
+    }
     if (objectinstance_getpropertyinterned(self, functional_fieldproperty, &field) &&
         MORPHO_ISLIST(field)) {
         objectlist *list = MORPHO_GETLIST(field);
@@ -4401,12 +6183,24 @@ bool integral_prepareref(objectinstance *self, objectmesh *mesh, grade g, object
         ref->fields=list->val.data;
         ref->originalfields=list->val.data;
         
+        bool jacobian=false;
         for (int i=0; i<ref->nfields; i++) {
             if (MORPHO_ISFIELD(ref->fields[i])) {
                 objectfield *fld = MORPHO_GETFIELD(ref->fields[i]);
                 field_addpool(fld);
+                if (MORPHO_ISFESPACE(fld->fnspc)) jacobian=true;
             }
         }
+        
+        // Gradients of finite element fields need the inverse jacobian of each element
+        if (jacobian && !sel) functional_preparegeometry(mesh, g, true);
+    }
+    if (success && !ref->batch && !ref->native &&
+        objectinstance_getpropertyinterned(self, integral_kernelproperty, &kernel) &&
+        MORPHO_ISKERNEL(kernel) &&
+        MORPHO_ISSAME(MORPHO_GETKERNEL(kernel)->fn, ref->integrand) &&
+        kernel_bind(MORPHO_GETKERNEL(kernel), mesh->dim, ref->nfields, ref->originalfields)) {
+        ref->kernel=MORPHO_GETKERNEL(kernel);
     }
     return success;
 }
@@ -4515,79 +6309,233 @@ bool integral_integrandfn(unsigned int dim, double *t, double *x, unsigned int n
     return false;
 }
 
-/* ----------------------------------------------
- * LineIntegral
- * ---------------------------------------------- */
-
-/** Integrate a function over a line */
-bool lineintegral_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
-    integralref iref = *(integralref *) ref;
-    double *x[nv];
-    bool success;
-    value qgrad[iref.nfields+1];
-    for (int i=0; i<iref.nfields; i++) qgrad[i] = MORPHO_NIL;
-    
-    objectintegralelementref elref = MORPHO_STATICINTEGRALELEMENTREF(mesh, MESH_GRADE_LINE, id, nv, vid);
-    elref.iref = &iref;
-    elref.vertexposn = x;
-    elref.qgrad=qgrad;
-    elref.invj=NULL;
+/** Integrand function for the batched calling convention: the integrand is called once with a dim x n matrix of positions followed by a List of n interpolated values for each quantity, and should return a Matrix or List of n values. */
+bool integral_integrandbatchfn(unsigned int dim, unsigned int n, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    integralref *iref = ref;
+    objectmatrix posn = MORPHO_STATICMATRIX(x, dim, n);
+    value args[nquantity+1], out;
+    bool success=false;
     
-    if (!functional_elementsize(v, mesh, MESH_GRADE_LINE, id, nv, vid, &elref.elementsize)) return false;
-
-    iref.v=v;
-    for (unsigned int i=0; i<nv; i++) {
-        mesh_getvertexcoordinatesaslist(mesh, vid[i], &x[i]);
-    }
-
-    /* Set up quantities */
-    integral_cleartlvars(v);
-    vm_settlvar(v, elementhandle, MORPHO_OBJECT(&elref));
-
-    if (MORPHO_ISDICTIONARY(iref.method)) {
-        double err;
-        quantity quantities[iref.nfields+1];
-        integral_preparequantities(&iref, nv, vid, quantities);
-        elref.quantities=quantities;
-        
-        success=integrate(integral_integrandfn, MORPHO_GETDICTIONARY(iref.method), morpho_geterror(v), mesh->dim, MESH_GRADE_LINE, x, iref.nfields, quantities, &iref, out, &err);
+    args[0]=MORPHO_OBJECT(&posn);
+    for (unsigned int k=0; k<nquantity; k++) {
+        value qk[n];
+        for (unsigned int p=0; p<n; p++) qk[p]=quantity[p*nquantity+k];
         
-        integral_clearquantities(iref.nfields, quantities);
-        integral_clearelref(&elref);
-    } else { // Old integrator
-        value q0[iref.nfields+1], q1[iref.nfields+1];
-        value *q[2] = { q0, q1 };
-        for (unsigned int k=0; k<iref.nfields; k++) {
-            for (unsigned int i=0; i<nv; i++) {
-                field_getelement(MORPHO_GETFIELD(iref.fields[k]), MESH_GRADE_VERTEX, vid[i], 0, &q[i][k]);
-            }
+        objectlist *lst = object_newlist(n, qk);
+        if (!lst) {
+            for (unsigned int j=0; j<k; j++) morpho_freeobject(args[j+1]);
+            morpho_runtimeerror(iref->v, ERROR_ALLOCATIONFAILED);
+            return false;
         }
-        
-        success=integrate_integrate(integral_integrandfn, mesh->dim, MESH_GRADE_LINE, x, iref.nfields, q, &iref, out);
+        args[k+1]=MORPHO_OBJECT(lst);
     }
     
-    if (success) *out *=elref.elementsize;
-
-    integral_freetlvars(v);
+    // Pointwise information is not available to special functions
+    objectintegralelementref *elref = integral_getelementref(iref->v);
+    if (elref) {
+        elref->lambda=NULL;
+        elref->posn=NULL;
+        elref->qinterpolated=NULL;
+    }
     
-    // Free gradient information
-    for (int i=0; i<iref.nfields; i++) {
-        if (MORPHO_ISLIST(qgrad[i])) {
-            objectlist *l = MORPHO_GETLIST(qgrad[i]);
-            for (int j=0; j<l->val.count; j++) morpho_freeobject(l->val.data[j]);
+    if (morpho_call(iref->v, iref->integrand, nquantity+1, args, &out)) {
+        if (MORPHO_ISMATRIX(out) && matrix_countdof(MORPHO_GETMATRIX(out))==n) {
+            objectmatrix *m = MORPHO_GETMATRIX(out);
+            for (unsigned int p=0; p<n; p++) fout[p]=m->elements[p];
+            success=true;
+        } else if (MORPHO_ISLIST(out) && list_length(MORPHO_GETLIST(out))==n) {
+            objectlist *l = MORPHO_GETLIST(out);
+            success=true;
+            for (unsigned int p=0; p<n && success; p++) success=morpho_valuetofloat(l->val.data[p], &fout[p]);
         }
-        morpho_freeobject(qgrad[i]);
+        
+        if (!success) morpho_runtimeerror(iref->v, INTEGRAL_BTCHRTN);
     }
     
+    for (unsigned int k=0; k<nquantity; k++) morpho_freeobject(args[k+1]);
+    
     return success;
 }
 
-FUNCTIONAL_METHOD(LineIntegral, integrand, MESH_GRADE_LINE, integralref, integral_prepareref, functional_mapintegrand, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
-
-FUNCTIONAL_METHOD(LineIntegral, total, MESH_GRADE_LINE, integralref, integral_prepareref, functional_sumintegrand, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
-
-FUNCTIONAL_METHOD(LineIntegral, gradient, MESH_GRADE_LINE, integralref, integral_prepareref, functional_mapnumericalgradient, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
-
+/** Information needed to evaluate special functions within a compiled integrand */
+typedef struct {
+    integralref *iref;
+    double *lambda; // Barycentric coordinates of the points
+    int nbary; // Number of barycentric coordinates per point
+} integralkernelref;
+
+/** Evaluates special functions on behalf of a compiled integrand */
+static bool integral_kernelspecial(void *ref, kernelop op, int field, int p, double *out) {
+    integralkernelref *kref = ref;
+    vm *v = kref->iref->v;
+    objectintegralelementref *elref = integral_getelementref(v);
+    value val=MORPHO_NIL;
+    if (!elref) return false;
+    
+    switch (op) {
+        case KERNEL_TANGENT: val=integral_tangent(v, 0, NULL); break;
+        case KERNEL_NORMAL: val=integral_normal(v, 0, NULL); break;
+        case KERNEL_GRAD:
+            elref->lambda=kref->lambda+p*kref->nbary;
+            if (!integral_evaluategradient(v, kref->iref->originalfields[field], &val)) return false;
+            break;
+        default: return false;
+    }
+    
+    int dim=elref->mesh->dim;
+    if (!MORPHO_ISMATRIX(val) || matrix_countdof(MORPHO_GETMATRIX(val))!=dim) return false;
+    
+    double *el = MORPHO_GETMATRIX(val)->elements;
+    for (int i=0; i<dim; i++) out[i]=el[i];
+    
+    return true;
+}
+
+/** Evaluates a compiled integrand at a batch of points */
+bool integral_kernelbatchfn(unsigned int dim, unsigned int n, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    integralref *iref = ref;
+    integralkernelref kref = { .iref=iref, .lambda=t, .nbary=1 };
+    
+    objectintegralelementref *elref = integral_getelementref(iref->v);
+    if (elref) {
+        kref.nbary=elref->g+1;
+        elref->posn=x;
+        elref->qinterpolated=quantity;
+    }
+    
+    if (!kernel_evaluate(iref->kernel, dim, n, x, nquantity, quantity, integral_kernelspecial, &kref, fout)) return false;
+    
+    /* The kernel uses real arithmetic; points where this fails, e.g. outside the domain of sqrt, are evaluated by the
+       integrand function, which may return a complex value */
+    for (unsigned int p=0; p<n; p++) {
+        if (isfinite(fout[p])) continue;
+        fout[p]=0.0;
+        if (!integral_integrandfn(dim, t+p*kref.nbary, x+p*dim, nquantity, quantity+p*nquantity, ref, fout+p)) return false;
+    }
+    
+    return true;
+}
+
+/** Evaluates a compiled integrand at a single point */
+bool integral_kernelfn(unsigned int dim, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    return integral_kernelbatchfn(dim, 1, t, x, nquantity, quantity, ref, fout);
+}
+
+/** Evaluates a native integrand at a batch of points */
+bool integral_nativebatchfn(unsigned int dim, unsigned int n, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    objectnative *native = ((integralref *) ref)->native;
+    return (native->defn->batch) (dim, n, t, x, nquantity, quantity, native->ref, fout);
+}
+
+/** Evaluates a native integrand at a single point */
+bool integral_nativefn(unsigned int dim, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    objectnative *native = ((integralref *) ref)->native;
+    if (native->defn->integrand) return (native->defn->integrand) (dim, t, x, nquantity, quantity, native->ref, fout);
+    return integral_nativebatchfn(dim, 1, t, x, nquantity, quantity, ref, fout);
+}
+
+/** Selects the function used to evaluate the integrand at a single point */
+integrandfunction *integral_pointfn(integralref *iref) {
+    if (iref->native) return integral_nativefn;
+    if (iref->kernel) return integral_kernelfn;
+    return integral_integrandfn;
+}
+
+/** Integrates over an element with the adaptive integrator, using the batched calling convention if requested */
+bool integral_integrateelement(vm *v, integralref *iref, objectintegralelementref *elref, grade g, double **x, double *out) {
+    double err;
+    bool success;
+    quantity quantities[iref->nfields+1];
+    integral_preparequantities(iref, elref->nv, elref->vid, quantities);
+    elref->quantities=quantities;
+    
+    objectdictionary *method = (MORPHO_ISDICTIONARY(iref->method) ? MORPHO_GETDICTIONARY(iref->method) : NULL);
+    
+    if (iref->batch) {
+        success=integrate_batch(integral_integrandbatchfn, method, morpho_geterror(v), elref->mesh->dim, g, x, iref->nfields, quantities, iref, out, &err);
+    } else if (iref->native && iref->native->defn->batch) {
+        success=integrate_batch(integral_nativebatchfn, method, morpho_geterror(v), elref->mesh->dim, g, x, iref->nfields, quantities, iref, out, &err);
+    } else if (iref->kernel) {
+        success=integrate_batch(integral_kernelbatchfn, method, morpho_geterror(v), elref->mesh->dim, g, x, iref->nfields, quantities, iref, out, &err);
+    } else {
+        success=integrate(integral_pointfn(iref), method, morpho_geterror(v), elref->mesh->dim, g, x, iref->nfields, quantities, iref, out, &err);
+    }
+    
+    integral_clearquantities(iref->nfields, quantities);
+    integral_clearelref(elref);
+    
+    return success;
+}
+
+/* ----------------------------------------------
+ * LineIntegral
+ * ---------------------------------------------- */
+
+/** Integrate a function over a line */
+bool lineintegral_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    integralref iref = *(integralref *) ref;
+    double *x[nv];
+    bool success;
+    value qgrad[iref.nfields+1];
+    for (int i=0; i<iref.nfields; i++) qgrad[i] = MORPHO_NIL;
+    
+    objectintegralelementref elref = MORPHO_STATICINTEGRALELEMENTREF(mesh, MESH_GRADE_LINE, id, nv, vid);
+    elref.iref = &iref;
+    elref.vertexposn = x;
+    elref.qgrad=qgrad;
+    elref.invj=NULL;
+    
+    if (!functional_elementsize(v, mesh, MESH_GRADE_LINE, id, nv, vid, &elref.elementsize)) return false;
+
+    iref.v=v;
+    for (unsigned int i=0; i<nv; i++) {
+        mesh_getvertexcoordinatesaslist(mesh, vid[i], &x[i]);
+    }
+
+    /* Set up quantities */
+    integral_cleartlvars(v);
+    vm_settlvar(v, elementhandle, MORPHO_OBJECT(&elref));
+
+    if (MORPHO_ISDICTIONARY(iref.method) || iref.batch) {
+        success=integral_integrateelement(v, &iref, &elref, MESH_GRADE_LINE, x, out);
+    } else { // Old integrator
+        value q0[iref.nfields+1], q1[iref.nfields+1];
+        value *q[2] = { q0, q1 };
+        for (unsigned int k=0; k<iref.nfields; k++) {
+            for (unsigned int i=0; i<nv; i++) {
+                field_getelement(MORPHO_GETFIELD(iref.fields[k]), MESH_GRADE_VERTEX, vid[i], 0, &q[i][k]);
+            }
+        }
+        
+        success=integrate_integrate(integral_pointfn(&iref), mesh->dim, MESH_GRADE_LINE, x, iref.nfields, q, &iref, out);
+    }
+    
+    if (success) *out *=elref.elementsize;
+
+    integral_freetlvars(v);
+    
+    // Free gradient information
+    for (int i=0; i<iref.nfields; i++) {
+        if (MORPHO_ISLIST(qgrad[i])) {
+            objectlist *l = MORPHO_GETLIST(qgrad[i]);
+            for (int j=0; j<l->val.count; j++) morpho_freeobject(l->val.data[j]);
+        }
+        morpho_freeobject(qgrad[i]);
+    }
+    
+    return success;
+}
+
+FUNCTIONAL_METHOD(LineIntegral, integrand, MESH_GRADE_LINE, integralref, integral_prepareref, functional_mapintegrand, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHOD(LineIntegral, total, MESH_GRADE_LINE, integralref, integral_prepareref, functional_sumintegrand, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHOD(LineIntegral, gradient, MESH_GRADE_LINE, integralref, integral_prepareref, functional_mapnumericalgradient, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODTOTALANDGRADIENT(LineIntegral, MESH_GRADE_LINE, integralref, integral_prepareref, lineintegral_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODSETPREPARE(LineIntegral, MESH_GRADE_LINE, integralref, integral_prepareref, lineintegral_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
 FUNCTIONAL_METHOD(LineIntegral, hessian, MESH_GRADE_LINE, integralref, integral_prepareref, functional_mapnumericalhessian, lineintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE)
 
 /** Initialize a LineIntegral object */
@@ -4598,11 +6546,13 @@ value LineIntegral_init(vm *v, int nargs, value *args) {
     value method=MORPHO_NIL;
     value mref=MORPHO_NIL;
     value wtbyref=MORPHO_NIL;
+    value batch=MORPHO_NIL;
 
-    if (builtin_options(v, nargs, args, &nfixed, 3,
+    if (builtin_options(v, nargs, args, &nfixed, 4,
                         functional_methodproperty, &method,
                         linearelasticity_referenceproperty, &mref,
-                        linearelasticity_weightbyreferenceproperty, &wtbyref)) {
+                        linearelasticity_weightbyreferenceproperty, &wtbyref,
+                        integral_batchproperty, &batch)) {
         if (MORPHO_ISDICTIONARY(method)) {
             objectinstance_setproperty(self, functional_methodproperty, method);
         } else if (!MORPHO_ISNIL(method)) {
@@ -4611,6 +6561,7 @@ value LineIntegral_init(vm *v, int nargs, value *args) {
 
         if (MORPHO_ISMESH(mref)) objectinstance_setproperty(self, linearelasticity_referenceproperty, mref);
         if (MORPHO_ISBOOL(wtbyref)) objectinstance_setproperty(self, linearelasticity_weightbyreferenceproperty, wtbyref);
+        if (MORPHO_ISBOOL(batch)) objectinstance_setproperty(self, integral_batchproperty, batch);
     } else {
         morpho_runtimeerror(v, INTEGRAL_ARGS);
         return MORPHO_NIL;
@@ -4619,7 +6570,10 @@ value LineIntegral_init(vm *v, int nargs, value *args) {
     if (nfixed>0) {
         value f = MORPHO_GETARG(args, 0);
 
-        if (morpho_countparameters(f, &nparams)) {
+        if (MORPHO_ISNATIVE(f)) { // Native integrands declare how many fields they expect
+            nparams=MORPHO_GETNATIVE(f)->defn->nfields+1;
+            objectinstance_setproperty(self, scalarpotential_functionproperty, f);
+        } else if (morpho_countparameters(f, &nparams)) {
             objectinstance_setproperty(self, scalarpotential_functionproperty, MORPHO_GETARG(args, 0));
         } else {
             morpho_runtimeerror(v, INTEGRAL_ARGS);
@@ -4650,6 +6604,16 @@ value LineIntegral_init(vm *v, int nargs, value *args) {
         morpho_bindobjects(v, 1, &field);
     }
 
+    // Attempt to compile the integrand so that it can be evaluated without calling the VM
+    if (nfixed>0 && !MORPHO_ISNATIVE(MORPHO_GETARG(args, 0))) {
+        objectkernel *k = kernel_compile(v, MORPHO_GETARG(args, 0), nfixed-1);
+        if (k) {
+            value kernel = MORPHO_OBJECT(k);
+            objectinstance_setproperty(self, integral_kernelproperty, kernel);
+            morpho_bindobjects(v, 1, &kernel);
+        }
+    }
+
     return MORPHO_NIL;
 }
 
@@ -4680,7 +6644,8 @@ MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, LineIntegral_integrand, BUILTIN_FLAGS
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, LineIntegral_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, LineIntegral_gradient, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, LineIntegral_fieldgradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, LineIntegral_hessian, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, LineIntegral_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, LineIntegral_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -4717,16 +6682,8 @@ bool areaintegral_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *
     integral_cleartlvars(v);
     vm_settlvar(v, elementhandle, MORPHO_OBJECT(&elref));
     
-    if (MORPHO_ISDICTIONARY(iref.method)) {
-        double err;
-        quantity quantities[iref.nfields+1];
-        integral_preparequantities(&iref, nv, vid, quantities);
-        elref.quantities=quantities;
-        
-        success=integrate(integral_integrandfn, MORPHO_GETDICTIONARY(iref.method), morpho_geterror(v), mesh->dim, MESH_GRADE_AREA, x, iref.nfields, quantities, &iref, out, &err);
-        
-        integral_clearquantities(iref.nfields, quantities);
-        integral_clearelref(&elref);
+    if (MORPHO_ISDICTIONARY(iref.method) || iref.batch) {
+        success=integral_integrateelement(v, &iref, &elref, MESH_GRADE_AREA, x, out);
     } else {
         value q0[iref.nfields+1], q1[iref.nfields+1], q2[iref.nfields+1];
         value *q[3] = { q0, q1, q2 };
@@ -4736,7 +6693,7 @@ bool areaintegral_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *
             }
         }
         
-        success=integrate_integrate(integral_integrandfn, mesh->dim, MESH_GRADE_AREA, x, iref.nfields, q, &iref, out);
+        success=integrate_integrate(integral_pointfn(&iref), mesh->dim, MESH_GRADE_AREA, x, iref.nfields, q, &iref, out);
     }
     
     if (success) *out *= elref.elementsize;
@@ -4761,6 +6718,10 @@ FUNCTIONAL_METHOD(AreaIntegral, total, MESH_GRADE_AREA, integralref, integral_pr
 
 FUNCTIONAL_METHOD(AreaIntegral, gradient, MESH_GRADE_AREA, integralref, integral_prepareref, functional_mapnumericalgradient, areaintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(AreaIntegral, MESH_GRADE_AREA, integralref, integral_prepareref, areaintegral_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODSETPREPARE(AreaIntegral, MESH_GRADE_AREA, integralref, integral_prepareref, areaintegral_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
 /** Field gradients for Area Integrals */
 value AreaIntegral_fieldgradient(vm *v, int nargs, value *args) {
     functional_mapinfo info;
@@ -4787,7 +6748,8 @@ MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, LineIntegral_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, AreaIntegral_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, AreaIntegral_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, AreaIntegral_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, AreaIntegral_fieldgradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, AreaIntegral_fieldgradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, AreaIntegral_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* ----------------------------------------------
@@ -4820,16 +6782,8 @@ bool volumeintegral_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int
     integral_cleartlvars(v);
     vm_settlvar(v, elementhandle, MORPHO_OBJECT(&elref));
     
-    if (MORPHO_ISDICTIONARY(iref.method)) {
-        double err;
-        quantity quantities[iref.nfields+1];
-        integral_preparequantities(&iref, nv, vid, quantities);
-        elref.quantities=quantities;
-        
-        success=integrate(integral_integrandfn, MORPHO_GETDICTIONARY(iref.method), morpho_geterror(v), mesh->dim, MESH_GRADE_VOLUME, x, iref.nfields, quantities, &iref, out, &err);
-        
-        integral_clearquantities(iref.nfields, quantities);
-        integral_clearelref(&elref);
+    if (MORPHO_ISDICTIONARY(iref.method) || iref.batch) {
+        success=integral_integrateelement(v, &iref, &elref, MESH_GRADE_VOLUME, x, out);
     } else {
         value q0[iref.nfields+1], q1[iref.nfields+1], q2[iref.nfields+1], q3[iref.nfields+1];
         value *q[4] = { q0, q1, q2, q3 };
@@ -4839,7 +6793,7 @@ bool volumeintegral_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int
             }
         }
         
-        success=integrate_integrate(integral_integrandfn, mesh->dim, MESH_GRADE_VOLUME, x, iref.nfields, q, &iref, out);
+        success=integrate_integrate(integral_pointfn(&iref), mesh->dim, MESH_GRADE_VOLUME, x, iref.nfields, q, &iref, out);
     }
     
     if (success) *out *=elref.elementsize;
@@ -4863,6 +6817,10 @@ FUNCTIONAL_METHOD(VolumeIntegral, total, MESH_GRADE_VOLUME, integralref, integra
 
 FUNCTIONAL_METHOD(VolumeIntegral, gradient, MESH_GRADE_VOLUME, integralref, integral_prepareref, functional_mapnumericalgradient, volumeintegral_integrand, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
 
+FUNCTIONAL_METHODTOTALANDGRADIENT(VolumeIntegral, MESH_GRADE_VOLUME, integralref, integral_prepareref, volumeintegral_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
+FUNCTIONAL_METHODSETPREPARE(VolumeIntegral, MESH_GRADE_VOLUME, integralref, integral_prepareref, volumeintegral_integrand, NULL, NULL, GRADSQ_ARGS, SYMMETRY_NONE);
+
 /** Field gradients for Volume Integrals */
 value VolumeIntegral_fieldgradient(vm *v, int nargs, value *args) {
     functional_mapinfo info;
@@ -4889,7 +6847,639 @@ MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, LineIntegral_init, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, VolumeIntegral_integrand, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, VolumeIntegral_total, BUILTIN_FLAGSEMPTY),
 MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, VolumeIntegral_gradient, BUILTIN_FLAGSEMPTY),
-MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, VolumeIntegral_fieldgradient, BUILTIN_FLAGSEMPTY)
+MORPHO_METHOD(FUNCTIONAL_FIELDGRADIENT_METHOD, VolumeIntegral_fieldgradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, VolumeIntegral_totalAndGradient, BUILTIN_FLAGSEMPTY)
+MORPHO_ENDCLASS
+
+/* ----------------------------------------------
+ * NativeFunctional
+ * ---------------------------------------------- */
+
+typedef struct {
+    objectnative *native;
+} nativefunctionalref;
+
+/** Prepares a reference to the native object held by a NativeFunctional */
+bool nativefunctional_prepareref(objectinstance *self, nativefunctionalref *ref) {
+    value func=MORPHO_NIL;
+    if (objectinstance_getpropertyinterned(self, scalarpotential_functionproperty, &func) &&
+        MORPHO_ISNATIVE(func)) {
+        ref->native=MORPHO_GETNATIVE(func);
+        return (ref->native->defn->elementintegrand!=NULL);
+    }
+    return false;
+}
+
+/** Calls the native element integrand */
+bool nativefunctional_integrand(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    objectnative *native = ((nativefunctionalref *) ref)->native;
+    return (native->defn->elementintegrand) (v, mesh, id, nv, vid, native->ref, out);
+}
+
+/** Calls the native element gradient */
+bool nativefunctional_gradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
+    objectnative *native = ((nativefunctionalref *) ref)->native;
+    return (native->defn->elementgradient) (v, mesh, id, nv, vid, native->ref, frc);
+}
+
+/** Sets up the map info for a NativeFunctional; the grade is set by the native definition */
+static bool nativefunctional_prepareinfo(vm *v, int nargs, value *args, nativefunctionalref *ref, functional_mapinfo *info) {
+    if (!functional_validateargs(v, nargs, args, info)) return false;
+    if (!nativefunctional_prepareref(MORPHO_GETINSTANCE(MORPHO_SELF(args)), ref)) {
+        morpho_runtimeerror(v, NATIVEFUNCTIONAL_ARGS);
+        return false;
+    }
+    info->g=ref->native->defn->g;
+    info->integrand=nativefunctional_integrand;
+    info->grad=(ref->native->defn->elementgradient ? nativefunctional_gradient : NULL);
+    info->sym=SYMMETRY_NONE;
+    info->ref=ref;
+    return true;
+}
+
+/** Initialize a NativeFunctional object */
+value NativeFunctional_init(vm *v, int nargs, value *args) {
+    if (nargs==1 &&
+        MORPHO_ISNATIVE(MORPHO_GETARG(args, 0)) &&
+        MORPHO_GETNATIVE(MORPHO_GETARG(args, 0))->defn->elementintegrand) {
+        objectinstance_setproperty(MORPHO_GETINSTANCE(MORPHO_SELF(args)), scalarpotential_functionproperty, MORPHO_GETARG(args, 0));
+    } else morpho_runtimeerror(v, NATIVEFUNCTIONAL_ARGS);
+
+    return MORPHO_NIL;
+}
+
+/** Integrand on each element */
+value NativeFunctional_integrand(vm *v, int nargs, value *args) {
+    functional_mapinfo info;
+    nativefunctionalref ref;
+    value out=MORPHO_NIL;
+
+    if (nativefunctional_prepareinfo(v, nargs, args, &ref, &info)) functional_mapintegrand(v, &info, &out);
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out);
+    return out;
+}
+
+/** Total */
+value NativeFunctional_total(vm *v, int nargs, value *args) {
+    functional_mapinfo info;
+    nativefunctionalref ref;
+    value out=MORPHO_NIL;
+
+    if (nativefunctional_prepareinfo(v, nargs, args, &ref, &info)) functional_sumintegrand(v, &info, &out);
+    return out;
+}
+
+/** Gradient, computed numerically if the native definition doesn't provide one */
+value NativeFunctional_gradient(vm *v, int nargs, value *args) {
+    functional_mapinfo info;
+    nativefunctionalref ref;
+    value out=MORPHO_NIL;
+
+    if (nativefunctional_prepareinfo(v, nargs, args, &ref, &info)) {
+        if (info.grad) functional_mapgradient(v, &info, &out);
+        else functional_mapnumericalgradient(v, &info, &out);
+    }
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out);
+    return out;
+}
+
+/** Total and gradient in a single pass */
+value NativeFunctional_totalAndGradient(vm *v, int nargs, value *args) {
+    functional_mapinfo info;
+    nativefunctionalref ref;
+    value res[2], out=MORPHO_NIL;
+
+    if (nativefunctional_prepareinfo(v, nargs, args, &ref, &info) &&
+        functional_maptotalandgradient(v, &info, res)) out=functional_totalandgradientlist(v, res);
+    return out;
+}
+
+/** Hessian, computed numerically */
+value NativeFunctional_hessian(vm *v, int nargs, value *args) {
+    functional_mapinfo info;
+    nativefunctionalref ref;
+    value out=MORPHO_NIL;
+
+    if (nativefunctional_prepareinfo(v, nargs, args, &ref, &info)) functional_mapnumericalhessian(v, &info, &out);
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out);
+    return out;
+}
+
+MORPHO_BEGINCLASS(NativeFunctional)
+MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, NativeFunctional_init, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_INTEGRAND_METHOD, NativeFunctional_integrand, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, NativeFunctional_total, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, NativeFunctional_gradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_HESSIAN_METHOD, NativeFunctional_hessian, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, NativeFunctional_totalAndGradient, BUILTIN_FLAGSEMPTY)
+MORPHO_ENDCLASS
+
+/** Prepares a NativeFunctional for evaluation in a FunctionalSet */
+static bool NativeFunctional_setprepare(vm *v, objectinstance *self, objectmesh *mesh, objectselection *sel, functional_mapinfo *info) {
+    nativefunctionalref *ref = MORPHO_MALLOC(sizeof(nativefunctionalref));
+    if (!ref) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); return false; }
+    if (!nativefunctional_prepareref(self, ref)) {
+        MORPHO_FREE(ref);
+        morpho_runtimeerror(v, NATIVEFUNCTIONAL_ARGS);
+        return false;
+    }
+    info->mesh=mesh;
+    info->sel=sel;
+    info->g=ref->native->defn->g;
+    info->integrand=nativefunctional_integrand;
+    info->grad=(ref->native->defn->elementgradient ? nativefunctional_gradient : NULL);
+    info->sym=SYMMETRY_NONE;
+    info->ref=ref;
+    return true;
+}
+
+/* ----------------------------------------------
+ * FunctionalSet
+ * ---------------------------------------------- */
+
+/* A FunctionalSet holds a list of functionals with selections and prefactors, and evaluates their
+   weighted sum. Members that share a grade and selection are evaluated together in a single sweep
+   over the elements, accumulating into one set of output matrices. */
+
+static value functionalset_functionalsproperty;
+static value functionalset_selectionsproperty;
+static value functionalset_prefactorsproperty;
+static value functionalset_selectionoption;
+static value functionalset_prefactoroption;
+
+/** Functional classes that can be members of a FunctionalSet */
+typedef struct {
+    objectclass *klass;
+    functional_setpreparefn *prepare;
+} functionalset_entry;
+
+DECLARE_VARRAY(functionalsetentry, functionalset_entry);
+DEFINE_VARRAY(functionalsetentry, functionalset_entry);
+
+static varray_functionalsetentry functionalset_classes;
+
+/** Registers a functional class so that it can be evaluated as part of a FunctionalSet */
+void functionalset_register(char *classname, functional_setpreparefn *prepare) {
+    objectstring name = MORPHO_STATICSTRING(classname);
+    value klass = builtin_findclass(MORPHO_OBJECT(&name));
+    if (!MORPHO_ISCLASS(klass)) return;
+    
+    functionalset_entry entry = { .klass = MORPHO_GETCLASS(klass), .prepare = prepare };
+    varray_functionalsetentrywrite(&functionalset_classes, entry);
+}
+
+/** Finds the prepare function for an object, searching its superclasses */
+static functional_setpreparefn *functionalset_findprepare(value obj) {
+    if (!MORPHO_ISINSTANCE(obj)) return NULL;
+    
+    for (objectclass *klass=MORPHO_GETINSTANCE(obj)->klass; klass; klass=klass->superclass) {
+        for (int i=0; i<functionalset_classes.count; i++) {
+            if (functionalset_classes.data[i].klass==klass) return functionalset_classes.data[i].prepare;
+        }
+    }
+    return NULL;
+}
+
+/** A prepared member of a FunctionalSet */
+typedef struct {
+    functional_mapinfo info;
+    double prefactor;
+} functionalset_member;
+
+/** Members that share a grade and selection, evaluated together in one sweep */
+typedef struct {
+    grade g;
+    objectselection *sel;
+    int nmembers;
+    functionalset_member **members;
+    bool total; /* Whether to compute the total */
+    bool gradient; /* Whether to compute the gradient */
+    bool split; /* Whether members without symmetry behavior accumulate separately */
+} functionalset_group;
+
+/** Per task storage for a sweep */
+typedef struct {
+    double *value; /* Weighted integrand of the current element */
+    objectmatrix *frc[2]; /* Gradient output; frc[1] is used by members without symmetry behavior if the group is split */
+    varray_elementid touched; /* Vertices touched by the current element */
+    varray_double saved; /* Output columns saved while a weighted gradient is computed */
+} functionalset_result;
+
+/** Finds the vertices that a member's gradient on an element touches, without repeats */
+static void functionalset_touched(functionalset_member *m, elementid id, int nv, int *vid, varray_elementid *out) {
+    out->count=0;
+    varray_elementidadd(out, vid, nv);
+    if (!m->info.dependencies) return;
+    
+    int n=out->count;
+    (m->info.dependencies) (&m->info, id, out);
+    
+    int k=n; // Remove any dependencies already listed
+    for (int i=n; i<out->count; i++) {
+        bool repeat=false;
+        for (int j=0; j<k && !repeat; j++) repeat=(out->data[j]==out->data[i]);
+        if (!repeat) out->data[k++]=out->data[i];
+    }
+    out->count=k;
+}
+
+/** Adds a member's gradient on an element to frc; mesh is the mesh to perturb for numerical gradients */
+static bool functionalset_gradient(vm *v, functionalset_member *m, objectmesh *mesh, elementid id, int nv, int *vid, functionalset_result *res, objectmatrix *frc) {
+    bool weighted=(m->prefactor!=1.0);
+    int dim=frc->nrows;
+    
+    if (weighted) { // Save and clear the columns the element touches so they hold only this gradient
+        functionalset_touched(m, id, nv, vid, &res->touched);
+        res->saved.count=0;
+        for (int i=0; i<res->touched.count; i++) {
+            double *col=frc->elements+res->touched.data[i]*dim;
+            varray_doubleadd(&res->saved, col, dim);
+            for (int k=0; k<dim; k++) col[k]=0.0;
+        }
+    }
+    
+    bool success;
+    if (m->info.grad) success=(*m->info.grad) (v, m->info.mesh, id, nv, vid, m->info.ref, frc);
+    else success=functional_numericalgradientmapfn(v, mesh, id, nv, vid, &m->info, frc);
+    
+    if (weighted) { // Scale the gradient and restore the saved columns
+        for (int i=0; i<res->touched.count; i++) {
+            double *col=frc->elements+res->touched.data[i]*dim;
+            double *prev=res->saved.data+i*dim;
+            for (int k=0; k<dim; k++) col[k]=prev[k]+m->prefactor*col[k];
+        }
+    }
+    
+    return success;
+}
+
+/** Evaluates every member of a group on an element; ref is the group */
+static bool functionalset_mapfn(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, void *out) {
+    functionalset_group *grp = (functionalset_group *) ref;
+    functionalset_result *res = (functionalset_result *) out;
+    double total=0.0, val;
+    
+    for (int i=0; i<grp->nmembers; i++) {
+        functionalset_member *m = grp->members[i];
+        
+        if (grp->total) {
+            if (!(*m->info.integrand) (v, m->info.mesh, id, nv, vid, m->info.ref, &val)) return false;
+            total+=m->prefactor*val;
+        }
+        
+        if (grp->gradient) {
+            objectmatrix *frc=res->frc[(grp->split && m->info.sym==SYMMETRY_NONE) ? 1 : 0];
+            if (!functionalset_gradient(v, m, mesh, id, nv, vid, res, frc)) return false;
+        }
+    }
+    
+    *res->value=total;
+    return true;
+}
+
+/** Sweeps over the elements of a group in serial, adding the total to sum */
+static bool functionalset_sweepX(vm *v, objectmesh *mesh, functionalset_group *grp, functionalset_result *res, double *sum) {
+    objectselection *sel = grp->sel;
+    grade g = grp->g;
+    objectsparse *s=NULL;
+    bool success=false;
+    int n=0;
+    
+    functional_mapinfo info;
+    functional_clearmapinfo(&info);
+    info.mesh=mesh; info.sel=sel; info.g=g;
+    
+    if (!functional_countelements(v, mesh, g, &n, &s)) return false;
+    functional_cachegeometry(&info);
+    
+    /* Find any image elements so we can skip over them */
+    varray_elementid imageids;
+    varray_elementidinit(&imageids);
+    functional_symmetryimagelist(mesh, g, true, &imageids);
+    
+    int vertexid; // Use this if looping over grade 0
+    int *vid=(g==0 ? &vertexid : NULL),
+        nv=(g==0 ? 1 : 0); // The vertex indices
+    int sindx=0; // Index into imageids array
+    double c=0.0, y, t, result;
+    res->value=&result;
+    
+    int nel=(sel ? sel->selected[g].capacity : n);
+    if (sel && sel->selected[g].count==0) nel=0;
+    
+    for (int k=0; k<nel; k++) {
+        elementid i=k;
+        if (sel) {
+            if (!MORPHO_ISINTEGER(sel->selected[g].contents[k].key)) continue;
+            i = MORPHO_GETINTEGERVALUE(sel->selected[g].contents[k].key);
+        }
+        
+        // Skip this element if it's an image element
+        if ((imageids.count>0) && (sindx<imageids.count) && imageids.data[sindx]==i) { sindx++; continue; }
+        
+        if (s) sparseccs_getrowindices(&s->ccs, i, &nv, &vid);
+        else vertexid=i;
+        
+        if (vid && nv>0) {
+            if (!functionalset_mapfn(v, mesh, i, nv, vid, (void *) grp, res)) goto functionalset_sweep_cleanup;
+            y=result-c; t=*sum+y; c=(t-*sum)-y; *sum=t; // Kahan summation
+        }
+    }
+    success=true;
+    
+functionalset_sweep_cleanup:
+    varray_elementidclear(&imageids);
+    return success;
+}
+
+/** Sweeps over the elements of a group in parallel, adding the total to sum */
+static bool functionalset_sweep(vm *v, objectmesh *mesh, functionalset_group *grp, int ntask, functionalset_result *res, objectmesh *meshclones, double *sum) {
+    functional_task task[ntask];
+    functional_sumintermediate sums[ntask];
+    bool success=false;
+    
+    functional_mapinfo info;
+    functional_clearmapinfo(&info);
+    info.mesh=mesh; info.sel=grp->sel; info.g=grp->g;
+    
+    varray_elementid imageids;
+    varray_elementidinit(&imageids);
+    
+    functional_cachegeometry(&info);
+    if (!functional_preparetasks(v, &info, ntask, task, &imageids)) return false;
+    
+    int nchunks=functional_countchunks(ntask, task);
+    double *chunks=MORPHO_MALLOC(sizeof(double)*(nchunks+1));
+    if (!chunks) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functionalset_sweep_cleanup; }
+    for (int i=0; i<nchunks; i++) chunks[i]=0.0;
+    
+    for (int i=0; i<ntask; i++) {
+        if (meshclones && meshclones[i].vert) task[i].mesh=&meshclones[i];
+        
+        res[i].value=&sums[i].result;
+        sums[i].c=0.0; sums[i].sum=0.0;
+        sums[i].chunks=chunks;
+        
+        task[i].ref=(void *) grp;
+        task[i].mapfn=functionalset_mapfn;
+        task[i].processfn=functional_sumintegrandprocessfn;
+        task[i].chunkfn=functional_sumintegrandchunkfn;
+        task[i].result=(void *) &res[i];
+        task[i].out=(void *) &sums[i];
+    }
+    
+    success=functional_parallelmap(ntask, task);
+    if (success) *sum+=functional_sumlist(chunks, nchunks);
+    
+functionalset_sweep_cleanup:
+    if (chunks) MORPHO_FREE(chunks);
+    functional_cleanuptasks(v, ntask, task);
+    varray_elementidclear(&imageids);
+    return success;
+}
+
+/** Evaluates the members of a FunctionalSet
+ * @param[in] v - virtual machine in use
+ * @param[in] self - the FunctionalSet
+ * @param[in] mesh - mesh to evaluate on
+ * @param[in] total - whether to compute the total
+ * @param[in] gradient - whether to compute the gradient
+ * @param[out] out - out[0] is set to the total and out[1] to the gradient as requested
+ * @returns true on success */
+static bool functionalset_evaluate(vm *v, objectinstance *self, objectmesh *mesh, bool total, bool gradient, value *out) {
+    value fnlist=MORPHO_NIL, sellist=MORPHO_NIL, prelist=MORPHO_NIL;
+    if (!objectinstance_getpropertyinterned(self, functionalset_functionalsproperty, &fnlist) ||
+        !objectinstance_getpropertyinterned(self, functionalset_selectionsproperty, &sellist) ||
+        !objectinstance_getpropertyinterned(self, functionalset_prefactorsproperty, &prelist) ||
+        !MORPHO_ISLIST(fnlist) || !MORPHO_ISLIST(sellist) || !MORPHO_ISLIST(prelist)) return false;
+    
+    int n=MORPHO_GETLIST(fnlist)->val.count;
+    value *fns=MORPHO_GETLIST(fnlist)->val.data, *sels=MORPHO_GETLIST(sellist)->val.data, *pres=MORPHO_GETLIST(prelist)->val.data;
+    
+    int ntask=morpho_threadnumber();
+    int nout=(ntask>0 ? ntask : 1);
+    bool success=false, numerical=false, symadd=false, symnone=false;
+    int nmembers=0, ngroups=0;
+    double sum=0.0;
+    
+    functionalset_member members[n+1];
+    functionalset_member *order[n+1]; // Members sorted into groups
+    functionalset_group groups[n+1];
+    functionalset_result res[nout];
+    objectmesh meshclones[nout];
+    for (int i=0; i<nout; i++) {
+        res[i].frc[0]=res[i].frc[1]=NULL;
+        varray_elementidinit(&res[i].touched);
+        varray_doubleinit(&res[i].saved);
+        meshclones[i].vert=NULL;
+    }
+    
+    /* Prepare each member */
+    for (int i=0; i<n; i++) {
+        functional_setpreparefn *prepare=functionalset_findprepare(fns[i]);
+        if (!prepare) { morpho_runtimeerror(v, FUNCTIONALSET_UNSPRTD); goto functionalset_evaluate_cleanup; }
+        
+        functionalset_member *m=&members[nmembers];
+        functional_clearmapinfo(&m->info);
+        objectselection *sel=(MORPHO_ISSELECTION(sels[i]) ? MORPHO_GETSELECTION(sels[i]) : NULL);
+        if (!(*prepare) (v, MORPHO_GETINSTANCE(fns[i]), mesh, sel, &m->info)) goto functionalset_evaluate_cleanup;
+        morpho_valuetofloat(pres[i], &m->prefactor);
+        nmembers++;
+        
+        if (!m->info.grad) numerical=true;
+        if (m->info.sym==SYMMETRY_ADD) symadd=true; else symnone=true;
+    }
+    
+    /* Group members that share a grade and selection */
+    for (int i=0; i<nmembers; i++) {
+        int j;
+        for (j=0; j<ngroups; j++) if (groups[j].g==members[i].info.g && groups[j].sel==members[i].info.sel) break;
+        if (j==ngroups) {
+            groups[j].g=members[i].info.g;
+            groups[j].sel=members[i].info.sel;
+            groups[j].nmembers=0;
+            ngroups++;
+        }
+        groups[j].nmembers++;
+    }
+    
+    functionalset_member **posn=order;
+    for (int j=0; j<ngroups; j++) {
+        groups[j].members=posn;
+        groups[j].total=total;
+        groups[j].gradient=gradient;
+        groups[j].split=(symadd && symnone && mesh_getconnectivityelement(mesh, 0, 0));
+        for (int i=0; i<nmembers; i++) {
+            if (groups[j].g==members[i].info.g && groups[j].sel==members[i].info.sel) *(posn++)=&members[i];
+        }
+    }
+    bool split=(ngroups>0 && groups[0].split);
+    
+    /* Create output matrices, shared by all groups */
+    if (gradient) for (int i=0; i<nout; i++) {
+        for (int k=0; k<(split ? 2 : 1); k++) {
+            res[i].frc[k]=object_newmatrix(mesh->vert->nrows, mesh->vert->ncols, true);
+            if (!res[i].frc[k]) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functionalset_evaluate_cleanup; }
+        }
+        
+        if (numerical && ntask>0) { // Each thread perturbs its own copy of the vertex matrix
+            meshclones[i]=*mesh;
+            meshclones[i].vert=object_clonematrix(mesh->vert);
+            if (!meshclones[i].vert) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); goto functionalset_evaluate_cleanup; }
+        }
+    }
+    
+    /* Sweep over each group */
+    for (int j=0; j<ngroups; j++) {
+        if (ntask>0) {
+            if (!functionalset_sweep(v, mesh, &groups[j], ntask, res, meshclones, &sum)) goto functionalset_evaluate_cleanup;
+        } else if (!functionalset_sweepX(v, mesh, &groups[j], res, &sum)) goto functionalset_evaluate_cleanup;
+    }
+    
+    if (total) out[0]=MORPHO_FLOAT(sum);
+    
+    if (gradient) {
+        objectmatrix *frc[nout];
+        for (int k=0; k<(split ? 2 : 1); k++) {
+            for (int i=0; i<nout; i++) frc[i]=res[i].frc[k];
+            if (nout>1) functional_reducematrices(nout, frc);
+        }
+        
+        /* Symmetry actions apply to members with SYMMETRY_ADD, which are all in frc[0] unless there are none */
+        if (symadd) functional_symmetrysumforces(mesh, res[0].frc[0]);
+        if (split) matrix_add(res[0].frc[0], res[0].frc[1], res[0].frc[0]);
+        
+        out[1]=MORPHO_OBJECT(res[0].frc[0]);
+        res[0].frc[0]=NULL;
+    }
+    
+    success=true;
+    
+functionalset_evaluate_cleanup:
+    for (int i=0; i<nmembers; i++) if (members[i].info.ref) MORPHO_FREE(members[i].info.ref);
+    for (int i=0; i<nout; i++) {
+        for (int k=0; k<2; k++) if (res[i].frc[k]) object_free((object *) res[i].frc[k]);
+        if (meshclones[i].vert) object_free((object *) meshclones[i].vert);
+        varray_elementidclear(&res[i].touched);
+        varray_doubleclear(&res[i].saved);
+    }
+    
+    return success;
+}
+
+/** Initialize a FunctionalSet */
+value FunctionalSet_init(vm *v, int nargs, value *args) {
+    objectinstance *self = MORPHO_GETINSTANCE(MORPHO_SELF(args));
+    value lists[3];
+    
+    for (int i=0; i<3; i++) {
+        objectlist *new = object_newlist(0, NULL);
+        if (!new) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); return MORPHO_NIL; }
+        lists[i]=MORPHO_OBJECT(new);
+    }
+    morpho_bindobjects(v, 3, lists);
+    
+    objectinstance_setproperty(self, functionalset_functionalsproperty, lists[0]);
+    objectinstance_setproperty(self, functionalset_selectionsproperty, lists[1]);
+    objectinstance_setproperty(self, functionalset_prefactorsproperty, lists[2]);
+    
+    return MORPHO_NIL;
+}
+
+/** Appends a functional, with an optional selection and prefactor */
+value FunctionalSet_append(vm *v, int nargs, value *args) {
+    objectinstance *self = MORPHO_GETINSTANCE(MORPHO_SELF(args));
+    value sel=MORPHO_NIL, prefactor=MORPHO_FLOAT(1.0);
+    value lists[3];
+    int nfixed;
+    
+    if (!builtin_options(v, nargs, args, &nfixed, 2, functionalset_selectionoption, &sel, functionalset_prefactoroption, &prefactor) ||
+        nfixed!=1 ||
+        !(MORPHO_ISNIL(sel) || MORPHO_ISSELECTION(sel)) ||
+        !(MORPHO_ISNUMBER(prefactor))) {
+        morpho_runtimeerror(v, FUNCTIONALSET_ARGS);
+        return MORPHO_NIL;
+    }
+    
+    if (!functionalset_findprepare(MORPHO_GETARG(args, 0))) {
+        morpho_runtimeerror(v, FUNCTIONALSET_UNSPRTD);
+        return MORPHO_NIL;
+    }
+    
+    if (objectinstance_getpropertyinterned(self, functionalset_functionalsproperty, &lists[0]) &&
+        objectinstance_getpropertyinterned(self, functionalset_selectionsproperty, &lists[1]) &&
+        objectinstance_getpropertyinterned(self, functionalset_prefactorsproperty, &lists[2]) &&
+        MORPHO_ISLIST(lists[0]) && MORPHO_ISLIST(lists[1]) && MORPHO_ISLIST(lists[2])) {
+        list_append(MORPHO_GETLIST(lists[0]), MORPHO_GETARG(args, 0));
+        list_append(MORPHO_GETLIST(lists[1]), sel);
+        list_append(MORPHO_GETLIST(lists[2]), prefactor);
+    }
+    
+    return MORPHO_NIL;
+}
+
+/** Tests whether a functional can be a member of a FunctionalSet */
+value FunctionalSet_supports(vm *v, int nargs, value *args) {
+    if (nargs!=1) {
+        morpho_runtimeerror(v, FUNCTIONALSET_ARGS);
+        return MORPHO_NIL;
+    }
+    return MORPHO_BOOL(functionalset_findprepare(MORPHO_GETARG(args, 0))!=NULL);
+}
+
+/** Number of functionals in the set */
+value FunctionalSet_count(vm *v, int nargs, value *args) {
+    value fnlist=MORPHO_NIL;
+    if (objectinstance_getpropertyinterned(MORPHO_GETINSTANCE(MORPHO_SELF(args)), functionalset_functionalsproperty, &fnlist) &&
+        MORPHO_ISLIST(fnlist)) return MORPHO_INTEGER(MORPHO_GETLIST(fnlist)->val.count);
+    return MORPHO_INTEGER(0);
+}
+
+/** Gets the mesh from the arguments */
+static objectmesh *functionalset_mesh(vm *v, int nargs, value *args) {
+    if (nargs==1 && MORPHO_ISMESH(MORPHO_GETARG(args, 0))) return MORPHO_GETMESH(MORPHO_GETARG(args, 0));
+    morpho_runtimeerror(v, FUNC_INTEGRAND_MESH);
+    return NULL;
+}
+
+/** Weighted sum of the totals */
+value FunctionalSet_total(vm *v, int nargs, value *args) {
+    objectmesh *mesh = functionalset_mesh(v, nargs, args);
+    value res[2], out=MORPHO_NIL;
+    
+    if (mesh && functionalset_evaluate(v, MORPHO_GETINSTANCE(MORPHO_SELF(args)), mesh, true, false, res)) out=res[0];
+    return out;
+}
+
+/** Weighted sum of the gradients */
+value FunctionalSet_gradient(vm *v, int nargs, value *args) {
+    objectmesh *mesh = functionalset_mesh(v, nargs, args);
+    value res[2], out=MORPHO_NIL;
+    
+    if (mesh && functionalset_evaluate(v, MORPHO_GETINSTANCE(MORPHO_SELF(args)), mesh, false, true, res)) {
+        out=res[1];
+        morpho_bindobjects(v, 1, &out);
+    }
+    return out;
+}
+
+/** Weighted sums of the totals and gradients, found together */
+value FunctionalSet_totalAndGradient(vm *v, int nargs, value *args) {
+    objectmesh *mesh = functionalset_mesh(v, nargs, args);
+    value res[2], out=MORPHO_NIL;
+    
+    if (mesh && functionalset_evaluate(v, MORPHO_GETINSTANCE(MORPHO_SELF(args)), mesh, true, true, res)) out=functional_totalandgradientlist(v, res);
+    return out;
+}
+
+MORPHO_BEGINCLASS(FunctionalSet)
+MORPHO_METHOD(MORPHO_INITIALIZER_METHOD, FunctionalSet_init, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(MORPHO_APPEND_METHOD, FunctionalSet_append, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONALSET_SUPPORTS_METHOD, FunctionalSet_supports, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(MORPHO_COUNT_METHOD, FunctionalSet_count, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTAL_METHOD, FunctionalSet_total, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_GRADIENT_METHOD, FunctionalSet_gradient, BUILTIN_FLAGSEMPTY),
+MORPHO_METHOD(FUNCTIONAL_TOTALANDGRADIENT_METHOD, FunctionalSet_totalAndGradient, BUILTIN_FLAGSEMPTY)
 MORPHO_ENDCLASS
 
 /* **********************************************************************
@@ -4920,10 +7510,18 @@ void functional_initialize(void) {
     nematic_pitchproperty=builtin_internsymbolascstring(NEMATIC_PITCH_PROPERTY);
     
     functional_methodproperty=builtin_internsymbolascstring(INTEGRAL_METHOD_PROPERTY);
+    integral_batchproperty=builtin_internsymbolascstring(INTEGRAL_BATCH_PROPERTY);
+    integral_kernelproperty=builtin_internsymbolascstring(INTEGRAL_KERNEL_PROPERTY);
 
     curvature_integrandonlyproperty=builtin_internsymbolascstring(CURVATURE_INTEGRANDONLY_PROPERTY);
     curvature_geodesicproperty=builtin_internsymbolascstring(CURVATURE_GEODESIC_PROPERTY);
 
+    functionalset_functionalsproperty=builtin_internsymbolascstring(FUNCTIONALSET_FUNCTIONALS_PROPERTY);
+    functionalset_selectionsproperty=builtin_internsymbolascstring(FUNCTIONALSET_SELECTIONS_PROPERTY);
+    functionalset_prefactorsproperty=builtin_internsymbolascstring(FUNCTIONALSET_PREFACTORS_PROPERTY);
+    functionalset_selectionoption=builtin_internsymbolascstring(FUNCTIONALSET_SELECTION_OPTION);
+    functionalset_prefactoroption=builtin_internsymbolascstring(FUNCTIONALSET_PREFACTOR_OPTION);
+
     objectstring objclassname = MORPHO_STATICSTRING(OBJECT_CLASSNAME);
     value objclass = builtin_findclass(MORPHO_OBJECT(&objclassname));
 
@@ -4947,6 +7545,29 @@ void functional_initialize(void) {
     builtin_addclass(VOLUMEINTEGRAL_CLASSNAME, MORPHO_GETCLASSDEFINITION(VolumeIntegral), objclass);
     builtin_addclass(NEMATIC_CLASSNAME, MORPHO_GETCLASSDEFINITION(Nematic), objclass);
     builtin_addclass(NEMATICELECTRIC_CLASSNAME, MORPHO_GETCLASSDEFINITION(NematicElectric), objclass);
+    builtin_addclass(NATIVEFUNCTIONAL_CLASSNAME, MORPHO_GETCLASSDEFINITION(NativeFunctional), objclass);
+    builtin_addclass(FUNCTIONALSET_CLASSNAME, MORPHO_GETCLASSDEFINITION(FunctionalSet), objclass);
+
+    varray_functionalsetentryinit(&functionalset_classes);
+    functionalset_register(LENGTH_CLASSNAME, Length_setprepare);
+    functionalset_register(AREA_CLASSNAME, Area_setprepare);
+    functionalset_register(AREAENCLOSED_CLASSNAME, AreaEnclosed_setprepare);
+    functionalset_register(VOLUMEENCLOSED_CLASSNAME, VolumeEnclosed_setprepare);
+    functionalset_register(VOLUME_CLASSNAME, Volume_setprepare);
+    functionalset_register(HYDROGEL_CLASSNAME, Hydrogel_setprepare);
+    functionalset_register(EQUIELEMENT_CLASSNAME, EquiElement_setprepare);
+    functionalset_register(LINECURVATURESQ_CLASSNAME, LineCurvatureSq_setprepare);
+    functionalset_register(LINETORSIONSQ_CLASSNAME, LineTorsionSq_setprepare);
+    functionalset_register(MEANCURVATURESQ_CLASSNAME, MeanCurvatureSq_setprepare);
+    functionalset_register(GAUSSCURVATURE_CLASSNAME, GaussCurvature_setprepare);
+    functionalset_register(GRADSQ_CLASSNAME, GradSq_setprepare);
+    functionalset_register(NORMSQ_CLASSNAME, NormSq_setprepare);
+    functionalset_register(LINEINTEGRAL_CLASSNAME, LineIntegral_setprepare);
+    functionalset_register(AREAINTEGRAL_CLASSNAME, AreaIntegral_setprepare);
+    functionalset_register(VOLUMEINTEGRAL_CLASSNAME, VolumeIntegral_setprepare);
+    functionalset_register(NEMATIC_CLASSNAME, Nematic_setprepare);
+    functionalset_register(NEMATICELECTRIC_CLASSNAME, NematicElectric_setprepare);
+    functionalset_register(NATIVEFUNCTIONAL_CLASSNAME, NativeFunctional_setprepare);
 
     builtin_addfunction(TANGENT_FUNCTION, integral_tangent, BUILTIN_FLAGSEMPTY);
     builtin_addfunction(NORMAL_FUNCTION, integral_normal, BUILTIN_FLAGSEMPTY);
@@ -4974,6 +7595,7 @@ void functional_initialize(void) {
     morpho_defineerror(NEMATICELECTRIC_ARGS, ERROR_HALT, NEMATICELECTRIC_ARGS_MSG);
 
     morpho_defineerror(FUNCTIONAL_ARGS, ERROR_HALT, FUNCTIONAL_ARGS_MSG);
+    morpho_defineerror(FUNCTIONAL_DUALVARS, ERROR_HALT, FUNCTIONAL_DUALVARS_MSG);
 
     morpho_defineerror(INTEGRAL_ARGS, ERROR_HALT, INTEGRAL_ARGS_MSG);
     morpho_defineerror(INTEGRAL_NFLDS, ERROR_HALT, INTEGRAL_NFLDS_MSG);
@@ -4982,8 +7604,14 @@ void functional_initialize(void) {
     morpho_defineerror(INTEGRAL_AMBGSFLD, ERROR_HALT, INTEGRAL_AMBGSFLD_MSG);
     morpho_defineerror(INTEGRAL_SPCLFN, ERROR_HALT, INTEGRAL_SPCLFN_MSG);
     morpho_defineerror(INTEGRAL_GRDEVL, ERROR_HALT, INTEGRAL_GRDEVL_MSG);
+    morpho_defineerror(INTEGRAL_BTCHRTN, ERROR_HALT, INTEGRAL_BTCHRTN_MSG);
+    morpho_defineerror(INTEGRAL_BTCHGRD, ERROR_HALT, INTEGRAL_BTCHGRD_MSG);
+    morpho_defineerror(NATIVEFUNCTIONAL_ARGS, ERROR_HALT, NATIVEFUNCTIONAL_ARGS_MSG);
+    morpho_defineerror(FUNCTIONALSET_ARGS, ERROR_HALT, FUNCTIONALSET_ARGS_MSG);
+    morpho_defineerror(FUNCTIONALSET_UNSPRTD, ERROR_HALT, FUNCTIONALSET_UNSPRTD_MSG);
     
     functional_poolinitialized = false;
+    MorphoMutex_init(&functional_statslock);
     
     objectintegralelementreftype=object_addtype(&objectintegralelementrefdefn);
     elementhandle=vm_addtlvar();
@@ -4996,6 +7624,12 @@ void functional_initialize(void) {
 
 void functional_finalize(void) {
     if (functional_poolinitialized) threadpool_clear(&functional_pool);
+    MorphoMutex_clear(&functional_statslock);
+    if (functional_stats) MORPHO_FREE(functional_stats);
+    functional_stats=NULL;
+    functional_nstats=0;
+    for (int i=0; i<FUNCTIONAL_NHESSIANPATTERNS; i++) functional_clearpattern(&functional_patterns[i]);
+    varray_functionalsetentryclear(&functionalset_classes);
 }
 
 #endif
@@ -15,6 +15,7 @@
 #include "mesh.h"
 #include "field.h"
 #include "selection.h"
+#include "dual.h"
 
 /* -------------------------------------------------------
  * Functionals
@@ -46,6 +47,8 @@
 #define CURVATURE_GEODESIC_PROPERTY           "geodesic"
 
 #define INTEGRAL_METHOD_PROPERTY              "method"
+#define INTEGRAL_BATCH_PROPERTY               "batch"
+#define INTEGRAL_KERNEL_PROPERTY              "kernel"
 
 /* Functional methods */
 #define FUNCTIONAL_INTEGRAND_METHOD    "integrand"
@@ -54,6 +57,7 @@
 #define FUNCTIONAL_FIELDGRADIENT_METHOD     "fieldgradient"
 #define FUNCTIONAL_HESSIAN_METHOD      "hessian"
 #define FUNCTIONAL_INTEGRANDFORELEMENT_METHOD      "integrandForElement"
+#define FUNCTIONAL_TOTALANDGRADIENT_METHOD         "totalAndGradient"
 
 /* Special functions that can be used in integrands */
 #define TANGENT_FUNCTION               "tangent"
@@ -82,6 +86,16 @@
 #define VOLUMEINTEGRAL_CLASSNAME       "VolumeIntegral"
 #define NEMATIC_CLASSNAME              "Nematic"
 #define NEMATICELECTRIC_CLASSNAME      "NematicElectric"
+#define NATIVEFUNCTIONAL_CLASSNAME     "NativeFunctional"
+#define FUNCTIONALSET_CLASSNAME        "FunctionalSet"
+
+/* FunctionalSet properties and options */
+#define FUNCTIONALSET_FUNCTIONALS_PROPERTY   "functionals"
+#define FUNCTIONALSET_SELECTIONS_PROPERTY    "selections"
+#define FUNCTIONALSET_PREFACTORS_PROPERTY    "prefactors"
+#define FUNCTIONALSET_SELECTION_OPTION       "selection"
+#define FUNCTIONALSET_PREFACTOR_OPTION       "prefactor"
+#define FUNCTIONALSET_SUPPORTS_METHOD        "supports"
 
 /* Errors */
 #define FUNC_INTEGRAND_MESH            "FnctlIntMsh"
@@ -117,6 +131,21 @@
 #define INTEGRAL_NFLDS                 "IntgrlNFlds"
 #define INTEGRAL_NFLDS_MSG             "Incorrect number of Fields provided for integrand function."
 
+#define INTEGRAL_BTCHRTN               "IntgrlBtchRtn"
+#define INTEGRAL_BTCHRTN_MSG           "A batched integrand must return a Matrix or List with one value per point."
+
+#define INTEGRAL_BTCHGRD               "IntgrlBtchGrd"
+#define INTEGRAL_BTCHGRD_MSG           "The gradient of a Field with a finite element discretization is not available in a batched integrand."
+
+#define NATIVEFUNCTIONAL_ARGS          "NtvFnctlArgs"
+#define NATIVEFUNCTIONAL_ARGS_MSG      "NativeFunctional requires a native object that provides an element integrand."
+
+#define FUNCTIONALSET_ARGS             "FnctlSetArgs"
+#define FUNCTIONALSET_ARGS_MSG         "FunctionalSet.append expects a functional, with optional selection and prefactor arguments."
+
+#define FUNCTIONALSET_UNSPRTD          "FnctlSetUnsprtd"
+#define FUNCTIONALSET_UNSPRTD_MSG      "This functional can't be evaluated as part of a FunctionalSet."
+
 #define VOLUMEENCLOSED_ZERO            "VolEnclZero"
 #define VOLUMEENCLOSED_ZERO_MSG        "VolumeEnclosed detected an element of zero size. Check that a mesh point is not coincident with the origin."
 
@@ -156,6 +185,9 @@
 #define FUNCTIONAL_ARGS                "FnctlArgs"
 #define FUNCTIONAL_ARGS_MSG            "Invalid args passed to method."
 
+#define FUNCTIONAL_DUALVARS            "FnctlDualVars"
+#define FUNCTIONAL_DUALVARS_MSG        "An element depends on too many vertices to be differentiated exactly."
+
 /* -------------------------------------------------------
  * Functional types
  * ------------------------------------------------------- */
@@ -179,6 +211,10 @@ typedef bool (functional_gradient) (vm *v, objectmesh *mesh, elementid id, int n
 typedef bool (functional_fieldgradient) (vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectfield *frc);
 
 struct s_functional_mapinfo; // Resolve circular typedef dependency
+struct s_functional_hessianaccumulator;
+
+/** Hessian function: adds the second derivatives of an element's integrand to an accumulator */
+typedef bool (functional_hessian) (vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, struct s_functional_hessianaccumulator *hess);
 
 /** Clone reference function */
 typedef void * (functional_cloneref) (void *ref, objectfield *field, objectfield *sub);
@@ -189,6 +225,18 @@ typedef void (functional_freeref) (void *ref);
 /** Dependencies function */
 typedef bool (functional_dependencies) (struct s_functional_mapinfo *info, elementid id, varray_elementid *out);
 
+/** Supplies vertex positions as dual numbers; each vertex requested becomes a set of variables */
+typedef struct {
+    objectmesh *mesh; // Mesh in use
+    bool hessian; // Whether to track second derivatives
+    bool overflow; // Set if too many vertices were requested
+    int nvert; // Vertices whose coordinates are variables, in the order they were requested
+    elementid vert[DUAL_MAXVARIABLES];
+} functional_dualvertices;
+
+/** Dual integrand function: evaluates an integrand on dual numbers, getting vertex positions from functional_dualposition */
+typedef bool (functional_dualintegrand) (vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualvertices *x, dual *out);
+
 typedef struct s_functional_mapinfo {
     objectmesh *mesh; // Mesh to use
     objectselection *sel; // Selection, if any
@@ -198,6 +246,7 @@ typedef struct s_functional_mapinfo {
     functional_integrand *integrand; // Integrand function
     functional_gradient *grad; // Gradient
     functional_fieldgradient *fieldgrad; // Field gradient
+    functional_hessian *hess; // Hessian
     functional_dependencies *dependencies; // Dependencies
     functional_cloneref *cloneref; // Clone a reference with a given field substituted
     functional_freeref *freeref; // Free a reference
@@ -205,6 +254,40 @@ typedef struct s_functional_mapinfo {
     void *ref; // Reference to pass on
 } functional_mapinfo;
 
+/** Prepares a functional to be evaluated as a member of a FunctionalSet, filling out info with a reference allocated with MORPHO_MALLOC */
+typedef bool (functional_setpreparefn) (vm *v, objectinstance *self, objectmesh *mesh, objectselection *sel, functional_mapinfo *info);
+
+/** Records the work done by one task in a multithreaded map */
+typedef struct {
+    int nelements; // Number of elements processed
+    int nchunks; // Number of chunks of elements claimed
+    double time; // Time spent in seconds
+} functional_taskstatistics;
+
+/** Target number of chunks per task when the grain size is chosen automatically */
+#define FUNCTIONAL_CHUNKSPERTASK 8
+
+/** Maximum number of colours used to divide elements into sets that touch distinct vertices */
+#define FUNCTIONAL_MAXCOLOURS 64
+
+/** Number of hessian sparsity patterns retained for reuse */
+#define FUNCTIONAL_NHESSIANPATTERNS 8
+
+/** An entry contributed to a sparse matrix */
+typedef struct {
+    int row;
+    int col;
+    double val;
+} functionaltriplet;
+
+DECLARE_VARRAY(functionaltriplet, functionaltriplet);
+
+void functional_setgrainsize(int grain);
+int functional_getgrainsize(void);
+void functional_setreplicationlimit(size_t limit);
+size_t functional_getreplicationlimit(void);
+int functional_getmapstatistics(int nmax, functional_taskstatistics *stats);
+
 bool functional_validateargs(vm *v, int nargs, value *args, functional_mapinfo *info);
 void functional_symmetryimagelist(objectmesh *mesh, grade g, bool sort, varray_elementid *ids);
 bool functional_symmetrysumforces(objectmesh *mesh, objectmatrix *frc);
@@ -218,6 +301,18 @@ bool functional_mapgradient(vm *v, functional_mapinfo *info, value *out);
 bool functional_mapfieldgradient(vm *v, functional_mapinfo *info, value *out);
 bool functional_mapnumericalgradient(vm *v, functional_mapinfo *info, value *out);
 bool functional_mapnumericalfieldgradient(vm *v, functional_mapinfo *info, value *out);
+bool functional_maphessian(vm *v, functional_mapinfo *info, value *out);
+bool functional_mapnumericalhessian(vm *v, functional_mapinfo *info, value *out);
+bool functional_maptotalandgradient(vm *v, functional_mapinfo *info, value *out);
+value functional_totalandgradientlist(vm *v, value *res);
+
+void functionalset_register(char *classname, functional_setpreparefn *prepare);
+
+void functional_hessianaddblock(struct s_functional_hessianaccumulator *hess, int dim, elementid i, elementid j, double *block);
+
+bool functional_dualposition(functional_dualvertices *x, elementid id, dual *out);
+bool functional_dualgradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualintegrand *integrand, objectmatrix *frc);
+bool functional_dualhessian(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, functional_dualintegrand *integrand, struct s_functional_hessianaccumulator *hess);
 
 void functional_vecadd(unsigned int n, double *a, double *b, double *out);
 void functional_vecaddscale(unsigned int n, double *a, double lambda, double *b, double *out);
@@ -231,6 +326,7 @@ void functional_veccross2d(double *a, double *b, double *out);
 bool functional_elementsize(vm *v, objectmesh *mesh, grade g, elementid id, int nv, int *vid, double *out);
 bool functional_elementgradient_scale(vm *v, objectmesh *mesh, grade g, elementid id, int nv, int *vid, objectmatrix *frc, double scale);
 bool functional_elementgradient(vm *v, objectmesh *mesh, grade g, elementid id, int nv, int *vid, objectmatrix *frc);
+bool functional_preparegeometry(objectmesh *mesh, grade g, bool jacobian);
 
 /* -------------------------------------------------------
  * Functional method macros
@@ -312,6 +408,20 @@ value name##_total(vm *v, int nargs, value *args) { \
     return out; \
 }
 
+/** Total an integrand and find its gradient in a single pass; gradientfn may be NULL to differentiate the integrand numerically */
+#define FUNCTIONAL_TOTALANDGRADIENT(name, grade, totalfn, gradientfn, symbhvr) \
+value name##_totalAndGradient(vm *v, int nargs, value *args) { \
+    functional_mapinfo info; \
+    value res[2], out=MORPHO_NIL; \
+    \
+    if (functional_validateargs(v, nargs, args, &info)) { \
+        info.g = grade; info.integrand = totalfn; info.grad = gradientfn; info.sym = symbhvr; \
+        if (functional_maptotalandgradient(v, &info, res)) out=functional_totalandgradientlist(v, res); \
+    } \
+    \
+    return out; \
+}
+
 /** Hessian */
 #define FUNCTIONAL_HESSIAN(name, grade, totalfn) \
 value name##_hessian(vm *v, int nargs, value *args) { \
@@ -327,6 +437,33 @@ value name##_hessian(vm *v, int nargs, value *args) { \
     return out; \
 }
 
+/** Hessian computed from an analytic hessian function */
+#define FUNCTIONAL_ANALYTICHESSIAN(name, grade, hessianfn) \
+value name##_hessian(vm *v, int nargs, value *args) { \
+    functional_mapinfo info; \
+    value out=MORPHO_NIL; \
+    \
+    if (functional_validateargs(v, nargs, args, &info)) { \
+        info.g = grade; info.hess = hessianfn; \
+        functional_maphessian(v, &info, &out); \
+    } \
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out); \
+    \
+    return out; \
+}
+
+/** Gradient function that differentiates a dual integrand */
+#define FUNCTIONAL_DUALGRADIENTFN(gradientfn, dualfn) \
+bool gradientfn(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) { \
+    return functional_dualgradient(v, mesh, id, nv, vid, ref, dualfn, frc); \
+}
+
+/** Hessian function that differentiates a dual integrand twice */
+#define FUNCTIONAL_DUALHESSIANFN(hessianfn, dualfn) \
+bool hessianfn(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, struct s_functional_hessianaccumulator *hess) { \
+    return functional_dualhessian(v, mesh, id, nv, vid, ref, dualfn, hess); \
+}
+
 /* Alternative way of defining methods that use a reference */
 #define FUNCTIONAL_METHOD(class, name, grade, reftype, prepare, integrandfn, integrandmapfn, deps, err, symbhvr) value class##_##name(vm *v, int nargs, value *args) { \
     functional_mapinfo info; \
@@ -347,6 +484,108 @@ value name##_hessian(vm *v, int nargs, value *args) { \
     return out; \
 }
 
+/** Evaluate an analytic gradient for a functional with a reference structure; the dependencies list the vertices that each element's gradient contributes to */
+#define FUNCTIONAL_METHODGRADIENT(class, grade, reftype, prepare, gradientfn, deps, err, symbhvr) value class##_gradient(vm *v, int nargs, value *args) { \
+    functional_mapinfo info; \
+    reftype ref; \
+    value out=MORPHO_NIL; \
+    \
+    if (functional_validateargs(v, nargs, args, &info)) { \
+        if (prepare(MORPHO_GETINSTANCE(MORPHO_SELF(args)), info.mesh, grade, info.sel, &ref)) { \
+            info.grad = gradientfn; \
+            info.dependencies = deps; \
+            info.sym = symbhvr; \
+            info.g = grade; \
+            info.ref = &ref; \
+            functional_mapgradient(v, &info, &out); \
+        } else morpho_runtimeerror(v, err); \
+    } \
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out); \
+    return out; \
+}
+
+/** Total an integrand and find its gradient in a single pass for a functional with a reference structure; gradientfn may be NULL to differentiate the integrand numerically */
+#define FUNCTIONAL_METHODTOTALANDGRADIENT(class, grade, reftype, prepare, integrandfn, gradientfn, deps, err, symbhvr) value class##_totalAndGradient(vm *v, int nargs, value *args) { \
+    functional_mapinfo info; \
+    reftype ref; \
+    value res[2], out=MORPHO_NIL; \
+    \
+    if (functional_validateargs(v, nargs, args, &info)) { \
+        if (prepare(MORPHO_GETINSTANCE(MORPHO_SELF(args)), info.mesh, grade, info.sel, &ref)) { \
+            info.integrand = integrandfn; \
+            info.grad = gradientfn; \
+            info.dependencies = deps; \
+            info.sym = symbhvr; \
+            info.g = grade; \
+            info.ref = &ref; \
+            if (functional_maptotalandgradient(v, &info, res)) out=functional_totalandgradientlist(v, res); \
+        } else morpho_runtimeerror(v, err); \
+    } \
+    return out; \
+}
+
+/** Prepare a functional without a reference structure for evaluation in a FunctionalSet */
+#define FUNCTIONAL_SETPREPARE(name, grade, totalfn, gradientfn, symbhvr) \
+static bool name##_setprepare(vm *v, objectinstance *self, objectmesh *mesh, objectselection *sel, functional_mapinfo *info) { \
+    info->mesh = mesh; info->sel = sel; info->g = grade; \
+    info->integrand = totalfn; info->grad = gradientfn; info->sym = symbhvr; \
+    return true; \
+}
+
+/** Prepare a functional with a reference structure for evaluation in a FunctionalSet; the reference is copied to the heap */
+#define FUNCTIONAL_METHODSETPREPARE(class, grade, reftype, prepare, integrandfn, gradientfn, deps, err, symbhvr) \
+static bool class##_setprepare(vm *v, objectinstance *self, objectmesh *mesh, objectselection *sel, functional_mapinfo *info) { \
+    reftype ref; \
+    memset(&ref, 0, sizeof(reftype)); \
+    if (!prepare(self, mesh, grade, sel, &ref)) { morpho_runtimeerror(v, err); return false; } \
+    reftype *new = MORPHO_MALLOC(sizeof(reftype)); \
+    if (!new) { morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED); return false; } \
+    *new = ref; \
+    info->mesh = mesh; info->sel = sel; info->g = grade; \
+    info->integrand = integrandfn; info->grad = gradientfn; info->dependencies = deps; info->sym = symbhvr; \
+    info->ref = new; \
+    return true; \
+}
+
+/** Evaluate an analytic hessian for a functional with a reference structure; the dependencies list the vertices that each element's hessian involves */
+#define FUNCTIONAL_METHODHESSIAN(class, grade, reftype, prepare, hessianfn, deps, err) value class##_hessian(vm *v, int nargs, value *args) { \
+    functional_mapinfo info; \
+    reftype ref; \
+    value out=MORPHO_NIL; \
+    \
+    if (functional_validateargs(v, nargs, args, &info)) { \
+        if (prepare(MORPHO_GETINSTANCE(MORPHO_SELF(args)), info.mesh, grade, info.sel, &ref)) { \
+            info.hess = hessianfn; \
+            info.dependencies = deps; \
+            info.g = grade; \
+            info.ref = &ref; \
+            functional_maphessian(v, &info, &out); \
+        } else morpho_runtimeerror(v, err); \
+    } \
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out); \
+    return out; \
+}
+
+/** Evaluate a hessian for a functional with a reference structure by differencing its analytic gradient */
+#define FUNCTIONAL_METHODGRADIENTHESSIAN(class, grade, reftype, prepare, integrandfn, gradientfn, deps, err) value class##_hessian(vm *v, int nargs, value *args) { \
+    functional_mapinfo info; \
+    reftype ref; \
+    value out=MORPHO_NIL; \
+    \
+    if (functional_validateargs(v, nargs, args, &info)) { \
+        if (prepare(MORPHO_GETINSTANCE(MORPHO_SELF(args)), info.mesh, grade, info.sel, &ref)) { \
+            info.integrand = integrandfn; \
+            info.grad = gradientfn; \
+            info.dependencies = deps; \
+            info.g = grade; \
+            info.ref = &ref; \
+            functional_mapnumericalhessian(v, &info, &out); \
+        } else morpho_runtimeerror(v, err); \
+    } \
+    if (!MORPHO_ISNIL(out)) morpho_bindobjects(v, 1, &out); \
+    return out; \
+}
+
 /* -------------------------------------------------------
  * Initialization
  * ------------------------------------------------------- */
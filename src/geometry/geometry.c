@@ -5,10 +5,13 @@
  */
 
 #include "geometry.h"
+#include "native.h"
 
 void geometry_initialize(void) {
     mesh_initialize();
     integrate_initialize();
+    kernel_initialize();
+    native_initialize();
     field_initialize();
     functional_initialize();
     fespace_initialize();
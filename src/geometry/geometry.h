@@ -13,6 +13,7 @@
 #include "functional.h"
 #include "fespace.h"
 #include "integrate.h"
+#include "kernel.h"
 
 void geometry_initialize(void);
 
@@ -2167,6 +2167,7 @@ DEFINE_VARRAY(quadratureworkitem, quadratureworkitem)
 /** Initialize an integrator structure */
 void integrator_init(integrator *integrate) {
     integrate->integrand=NULL;
+    integrate->batch=NULL;
     
     integrate->dim=0;
     integrate->nbary=0;
@@ -2181,6 +2182,7 @@ void integrator_init(integrator *integrate) {
     varray_quadratureworkiteminit(&integrate->worklist);
     varray_doubleinit(&integrate->vertexstack);
     varray_intinit(&integrate->elementstack);
+    varray_valueinit(&integrate->qbatch);
     
     integrate->ztol = INTEGRATE_ZEROCHECK;
     integrate->tol = INTEGRATE_ACCURACYGOAL;
@@ -2198,6 +2200,7 @@ void integrator_clear(integrator *integrate) {
     varray_quadratureworkitemclear(&integrate->worklist);
     varray_intclear(&integrate->elementstack);
     varray_doubleclear(&integrate->vertexstack);
+    varray_valueclear(&integrate->qbatch);
 }
 
 /** Adds a vertex to the integrators vertex stack, returning the id */
@@ -2237,6 +2240,24 @@ void integrator_initializequantities(integrator *integrate, int nq, quantity *qu
 /** Frees up any objects used in the quantities list */
 void integrator_finalizequantities(integrator *integrate) {
     for (int i=0; i<integrate->nquantity; i++) morpho_freeobject(integrate->qval[i]);
+    for (int i=0; i<integrate->qbatch.count; i++) morpho_freeobject(integrate->qbatch.data[i]);
+    integrate->qbatch.count=0;
+}
+
+/** Ensures there is storage for interpolated quantities at n points in the batch list */
+bool integrator_reservebatchquantities(integrator *integrate, int n) {
+    int nq=integrate->nquantity;
+    
+    for (int i=integrate->qbatch.count; i<n*nq; i++) {
+        value q = integrate->qval[i % nq], new=q; // Copy the paradigmatic value
+        if (MORPHO_ISMATRIX(q)) {
+            objectmatrix *m = object_clonematrix(MORPHO_GETMATRIX(q));
+            if (!m) return false;
+            new=MORPHO_OBJECT(m);
+        }
+        if (!varray_valueadd(&integrate->qbatch, &new, 1)) return false;
+    }
+    return true;
 }
 
 /** Retrieves the vertex pointers given an elementid.
@@ -2402,8 +2423,8 @@ bool integrator_sumquantityweighted(int n, double *wts, value *q, value *out) {
     return success;
 }
 
-/** Interpolates quantities */
-void integrator_interpolatequantities(integrator *integrate, double *bary) {
+/** Interpolates quantities at a point, storing the results in qval */
+void integrator_interpolatequantitiesto(integrator *integrate, double *bary, value *qval) {
     for (int i=0; i<integrate->nquantity; i++) {
         int nnodes = integrate->quantity[i].nnodes;
         double wts[nnodes];
@@ -2413,18 +2434,42 @@ void integrator_interpolatequantities(integrator *integrate, double *bary) {
             for (int k=0; k<nnodes; k++) wts[k]=bary[k];
         }
         
-        integrator_sumquantityweighted(nnodes, wts, integrate->quantity[i].vals, &integrate->qval[i]);
+        integrator_sumquantityweighted(nnodes, wts, integrate->quantity[i].vals, &qval[i]);
     }
 }
 
+/** Interpolates quantities */
+void integrator_interpolatequantities(integrator *integrate, double *bary) {
+    integrator_interpolatequantitiesto(integrate, bary, integrate->qval);
+}
+
 /* --------------------------------
  * Function to perform quadrature
  * -------------------------------- */
 
+/** Evaluates a batched integrand at specified places with a single call */
+bool integrator_evalbatch(integrator *integrate, quadraturerule *rule, int imin, int imax, double *rmat, double *vmat, double *f) {
+    int n=imax-imin, nbary=integrate->nbary, dim=integrate->dim, nq=integrate->nquantity;
+    if (n<=0) return true;
+    
+    double node[n*nbary], x[n*dim];
+    if (nq && !integrator_reservebatchquantities(integrate, n)) return false;
+    
+    for (int i=0; i<n; i++) {
+        integrator_transformtorefelement(integrate, rmat, &rule->nodes[nbary*(imin+i)], &node[i*nbary]);
+        integrator_interpolatecoordinates(integrate, &node[i*nbary], vmat, &x[i*dim]);
+        if (nq) integrator_interpolatequantitiesto(integrate, &node[i*nbary], &integrate->qbatch.data[i*nq]);
+    }
+    
+    return (*integrate->batch) (dim, n, node, x, nq, integrate->qbatch.data, integrate->ref, &f[imin]);
+}
+
 /** Evaluates the integrand at specified places */
 bool integrator_evalfn(integrator *integrate, quadraturerule *rule, int imin, int imax, double *rmat, double *vmat, double *x, double *f) {
     double node[integrate->nbary];
     
+    if (integrate->batch) return integrator_evalbatch(integrate, rule, imin, imax, rmat, vmat, f);
+    
     for (int i=imin; i<imax; i++) {
         integrator_transformtorefelement(integrate, rmat, &rule->nodes[integrate->nbary*i], node);
         integrator_interpolatecoordinates(integrate, node, vmat, x);
@@ -2826,6 +2871,24 @@ integrator_integrate_error:
  * Public interface resembling old version
  * --------------------------------------- */
 
+/** Configures an integrator, integrates over an element and clears the integrator */
+static bool integrate_withintegrator(integrator *integrate, integrandfunction *integrand, objectdictionary *method, error *err, unsigned int dim, unsigned int grade, double **x, unsigned int nquantity, quantity *quantity, void *ref, double *out, double *errest) {
+    bool success=false;
+    
+    if (method) {
+        if (!integrator_configurewithdictionary(integrate, err, grade, method)) goto integrate_cleanup;
+    } else if (!integrator_configure(integrate, err, true, grade, -1, NULL)) goto integrate_cleanup;
+    success=integrator_integrate(integrate, integrand, dim, x, nquantity, quantity, ref);
+    
+    *out = integrate->val;
+    if (errest) *errest = integrate->errest;
+    
+integrate_cleanup:
+    integrator_clear(integrate);
+    
+    return success;
+}
+
 /** Integrate over an element - public interface for one off integrals.
  * @param[in] integrand   - integrand
  * @param[in] method         - Dictionary with method selection (optional)
@@ -2840,21 +2903,21 @@ integrator_integrate_error:
  * @param[out] errest        - an estimate of the error
  * @returns true on success. */
 bool integrate(integrandfunction *integrand, objectdictionary *method, error *err, unsigned int dim, unsigned int grade, double **x, unsigned int nquantity, quantity *quantity, void *ref, double *out, double *errest) {
-    bool success=false;
     integrator integrate;
     integrator_init(&integrate);
     
-    if (method) {
-        if (!integrator_configurewithdictionary(&integrate, err, grade, method)) return false;
-    } else if (!integrator_configure(&integrate, err, true, grade, -1, NULL)) return false;
-    success=integrator_integrate(&integrate, integrand, dim, x, nquantity, quantity, ref);
-    
-    *out = integrate.val;
-    if (errest) *errest = integrate.errest;
-    
-    integrator_clear(&integrate);
+    return integrate_withintegrator(&integrate, integrand, method, err, dim, grade, x, nquantity, quantity, ref, out, errest);
+}
+
+/** Integrate over an element, evaluating the integrand at all quadrature points of a rule in a single call.
+ *  Arguments are as for integrate, except that the integrand follows the batched calling convention.
+ * @returns true on success. */
+bool integrate_batch(integrandbatchfunction *integrand, objectdictionary *method, error *err, unsigned int dim, unsigned int grade, double **x, unsigned int nquantity, quantity *quantity, void *ref, double *out, double *errest) {
+    integrator integrate;
+    integrator_init(&integrate);
+    integrate.batch=integrand;
     
-    return success;
+    return integrate_withintegrator(&integrate, NULL, method, err, dim, grade, x, nquantity, quantity, ref, out, errest);
 }
 
 /* -------------------------------------
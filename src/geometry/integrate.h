@@ -43,6 +43,19 @@
  */
 typedef bool (integrandfunction) (unsigned int dim, double *lambda, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout);
 
+/** Specification for an integrand that is evaluated at a batch of points in a single call.
+ * @param[in] dim            - The dimension of the space
+ * @param[in] n                 - Number of points
+ * @param[in] lambda      - Barycentric coordinates for each point, stored consecutively
+ * @param[in] x                 - Coordinates of each point, stored consecutively (i.e. a dim x n column major matrix)
+ * @param[in] nquantity - Number of quantities
+ * @param[in] quantity - Interpolated quantities; quantity k at point p is quantity[p*nquantity+k]
+ * @param[in] ref             - A reference passed by the caller
+ * @param[out] fout          - Values of the integrand at each of the n points
+ * @returns true on success.
+ */
+typedef bool (integrandbatchfunction) (unsigned int dim, unsigned int n, double *lambda, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout);
+
 /* ----------------------------------
  * Quadrature rules define wts/nodes
  * ---------------------------------- */
@@ -119,6 +132,7 @@ typedef struct {
 
 typedef struct {
     integrandfunction *integrand; /** Function to integrate */
+    integrandbatchfunction *batch; /** Batched function to integrate; used in preference to integrand if set */
     void *ref; /** Reference to pass to integrand function */
     
     int dim; /** Dimension of points in embedded space */
@@ -129,6 +143,7 @@ typedef struct {
     int nquantity; /** Number of quantities to interpolate */
     quantity *quantity; /** Quantity list */
     value *qval; /** Interpolated quantity values */
+    varray_value qbatch; /** Interpolated quantity values for a batch of points */
     
     quadraturerule *rule;  /** Quadrature rule to use */
     quadraturerule *errrule; /** Additional rule for error estimation */
@@ -175,6 +190,8 @@ bool integrate_integrate(integrandfunction *integrand, unsigned int dim, unsigne
 
 bool integrate(integrandfunction *integrand, objectdictionary *method, error *err, unsigned int dim, unsigned int grade, double **x, unsigned int nquantity, quantity *quantity, void *ref, double *out, double *errest);
 
+bool integrate_batch(integrandbatchfunction *integrand, objectdictionary *method, error *err, unsigned int dim, unsigned int grade, double **x, unsigned int nquantity, quantity *quantity, void *ref, double *out, double *errest);
+
 void integrate_initialize(void);
 
 #endif
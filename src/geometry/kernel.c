@@ -0,0 +1,588 @@
+/** @file kernel.c
+ *  @author T J Atherton
+ *
+ *  @brief Compiles integrand functions to expression kernels that can be evaluated without the VM
+ *
+ *  @details Many integrands are pure arithmetic on the position and interpolated fields. The bytecode of such a
+ *  function is translated into a small expression graph that can be evaluated natively at a whole batch of
+ *  quadrature points at once. Functions that use anything the translator doesn't understand are left to the VM.
+*/
+
+#include "build.h"
+#ifdef MORPHO_INCLUDE_GEOMETRY
+
+#include <math.h>
+#include "compile.h"
+#include "vm.h"
+#include "morpho.h"
+#include "classes.h"
+#include "kernel.h"
+#include "matrix.h"
+#include "field.h"
+#include "functional.h"
+
+/* **********************************************************************
+ * Kernel objects
+ * ********************************************************************** */
+
+objecttype objectkerneltype;
+
+void objectkernel_printfn(object *obj, void *v) {
+    morpho_printf(v, "<Kernel>");
+}
+
+void objectkernel_markfn(object *obj, void *v) {
+    objectkernel *k = (objectkernel *) obj;
+    morpho_markvalue(v, k->fn);
+}
+
+size_t objectkernel_sizefn(object *obj) {
+    return sizeof(objectkernel);
+}
+
+objecttypedefn objectkerneldefn = {
+    .printfn=objectkernel_printfn,
+    .markfn=objectkernel_markfn,
+    .freefn=NULL,
+    .sizefn=objectkernel_sizefn,
+    .hashfn=NULL,
+    .cmpfn=NULL
+};
+
+/* **********************************************************************
+ * Functions understood by the kernel compiler
+ * ********************************************************************** */
+
+typedef double (*kernelmathfn) (double);
+
+/** Elementary functions, identified by the name of the builtin function */
+static struct {
+    char *name;
+    kernelmathfn fn;
+} kernel_mathfunctions[] = {
+    { "sqrt", sqrt }, { "exp", exp }, { "log", log }, { "log10", log10 },
+    { "sin", sin }, { "cos", cos }, { "tan", tan }, { "asin", asin }, { "acos", acos },
+    { "sinh", sinh }, { "cosh", cosh }, { "tanh", tanh },
+    { "abs", fabs }, { "fabs", fabs },
+    { NULL, NULL }
+};
+
+/** Special functions provided by integral functionals */
+static struct {
+    char *name;
+    kernelop op;
+    int nargs;
+} kernel_specialfunctions[] = {
+    { TANGENT_FUNCTION, KERNEL_TANGENT, 0 },
+    { NORMAL_FUNCTION, KERNEL_NORMAL, 0 },
+    { GRAD_FUNCTION, KERNEL_GRAD, 1 },
+    { NULL, 0, 0 }
+};
+
+/** Identifies a builtin function; returns the index of a math function, or of a special function offset by KERNEL_SPECIAL */
+#define KERNEL_SPECIAL 1000
+
+static int kernel_identifyfunction(value fn) {
+    if (!MORPHO_ISBUILTINFUNCTION(fn)) return -1;
+    objectbuiltinfunction *f = MORPHO_GETBUILTINFUNCTION(fn);
+    if (!MORPHO_ISSTRING(f->name) ||
+        !MORPHO_ISSAME(builtin_findfunction(f->name), fn)) return -1; // Must be the global builtin of that name
+
+    char *name = MORPHO_GETCSTRING(f->name);
+    for (int i=0; kernel_mathfunctions[i].name; i++) {
+        if (strcmp(name, kernel_mathfunctions[i].name)==0) return i;
+    }
+    for (int i=0; kernel_specialfunctions[i].name; i++) {
+        if (strcmp(name, kernel_specialfunctions[i].name)==0) return KERNEL_SPECIAL+i;
+    }
+    return -1;
+}
+
+/* **********************************************************************
+ * Compiler
+ * ********************************************************************** */
+
+/** Contents of a register during translation */
+typedef struct {
+    enum { KERNEL_REGUNKNOWN, KERNEL_REGNODE, KERNEL_REGSELECTOR, KERNEL_REGFUNCTION } type;
+    int ix; /** Node, constant or function index */
+} kernelregister;
+
+/** Adds a node to a kernel, returning its index or -1 if the kernel is full */
+static int kernel_addnode(objectkernel *k, kernelop op, int a, int b, int ix) {
+    if (k->nnodes>=KERNEL_MAXNODES) return -1;
+    kernelnode *n = &k->node[k->nnodes];
+    n->op=op;
+    n->a=a;
+    n->b=b;
+    n->ix=ix;
+    n->live=false;
+    n->vector=false;
+    n->shape=1;
+    n->offset=0;
+    n->val=0.0;
+    return k->nnodes++;
+}
+
+/** Gets the node held by a register, or -1 */
+static inline int kernel_node(kernelregister *r) {
+    return (r->type==KERNEL_REGNODE ? r->ix : -1);
+}
+
+/** Gets the integer value of a constant node */
+static bool kernel_constantindex(objectkernel *k, int node, int *out) {
+    if (node<0 || k->node[node].op!=KERNEL_CONSTANT) return false;
+    double val=k->node[node].val;
+    if (val<0 || val!=floor(val)) return false;
+    *out=(int) val;
+    return true;
+}
+
+/** Sets a register to a new node */
+static bool kernel_setnode(kernelregister *r, int node) {
+    if (node<0) return false;
+    r->type=KERNEL_REGNODE;
+    r->ix=node;
+    return true;
+}
+
+/** Adds a node for a binary arithmetic operation */
+static bool kernel_binary(objectkernel *k, kernelregister *reg, kernelop op, int a, int b, int c) {
+    int left=kernel_node(&reg[b]), right=kernel_node(&reg[c]);
+    if (left<0 || right<0) return false;
+    return kernel_setnode(&reg[a], kernel_addnode(k, op, left, right, 0));
+}
+
+/** Loads a constant into a register */
+static bool kernel_loadconstant(objectkernel *k, objectfunction *func, kernelregister *r, indx ix) {
+    if (ix>=func->konst.count) return false;
+    value c = func->konst.data[ix];
+
+    if (MORPHO_ISNUMBER(c)) {
+        int node=kernel_addnode(k, KERNEL_CONSTANT, -1, -1, 0);
+        if (node<0) return false;
+        morpho_valuetofloat(c, &k->node[node].val);
+        return kernel_setnode(r, node);
+    } else if (MORPHO_ISSTRING(c)) {
+        r->type=KERNEL_REGSELECTOR;
+        r->ix=(int) ix;
+    } else {
+        int fn=kernel_identifyfunction(c);
+        r->type=(fn>=0 ? KERNEL_REGFUNCTION : KERNEL_REGUNKNOWN);
+        r->ix=fn;
+    }
+    return true;
+}
+
+/** Translates a method invocation */
+static bool kernel_invoke(objectkernel *k, objectfunction *func, kernelregister *reg, int a, int nargs, int nopt) {
+    if (reg[a].type!=KERNEL_REGSELECTOR || nopt>0) return false;
+    char *selector = MORPHO_GETCSTRING(func->konst.data[reg[a].ix]);
+    int obj=kernel_node(&reg[a+1]), node=-1;
+    if (obj<0) return false;
+
+    if (strcmp(selector, MATRIX_INNER_METHOD)==0 && nargs==1) {
+        int arg=kernel_node(&reg[a+2]);
+        if (arg>=0) node=kernel_addnode(k, KERNEL_INNER, obj, arg, 0);
+    } else if (strcmp(selector, MATRIX_NORM_METHOD)==0 && nargs==0) {
+        node=kernel_addnode(k, KERNEL_NORM, obj, -1, 0);
+    }
+
+    return kernel_setnode(&reg[a+1], node);
+}
+
+/** Translates a function call */
+static bool kernel_call(objectkernel *k, kernelregister *reg, int a, int nargs, int nopt) {
+    if (reg[a].type!=KERNEL_REGFUNCTION || nopt>0) return false;
+    int fn=reg[a].ix, node=-1;
+
+    if (fn<KERNEL_SPECIAL) {
+        int arg=kernel_node(&reg[a+1]);
+        if (nargs==1 && arg>=0) node=kernel_addnode(k, KERNEL_MATH, arg, -1, fn);
+    } else {
+        kernelop op=kernel_specialfunctions[fn-KERNEL_SPECIAL].op;
+        if (nargs!=kernel_specialfunctions[fn-KERNEL_SPECIAL].nargs) return false;
+
+        if (op==KERNEL_GRAD) { // The argument must identify a field
+            int arg=kernel_node(&reg[a+1]);
+            if (arg<0) return false;
+            kernelop aop=k->node[arg].op;
+            if (aop!=KERNEL_QUANTITY && aop!=KERNEL_GLOBAL && aop!=KERNEL_UPVALUE) return false;
+            node=kernel_addnode(k, op, arg, -1, 0);
+        } else node=kernel_addnode(k, op, -1, -1, 0);
+    }
+
+    return kernel_setnode(&reg[a], node);
+}
+
+/** Translates an indexing operation; only constant indices that select a component of a column vector are supported */
+static bool kernel_index(objectkernel *k, kernelregister *reg, int a, int b, int c) {
+    int obj=kernel_node(&reg[a]), i, j;
+    if (obj<0 || c<b || c-b>1) return false;
+    if (!kernel_constantindex(k, kernel_node(&reg[b]), &i)) return false;
+    if (c>b && (!kernel_constantindex(k, kernel_node(&reg[c]), &j) || j!=0)) return false;
+
+    return kernel_setnode(&reg[b], kernel_addnode(k, KERNEL_INDEX, obj, -1, i));
+}
+
+/** Translates the bytecode of a function into kernel nodes by following the flow of values through registers */
+static bool kernel_translate(objectkernel *k, program *p, objectfunction *func, objectclosure *closure) {
+    kernelregister reg[MORPHO_MAXREGISTERS+1];
+    for (int i=0; i<=MORPHO_MAXREGISTERS; i++) reg[i].type=KERNEL_REGUNKNOWN;
+
+    if (!kernel_setnode(&reg[1], kernel_addnode(k, KERNEL_POSITION, -1, -1, 0))) return false;
+    for (int i=0; i<k->nfields; i++) {
+        if (!kernel_setnode(&reg[i+2], kernel_addnode(k, KERNEL_QUANTITY, -1, -1, i))) return false;
+    }
+
+    for (instructionindx i=func->entry; i<p->code.count; i++) {
+        instruction bc = p->code.data[i];
+        int a=DECODE_A(bc), b=DECODE_B(bc), c=DECODE_C(bc);
+        bool success=false;
+
+        switch (DECODE_OP(bc)) {
+            case OP_NOP: success=true; break;
+            case OP_MOV: reg[a]=reg[b]; success=true; break;
+            case OP_LCT: success=kernel_loadconstant(k, func, &reg[a], DECODE_Bx(bc)); break;
+            case OP_LGL: success=kernel_setnode(&reg[a], kernel_addnode(k, KERNEL_GLOBAL, -1, -1, DECODE_Bx(bc))); break;
+            case OP_LUP:
+                if (closure && b<closure->nupvalues) success=kernel_setnode(&reg[a], kernel_addnode(k, KERNEL_UPVALUE, -1, -1, b));
+                break;
+            case OP_ADD: case OP_ADDF: case OP_ADDI: success=kernel_binary(k, reg, KERNEL_ADD, a, b, c); break;
+            case OP_SUB: case OP_SUBF: case OP_SUBI: success=kernel_binary(k, reg, KERNEL_SUB, a, b, c); break;
+            case OP_MUL: case OP_MULF: case OP_MULI: success=kernel_binary(k, reg, KERNEL_MUL, a, b, c); break;
+            case OP_DIV: case OP_DIVF: success=kernel_binary(k, reg, KERNEL_DIV, a, b, c); break;
+            case OP_POW: success=kernel_binary(k, reg, KERNEL_POW, a, b, c); break;
+            case OP_LIX: success=kernel_index(k, reg, a, b, c); break;
+            case OP_INVOKE: success=kernel_invoke(k, func, reg, a, b, c); break;
+            case OP_CALL: success=kernel_call(k, reg, a, b, c); break;
+            case OP_RETURN:
+                k->result=(a>0 ? kernel_node(&reg[b]) : -1);
+                return (k->result>=0);
+            default: break; // Anything else, including branches, is left to the VM
+        }
+
+        if (!success) return false;
+    }
+
+    return false;
+}
+
+/** Marks the nodes that contribute to the result */
+static void kernel_findlive(objectkernel *k) {
+    k->node[k->result].live=true;
+    for (int i=k->result; i>=0; i--) {
+        kernelnode *n = &k->node[i];
+        if (!n->live || n->op==KERNEL_GRAD) continue; // The operand of grad only identifies the field
+        if (n->a>=0) k->node[n->a].live=true;
+        if (n->b>=0) k->node[n->b].live=true;
+    }
+}
+
+/** Attempts to compile a function into a kernel
+ * @param[in] v - the virtual machine that holds the program and globals
+ * @param[in] fn - the function or closure to compile
+ * @param[in] nfields - number of fields passed to the function after the position
+ * @returns a new kernel object, or NULL if the function can't be compiled */
+objectkernel *kernel_compile(vm *v, value fn, int nfields) {
+    objectfunction *func=NULL;
+    objectclosure *closure=NULL;
+
+    if (MORPHO_ISCLOSURE(fn)) {
+        closure=MORPHO_GETCLOSURE(fn);
+        func=closure->func;
+    } else if (MORPHO_ISFUNCTION(fn)) {
+        func=MORPHO_GETFUNCTION(fn);
+    } else return NULL;
+
+    program *p = v->current;
+    if (!p || func->nargs!=nfields+1 || func->nopt>0 ||
+        function_hasvargs(func) || function_hastypedparameters(func) ||
+        func->entry<0 || func->entry>=p->code.count) return NULL;
+
+    objectkernel *new = (objectkernel *) object_new(sizeof(objectkernel), OBJECT_KERNEL);
+    if (!new) return NULL;
+
+    new->fn=fn;
+    new->v=v;
+    new->nfields=nfields;
+    new->nnodes=0;
+    new->result=-1;
+    new->size=0;
+    new->bound=false;
+
+    if (!kernel_translate(new, p, func, closure)) {
+        object_free((object *) new);
+        return NULL;
+    }
+    kernel_findlive(new);
+
+    return new;
+}
+
+/* **********************************************************************
+ * Binding
+ * ********************************************************************** */
+
+/** Reads the current value of a global or upvalue */
+static bool kernel_getvariable(objectkernel *k, kernelnode *n, value *out) {
+    if (n->op==KERNEL_GLOBAL) {
+        if (n->ix>=k->v->globals.count) return false;
+        *out=k->v->globals.data[n->ix];
+        return true;
+    } else if (n->op==KERNEL_UPVALUE && MORPHO_ISCLOSURE(k->fn)) {
+        objectclosure *closure=MORPHO_GETCLOSURE(k->fn);
+        if (!closure->upvalues[n->ix]) return false;
+        *out=*closure->upvalues[n->ix]->location;
+        return true;
+    }
+    return false;
+}
+
+/** Sets the type of a node */
+static inline void kernel_settype(kernelnode *n, bool vector, int shape) {
+    n->vector=vector;
+    n->shape=shape;
+}
+
+/** Binds a kernel for use: reads the current values of globals and upvalues, determines the type of each node given
+ *  the dimension of the space and the fields, and lays out the work buffer.
+ * @param[in] k - the kernel
+ * @param[in] dim - dimension of the space
+ * @param[in] nfields - number of fields
+ * @param[in] fields - the fields supplied to the integral
+ * @returns true if the kernel can be used; false if the integrand must be called through the VM */
+bool kernel_bind(objectkernel *k, int dim, int nfields, value *fields) {
+    int size=0;
+    k->bound=false;
+    if (nfields!=k->nfields || dim>KERNEL_MAXSHAPE) return false;
+
+    for (int i=0; i<k->nnodes; i++) {
+        kernelnode *n = &k->node[i];
+        if (!n->live) continue;
+        kernelnode *a = (n->a>=0 ? &k->node[n->a] : NULL);
+        kernelnode *b = (n->b>=0 ? &k->node[n->b] : NULL);
+
+        switch (n->op) {
+            case KERNEL_CONSTANT:
+                kernel_settype(n, false, 1);
+                break;
+            case KERNEL_GLOBAL:
+            case KERNEL_UPVALUE: {
+                value val;
+                if (!kernel_getvariable(k, n, &val) ||
+                    !MORPHO_ISNUMBER(val)) return false;
+                morpho_valuetofloat(val, &n->val);
+                kernel_settype(n, false, 1);
+            }
+                break;
+            case KERNEL_POSITION:
+            case KERNEL_TANGENT:
+            case KERNEL_NORMAL:
+                kernel_settype(n, true, dim);
+                break;
+            case KERNEL_QUANTITY: {
+                if (!MORPHO_ISFIELD(fields[n->ix])) return false;
+                value prototype = MORPHO_GETFIELD(fields[n->ix])->prototype;
+                if (MORPHO_ISFLOAT(prototype)) {
+                    kernel_settype(n, false, 1);
+                } else if (MORPHO_ISMATRIX(prototype) &&
+                           MORPHO_GETMATRIX(prototype)->ncols==1) {
+                    kernel_settype(n, true, MORPHO_GETMATRIX(prototype)->nrows);
+                } else return false;
+            }
+                break;
+            case KERNEL_ADD:
+            case KERNEL_SUB:
+                if (a->vector!=b->vector || a->shape!=b->shape) return false;
+                kernel_settype(n, a->vector, a->shape);
+                break;
+            case KERNEL_MUL:
+                if (a->vector && b->vector) return false;
+                kernel_settype(n, a->vector || b->vector, (a->vector ? a->shape : b->shape));
+                break;
+            case KERNEL_DIV:
+                if (b->vector) return false;
+                kernel_settype(n, a->vector, a->shape);
+                break;
+            case KERNEL_POW:
+                if (a->vector || b->vector) return false;
+                kernel_settype(n, false, 1);
+                break;
+            case KERNEL_INDEX:
+                if (!a->vector || n->ix>=a->shape) return false;
+                kernel_settype(n, false, 1);
+                break;
+            case KERNEL_INNER:
+                if (!a->vector || !b->vector || a->shape!=b->shape) return false;
+                kernel_settype(n, false, 1);
+                break;
+            case KERNEL_NORM:
+                if (!a->vector) return false;
+                kernel_settype(n, false, 1);
+                break;
+            case KERNEL_MATH:
+                if (a->vector) return false;
+                kernel_settype(n, false, 1);
+                break;
+            case KERNEL_GRAD: { // Identify the field and check it is a scalar
+                int fld=-1;
+                if (a->op==KERNEL_QUANTITY) {
+                    fld=a->ix;
+                } else {
+                    value val;
+                    if (!kernel_getvariable(k, a, &val)) return false;
+                    for (int j=0; j<nfields; j++) if (MORPHO_ISSAME(fields[j], val)) fld=j;
+                }
+                if (fld<0 || !MORPHO_ISFIELD(fields[fld]) ||
+                    !MORPHO_ISFLOAT(MORPHO_GETFIELD(fields[fld])->prototype)) return false;
+                n->ix=fld;
+                kernel_settype(n, true, dim);
+            }
+                break;
+        }
+
+        if (n->shape>KERNEL_MAXSHAPE) return false;
+        n->offset=size;
+        size+=n->shape;
+    }
+
+    if (k->node[k->result].vector) return false;
+
+    k->size=size;
+    k->bound=true;
+    return true;
+}
+
+/* **********************************************************************
+ * Evaluation
+ * ********************************************************************** */
+
+/** Copies interpolated quantity ix at each point into the work buffer */
+static bool kernel_loadquantity(unsigned int n, unsigned int nquantity, value *quantity, int ix, int shape, double *out) {
+    for (unsigned int p=0; p<n; p++) {
+        value q = quantity[p*nquantity+ix];
+        if (MORPHO_ISFLOAT(q) && shape==1) {
+            out[p]=MORPHO_GETFLOATVALUE(q);
+        } else if (MORPHO_ISMATRIX(q) && matrix_countdof(MORPHO_GETMATRIX(q))==shape) {
+            double *el = MORPHO_GETMATRIX(q)->elements;
+            for (int c=0; c<shape; c++) out[p*shape+c]=el[c];
+        } else return false;
+    }
+    return true;
+}
+
+/** Evaluates the nodes of a kernel in order, each at all n points */
+static bool kernel_evaluatenodes(objectkernel *k, unsigned int dim, unsigned int n, double *x, unsigned int nquantity, value *quantity, kernelspecialfn *special, void *ref, double *buf) {
+    for (int i=0; i<k->nnodes; i++) {
+        kernelnode *nd = &k->node[i];
+        if (!nd->live) continue;
+        int s=nd->shape, sa=0, sb=0, ns=n*s;
+        double *out=buf+nd->offset*n, *a=NULL, *b=NULL;
+        if (nd->a>=0) { a=buf+k->node[nd->a].offset*n; sa=k->node[nd->a].shape; }
+        if (nd->b>=0) { b=buf+k->node[nd->b].offset*n; sb=k->node[nd->b].shape; }
+
+        switch (nd->op) {
+            case KERNEL_CONSTANT:
+            case KERNEL_GLOBAL:
+            case KERNEL_UPVALUE:
+                for (int p=0; p<n; p++) out[p]=nd->val;
+                break;
+            case KERNEL_POSITION:
+                for (int j=0; j<ns; j++) out[j]=x[j];
+                break;
+            case KERNEL_QUANTITY:
+                if (!kernel_loadquantity(n, nquantity, quantity, nd->ix, s, out)) return false;
+                break;
+            case KERNEL_ADD:
+                for (int j=0; j<ns; j++) out[j]=a[j]+b[j];
+                break;
+            case KERNEL_SUB:
+                for (int j=0; j<ns; j++) out[j]=a[j]-b[j];
+                break;
+            case KERNEL_MUL:
+                if (sa==sb) for (int j=0; j<ns; j++) out[j]=a[j]*b[j];
+                else if (sa==1) for (int p=0; p<n; p++) for (int c=0; c<s; c++) out[p*s+c]=a[p]*b[p*s+c];
+                else for (int p=0; p<n; p++) for (int c=0; c<s; c++) out[p*s+c]=a[p*s+c]*b[p];
+                break;
+            case KERNEL_DIV:
+                for (int p=0; p<n; p++) for (int c=0; c<s; c++) out[p*s+c]=a[p*s+c]/b[p];
+                break;
+            case KERNEL_POW:
+                for (int p=0; p<n; p++) out[p]=pow(a[p], b[p]);
+                break;
+            case KERNEL_INDEX:
+                for (int p=0; p<n; p++) out[p]=a[p*sa+nd->ix];
+                break;
+            case KERNEL_INNER:
+                for (int p=0; p<n; p++) {
+                    double sum=0.0;
+                    for (int c=0; c<sa; c++) sum+=a[p*sa+c]*b[p*sa+c];
+                    out[p]=sum;
+                }
+                break;
+            case KERNEL_NORM:
+                for (int p=0; p<n; p++) {
+                    double sum=0.0;
+                    for (int c=0; c<sa; c++) sum+=a[p*sa+c]*a[p*sa+c];
+                    out[p]=sqrt(sum);
+                }
+                break;
+            case KERNEL_MATH: {
+                kernelmathfn fn = kernel_mathfunctions[nd->ix].fn;
+                for (int p=0; p<n; p++) out[p]=(*fn) (a[p]);
+            }
+                break;
+            case KERNEL_TANGENT:
+            case KERNEL_NORMAL: // Constant over the element
+                if (!(*special) (ref, nd->op, -1, 0, out)) return false;
+                for (int p=1; p<n; p++) for (int c=0; c<s; c++) out[p*s+c]=out[c];
+                break;
+            case KERNEL_GRAD:
+                for (int p=0; p<n; p++) if (!(*special) (ref, nd->op, nd->ix, p, out+p*s)) return false;
+                break;
+        }
+    }
+
+    return true;
+}
+
+/** Evaluates a bound kernel at a batch of points
+ * @param[in] k - the kernel
+ * @param[in] dim - dimension of the space
+ * @param[in] n - number of points
+ * @param[in] x - positions of the points, stored consecutively
+ * @param[in] nquantity - number of quantities
+ * @param[in] quantity - interpolated quantities; quantity k at point p is quantity[p*nquantity+k]
+ * @param[in] special - function to evaluate special functions
+ * @param[in] ref - reference passed to special
+ * @param[out] fout - value of the kernel at each point
+ * @returns true on success */
+bool kernel_evaluate(objectkernel *k, unsigned int dim, unsigned int n, double *x, unsigned int nquantity, value *quantity, kernelspecialfn *special, void *ref, double *fout) {
+    if (!k->bound) return false;
+
+    size_t size = k->size*n;
+    double stackbuf[size<=KERNEL_STACKSIZE ? size : 1];
+    double *buf = (size<=KERNEL_STACKSIZE ? stackbuf : MORPHO_MALLOC(sizeof(double)*size));
+    if (!buf) return false;
+
+    bool success=kernel_evaluatenodes(k, dim, n, x, nquantity, quantity, special, ref, buf);
+    if (success) {
+        double *result=buf+k->node[k->result].offset*n;
+        for (unsigned int p=0; p<n; p++) fout[p]=result[p];
+    }
+
+    if (buf!=stackbuf) MORPHO_FREE(buf);
+
+    return success;
+}
+
+/* **********************************************************************
+ * Initialization
+ * ********************************************************************** */
+
+void kernel_initialize(void) {
+    objectkerneltype=object_addtype(&objectkerneldefn);
+}
+
+#endif
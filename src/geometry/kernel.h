@@ -0,0 +1,107 @@
+/** @file kernel.h
+ *  @author T J Atherton
+ *
+ *  @brief Compiles integrand functions to expression kernels that can be evaluated without the VM
+ */
+
+#ifndef kernel_h
+#define kernel_h
+
+#include "build.h"
+#ifdef MORPHO_INCLUDE_GEOMETRY
+
+#include "morpho.h"
+#include "classes.h"
+
+/* -------------------------------------------------------
+ * Kernel settings
+ * ------------------------------------------------------- */
+
+/** Maximum number of nodes in a kernel */
+#define KERNEL_MAXNODES 64
+
+/** Maximum number of components of a vector in a kernel */
+#define KERNEL_MAXSHAPE 16
+
+/** Maximum size of the work buffer, in doubles, that is allocated on the stack */
+#define KERNEL_STACKSIZE 4096
+
+/* -------------------------------------------------------
+ * Kernel expressions
+ * ------------------------------------------------------- */
+
+/** Operations represented by a kernel node */
+typedef enum {
+    KERNEL_CONSTANT, /** A numerical constant */
+    KERNEL_GLOBAL,   /** A global variable holding a number; ix is the global */
+    KERNEL_UPVALUE,  /** An upvalue holding a number; ix is the upvalue */
+    KERNEL_POSITION, /** The position of the point */
+    KERNEL_QUANTITY, /** An interpolated field; ix is the field */
+    KERNEL_ADD,
+    KERNEL_SUB,
+    KERNEL_MUL,
+    KERNEL_DIV,
+    KERNEL_POW,
+    KERNEL_INDEX,    /** Component ix of a vector */
+    KERNEL_INNER,    /** Inner product of two vectors */
+    KERNEL_NORM,     /** Norm of a vector */
+    KERNEL_MATH,     /** Elementary function of a scalar; ix identifies the function */
+    KERNEL_TANGENT,  /** Unit tangent to the element */
+    KERNEL_NORMAL,   /** Unit normal to the element */
+    KERNEL_GRAD      /** Gradient of a scalar field; a is the node that identifies the field */
+} kernelop;
+
+/** A node in a kernel; operands always precede the nodes that use them */
+typedef struct {
+    kernelop op;
+    int a, b;     /** Operand nodes */
+    int ix;       /** Constant, global, upvalue, field, component or function index */
+    bool live;    /** Whether the node contributes to the result */
+    bool vector;  /** Whether the node is a vector (filled out by kernel_bind) */
+    int shape;    /** Number of components (filled out by kernel_bind) */
+    int offset;   /** Offset of the node's values in the work buffer (filled out by kernel_bind) */
+    double val;   /** Value of a constant, global or upvalue */
+} kernelnode;
+
+/* -------------------------------------------------------
+ * Kernel objects
+ * ------------------------------------------------------- */
+
+extern objecttype objectkerneltype;
+#define OBJECT_KERNEL objectkerneltype
+
+/** A kernel compiled from an integrand function */
+typedef struct {
+    object obj;
+    value fn;        /** The function or closure compiled */
+    vm *v;           /** Virtual machine that holds the globals referred to */
+    int nfields;     /** Number of fields the function accepts */
+    int nnodes;      /** Number of nodes */
+    int result;      /** Node holding the result */
+    int size;        /** Size of the work buffer per point, filled out by kernel_bind */
+    bool bound;      /** Whether the kernel has been successfully bound */
+    kernelnode node[KERNEL_MAXNODES];
+} objectkernel;
+
+/** Tests whether an object is a kernel */
+#define MORPHO_ISKERNEL(val) object_istype(val, OBJECT_KERNEL)
+
+/** Gets the object as a kernel */
+#define MORPHO_GETKERNEL(val)   ((objectkernel *) MORPHO_GETOBJECT(val))
+
+/* -------------------------------------------------------
+ * Kernel interface
+ * ------------------------------------------------------- */
+
+/** Evaluates special functions (tangent, normal and grad) for point p; field is the index of the field for KERNEL_GRAD */
+typedef bool (kernelspecialfn) (void *ref, kernelop op, int field, int p, double *out);
+
+objectkernel *kernel_compile(vm *v, value fn, int nfields);
+bool kernel_bind(objectkernel *k, int dim, int nfields, value *fields);
+bool kernel_evaluate(objectkernel *k, unsigned int dim, unsigned int n, double *x, unsigned int nquantity, value *quantity, kernelspecialfn *special, void *ref, double *fout);
+
+void kernel_initialize(void);
+
+#endif
+
+#endif /* kernel_h */
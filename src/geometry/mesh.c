@@ -52,6 +52,7 @@ void objectmesh_freefn(object *obj) {
         }
     }
     if (m->conn) object_free((object *) m->conn);
+    mesh_cleargeometry(m);
 }
 
 size_t objectmesh_sizefn(object *obj) {
@@ -81,6 +82,7 @@ objectmesh *object_newmesh(unsigned int dim, unsigned int nv, double *v) {
         new->conn=NULL;
         new->vert=object_newmatrix(dim, nv, false);
         new->link=NULL;
+        for (int i=0; i<MESH_GEOMETRYGRADES; i++) new->geometry[i]=NULL;
         if (new->vert) {
             mesh_link(new, (object *) new->vert);
             if (dim>0){
@@ -228,6 +230,7 @@ objectsparse *mesh_newconnectivityelement(objectmesh *mesh, unsigned int row, un
 bool mesh_setconnectivityelement(objectmesh *mesh, unsigned int row, unsigned int col, objectsparse *el) {
     if (row==col) return false;
     unsigned int indx[2]={row,col};
+    if (row==0) mesh_cleargeometry(mesh); // The definition of the elements has changed
     if (mesh_checkconnectivity(mesh)) {
         value old = MORPHO_NIL;
         if ((array_getelement(mesh->conn, 2, indx, &old)==ARRAY_OK) &&
@@ -672,6 +675,82 @@ void mesh_resetconnectivity(objectmesh *m) {
     }
 }
 
+/* **********************************************************************
+ * Geometry cache
+ * ********************************************************************** */
+
+/** Frees a geometry cache entry */
+static void mesh_freegeometry(meshgeometry *geo) {
+    if (geo->size) MORPHO_FREE(geo->size);
+    if (geo->normal) MORPHO_FREE(geo->normal);
+    if (geo->invj) MORPHO_FREE(geo->invj);
+    MORPHO_FREE(geo);
+}
+
+/** Gets cached geometric quantities for the elements of grade g
+ * @returns the cache entry, or NULL if there is none or the vertices have moved since it was computed */
+meshgeometry *mesh_getgeometry(objectmesh *mesh, grade g) {
+    if (g<1 || g>=MESH_GEOMETRYGRADES) return NULL;
+    meshgeometry *geo = mesh->geometry[g];
+    if (geo && mesh->vert && geo->vert==mesh->vert && geo->version==mesh->vert->version) return geo;
+    return NULL;
+}
+
+/** Gets a cache entry for the elements of grade g ready to be filled in, allocating storage as necessary.
+ *  The entry is invalid until mesh_validategeometry is called.
+ * @param[in] mesh - the mesh
+ * @param[in] g - grade of element
+ * @param[in] jacobian - whether to allocate storage for inverse jacobians
+ * @returns the cache entry, or NULL on failure */
+meshgeometry *mesh_newgeometry(objectmesh *mesh, grade g, bool jacobian) {
+    if (g<1 || g>=MESH_GEOMETRYGRADES || !mesh->vert) return NULL;
+    objectsparse *conn = mesh_getconnectivityelement(mesh, 0, g);
+    if (!conn) return NULL;
+    int nel = mesh_nelements(conn);
+    
+    meshgeometry *geo = mesh->geometry[g];
+    if (geo && geo->nel!=nel) {
+        mesh_freegeometry(geo);
+        geo=mesh->geometry[g]=NULL;
+    }
+    
+    if (!geo) {
+        geo=MORPHO_MALLOC(sizeof(meshgeometry));
+        if (!geo) return NULL;
+        geo->nel=nel;
+        geo->size=MORPHO_MALLOC(sizeof(double)*nel);
+        geo->normal=NULL;
+        geo->invj=NULL;
+        if (g==MESH_GRADE_AREA && mesh->dim==3) geo->normal=MORPHO_MALLOC(sizeof(double)*nel*mesh->dim);
+        
+        if (!geo->size || (g==MESH_GRADE_AREA && mesh->dim==3 && !geo->normal)) {
+            mesh_freegeometry(geo);
+            return NULL;
+        }
+        mesh->geometry[g]=geo;
+    }
+    
+    if (jacobian && !geo->invj) geo->invj=MORPHO_MALLOC(sizeof(double)*nel*mesh->dim*g);
+    if (jacobian && !geo->invj) return NULL;
+    
+    geo->vert=NULL;
+    return geo;
+}
+
+/** Marks a cache entry as valid for the current vertex positions */
+void mesh_validategeometry(objectmesh *mesh, meshgeometry *geo) {
+    geo->vert=mesh->vert;
+    geo->version=mesh->vert->version;
+}
+
+/** Discards all cached geometric quantities */
+void mesh_cleargeometry(objectmesh *mesh) {
+    for (int i=0; i<MESH_GEOMETRYGRADES; i++) {
+        if (mesh->geometry[i]) mesh_freegeometry(mesh->geometry[i]);
+        mesh->geometry[i]=NULL;
+    }
+}
+
 /* **********************************************************************
  * Clone
  * ********************************************************************** */
@@ -1108,6 +1187,7 @@ value Mesh_setvertexmatrix(vm *v, int nargs, value *args) {
         } else {
             if (m->dim==0) m->dim=mat->nrows;
             m->vert=mat;
+            mesh_cleargeometry(m); // The previous vertex matrix may be freed and its address reused
         }
     }
 
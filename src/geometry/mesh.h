@@ -22,12 +22,26 @@
 extern objecttype objectmeshtype;
 #define OBJECT_MESH objectmeshtype
 
+/** Number of grades for which geometric quantities are cached */
+#define MESH_GEOMETRYGRADES 4
+
+/** Geometric quantities for every element of one grade; these remain valid while the vertex matrix and its version are unchanged */
+typedef struct {
+    objectmatrix *vert;    // Vertex matrix the quantities were computed from
+    unsigned int version;  // Version of the vertex matrix when they were computed
+    int nel;               // Number of elements
+    double *size;          // Size of each element
+    double *normal;        // Unit normal of each element (area elements in 3D only), or NULL
+    double *invj;          // Inverse jacobian of each element (dim x grade entries), or NULL if not computed
+} meshgeometry;
+
 typedef struct {
     object obj;
     unsigned int dim;
     objectmatrix *vert;
     objectarray *conn;
     object *link;
+    meshgeometry *geometry[MESH_GEOMETRYGRADES]; // Cached geometric quantities for each grade
 } objectmesh;
 
 /** Tests whether an object is a mesh */
@@ -151,6 +165,11 @@ bool mesh_matchelements(objectsparse *vmatrix, grade g, int nids, int *ids, int
 
 bool mesh_getconnectivity(objectsparse *conn, elementid id, int *nentries, int **entries);
 void mesh_freezeconnectivity(objectmesh *mesh);
+
+meshgeometry *mesh_getgeometry(objectmesh *mesh, grade g);
+meshgeometry *mesh_newgeometry(objectmesh *mesh, grade g, bool jacobian);
+void mesh_validategeometry(objectmesh *mesh, meshgeometry *geo);
+void mesh_cleargeometry(objectmesh *mesh);
 void mesh_resetconnectivity(objectmesh *m);
 
 bool mesh_getvertexcoordinates(objectmesh *mesh, elementid id, double *val);
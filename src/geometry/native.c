@@ -0,0 +1,217 @@
+/** @file native.c
+ *  @author T J Atherton
+ *
+ *  @brief Interface for extensions to provide native integrands and element functions to functionals
+ *
+ *  @details An extension describes its functions with a nativedefn and exposes them to morpho programs by
+ *  returning a native object from a builtin function, e.g.
+ *
+ *      static nativedefn gaussian = { .version=NATIVE_ABIVERSION, .name="Gaussian", .integrand=gaussian_integrand };
+ *
+ *      value Gaussian(vm *v, int nargs, value *args) {
+ *          return native_new(v, &gaussian, NULL);
+ *      }
+ *
+ *  The resulting object can be passed to LineIntegral, AreaIntegral or VolumeIntegral in place of a function,
+ *  or to NativeFunctional, and is then called directly without going through the VM. The NativeExample
+ *  builtin, which is only built with MORPHO_NATIVEEXAMPLES, provides a few such objects for the test suite.
+*/
+
+#include "build.h"
+#ifdef MORPHO_INCLUDE_GEOMETRY
+
+#include <string.h>
+#include <math.h>
+
+#include "morpho.h"
+#include "classes.h"
+#include "native.h"
+
+/* **********************************************************************
+ * Native objects
+ * ********************************************************************** */
+
+objecttype objectnativetype;
+
+void objectnative_printfn(object *obj, void *v) {
+    objectnative *n = (objectnative *) obj;
+    morpho_printf(v, "<Native %s>", (n->defn->name ? n->defn->name : ""));
+}
+
+void objectnative_freefn(object *obj) {
+    objectnative *n = (objectnative *) obj;
+    if (n->defn->freeref && n->ref) (n->defn->freeref) (n->ref);
+}
+
+size_t objectnative_sizefn(object *obj) {
+    return sizeof(objectnative);
+}
+
+objecttypedefn objectnativedefn = {
+    .printfn=objectnative_printfn,
+    .markfn=NULL,
+    .freefn=objectnative_freefn,
+    .sizefn=objectnative_sizefn,
+    .hashfn=NULL,
+    .cmpfn=NULL
+};
+
+/* **********************************************************************
+ * Interface
+ * ********************************************************************** */
+
+/** Creates a native object from a definition, binding it to the vm
+ * @param[in] v - the virtual machine in use
+ * @param[in] defn - the definition; must remain valid for the lifetime of the object
+ * @param[in] ref - reference passed to the functions in defn, freed with defn->freeref if provided
+ * @returns the new object, or nil if an error was raised */
+value native_new(vm *v, nativedefn *defn, void *ref) {
+    if (defn->version!=NATIVE_ABIVERSION) {
+        morpho_runtimeerror(v, NATIVE_VRSN, (defn->name ? defn->name : ""), defn->version, NATIVE_ABIVERSION);
+        if (defn->freeref && ref) (defn->freeref) (ref);
+        return MORPHO_NIL;
+    }
+
+    objectnative *new = (objectnative *) object_new(sizeof(objectnative), OBJECT_NATIVE);
+    if (!new) {
+        morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+        if (defn->freeref && ref) (defn->freeref) (ref);
+        return MORPHO_NIL;
+    }
+
+    new->defn=defn;
+    new->ref=ref;
+
+    value out = MORPHO_OBJECT(new);
+    morpho_bindobjects(v, 1, &out);
+    return out;
+}
+
+/* **********************************************************************
+ * Examples
+ * ********************************************************************** */
+
+#ifdef MORPHO_NATIVEEXAMPLES
+
+/** Reference shared by the example definitions, which multiply their result by a scale */
+typedef struct {
+    double scale;
+} nativeexampleref;
+
+/** Integrand scale*exp(-|x|^2) at a single point */
+static bool nativeexample_gaussian(unsigned int dim, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    double r2=0.0;
+    for (unsigned int i=0; i<dim; i++) r2+=x[i]*x[i];
+    *fout=((nativeexampleref *) ref)->scale*exp(-r2);
+    return true;
+}
+
+/** Integrand scale*q*exp(-|x|^2), where q is a scalar field, at a batch of points */
+static bool nativeexample_weightedgaussian(unsigned int dim, unsigned int n, double *t, double *x, unsigned int nquantity, value *quantity, void *ref, double *fout) {
+    for (unsigned int p=0; p<n; p++) {
+        double q;
+        if (!morpho_valuetofloat(quantity[p*nquantity], &q) ||
+            !nativeexample_gaussian(dim, t, x+p*dim, 0, NULL, ref, fout+p)) return false;
+        fout[p]*=q;
+    }
+    return true;
+}
+
+/** Element integrand scale*length on a line element */
+static bool nativeexample_tension(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    double *x0, *x1, l2=0.0;
+    if (nv!=2 || !matrix_getcolumn(mesh->vert, vid[0], &x0) || !matrix_getcolumn(mesh->vert, vid[1], &x1)) return false;
+
+    for (int i=0; i<mesh->dim; i++) l2+=(x1[i]-x0[i])*(x1[i]-x0[i]);
+    *out=((nativeexampleref *) ref)->scale*sqrt(l2);
+    return true;
+}
+
+/** Gradient of nativeexample_tension with respect to the vertex positions */
+static bool nativeexample_tensiongradient(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, objectmatrix *frc) {
+    double *x0, *x1, s[mesh->dim], l2=0.0;
+    if (nv!=2 || !matrix_getcolumn(mesh->vert, vid[0], &x0) || !matrix_getcolumn(mesh->vert, vid[1], &x1)) return false;
+
+    for (int i=0; i<mesh->dim; i++) {
+        s[i]=x1[i]-x0[i];
+        l2+=s[i]*s[i];
+    }
+    if (l2<MORPHO_EPS) return false;
+
+    double scale=((nativeexampleref *) ref)->scale/sqrt(l2);
+    matrix_addtocolumn(frc, vid[0], -scale, s);
+    matrix_addtocolumn(frc, vid[1], scale, s);
+    return true;
+}
+
+/** Element integrand scale*area on a triangle; provides no gradient */
+static bool nativeexample_area(vm *v, objectmesh *mesh, elementid id, int nv, int *vid, void *ref, double *out) {
+    double *x[3], aa=0.0, bb=0.0, ab=0.0;
+    if (nv!=3) return false;
+    for (int j=0; j<nv; j++) if (!matrix_getcolumn(mesh->vert, vid[j], &x[j])) return false;
+
+    for (int i=0; i<mesh->dim; i++) {
+        double a=x[1][i]-x[0][i], b=x[2][i]-x[0][i];
+        aa+=a*a; bb+=b*b; ab+=a*b;
+    }
+    *out=((nativeexampleref *) ref)->scale*0.5*sqrt(fabs(aa*bb-ab*ab));
+    return true;
+}
+
+static void nativeexample_freeref(void *ref) {
+    MORPHO_FREE(ref);
+}
+
+static nativedefn nativeexamples[] = {
+    { .version=NATIVE_ABIVERSION, .name="Gaussian", .nfields=0, .integrand=nativeexample_gaussian, .freeref=nativeexample_freeref },
+    { .version=NATIVE_ABIVERSION, .name="WeightedGaussian", .nfields=1, .batch=nativeexample_weightedgaussian, .freeref=nativeexample_freeref },
+    { .version=NATIVE_ABIVERSION, .name="Tension", .g=MESH_GRADE_LINE, .elementintegrand=nativeexample_tension, .elementgradient=nativeexample_tensiongradient, .freeref=nativeexample_freeref },
+    { .version=NATIVE_ABIVERSION, .name="Area", .g=MESH_GRADE_AREA, .elementintegrand=nativeexample_area, .freeref=nativeexample_freeref }
+};
+
+/** Creates one of the example native objects, which show how extensions use this interface:
+ *  NativeExample(name, [scale]) */
+static value native_example(vm *v, int nargs, value *args) {
+    double scale=1.0;
+
+    if ((nargs==1 || (nargs==2 && morpho_valuetofloat(MORPHO_GETARG(args, 1), &scale))) &&
+        MORPHO_ISSTRING(MORPHO_GETARG(args, 0))) {
+        char *name=MORPHO_GETCSTRING(MORPHO_GETARG(args, 0));
+
+        for (unsigned int i=0; i<sizeof(nativeexamples)/sizeof(nativedefn); i++) {
+            if (strcmp(name, nativeexamples[i].name)!=0) continue;
+
+            nativeexampleref *ref = MORPHO_MALLOC(sizeof(nativeexampleref));
+            if (!ref) {
+                morpho_runtimeerror(v, ERROR_ALLOCATIONFAILED);
+                return MORPHO_NIL;
+            }
+            ref->scale=scale;
+            return native_new(v, &nativeexamples[i], ref);
+        }
+    }
+
+    morpho_runtimeerror(v, NATIVE_EXAMPLEARGS);
+    return MORPHO_NIL;
+}
+
+#endif
+
+/* **********************************************************************
+ * Initialization
+ * ********************************************************************** */
+
+void native_initialize(void) {
+    objectnativetype=object_addtype(&objectnativedefn);
+
+#ifdef MORPHO_NATIVEEXAMPLES
+    builtin_addfunction(NATIVEEXAMPLE_FUNCTION, native_example, BUILTIN_FLAGSEMPTY);
+#endif
+
+    morpho_defineerror(NATIVE_VRSN, ERROR_HALT, NATIVE_VRSN_MSG);
+#ifdef MORPHO_NATIVEEXAMPLES
+    morpho_defineerror(NATIVE_EXAMPLEARGS, ERROR_HALT, NATIVE_EXAMPLEARGS_MSG);
+#endif
+}
+
+#endif
@@ -0,0 +1,88 @@
+/** @file native.h
+ *  @author T J Atherton
+ *
+ *  @brief Interface for extensions to provide native integrands and element functions to functionals
+ */
+
+#ifndef native_h
+#define native_h
+
+#include "build.h"
+#ifdef MORPHO_INCLUDE_GEOMETRY
+
+#include "morpho.h"
+#include "classes.h"
+#include "functional.h"
+#include "integrate.h"
+
+/* -------------------------------------------------------
+ * Native definitions
+ * ------------------------------------------------------- */
+
+/** Version of the native interface; extensions should set the version field of their definitions to this */
+#define NATIVE_ABIVERSION 1
+
+/** Describes a native integrand or element function provided by an extension.
+ *  Extensions normally create a static definition and return a native object from a builtin function with native_new.
+ *  - integrand and batch are called at quadrature points by LineIntegral, AreaIntegral and VolumeIntegral
+ *  - elementintegrand and elementgradient are called on whole elements by NativeFunctional
+ *  Any of the functions may be NULL if not supported. All functions receive the ref that was passed to native_new. */
+typedef struct {
+    int version;                             /** Must be set to NATIVE_ABIVERSION */
+    char *name;                              /** Name used when printing */
+    int nfields;                             /** Number of Fields the integrand expects */
+    integrandfunction *integrand;            /** Integrand evaluated at a single point */
+    integrandbatchfunction *batch;           /** Integrand evaluated at a batch of points; used in preference to integrand */
+    grade g;                                 /** Grade of element for elementintegrand and elementgradient */
+    functional_integrand *elementintegrand;  /** Integrand evaluated on an element */
+    functional_gradient *elementgradient;    /** Gradient of elementintegrand; if NULL the gradient is found numerically */
+    void (*freeref) (void *ref);             /** Called to free ref when the object is freed, or NULL */
+} nativedefn;
+
+/* -------------------------------------------------------
+ * Native objects
+ * ------------------------------------------------------- */
+
+extern objecttype objectnativetype;
+#define OBJECT_NATIVE objectnativetype
+
+/** A native object pairs a definition with a reference specific to this object */
+typedef struct {
+    object obj;
+    nativedefn *defn;
+    void *ref;
+} objectnative;
+
+/** Tests whether an object is a native object */
+#define MORPHO_ISNATIVE(val) object_istype(val, OBJECT_NATIVE)
+
+/** Gets the object as a native object */
+#define MORPHO_GETNATIVE(val)   ((objectnative *) MORPHO_GETOBJECT(val))
+
+/* -------------------------------------------------------
+ * Example native objects, built only with MORPHO_NATIVEEXAMPLES
+ * ------------------------------------------------------- */
+
+#define NATIVEEXAMPLE_FUNCTION         "NativeExample"
+
+/* -------------------------------------------------------
+ * Native errors
+ * ------------------------------------------------------- */
+
+#define NATIVE_VRSN                    "NtvVrsn"
+#define NATIVE_VRSN_MSG                "Native definition '%s' was built for interface version %i; this version of morpho supports version %i."
+
+#define NATIVE_EXAMPLEARGS             "NtvExmplArgs"
+#define NATIVE_EXAMPLEARGS_MSG         "NativeExample expects the name of an example, 'Gaussian', 'WeightedGaussian', 'Tension' or 'Area', and an optional scale."
+
+/* -------------------------------------------------------
+ * Native interface
+ * ------------------------------------------------------- */
+
+value native_new(vm *v, nativedefn *defn, void *ref);
+
+void native_initialize(void);
+
+#endif
+
+#endif /* native_h */
@@ -49,6 +49,7 @@ objectmatrix *object_newmatrix(unsigned int nrows, unsigned int ncols, bool zero
     if (new) {
         new->ncols=ncols;
         new->nrows=nrows;
+        new->version=0;
         new->elements=new->matrixdata;
         if (zero) {
             memset(new->elements, 0, sizeof(double)*nel);
@@ -249,6 +250,7 @@ objectmatrix *object_clonematrix(objectmatrix *in) {
 bool matrix_setelement(objectmatrix *matrix, unsigned int row, unsigned int col, double value) {
     if (col<matrix->ncols && row<matrix->nrows) {
         matrix->elements[col*matrix->nrows+row]=value;
+        MATRIX_MODIFIED(matrix);
         return true;
     }
     return false;
@@ -285,6 +287,7 @@ bool matrix_getcolumn(objectmatrix *matrix, unsigned int col, double **v) {
 bool matrix_setcolumn(objectmatrix *matrix, unsigned int col, double *v) {
     if (col<matrix->ncols) {
         cblas_dcopy(matrix->nrows, v, 1, &matrix->elements[col*matrix->nrows], 1);
+        MATRIX_MODIFIED(matrix);
         return true;
     }
     return false;
@@ -299,6 +302,7 @@ bool matrix_setcolumn(objectmatrix *matrix, unsigned int col, double *v) {
 bool matrix_addtocolumn(objectmatrix *m, unsigned int col, double alpha, double *v) {
     if (col<m->ncols) {
         cblas_daxpy(m->nrows, alpha, v, 1, &m->elements[col*m->nrows], 1);
+        MATRIX_MODIFIED(m);
         return true;
     }
     return false;
@@ -317,6 +321,7 @@ unsigned int matrix_countdof(objectmatrix *a) {
 objectmatrixerror matrix_copy(objectmatrix *a, objectmatrix *out) {
     if (a->ncols==out->ncols && a->nrows==out->nrows) {
         cblas_dcopy(a->ncols * a->nrows, a->elements, 1, out->elements, 1);
+        MATRIX_MODIFIED(out);
         return MATRIX_OK;
     }
     return MATRIX_INCMPTBLDIM;
@@ -365,6 +370,7 @@ objectmatrixerror matrix_addscalar(objectmatrix *a, double lambda, double beta,
 objectmatrixerror matrix_accumulate(objectmatrix *a, double lambda, objectmatrix *b) {
     if (a->ncols==b->ncols && a->nrows==b->nrows ) {
         cblas_daxpy(a->ncols * a->nrows, lambda, b->elements, 1, a->elements, 1);
+        MATRIX_MODIFIED(a);
         return MATRIX_OK;
     }
     return MATRIX_INCMPTBLDIM;
@@ -606,6 +612,7 @@ objectmatrixerror matrix_trace(objectmatrix *a, double *out) {
 /** Scale a matrix */
 objectmatrixerror matrix_scale(objectmatrix *a, double scale) {
     cblas_dscal(a->ncols*a->nrows, scale, a->elements, 1);
+    MATRIX_MODIFIED(a);
     
     return MATRIX_OK;
 }
@@ -621,6 +628,7 @@ objectmatrixerror matrix_identity(objectmatrix *a) {
 /** Sets a matrix to zero */
 objectmatrixerror matrix_zero(objectmatrix *a) {
     memset(a->elements, 0, sizeof(double)*a->nrows*a->ncols);
+    MATRIX_MODIFIED(a);
     
     return MATRIX_OK;
 }
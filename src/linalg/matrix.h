@@ -49,6 +49,7 @@ typedef struct {
     object obj;
     unsigned int nrows;
     unsigned int ncols;
+    unsigned int version; /** Incremented when the elements are modified in place; used to validate cached data */
     double *elements;
     double matrixdata[];
 } objectmatrix;
@@ -64,6 +65,7 @@ objectmatrix *object_newmatrix(unsigned int nrows, unsigned int ncols, bool zero
 
 /** Creates a new matrix from an array */
 objectmatrix *object_matrixfromarray(objectarray *array);
+objectmatrix *object_matrixfromlist(objectlist *list);
 
 /** Creates a new matrix from an existing matrix */
 objectmatrix *object_clonematrix(objectmatrix *array);
@@ -72,6 +74,9 @@ objectmatrix *object_clonematrix(objectmatrix *array);
     @details Intended for small matrices; Caller needs to supply a double array of size nr*nc. */
 #define MORPHO_STATICMATRIX(darray, nr, nc)      { .obj.type=OBJECT_MATRIX, .obj.status=OBJECT_ISUNMANAGED, .obj.next=NULL, .elements=darray, .nrows=nr, .ncols=nc }
 
+/** Records that the elements of a matrix have been modified in place */
+#define MATRIX_MODIFIED(m) ((m)->version++)
+
 /** Macro to decide if a matrix is 'small' or 'large' and hence static or dynamic allocation should be used. */
 #define MATRIX_ISSMALL(m) (m->nrows*m->ncols<MORPHO_MAXIMUMSTACKALLOC)
 
@@ -145,6 +145,7 @@ compiler *morpho_newcompiler(program *out);
 void morpho_freecompiler(compiler *c);
 bool morpho_compile(char *in, compiler *c, bool optimize, error *err);
 const char *morpho_compilerrestartpoint(compiler *c);
+void morpho_setlazycompilation(bool lazy);
 void morpho_resetentry(program *p);
 
 /* Interpreting */
@@ -171,6 +172,8 @@ void morpho_disassemble(vm *v, program *code, int *matchline);
 /* Multithreading */
 void morpho_setthreadnumber(int nthreads);
 int morpho_threadnumber(void);
+void morpho_setthreadaffinity(int firstcpu);
+int morpho_threadaffinity(void);
 
 /* Initialization and finalization */
 typedef void (*morpho_finalizefn) (void);
@@ -183,7 +186,9 @@ void morpho_setargs(int argc, const char * argv[]); // Pass arguments to morpho
 /* Obtain and use subkernels [for internal use only] */
 bool vm_subkernels(vm *v, int nkernels, vm **subkernels);
 void vm_releasesubkernel(vm *subkernel);
+bool vm_issubkernel(vm *v);
 void vm_cleansubkernel(vm *subkernel);
+void vm_unmarksubkernel(vm *subkernel);
 
 /* Thread local storage [for internal use only] */
 int vm_addtlvar(void);
@@ -10,6 +10,10 @@
  *  - APIs for using threads 
  *  - Functions that involve time */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // Needed for thread affinity
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -22,7 +26,9 @@
 #include <windows.h>
 #include <wincrypt.h>
 #else 
+#ifndef _POSIX_C_SOURCE
 #define _POSIX_C_SOURCE 199309L
+#endif
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -125,6 +131,16 @@ bool platform_isdirectory(const char *path) {
 #endif
 }
 
+/** Creates a directory at path, returning true on success or if the directory already exists */
+bool platform_makedirectory(const char *path) {
+    if (platform_isdirectory(path)) return true;
+#ifdef _WIN32
+    return CreateDirectory(path, NULL);
+#else
+    return (mkdir(path, 0755)==0);
+#endif
+}
+
 /** Returns the maximum size of a file path */
 size_t platform_maxpathsize(void) {
 #ifdef _WIN32 
@@ -307,6 +323,36 @@ void MorphoThread_exit(void) {
 #endif
 }
 
+/** Pins the calling thread to a given cpu; returns false if this isn't supported */
+bool MorphoThread_setaffinity(int cpu) {
+    int ncpus = platform_processorcount();
+    if (cpu<0 || ncpus<1) return false;
+    cpu = cpu % ncpus;
+#ifdef _WIN32
+    if (cpu>=(int) (8*sizeof(DWORD_PTR))) return false;
+    return (SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR) 1) << cpu)!=0);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set)==0);
+#else
+    return false; // e.g. macOS provides only affinity hints
+#endif
+}
+
+/** Returns the number of processors available */
+int platform_processorcount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n>0 ? (int) n : 1);
+#endif
+}
+
 /** Initializes a mutex */
 bool MorphoMutex_init(MorphoMutex *mutex) {
 #ifdef _WIN32
@@ -79,6 +79,7 @@ bool platform_setcurrentdirectory(const char *path);
 bool platform_getcurrentdirectory(char *buffer, size_t size);
 bool platform_gethomedirectory(char *buffer, size_t size);
 bool platform_isdirectory(const char *path);
+bool platform_makedirectory(const char *path);
 
 typedef struct {
 #ifdef _WIN32
@@ -128,12 +129,22 @@ typedef void*              MorphoThreadFnReturnType;
 typedef void* (*MorphoThreadFn)(void *);
 #endif
 
+/** Storage class for variables with a separate instance in each thread */
+#ifdef _WIN32
+#define MorphoThreadLocal __declspec(thread)
+#else
+#define MorphoThreadLocal _Thread_local
+#endif
+
 DECLARE_VARRAY(MorphoThread, MorphoThread);
 
 bool MorphoThread_create(MorphoThread *thread, MorphoThreadFn threadfn, void *ref);
 void MorphoThread_join(MorphoThread thread);
 void MorphoThread_clear(MorphoThread thread);
 void MorphoThread_exit(void);
+bool MorphoThread_setaffinity(int cpu);
+
+int platform_processorcount(void);
 
 bool MorphoMutex_init(MorphoMutex *mutex);
 void MorphoMutex_clear(MorphoMutex *mutex);
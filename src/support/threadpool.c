@@ -24,38 +24,296 @@ int morpho_threadnumber(void) {
     return threadpool_nthreads;
 }
 
+int threadpool_firstcpu = -1;
+
+/** Pins worker threads to consecutive cpus beginning with firstcpu; a negative value leaves them unpinned */
+void morpho_setthreadaffinity(int firstcpu) {
+    threadpool_firstcpu = (firstcpu<0 ? -1 : firstcpu);
+}
+
+/** Returns the first cpu that worker threads are pinned to, or -1 if they're not pinned */
+int morpho_threadaffinity(void) {
+    return threadpool_firstcpu;
+}
+
 DEFINE_VARRAY(task, task);
 
-/* Worker thread */
-MorphoThreadFnReturnType threadpool_worker(void *ref) {
-    threadpool *pool = (threadpool *) ref;
-    task t = { .func = NULL, .arg = NULL };
+/* **********************************************************************
+* Submission queue
+* ********************************************************************** */
 
+/** Initializes a submission queue */
+static bool taskqueue_init(taskqueue *q) {
+    q->cells=MORPHO_MALLOC(sizeof(taskcell)*THREADPOOL_QUEUESIZE);
+    if (!q->cells) return false;
+    
+    for (size_t i=0; i<THREADPOOL_QUEUESIZE; i++) atomic_init(&q->cells[i].sequence, i);
+    atomic_init(&q->enqueuepos, 0);
+    atomic_init(&q->dequeuepos, 0);
+    return true;
+}
+
+/** Clears a submission queue */
+static void taskqueue_clear(taskqueue *q) {
+    if (q->cells) MORPHO_FREE(q->cells);
+    q->cells=NULL;
+}
+
+/** Adds a task to the queue; returns false if the queue is full */
+static bool taskqueue_enqueue(taskqueue *q, task *t) {
+    size_t pos=atomic_load_explicit(&q->enqueuepos, memory_order_relaxed);
+    
+    while (true) {
+        taskcell *cell=&q->cells[pos & (THREADPOOL_QUEUESIZE-1)];
+        size_t seq=atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        ptrdiff_t diff=(ptrdiff_t) seq - (ptrdiff_t) pos;
+        
+        if (diff==0) { // The cell is free; try to claim it
+            if (atomic_compare_exchange_weak_explicit(&q->enqueuepos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->t=*t;
+                atomic_store_explicit(&cell->sequence, pos+1, memory_order_release);
+                return true;
+            }
+        } else if (diff<0) { // The queue is full
+            return false;
+        } else pos=atomic_load_explicit(&q->enqueuepos, memory_order_relaxed);
+    }
+}
+
+/** Removes a task from the queue; returns false if the queue is empty */
+static bool taskqueue_dequeue(taskqueue *q, task *t) {
+    size_t pos=atomic_load_explicit(&q->dequeuepos, memory_order_relaxed);
+    
     while (true) {
-        /* Await a task */
+        taskcell *cell=&q->cells[pos & (THREADPOOL_QUEUESIZE-1)];
+        size_t seq=atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        ptrdiff_t diff=(ptrdiff_t) seq - (ptrdiff_t) (pos+1);
+        
+        if (diff==0) { // The cell holds a task; try to claim it
+            if (atomic_compare_exchange_weak_explicit(&q->dequeuepos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) {
+                *t=cell->t;
+                atomic_store_explicit(&cell->sequence, pos+THREADPOOL_QUEUESIZE, memory_order_release);
+                return true;
+            }
+        } else if (diff<0) { // The queue is empty
+            return false;
+        } else pos=atomic_load_explicit(&q->dequeuepos, memory_order_relaxed);
+    }
+}
+
+/** Estimates the number of tasks in the queue */
+static size_t taskqueue_count(taskqueue *q) {
+    size_t enq=atomic_load_explicit(&q->enqueuepos, memory_order_relaxed);
+    size_t deq=atomic_load_explicit(&q->dequeuepos, memory_order_relaxed);
+    return (enq>deq ? enq-deq : 0);
+}
+
+/* **********************************************************************
+* Work-stealing deques
+* ********************************************************************** */
+
+/** Allocates a task array of a given size */
+static taskarray *taskarray_new(ptrdiff_t size, taskarray *prev) {
+    taskarray *a=MORPHO_MALLOC(sizeof(taskarray)+sizeof(taskslot)*size);
+    if (a) {
+        a->size=size;
+        a->prev=prev;
+    }
+    return a;
+}
+
+/** Initializes a deque */
+static bool taskdeque_init(taskdeque *d) {
+    taskarray *a=taskarray_new(THREADPOOL_DEQUESIZE, NULL);
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->array, a);
+    return (a!=NULL);
+}
+
+/** Clears a deque, including any arrays it has outgrown */
+static void taskdeque_clear(taskdeque *d) {
+    taskarray *next=NULL;
+    for (taskarray *a=atomic_load(&d->array); a!=NULL; a=next) {
+        next=a->prev;
+        MORPHO_FREE(a);
+    }
+    atomic_store(&d->array, NULL);
+}
+
+/** Pushes a task onto the bottom of a deque; must only be called by the owner */
+static bool taskdeque_push(taskdeque *d, task *t) {
+    ptrdiff_t b=atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    ptrdiff_t top=atomic_load_explicit(&d->top, memory_order_acquire);
+    taskarray *a=atomic_load_explicit(&d->array, memory_order_relaxed);
+    
+    if (b-top>a->size-1) { // Grow the array, keeping the old one until the deque is cleared
+        taskarray *new=taskarray_new(2*a->size, a);
+        if (!new) return false;
+        for (ptrdiff_t i=top; i<b; i++) {
+            taskslot *src=&a->slots[i & (a->size-1)], *dest=&new->slots[i & (new->size-1)];
+            atomic_store_explicit(&dest->func, atomic_load_explicit(&src->func, memory_order_relaxed), memory_order_relaxed);
+            atomic_store_explicit(&dest->arg, atomic_load_explicit(&src->arg, memory_order_relaxed), memory_order_relaxed);
+        }
+        atomic_store_explicit(&d->array, new, memory_order_release);
+        a=new;
+    }
+    
+    taskslot *slot=&a->slots[b & (a->size-1)];
+    atomic_store_explicit(&slot->func, t->func, memory_order_relaxed);
+    atomic_store_explicit(&slot->arg, t->arg, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+    return true;
+}
+
+/** Pops a task from the bottom of a deque; must only be called by the owner */
+static bool taskdeque_pop(taskdeque *d, task *t) {
+    ptrdiff_t b=atomic_load_explicit(&d->bottom, memory_order_relaxed)-1;
+    taskarray *a=atomic_load_explicit(&d->array, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    ptrdiff_t top=atomic_load_explicit(&d->top, memory_order_relaxed);
+    bool success=false;
+    
+    if (top<=b) {
+        taskslot *slot=&a->slots[b & (a->size-1)];
+        t->func=atomic_load_explicit(&slot->func, memory_order_relaxed);
+        t->arg=atomic_load_explicit(&slot->arg, memory_order_relaxed);
+        success=true;
+        
+        if (top==b) { // Last task; race any thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top+1, memory_order_seq_cst, memory_order_relaxed)) success=false;
+            atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+        }
+    } else atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+    
+    return success;
+}
+
+/** Steals a task from the top of a deque; may be called by any thread */
+static bool taskdeque_steal(taskdeque *d, task *t) {
+    ptrdiff_t top=atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    ptrdiff_t b=atomic_load_explicit(&d->bottom, memory_order_acquire);
+    
+    if (top<b) {
+        taskarray *a=atomic_load_explicit(&d->array, memory_order_acquire);
+        taskslot *slot=&a->slots[top & (a->size-1)];
+        task out = { .func=atomic_load_explicit(&slot->func, memory_order_relaxed),
+                     .arg=atomic_load_explicit(&slot->arg, memory_order_relaxed) };
+        
+        if (atomic_compare_exchange_strong_explicit(&d->top, &top, top+1, memory_order_seq_cst, memory_order_relaxed)) {
+            *t=out;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/** Checks whether a deque appears to contain tasks */
+static bool taskdeque_isempty(taskdeque *d) {
+    return atomic_load_explicit(&d->bottom, memory_order_acquire)<=atomic_load_explicit(&d->top, memory_order_acquire);
+}
+
+/* **********************************************************************
+* Workers
+* ********************************************************************** */
+
+/** The worker running on the current thread, if any */
+static MorphoThreadLocal threadpoolworker *threadpool_currentworker = NULL;
+
+/** Checks whether any work is available to a pool's workers */
+static bool threadpool_haswork(threadpool *pool) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (taskqueue_count(&pool->queue)>0) return true;
+    for (int i=0; i<pool->nthreads; i++) if (!taskdeque_isempty(&pool->workers[i].deque)) return true;
+    return false;
+}
+
+/** Wakes a sleeping worker, if there are any */
+static void threadpool_wake(threadpool *pool) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&pool->nsleeping)>0) {
         MorphoMutex_lock(&pool->lock_mutex);
-        while (pool->queue.count == 0 && !pool->stop)
-            MorphoCond_wait(&pool->work_available_cond, &pool->lock_mutex);
+        MorphoCond_signal(&pool->work_available_cond);
+        MorphoMutex_unlock(&pool->lock_mutex);
+    }
+}
 
-        if (pool->stop) break; /* Terminate if asked to do so */
+/** Takes tasks from the submission queue, moving a share of those waiting into the worker's deque */
+static bool threadpool_takesubmitted(threadpoolworker *w, task *t) {
+    threadpool *pool=w->pool;
+    if (!taskqueue_dequeue(&pool->queue, t)) return false;
+    
+    size_t nbatch=taskqueue_count(&pool->queue)/pool->nthreads;
+    if (nbatch>THREADPOOL_MAXBATCH) nbatch=THREADPOOL_MAXBATCH;
+    
+    task extra;
+    for (size_t i=0; i<nbatch && taskqueue_dequeue(&pool->queue, &extra); i++) {
+        if (!taskdeque_push(&w->deque, &extra)) { (extra.func) (extra.arg); atomic_fetch_sub(&pool->npending, 1); }
+    }
+    if (nbatch>0) threadpool_wake(pool); // Others may steal the batch
+    
+    return true;
+}
 
-        varray_taskpop(&pool->queue, &t); /* Get the task */
-        pool->nprocessing++;
+/** Finds a task for a worker: first from its own deque, then the submission queue, then by stealing from other workers */
+static bool threadpool_findtask(threadpoolworker *w, task *t) {
+    threadpool *pool=w->pool;
+    
+    if (taskdeque_pop(&w->deque, t)) return true;
+    if (threadpool_takesubmitted(w, t)) return true;
+    
+    for (int i=0; i<pool->nthreads; i++) {
+        int victim=(w->victim+i) % pool->nthreads;
+        if (victim==w->id) continue;
+        if (taskdeque_steal(&pool->workers[victim].deque, t)) {
+            w->victim=victim;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/** Records that a task is complete, waking any threads waiting at a fence if it was the last */
+static void threadpool_completetask(threadpool *pool) {
+    if (atomic_fetch_sub(&pool->npending, 1)==1) {
+        MorphoMutex_lock(&pool->lock_mutex);
+        MorphoCond_broadcast(&pool->work_halted_cond);
         MorphoMutex_unlock(&pool->lock_mutex);
+    }
+}
+
+/* Worker thread */
+MorphoThreadFnReturnType threadpool_worker(void *ref) {
+    threadpoolworker *w = (threadpoolworker *) ref;
+    threadpool *pool = w->pool;
+    task t = { .func = NULL, .arg = NULL };
+
+    threadpool_currentworker = w;
+    if (pool->firstcpu>=0) MorphoThread_setaffinity(pool->firstcpu+w->id);
 
-        if (t.func) { (t.func) (t.arg); }; /* Perform the assigned task */
+    while (!atomic_load(&pool->stop)) {
+        if (threadpool_findtask(w, &t)) {
+            if (t.func) { (t.func) (t.arg); }; /* Perform the assigned task */
+            threadpool_completetask(pool);
+            continue;
+        }
 
+        /* Sleep until work is available; the count of sleeping workers is raised before
+           checking for work so that threads adding tasks know to wake us */
         MorphoMutex_lock(&pool->lock_mutex);
-        pool->nprocessing--;
-        if (!pool->stop && pool->nprocessing == 0 && pool->queue.count == 0)
-            MorphoCond_signal(&pool->work_halted_cond);
+        atomic_fetch_add(&pool->nsleeping, 1);
+        while (!atomic_load(&pool->stop) && !threadpool_haswork(pool))
+            MorphoCond_wait(&pool->work_available_cond, &pool->lock_mutex);
+        atomic_fetch_sub(&pool->nsleeping, 1);
         MorphoMutex_unlock(&pool->lock_mutex);
     }
 
-    /* No need to lock here as lock was already obtained */
-    pool->nthreads--;
-    MorphoCond_signal(&pool->work_halted_cond);
-    MorphoMutex_unlock(&pool->lock_mutex);
+    threadpool_currentworker = NULL;
 
     return (MorphoThreadFnReturnType) NULL;
 }
@@ -66,7 +324,24 @@ MorphoThreadFnReturnType threadpool_worker(void *ref) {
 bool threadpool_init(threadpool *pool, int nworkers) {
     if (nworkers<1) return false;
 
-    varray_taskinit(&pool->queue);
+    pool->workers=MORPHO_MALLOC(sizeof(threadpoolworker)*nworkers);
+    if (!pool->workers) return false;
+    if (!taskqueue_init(&pool->queue)) { MORPHO_FREE(pool->workers); return false; }
+
+    for (int i=0; i<nworkers; i++) {
+        threadpoolworker *w=&pool->workers[i];
+        w->pool=pool;
+        w->id=i;
+        w->victim=(i+1) % nworkers;
+        if (!taskdeque_init(&w->deque)) {
+            for (int j=0; j<=i; j++) taskdeque_clear(&pool->workers[j].deque);
+            MORPHO_FREE(pool->workers);
+            pool->workers=NULL;
+            taskqueue_clear(&pool->queue);
+            return false;
+        }
+    }
+
     varray_MorphoThreadinit(&pool->threads);
 
     MorphoMutex_init(&pool->lock_mutex);
@@ -74,12 +349,14 @@ bool threadpool_init(threadpool *pool, int nworkers) {
     MorphoCond_init(&pool->work_halted_cond);
 
     pool->nthreads=nworkers;
-    pool->stop=false;
-    pool->nprocessing=0;
+    pool->firstcpu=threadpool_firstcpu;
+    atomic_init(&pool->stop, false);
+    atomic_init(&pool->nsleeping, 0);
+    atomic_init(&pool->npending, 0);
 
     for (int i=0; i<pool->nthreads; i++) {
         MorphoThread thread;
-        MorphoThread_create(&thread, threadpool_worker, pool);
+        MorphoThread_create(&thread, threadpool_worker, &pool->workers[i]);
         varray_MorphoThreadadd(&pool->threads, &thread, 1);
     }
 
@@ -89,9 +366,9 @@ bool threadpool_init(threadpool *pool, int nworkers) {
 /** Clears a threadpool. */
 void threadpool_clear(threadpool *pool) {
     MorphoMutex_lock(&pool->lock_mutex);
-    varray_taskclear(&pool->queue); /* Erase any remaining tasks */
-    pool->stop = true; /* Tell workers to stop */
+    atomic_store(&pool->stop, true); /* Tell workers to stop */
     MorphoCond_broadcast(&pool->work_available_cond); /* Signal to workers to wake up */
+    MorphoCond_broadcast(&pool->work_halted_cond);
     MorphoMutex_unlock(&pool->lock_mutex);
 
     for (int i=0; i<pool->threads.count; i++) MorphoThread_join(pool->threads.data[i]);
@@ -101,33 +378,77 @@ void threadpool_clear(threadpool *pool) {
     MorphoCond_clear(&pool->work_halted_cond);
 
     for (int i=0; i<pool->threads.count; i++) MorphoThread_clear(pool->threads.data[i]);
-    
+
     varray_MorphoThreadclear(&pool->threads);
+
+    /* Erase any remaining tasks */
+    for (int i=0; i<pool->nthreads; i++) taskdeque_clear(&pool->workers[i].deque);
+    MORPHO_FREE(pool->workers);
+    pool->workers=NULL;
+    taskqueue_clear(&pool->queue);
 }
 
-/** Adds a task to the threadpool */
-bool threadpool_add_task(threadpool *pool, workfn func, void *arg) {
-    bool success=true;
-    MorphoMutex_lock(&pool->lock_mutex);
+/** Prepares a threadpool for use with nworkers threads, registering the caller as a user until threadpool_release is called.
+ *  The pool is started on first use, and restarted if the number of threads or their affinity has changed since;
+ *  restarts only happen from threads outside any pool, and are deferred while the pool has other users or work
+ *  outstanding, since another thread may be waiting at a fence. Until then, the pool keeps its previous size.
+ *  @param[in] pool - pool to prepare
+ *  @param[in,out] initialized - records whether the pool has been started
+ *  @param[in] nworkers - number of workers required
+ *  @returns true if the pool is available, in which case threadpool_release must be called once the caller's work is complete */
+bool threadpool_prepare(threadpool *pool, bool *initialized, int nworkers) {
+    if (nworkers<1) nworkers=1;
+    
+    while (atomic_flag_test_and_set_explicit(&pool->preparing, memory_order_acquire)); // Other threads hold this only briefly
+    
+    if (*initialized &&
+        (pool->nthreads!=nworkers || pool->firstcpu!=threadpool_firstcpu) &&
+        !threadpool_currentworker &&
+        atomic_load(&pool->nusers)==0 &&
+        atomic_load(&pool->npending)==0) {
+        threadpool_clear(pool);
+        *initialized=false;
+    }
+    
+    if (!*initialized) *initialized=threadpool_init(pool, nworkers);
+    if (*initialized) atomic_fetch_add(&pool->nusers, 1);
+    
+    atomic_flag_clear_explicit(&pool->preparing, memory_order_release);
+    return *initialized;
+}
+
+/** Records that a caller of threadpool_prepare has finished with the pool */
+void threadpool_release(threadpool *pool) {
+    atomic_fetch_sub(&pool->nusers, 1);
+}
 
+/** Adds a task to the threadpool. Workers add to their own deque; other threads add to the submission queue,
+ *  and run the task themselves should the queue be full. */
+bool threadpool_add_task(threadpool *pool, workfn func, void *arg) {
     task t = { .func = func, .arg=arg };
-    if (!varray_taskadd(&pool->queue, &t, 1)) success=false; /* Add the task to the queue */
+    threadpoolworker *w = threadpool_currentworker;
 
-    MorphoCond_broadcast(&pool->work_available_cond); /* Signal there is work to be done */
-    MorphoMutex_unlock(&pool->lock_mutex);
-    return success;
+    atomic_fetch_add(&pool->npending, 1);
+
+    if (w && w->pool==pool) {
+        if (!taskdeque_push(&w->deque, &t)) { atomic_fetch_sub(&pool->npending, 1); return false; }
+    } else if (!taskqueue_enqueue(&pool->queue, &t)) {
+        if (func) (func) (arg);
+        threadpool_completetask(pool);
+        return true;
+    }
+
+    threadpool_wake(pool); /* Signal there is work to be done */
+    return true;
 }
 
 /** Blocks until all tasks in the thread pool are complete */
 void threadpool_fence(threadpool *pool) {
-    MorphoMutex_lock(&pool->lock_mutex);
+    if (atomic_load(&pool->npending)==0) return;
 
-    while (true) {
-        if ((!pool->stop && (pool->queue.count > 0 || pool->nprocessing>0)) || // If we are simply waiting for tasks to finish
-            (pool->stop && pool->nthreads > 0)) { // Or if we have been told to stop
-            MorphoCond_wait(&pool->work_halted_cond, &pool->lock_mutex); // Block until working_cond is set
-        } else break;
+    MorphoMutex_lock(&pool->lock_mutex);
+    while (atomic_load(&pool->npending)>0 && !atomic_load(&pool->stop)) {
+        MorphoCond_wait(&pool->work_halted_cond, &pool->lock_mutex); // Block until the last task completes
     }
-
     MorphoMutex_unlock(&pool->lock_mutex);
 }
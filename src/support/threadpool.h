@@ -1,13 +1,14 @@
 /** @file threadpool.h
  *  @author T J Atherton
  *
- *  @brief Thread pool 
+ *  @brief Thread pool
  */
 
 #ifndef threadpool_h
 #define threadpool_h
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "varray.h"
 #include "platform.h"
 
@@ -16,7 +17,7 @@
  * ----------------------------------------- */
 
 /** A task is the basic unit of work that is allocated to the thread pool; it comprises a work function to perform the task, and a single argument. */
- 
+
 /** A workfn will be called by the threadpool once a thread is available.
     You must supply all relevant information for both input and output in a single structure passed as an opaque reference. */
 typedef bool (* workfn) (void *arg);
@@ -28,24 +29,91 @@ typedef struct {
 
 DECLARE_VARRAY(task, task);
 
+/* -----------------------------------------
+ * Submission queue
+ * ----------------------------------------- */
+
+/** @brief Number of tasks the submission queue can hold; must be a power of two */
+#define THREADPOOL_QUEUESIZE 1024
+
+/** A cell in the submission queue; the sequence number records whether the cell is ready to be written or read */
+typedef struct {
+    atomic_size_t sequence;
+    task t;
+} taskcell;
+
+/** A bounded lock-free queue of tasks that any thread may add to or remove from */
+typedef struct {
+    taskcell *cells;
+    atomic_size_t enqueuepos;
+    atomic_size_t dequeuepos;
+} taskqueue;
+
+/* -----------------------------------------
+ * Work-stealing deques
+ * ----------------------------------------- */
+
+/** @brief Initial number of tasks a worker's deque can hold; must be a power of two */
+#define THREADPOOL_DEQUESIZE 64
+
+/** @brief Maximum number of tasks a worker moves from the submission queue to its deque at once */
+#define THREADPOOL_MAXBATCH 16
+
+/** A slot in a deque; thieves may read a slot while its owner writes to it, so the fields are atomic */
+typedef struct {
+    _Atomic(workfn) func;
+    _Atomic(void *) arg;
+} taskslot;
+
+/** The circular array that holds the contents of a deque */
+typedef struct staskarray {
+    ptrdiff_t size;
+    struct staskarray *prev; /* Arrays replaced when the deque grew; thieves may still be reading them */
+    taskslot slots[];
+} taskarray;
+
+/** A Chase-Lev deque; its owner pushes and pops tasks at the bottom while other workers steal from the top */
+typedef struct {
+    atomic_ptrdiff_t top;
+    atomic_ptrdiff_t bottom;
+    _Atomic(taskarray *) array;
+} taskdeque;
+
 /* -----------------------------------------
  * Thread pools
  * ----------------------------------------- */
 
+struct sthreadpool;
+
+/** State held by each worker thread */
 typedef struct {
-    MorphoMutex lock_mutex; /* Lock for access to threadpool structure. */
+    struct sthreadpool *pool; /* Pool the worker belongs to */
+    taskdeque deque; /* Tasks held by this worker */
+    int id; /* Index of the worker in the pool */
+    int victim; /* Next worker to try to steal from */
+} threadpoolworker;
+
+typedef struct sthreadpool {
+    MorphoMutex lock_mutex; /* Lock used only by threads that need to sleep. */
     MorphoCond work_available_cond; /* Signals that work is available. */
-    MorphoCond work_halted_cond; /* Signals when no threads are processing. */
-    int nprocessing; /* Number of threads actively processing work */
-    int nthreads; /* Number of active threads. */
-    bool stop; /* Indicates threads should terminate */
+    MorphoCond work_halted_cond; /* Signals when all tasks are complete. */
+    atomic_int nsleeping; /* Number of workers waiting for work */
+    atomic_int npending; /* Number of tasks added but not yet complete */
+    atomic_bool stop; /* Indicates threads should terminate */
+    int nthreads; /* Number of worker threads. */
+    int firstcpu; /* Cpu the first worker is pinned to, or -1 if workers aren't pinned */
+    atomic_int nusers; /* Number of callers between threadpool_prepare and threadpool_release */
+    atomic_flag preparing; /* Held while the pool is started or restarted; persists across restarts */
 
-    varray_task queue; /* Queue of tasks lined up */
+    taskqueue queue; /* Tasks added from outside the pool */
+    threadpoolworker *workers; /* State for each worker thread */
     varray_MorphoThread threads; /* Threads created by this pool */
 } threadpool;
 
 bool threadpool_init(threadpool *pool, int nworkers);
 void threadpool_clear(threadpool *pool);
+bool threadpool_prepare(threadpool *pool, bool *initialized, int nworkers);
+void threadpool_release(threadpool *pool);
 bool threadpool_add_task(threadpool *pool, workfn func, void *arg);
 void threadpool_fence(threadpool *pool);
 void threadpool_wait(threadpool *pool);
@@ -0,0 +1,9 @@
+// A test library for lazy compilation: when test.py is run with -l, the bodies of its functions are compiled only once they are referenced
+
+fn double(x) { return 2*x }
+
+fn quadruple(x) { return double(double(x)) }
+
+fn describe(x) { return "value ${x}" }
+
+fn unused(x) { return x + 1 }
@@ -183,11 +183,15 @@ total=0   # total number of tests
 CI = False
 # Also look for a command line argument that says this is being run with multiple threads
 MT = False
+# and one that says functions in modules should be compiled lazily
+LAZY = False
 for arg in sys.argv:
     if arg == '-c': # if the argument is -c, then we are running in CI mode
         CI = True
     if arg == '-m': # if the argument is -m, then we are running in multi-thread mode
         MT = True
+    if arg == '-l': # if the argument is -l, then we are running with lazy compilation
+        LAZY = True
 
 failedTestsFileName = "FailedTests.txt"
 if MT:
@@ -195,6 +199,10 @@ if MT:
     command += " -w4" 
     print("Running tests with 4 threads")
 
+if LAZY:
+    os.environ['MORPHO_LAZYCOMPILATION'] = '1' # inherited by the interpreter
+    print("Running tests with lazy compilation")
+
 files=glob.glob('**/**.'+ext, recursive=True)
 with open(failedTestsFileName,'w', encoding="utf8") as testLog:
 